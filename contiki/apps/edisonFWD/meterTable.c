@@ -0,0 +1,120 @@
+
+/* Per meter table */
+// Tracks every meter heard by its 64-bit address (same order as the
+// meter's nonce). Meter readings are dropped if their nonce matches one of
+// the last METER_NONCE_HISTORY nonces from that meter, which catches
+// retransmissions and replays of recent frames. Gaps in the 802.15.4
+// sequence number count as lost frames.
+
+#define METER_TABLE_LEN 64          // power of 2
+#define METER_TABLE_PROBE 8         // slots searched per lookup
+#define METER_NONCE_HISTORY 4
+#define METER_SEQ_MAX_GAP 32        // larger gaps are a meter reset, not loss
+
+typedef struct{
+    uint8_t addr[8];
+    uint8_t nonce[METER_NONCE_HISTORY][4];
+    uint8_t nonceIdx;
+    uint8_t seq;
+    uint8_t valid;
+    uint16_t lastSeen;
+    uint16_t received;
+    uint16_t lost;
+    uint16_t duplicated;
+} meterEntry_t;
+
+static meterEntry_t meterTable[METER_TABLE_LEN];
+static uint16_t meterTableTick = 0;
+
+static uint8_t meterTableHash(uint8_t* addr){
+    uint8_t i;
+    uint8_t hash = 0;
+    for (i=0; i<8; i++)
+        hash = (hash*31) + addr[i];
+    return hash & (METER_TABLE_LEN-1);
+}
+
+// entry of this meter, a new one replaces the oldest slot if needed
+static meterEntry_t* meterTableLookup(uint8_t* addr){
+    uint8_t i;
+    uint8_t idx = meterTableHash(addr);
+    meterEntry_t* entry;
+    meterEntry_t* oldest = &meterTable[idx];
+
+    for (i=0; i<METER_TABLE_PROBE; i++){
+        entry = &meterTable[(idx+i) & (METER_TABLE_LEN-1)];
+        if (entry->valid == 0){
+            oldest = entry;
+            break;
+        }
+        if (memcmp(entry->addr, addr, 8) == 0)
+            return entry;
+        if ((uint16_t)(meterTableTick - entry->lastSeen) >
+            (uint16_t)(meterTableTick - oldest->lastSeen))
+            oldest = entry;
+    }
+    memset(oldest, 0, sizeof(meterEntry_t));
+    memcpy(oldest->addr, addr, 8);
+    return oldest;
+}
+
+// Update the meter's counters, returns 1 if the frame is a duplicate
+// nonce is NULL for frames other than meter readings
+static uint8_t meterTableUpdate(uint8_t* addr, uint8_t seq, uint8_t* nonce){
+    meterEntry_t* entry = meterTableLookup(addr);
+    uint8_t gap;
+    uint8_t i;
+
+    meterTableTick += 1;
+    entry->lastSeen = meterTableTick;
+    if (nonce){
+        for (i=0; i<METER_NONCE_HISTORY; i++){
+            if (entry->valid && (memcmp(entry->nonce[i], nonce, 4) == 0)){
+                entry->duplicated += 1;
+                return 1;
+            }
+        }
+        memcpy(entry->nonce[entry->nonceIdx], nonce, 4);
+        entry->nonceIdx = (entry->nonceIdx == METER_NONCE_HISTORY-1)? 0 : entry->nonceIdx+1;
+    }
+    if (entry->valid){
+        gap = seq - entry->seq;
+        if ((gap > 1) && (gap <= METER_SEQ_MAX_GAP))
+            entry->lost += gap - 1;
+    }
+    entry->seq = seq;
+    entry->valid = 1;
+    entry->received += 1;
+    return 0;
+}
+
+// Pack entries starting at table index start into buf
+// 1 byte number of entries, 1 byte next index (0 when done), then per entry
+// 8 bytes address, 2 bytes received, 2 bytes lost, 2 bytes duplicated,
+// little endian. Returns the length of buf.
+static uint8_t meterTableStats(uint8_t* buf, uint8_t start, uint8_t maxLen){
+    uint8_t len = 2;
+    uint8_t num = 0;
+    uint8_t idx;
+    meterEntry_t* entry;
+
+    for (idx=start; idx<METER_TABLE_LEN; idx++){
+        entry = &meterTable[idx];
+        if (entry->valid == 0)
+            continue;
+        if (len + 14 > maxLen)
+            break;
+        memcpy(&buf[len], entry->addr, 8);
+        buf[len+8] = entry->received & 0xff;
+        buf[len+9] = (entry->received & 0xff00)>>8;
+        buf[len+10] = entry->lost & 0xff;
+        buf[len+11] = (entry->lost & 0xff00)>>8;
+        buf[len+12] = entry->duplicated & 0xff;
+        buf[len+13] = (entry->duplicated & 0xff00)>>8;
+        len += 14;
+        num += 1;
+    }
+    buf[0] = num;
+    buf[1] = (idx < METER_TABLE_LEN)? idx : 0;
+    return len;
+}
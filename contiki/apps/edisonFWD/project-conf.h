@@ -13,12 +13,24 @@
 #define CC2538_RF_CONF_SNIFFER  1
 
 #define TRIUMVI_PKT_IDENTIFIER 0xa0
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
 #define AES_PKT_IDENTIFIER 0xc0
 #define LEN_LEN 2 // LVal
 #define MIC_LEN 4 // MVal
 #define ADATA_LEN 0x08
 #define PDATA_LEN 0x05
 
+// FRAM offload, see dev/triumvi/framOffload.h
+#define TRIUMVI_PKT_OFFLOAD_IDENTIFIER0 0xa1
+#define TRIUMVI_PKT_OFFLOAD_IDENTIFIER1 0x5c
+#define TRIUMVI_OFFLOAD 0xad
+#define FRAM_OFFLOAD_CMD_REQ 0x01
+#define FRAM_OFFLOAD_CMD_STATUS 0x02
+#define FRAM_OFFLOAD_NONCE_GATEWAY 0x01
+#define FRAM_OFFLOAD_CTRL_PDATA_LEN 6
+#define FRAM_OFFLOAD_CTRL_LEN (14+FRAM_OFFLOAD_CTRL_PDATA_LEN+MIC_LEN)
+
 // From Edison to CC2538
 #define SPI0_CS_PORT_BASE               GPIO_PORT_TO_BASE(SPI0_CS_PORT)
 #define SPI0_CS_PIN_MASK                GPIO_PIN_MASK(SPI0_CS_PIN)
@@ -3,6 +3,7 @@
 // cmd + length (optional, length field counts) + payload (optional)
 // REQ_DATA doesn't need length
 // GET_DATA requires length
+// REQ_BATCH, GET_STATS don't need length
 
 #define SPI_MASTER_REQ_DATA     0x00
 #define SPI_MASTER_DUMMY        0x01
@@ -12,6 +13,11 @@
 #define SPI_RF_PACKET_SEND      0x05
 #define SPI_MASTER_SET_TIME     0x06
 #define SPI_MASTER_RST_RF_FIFO  0x07
+#define SPI_MASTER_OFFLOAD_REQ  0x08    // 8 bytes meter address
+#define SPI_MASTER_REQ_BATCH    0x09
+#define SPI_MASTER_ACK_BATCH    0x0a    // 1 byte number of packets
+#define SPI_MASTER_GET_STATS    0x0b
+#define SPI_MASTER_GET_METER_STATS 0x0c // 1 byte first table index
 
 #define MAX_SPI_LENGTH 128
 
@@ -51,6 +57,16 @@ uint8_t spi_packet_parse(spi_packet_t* rx_packet, uint8_t* data_ptr){
       return 1;
     break;
 
+    case SPI_MASTER_REQ_BATCH:
+      rx_packet->spi_payload_length = 0;
+      return 1;
+    break;
+
+    case SPI_MASTER_GET_STATS:
+      rx_packet->spi_payload_length = 0;
+      return 1;
+    break;
+
     default:
       rx_packet->spi_payload_length = (data_ptr[1]-1);
       for (i=0; i<rx_packet->spi_payload_length; i++)
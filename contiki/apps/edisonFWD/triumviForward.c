@@ -15,8 +15,10 @@
 #include "ieee-addr.h"
 #include "dev/crypto.h"
 #include "dev/ccm.h"
+#include "lib/random.h"
 #include "dev/udma.h"
 #include "softwareRTC.c"
+#include "meterTable.c"
 
 
 /* spi interface */
@@ -32,14 +34,14 @@
                         UDMA_CHCTL_ARBSIZE_4 | \
                         UDMA_CHCTL_XFERMODE_BASIC)
 
-#define TRIUMVI_PACKET_BUF_LEN 32
+#define TRIUMVI_RX_BUF_SIZE 3072   // bytes, received packets are packed back to back
 #define RESET_THRESHOLD 32  // if edison did not respond within 32 packets, reset CC2538
+#define OFFLOAD_PENDING_LEN 4   // meters waiting for a FRAM offload request
 
-/* Triumvi received packet buffer */
-typedef struct{
-    uint8_t payload[SPIFIFOSIZE];
-    uint8_t length;
-} triumviPacket_t;
+// single, extended and aggregated readings, all start with the 4 byte nonce
+#define METER_READING_ID(id) (((id) == TRIUMVI_PKT_IDENTIFIER) || \
+                              ((id) == TRIUMVI_PKT_EXT_IDENTIFIER) || \
+                              ((id) == TRIUMVI_PKT_AGG_IDENTIFIER))
 
 typedef enum{
     SPI_RESET,
@@ -47,10 +49,20 @@ typedef enum{
 } spiState_t;
 
 
-static triumviPacket_t triumviRXPackets[TRIUMVI_PACKET_BUF_LEN];
-static uint8_t triumviAvailIDX = 0;
-static uint8_t triumviFullIDX = 0;
-static uint8_t triumviRXBufFull = 0;
+/* Triumvi received packet buffer */
+// byte ring of 1 byte length + payload records. A record never wraps, so the
+// DMA sends it in place. If it does not fit before the end, a length of 0
+// marks the rest as unused and the record starts at 0.
+static uint8_t triumviRXBuf[TRIUMVI_RX_BUF_SIZE];
+static uint16_t triumviRXHead = 0;      // oldest record
+static uint16_t triumviRXTail = 0;      // next free byte
+static uint16_t triumviRXUsed = 0;      // bytes, including the unused end
+static uint16_t triumviRXCnt = 0;       // packets
+static uint8_t triumviRXBufFull = 0;    // a packet was dropped since the last read
+
+/* receive buffer statistics, sent on SPI_MASTER_GET_STATS */
+static uint32_t triumviRXDropped = 0;   // packets dropped, buffer full
+static uint16_t triumviRXPeak = 0;      // most bytes in use
 
 static uint8_t spi_rxfifo_halffull = 0;
 static uint8_t spi_cs_int = 0;
@@ -58,6 +70,23 @@ static uint8_t spiInUse = 0;
 
 static uint8_t resetCnt = 0;
 
+/* batch read */
+// 1 byte length (bytes that follow), 1 byte number of packets,
+// then 1 byte length + payload for each packet
+#define SPI_BATCH_MAX_LEN 255
+static uint8_t spiBatchBuf[SPI_BATCH_MAX_LEN];
+static uint8_t spiBatchCnt = 0;    // packets in the last batch sent
+
+/* FRAM offload */
+// addresses are in the same order as the meter's nonce, reversed from air
+static uint8_t offloadPending[OFFLOAD_PENDING_LEN][8];
+static uint8_t offloadPendingCnt = 0;
+static uint8_t offloadAddr[8];
+static uint8_t offloadActive = 0;
+static uint8_t offloadBatch;
+static uint8_t offloadReceived;     // bit i: frame i of offloadBatch is buffered
+static uint8_t offloadPlain[128];   // decrypted copy of an offload frame
+
 //#define LED_DEBUG
 
 static spiState_t spiState = SPI_WAIT;
@@ -78,6 +107,13 @@ void rf_rx_handler();
 static void spiCScallBack(uint8_t port, uint8_t pin);
 static void resetcallBack(uint8_t port, uint8_t pin);
 static void spiFIFOcallBack();
+static uint8_t triumviRXEnqueue(uint8_t* header_ptr, uint8_t header_length,
+        uint8_t* data_ptr, uint8_t data_length, int8_t rssi);
+static uint8_t packetSrcAddr(uint8_t* header_ptr, uint8_t* addr, uint8_t* seq);
+static uint8_t meterFrameDuplicated(uint8_t* addr, uint8_t seq, uint8_t* nonce);
+static void offloadCheckPending(uint8_t* addr);
+static void offloadFrame(uint8_t* addr, uint8_t* header_ptr, uint8_t header_length,
+        uint8_t* data_ptr, uint8_t data_length, int8_t rssi);
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
@@ -163,7 +199,7 @@ PROCESS_THREAD(mainProcess, ev, data) {
     while (1) {
         PROCESS_YIELD();
         // Buffer is not empty, SPI is not in use
-        if ((spiInUse == 0) && ((triumviAvailIDX != triumviFullIDX) || (triumviRXBufFull == 1))){
+        if ((spiInUse == 0) && (triumviRXCnt > 0)){
             GPIO_SET_PIN(TRIUMVI_DATA_READY_PORT_BASE, TRIUMVI_DATA_READY_MASK);
             if (triumviRXBufFull == 1) {
                 resetCnt += 1;
@@ -189,6 +225,92 @@ PROCESS_THREAD(mainProcess, ev, data) {
     PROCESS_END();
 }
 
+// skip the unused end of the buffer, returns the offset of the record
+static uint16_t triumviRXRecord(uint16_t idx){
+    if ((idx == TRIUMVI_RX_BUF_SIZE) || (triumviRXBuf[idx] == 0))
+        return 0;
+    return idx;
+}
+
+// remove the oldest packet
+static void triumviRXDequeue(){
+    uint16_t idx;
+    if (triumviRXCnt == 0)
+        return;
+    idx = triumviRXRecord(triumviRXHead);
+    if (idx != triumviRXHead)
+        triumviRXUsed -= TRIUMVI_RX_BUF_SIZE - triumviRXHead;
+    triumviRXUsed -= 1 + triumviRXBuf[idx];
+    triumviRXHead = idx + 1 + triumviRXBuf[idx];
+    triumviRXCnt -= 1;
+    triumviRXBufFull = 0;
+    // start over at 0 when empty, fewer records have to skip the end
+    if (triumviRXCnt == 0){
+        triumviRXHead = 0;
+        triumviRXTail = 0;
+        triumviRXUsed = 0;
+    }
+}
+
+static void triumviRXReset(){
+    triumviRXHead = 0;
+    triumviRXTail = 0;
+    triumviRXUsed = 0;
+    triumviRXCnt = 0;
+    triumviRXBufFull = 0;
+}
+
+// pack as many queued packets as fit, oldest first, returns the length
+// of spiBatchBuf
+static uint8_t spiBatchBuild(){
+    uint16_t idx = triumviRXHead;
+    uint16_t len = 1;
+    uint8_t packetLen;
+
+    spiBatchCnt = 0;
+    while (spiBatchCnt < triumviRXCnt){
+        idx = triumviRXRecord(idx);
+        packetLen = triumviRXBuf[idx];
+        if (len + 1 + packetLen > SPI_BATCH_MAX_LEN)
+            break;
+        memcpy(&spiBatchBuf[len], &triumviRXBuf[idx], 1 + packetLen);
+        len += 1 + packetLen;
+        spiBatchCnt += 1;
+        idx += 1 + packetLen;
+    }
+    spiBatchBuf[0] = spiBatchCnt;
+    return len;
+}
+
+// drop up to num packets of the last batch from the buffer
+static void spiBatchAck(uint8_t num){
+    if (num > spiBatchCnt)
+        num = spiBatchCnt;
+    while ((num > 0) && (triumviRXCnt > 0)){
+        triumviRXDequeue();
+        num -= 1;
+    }
+    spiBatchCnt = 0;
+}
+
+// dropped (4), queued packets (2), queued bytes (2), peak bytes (2),
+// buffer size (2), little endian
+static uint8_t spiStatsBuild(){
+    spiBatchBuf[0] = triumviRXDropped & 0xff;
+    spiBatchBuf[1] = (triumviRXDropped & 0xff00)>>8;
+    spiBatchBuf[2] = (triumviRXDropped & 0xff0000)>>16;
+    spiBatchBuf[3] = (triumviRXDropped & 0xff000000)>>24;
+    spiBatchBuf[4] = triumviRXCnt & 0xff;
+    spiBatchBuf[5] = (triumviRXCnt & 0xff00)>>8;
+    spiBatchBuf[6] = triumviRXUsed & 0xff;
+    spiBatchBuf[7] = (triumviRXUsed & 0xff00)>>8;
+    spiBatchBuf[8] = triumviRXPeak & 0xff;
+    spiBatchBuf[9] = (triumviRXPeak & 0xff00)>>8;
+    spiBatchBuf[10] = TRIUMVI_RX_BUF_SIZE & 0xff;
+    spiBatchBuf[11] = (TRIUMVI_RX_BUF_SIZE & 0xff00)>>8;
+    return 12;
+}
+
 PROCESS_THREAD(spiProcess, ev, data) {
     PROCESS_BEGIN();
     uint8_t spi_data_fifo[SPIFIFOSIZE];
@@ -197,6 +319,7 @@ PROCESS_THREAD(spiProcess, ev, data) {
     uint8_t* dma_src_end_addr;
     static uint8_t spi_data_ptr = 0;
     uint8_t proc_idx;
+    uint16_t recIdx;
     static uint8_t rf_pkt_payload[128] = {0};
     static uint8_t rf_pkt_len = 0;
     static myTime_t receivedTime;
@@ -236,9 +359,15 @@ PROCESS_THREAD(spiProcess, ev, data) {
                         switch (spi_rx_pkt.cmd){
                             // write length and data into tx fifo
                             case SPI_MASTER_REQ_DATA:
-                                packetLen = triumviRXPackets[triumviFullIDX].length;
+                                if (triumviRXCnt == 0) {
+                                    spix_put_data_single(SPIDEV, 0);
+                                    break;
+                                }
+                                // Head stays put, triumviRXDequeue accounts for a wrap
+                                recIdx = triumviRXRecord(triumviRXHead);
+                                packetLen = triumviRXBuf[recIdx];
                                 spix_put_data_single(SPIDEV, packetLen);
-                                dma_src_end_addr = triumviRXPackets[triumviFullIDX].payload + packetLen - 1;
+                                dma_src_end_addr = triumviRXBuf + recIdx + packetLen;
                                 udma_set_channel_src(CC2538_SPI0_TX_DMA_CHAN, (uint32_t)(dma_src_end_addr));
                                 udma_set_channel_control_word(CC2538_SPI0_TX_DMA_CHAN,
                                     (SPI0TX_DMA_FLAG | udma_xfer_size(packetLen)));
@@ -251,18 +380,53 @@ PROCESS_THREAD(spiProcess, ev, data) {
 
                             // spi transmission is completed, advances pointer
                             case SPI_MASTER_GET_DATA:
-                                if ((triumviAvailIDX != triumviFullIDX) || (triumviRXBufFull == 1)) {
-                                    triumviRXBufFull = 0;
-                                    if (triumviFullIDX == TRIUMVI_PACKET_BUF_LEN-1) {
-                                        triumviFullIDX = 0;
-                                    } else {
-                                        triumviFullIDX += 1;
-                                    }
-                                }
+                                triumviRXDequeue();
                                 resetCnt  = 0;
                                 spiInUse = 0;
                             break;
 
+                            // length and all packets that fit in one transfer
+                            case SPI_MASTER_REQ_BATCH:
+                                packetLen = spiBatchBuild();
+                                spix_put_data_single(SPIDEV, packetLen);
+                                dma_src_end_addr = spiBatchBuf + packetLen - 1;
+                                udma_set_channel_src(CC2538_SPI0_TX_DMA_CHAN, (uint32_t)(dma_src_end_addr));
+                                udma_set_channel_control_word(CC2538_SPI0_TX_DMA_CHAN,
+                                    (SPI0TX_DMA_FLAG | udma_xfer_size(packetLen)));
+                                udma_channel_enable(CC2538_SPI0_TX_DMA_CHAN);
+                            break;
+
+                            // batch is received, advances pointer by the acknowledged packets
+                            case SPI_MASTER_ACK_BATCH:
+                                if (spi_rx_pkt.spi_payload_length >= 1)
+                                    spiBatchAck(spi_rx_pkt.spi_payload[0]);
+                                resetCnt = 0;
+                                spiInUse = 0;
+                            break;
+
+                            // receive buffer statistics, same framing as REQ_DATA
+                            case SPI_MASTER_GET_STATS:
+                                packetLen = spiStatsBuild();
+                                spix_put_data_single(SPIDEV, packetLen);
+                                dma_src_end_addr = spiBatchBuf + packetLen - 1;
+                                udma_set_channel_src(CC2538_SPI0_TX_DMA_CHAN, (uint32_t)(dma_src_end_addr));
+                                udma_set_channel_control_word(CC2538_SPI0_TX_DMA_CHAN,
+                                    (SPI0TX_DMA_FLAG | udma_xfer_size(packetLen)));
+                                udma_channel_enable(CC2538_SPI0_TX_DMA_CHAN);
+                            break;
+
+                            // per meter counters, payload is the first table index
+                            case SPI_MASTER_GET_METER_STATS:
+                                packetLen = meterTableStats(spiBatchBuf,
+                                    (spi_rx_pkt.spi_payload_length >= 1)? spi_rx_pkt.spi_payload[0] : 0, SPI_BATCH_MAX_LEN);
+                                spix_put_data_single(SPIDEV, packetLen);
+                                dma_src_end_addr = spiBatchBuf + packetLen - 1;
+                                udma_set_channel_src(CC2538_SPI0_TX_DMA_CHAN, (uint32_t)(dma_src_end_addr));
+                                udma_set_channel_control_word(CC2538_SPI0_TX_DMA_CHAN,
+                                    (SPI0TX_DMA_FLAG | udma_xfer_size(packetLen)));
+                                udma_channel_enable(CC2538_SPI0_TX_DMA_CHAN);
+                            break;
+
                             case SPI_MASTER_RADIO_ON:
                                 NETSTACK_RADIO.on();
                                 spiInUse = 0;
@@ -293,9 +457,17 @@ PROCESS_THREAD(spiProcess, ev, data) {
                             break;
 
                             case SPI_MASTER_RST_RF_FIFO:
-                                triumviAvailIDX = 0;
-                                triumviFullIDX = 0;
-                                triumviRXBufFull = 0;
+                                triumviRXReset();
+                                spiBatchCnt = 0;
+                                spiInUse = 0;
+                            break;
+
+                            // ask the meter for its FRAM log next time it reports
+                            case SPI_MASTER_OFFLOAD_REQ:
+                                if ((spi_rx_pkt.spi_payload_length >= 8) && (offloadPendingCnt < OFFLOAD_PENDING_LEN)){
+                                    memcpy(offloadPending[offloadPendingCnt], spi_rx_pkt.spi_payload, 8);
+                                    offloadPendingCnt += 1;
+                                }
                                 spiInUse = 0;
                             break;
 
@@ -327,6 +499,14 @@ PROCESS_THREAD(packetReceiveProcess, ev, data) {
     uint8_t header_length;
     static uint8_t rtc_data_pkt[8];
     int8_t rssi;
+    uint8_t duplicated;
+    uint8_t srcAddr[8];
+    uint8_t srcSeq;
+    uint8_t* src;
+    uint8_t* nonce;
+    // offload frames are checked and control frames signed with the meter key
+    static uint8_t aesKey[] = AES_KEY;
+    aes_load_keys(aesKey, AES_KEY_STORE_SIZE_KEY_SIZE_128, 1, 0);
 
     // On process start, set timer to expire if no triumvi packets are received.
     etimer_set(&packet_rx_timer, CLOCK_SECOND*PACKET_RX_TIMEOUT);
@@ -358,6 +538,10 @@ PROCESS_THREAD(packetReceiveProcess, ev, data) {
             data_length = packetbuf_datalen();
             data_ptr = packetbuf_dataptr();
             rssi = (int8_t)packetbuf_attr(PACKETBUF_ATTR_RSSI);
+            // header is parsed once, NULL if there is no 64-bit source
+            src = packetSrcAddr(header_ptr, srcAddr, &srcSeq)? srcAddr : NULL;
+            nonce = ((data_length >= 5) && METER_READING_ID(data_ptr[0]))? &data_ptr[1] : NULL;
+            duplicated = meterFrameDuplicated(src, srcSeq, nonce);
 
             // check for time request packet
             if ((data_length == 2) && (data_ptr[0] == TRIUMVI_RTC) && (data_ptr[1] == TRIUMVI_RTC_REQ)) {
@@ -372,22 +556,17 @@ PROCESS_THREAD(packetReceiveProcess, ev, data) {
                 packetbuf_copyfrom(rtc_data_pkt, 8);
                 cc2538_on_and_transmit();
             }
-            // RX buffer is not full
-            else if ((triumviRXBufFull == 0) && (data_length > 0)) {
-                triumviRXPackets[triumviAvailIDX].length = data_length + header_length + 1; // Add RSSI to last byte
-                memcpy(triumviRXPackets[triumviAvailIDX].payload, header_ptr, header_length);
-                memcpy(triumviRXPackets[triumviAvailIDX].payload+header_length, data_ptr, data_length);
-                memcpy(triumviRXPackets[triumviAvailIDX].payload+header_length+data_length, &rssi, 1);
-                // check if fifo is full
-                if (((triumviAvailIDX == TRIUMVI_PACKET_BUF_LEN-1) && (triumviFullIDX == 0)) ||
-                    ((triumviAvailIDX != TRIUMVI_PACKET_BUF_LEN-1) && (triumviFullIDX == triumviAvailIDX+1))){
-                    triumviRXBufFull = 1;
-                }
-                // advance pointer
-                if (triumviAvailIDX == TRIUMVI_PACKET_BUF_LEN-1) {
-                    triumviAvailIDX = 0;
-                } else {
-                    triumviAvailIDX += 1;
+            // FRAM offload frames
+            else if ((data_length >= 6) && (data_ptr[0] == TRIUMVI_PKT_OFFLOAD_IDENTIFIER0) &&
+                    (data_ptr[1] == TRIUMVI_PKT_OFFLOAD_IDENTIFIER1)) {
+                offloadFrame(src, header_ptr, header_length, data_ptr, data_length, rssi);
+            }
+            // retransmitted readings never take buffer space
+            else if ((data_length > 0) && (duplicated == 0)) {
+                triumviRXEnqueue(header_ptr, header_length, data_ptr, data_length, rssi);
+                // the meter listens for a moment after each reading
+                if (METER_READING_ID(data_ptr[0]) && (offloadPendingCnt > 0)) {
+                    offloadCheckPending(src);
                 }
             }
             // Restart timeout
@@ -416,6 +595,184 @@ PROCESS_THREAD(rtcProcess, ev, data) {
     PROCESS_END();
 }
 
+// Copy a received frame into the buffer for Edison, returns 0 if it is full
+static uint8_t triumviRXEnqueue(uint8_t* header_ptr, uint8_t header_length,
+        uint8_t* data_ptr, uint8_t data_length, int8_t rssi) {
+    uint16_t packetLen = header_length + data_length + 1; // Add RSSI to last byte
+    uint16_t skip = 0;
+    uint8_t* rec;
+
+    // the end of the buffer is skipped if the record does not fit there
+    if (triumviRXTail + 1 + packetLen > TRIUMVI_RX_BUF_SIZE) {
+        skip = TRIUMVI_RX_BUF_SIZE - triumviRXTail;
+    }
+    if ((packetLen > SPIFIFOSIZE) ||
+        (triumviRXUsed + skip + 1 + packetLen > TRIUMVI_RX_BUF_SIZE)) {
+        triumviRXBufFull = 1;
+        triumviRXDropped += 1;
+        return 0;
+    }
+    if (skip > 0) {
+        triumviRXBuf[triumviRXTail] = 0;
+        triumviRXTail = 0;
+    }
+    rec = &triumviRXBuf[triumviRXTail];
+    rec[0] = packetLen;
+    memcpy(&rec[1], header_ptr, header_length);
+    memcpy(&rec[1+header_length], data_ptr, data_length);
+    memcpy(&rec[1+header_length+data_length], &rssi, 1);
+
+    triumviRXTail += 1 + packetLen;
+    if (triumviRXTail == TRIUMVI_RX_BUF_SIZE) {
+        triumviRXTail = 0;
+    }
+    triumviRXUsed += skip + 1 + packetLen;
+    triumviRXCnt += 1;
+    if (triumviRXUsed > triumviRXPeak) {
+        triumviRXPeak = triumviRXUsed;
+    }
+    return 1;
+}
+
+// 64-bit source address and sequence number of the received frame, 0 if
+// there is no 64-bit source
+static uint8_t packetSrcAddr(uint8_t* header_ptr, uint8_t* addr, uint8_t* seq) {
+    packet_header_t rx_pkt_header;
+    uint8_t i;
+    if ((process_packet_header(&rx_pkt_header, header_ptr) < 0) ||
+        (rx_pkt_header.pkt_src_addr_len != 8)) {
+        return 0;
+    }
+    for (i=0; i<8; i++) {
+        addr[i] = rx_pkt_header.pkt_src_addr[7-i];
+    }
+    *seq = rx_pkt_header.pkt_seq_number;
+    return 1;
+}
+
+// Track the sender, returns 1 if the frame is a meter reading seen before
+// addr is NULL without a 64-bit source, nonce is NULL if it is no reading
+static uint8_t meterFrameDuplicated(uint8_t* addr, uint8_t seq, uint8_t* nonce) {
+    if (addr == NULL) {
+        return 0;
+    }
+    return meterTableUpdate(addr, seq, nonce);
+}
+
+// Encrypt a control frame to the meter at addr and send it, payload is
+// FRAM_OFFLOAD_CTRL_PDATA_LEN bytes. Overwrites packetbuf.
+static void offloadSendCtrl(uint8_t cmd, uint8_t* addr, uint8_t* payload) {
+    static uint8_t ctrlPkt[FRAM_OFFLOAD_CTRL_LEN];
+    uint8_t myNonce[13];
+    uint16_t rand;
+
+    ctrlPkt[0] = TRIUMVI_OFFLOAD;
+    ctrlPkt[1] = cmd;
+    memcpy(&ctrlPkt[2], addr, 8);
+    rand = random_rand();
+    ctrlPkt[10] = (rand & 0xff00)>>8;
+    ctrlPkt[11] = rand & 0xff;
+    rand = random_rand();
+    ctrlPkt[12] = (rand & 0xff00)>>8;
+    ctrlPkt[13] = rand & 0xff;
+    memcpy(&ctrlPkt[14], payload, FRAM_OFFLOAD_CTRL_PDATA_LEN);
+
+    memcpy(myNonce, addr, 8);
+    myNonce[8] = FRAM_OFFLOAD_NONCE_GATEWAY;
+    memcpy(&myNonce[9], &ctrlPkt[10], 4);
+    // command and address are authenticated, not encrypted
+    ccm_auth_encrypt_start(LEN_LEN, 0, myNonce, &ctrlPkt[1], 9,
+        &ctrlPkt[14], FRAM_OFFLOAD_CTRL_PDATA_LEN, MIC_LEN, NULL);
+    while (ccm_auth_encrypt_check_status() != AES_CTRL_INT_STAT_RESULT_AV) {}
+    ccm_auth_encrypt_get_result(&ctrlPkt[14+FRAM_OFFLOAD_CTRL_PDATA_LEN], MIC_LEN);
+    packetbuf_copyfrom(ctrlPkt, FRAM_OFFLOAD_CTRL_LEN);
+    cc2538_on_and_transmit();
+}
+
+// Decrypt a copy of the offload frame into offloadPlain, the frame itself
+// goes to Edison as it is. Returns 1 if the MIC checks out.
+static uint8_t offloadFrameAuth(uint8_t* addr, uint8_t* data_ptr, uint8_t data_length) {
+    uint8_t myNonce[13];
+    uint8_t myMic[MIC_LEN];
+    uint8_t cdataLen = data_length-6;
+
+    if ((data_length < 10+MIC_LEN) || (cdataLen > sizeof(offloadPlain))) {
+        return 0;
+    }
+    memcpy(offloadPlain, &data_ptr[6], cdataLen);
+    memcpy(myNonce, addr, 8);
+    myNonce[8] = 0;
+    memcpy(&myNonce[9], &data_ptr[2], 4);
+    ccm_auth_decrypt_start(LEN_LEN, 0, myNonce, addr, ADATA_LEN,
+        offloadPlain, cdataLen, MIC_LEN, NULL);
+    while (ccm_auth_decrypt_check_status() != AES_CTRL_INT_STAT_RESULT_AV) {}
+    return (ccm_auth_decrypt_get_result(offloadPlain, cdataLen, myMic, MIC_LEN) == CRYPTO_SUCCESS);
+}
+
+// Send an offload request if Edison asked for this meter, starts a new
+// session. Overwrites packetbuf.
+static void offloadCheckPending(uint8_t* addr) {
+    uint8_t payload[FRAM_OFFLOAD_CTRL_PDATA_LEN] = {0};
+    uint8_t i;
+
+    if (addr == NULL) {
+        return;
+    }
+    for (i=0; i<offloadPendingCnt; i++) {
+        if (memcmp(offloadPending[i], addr, 8) == 0) {
+            offloadPendingCnt -= 1;
+            memcpy(offloadPending[i], offloadPending[offloadPendingCnt], 8);
+            memcpy(offloadAddr, addr, 8);
+            offloadActive = 1;
+            offloadBatch = 0;
+            offloadReceived = 0;
+            offloadSendCtrl(FRAM_OFFLOAD_CMD_REQ, addr, payload);
+            return;
+        }
+    }
+}
+
+// Buffer a frame of the current batch once, answer the last frame with the
+// frames buffered so far. Only frames with a valid MIC count as received,
+// the meter removes confirmed frames from its FRAM. Overwrites packetbuf.
+static void offloadFrame(uint8_t* addr, uint8_t* header_ptr, uint8_t header_length,
+        uint8_t* data_ptr, uint8_t data_length, int8_t rssi) {
+    uint8_t payload[FRAM_OFFLOAD_CTRL_PDATA_LEN];
+    uint8_t idx;
+    uint8_t numFrames;
+
+    if ((offloadActive == 0) || (addr == NULL) || memcmp(addr, offloadAddr, 8) ||
+        (offloadFrameAuth(addr, data_ptr, data_length) == 0)) {
+        return;
+    }
+    // decrypted header: batch, frame index, frames in batch, records
+    idx = offloadPlain[1];
+    numFrames = offloadPlain[2];
+    if ((idx >= 8) || (idx >= numFrames)) {
+        return;
+    }
+    if (offloadPlain[0] != offloadBatch) {
+        offloadBatch = offloadPlain[0];
+        offloadReceived = 0;
+    }
+    // retransmissions of buffered frames are dropped here
+    if (((offloadReceived & (0x01<<idx)) == 0) &&
+        triumviRXEnqueue(header_ptr, header_length, data_ptr, data_length, rssi)) {
+        offloadReceived |= (0x01<<idx);
+    }
+    if (idx == numFrames-1) {
+        payload[0] = offloadBatch;
+        payload[1] = offloadReceived;
+        // echo the nonce, the meter only takes a status for this frame
+        memcpy(&payload[2], &data_ptr[2], 4);
+        offloadSendCtrl(FRAM_OFFLOAD_CMD_STATUS, offloadAddr, payload);
+        // a frame without records ends the session
+        if ((numFrames == 1) && (offloadPlain[3] == 0) && (offloadReceived & 0x01)) {
+            offloadActive = 0;
+        }
+    }
+}
+
 void rf_rx_handler() {
     process_poll(&packetReceiveProcess);
 }
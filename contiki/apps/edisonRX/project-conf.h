@@ -13,6 +13,8 @@
 #define CC2538_RF_CONF_SNIFFER  1
 
 #define TRIUMVI_PKT_IDENTIFIER 0xa0
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
 #define AES_PKT_IDENTIFIER 0xc0
 #define LEN_LEN 2 // LVal
 #define MIC_LEN 4 // MVal
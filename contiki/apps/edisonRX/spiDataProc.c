@@ -3,12 +3,15 @@
 // cmd + length (optional, length field counts) + payload (optional)
 // REQ_DATA doesn't need length
 // GET_DATA requires length
+// REQ_BATCH doesn't need length
 
 #define SPI_MASTER_REQ_DATA 0x00
 #define SPI_MASTER_DUMMY 0x01
 #define SPI_MASTER_GET_DATA 0x02
 #define SPI_MASTER_RADIO_ON 0x03
 #define SPI_MASTER_RADIO_OFF 0x04
+#define SPI_MASTER_REQ_BATCH 0x09
+#define SPI_MASTER_ACK_BATCH 0x0a // 1 byte number of packets
 
 #define MAX_SPI_LENGTH 128
 
@@ -48,6 +51,11 @@ uint8_t spi_packet_parse(spi_packet_t* rx_packet, uint8_t* data_ptr){
       return 1;
     break;
 
+    case SPI_MASTER_REQ_BATCH:
+      rx_packet->spi_payload_length = 0;
+      return 1;
+    break;
+
     default:
       rx_packet->spi_payload_length = data_ptr[1]-1;
       for (i=0; i<rx_packet->spi_payload_length; i++)
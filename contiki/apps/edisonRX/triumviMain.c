@@ -23,10 +23,18 @@
 #define BATTERYPACK_STATUSREG  0x0040
 #define FRAMWRITE_STATUSREG    0x0008
 #define POWERFACTOR_STATUSREG  0x0004
+#define TIMESTAMP_STATUSREG    0x0002
+#define COUNTER_STATUSREG      0x0001
+
+// extension flags, last byte of an extended record
+#define DELTA_EXTFLAG          0x01    // 2 bytes suppressed readings, 4 bytes energy
+#define ENERGY_EXTFLAG         0x02    // 4 bytes accumulated energy
 
 /* Triumvi received packet buffer */
+// ID and address, then the decrypted aggregated frame at most
+#define TRIUMVI_PAYLOAD_LEN 98
 typedef struct{
-    uint8_t payload[22];
+    uint8_t payload[TRIUMVI_PAYLOAD_LEN];
     uint8_t length;
 } triumviPacket_t;
 
@@ -42,8 +50,30 @@ static uint8_t spiInUse = 0;
 
 static uint8_t resetCnt = 0;
 
-const uint8_t possible_packet_length[] = {5, 7, 11, 13};
-#define POSSIBLE_PKT_LEN_COMBINATION 4
+/* batch read */
+// 1 byte length (bytes that follow), 1 byte number of packets,
+// then 1 byte length + payload for each packet
+#define SPI_BATCH_MAX_LEN 255
+static uint8_t spiBatchBuf[SPI_BATCH_MAX_LEN];
+static uint8_t spiBatchCnt = 0;    // packets in the last batch sent
+
+/* Received frames waiting to be decrypted */
+// the frame is copied out of packetbuf so the radio can take the next one
+// while the crypto engine works on this one
+typedef struct{
+    uint8_t frame[128];     // header + payload
+    uint8_t hdrLength;
+    uint8_t length;
+} rawPacket_t;
+
+#define RAW_PACKET_BUF_LEN 4
+static rawPacket_t rawRXPackets[RAW_PACKET_BUF_LEN];
+static uint8_t rawAvailIDX = 0;
+static uint8_t rawFullIDX = 0;
+static uint8_t rawRXCnt = 0;
+
+// 1 byte ID, 4 bytes nonce, payload (at least power + status), MIC
+#define TRIUMVI_PKT_OVERHEAD (5+MIC_LEN)
 
 /* spi interface */
 #define SPIDEV          0
@@ -172,6 +202,53 @@ PROCESS_THREAD(mainProcess, ev, data) {
     PROCESS_END();
 }
 
+static uint8_t triumviRXCount(){
+    if (triumviRXBufFull == 1)
+        return TRIUMVI_PACKET_BUF_LEN;
+    if (triumviAvailIDX >= triumviFullIDX)
+        return triumviAvailIDX - triumviFullIDX;
+    return TRIUMVI_PACKET_BUF_LEN - triumviFullIDX + triumviAvailIDX;
+}
+
+// pack as many queued packets as fit, oldest first, returns the length
+// of spiBatchBuf
+static uint8_t spiBatchBuild(){
+    uint8_t queued = triumviRXCount();
+    uint8_t idx = triumviFullIDX;
+    uint16_t len = 1;
+    uint8_t packetLen;
+
+    spiBatchCnt = 0;
+    while (spiBatchCnt < queued){
+        packetLen = triumviRXPackets[idx].length;
+        if (len + 1 + packetLen > SPI_BATCH_MAX_LEN)
+            break;
+        spiBatchBuf[len] = packetLen;
+        memcpy(&spiBatchBuf[len+1], triumviRXPackets[idx].payload, packetLen);
+        len += 1 + packetLen;
+        spiBatchCnt += 1;
+        idx = (idx == TRIUMVI_PACKET_BUF_LEN-1)? 0 : idx+1;
+    }
+    spiBatchBuf[0] = spiBatchCnt;
+    return len;
+}
+
+// drop up to num packets of the last batch from the buffer
+static void spiBatchAck(uint8_t num){
+    uint8_t queued = triumviRXCount();
+    if (num > spiBatchCnt)
+        num = spiBatchCnt;
+    if (num > queued)
+        num = queued;
+    if (num > 0){
+        triumviRXBufFull = 0;
+        triumviFullIDX += num;
+        if (triumviFullIDX >= TRIUMVI_PACKET_BUF_LEN)
+            triumviFullIDX -= TRIUMVI_PACKET_BUF_LEN;
+    }
+    spiBatchCnt = 0;
+}
+
 PROCESS_THREAD(spiProcess, ev, data) {
     PROCESS_BEGIN();
     uint8_t spi_data_fifo[SPIFIFOSIZE];
@@ -251,6 +328,29 @@ PROCESS_THREAD(spiProcess, ev, data) {
                                 spiInUse = 0;
                             break;
 
+                            // length and all packets that fit in one transfer
+                            case SPI_MASTER_REQ_BATCH:
+                                packetLen = spiBatchBuild();
+                                spix_put_data_single(SPIDEV, packetLen);
+                                dma_src_end_addr = spiBatchBuf + packetLen - 1;
+                                udma_set_channel_src(CC2538_SPI0_TX_DMA_CHAN, (uint32_t)(dma_src_end_addr));
+                                udma_set_channel_control_word(CC2538_SPI0_TX_DMA_CHAN,
+                                    (SPI0TX_DMA_FLAG | udma_xfer_size(packetLen)));
+                                udma_channel_enable(CC2538_SPI0_TX_DMA_CHAN);
+                                GPIO_CLR_PIN(TRIUMVI_DATA_READY_PORT_BASE, TRIUMVI_DATA_READY_MASK);
+                            break;
+
+                            // batch is received, advances pointer by the acknowledged packets
+                            case SPI_MASTER_ACK_BATCH:
+                                if (spi_rx_pkt.spi_payload_length >= 1)
+                                    spiBatchAck(spi_rx_pkt.spi_payload[0]);
+                                #ifndef LED_DEBUG
+                                leds_off(LEDS_GREEN);
+                                #endif
+                                resetCnt = 0;
+                                spiInUse = 0;
+                            break;
+
                             case SPI_MASTER_RADIO_ON:
                                 NETSTACK_RADIO.on();
                                 spiInUse = 0;
@@ -285,6 +385,31 @@ PROCESS_THREAD(spiProcess, ev, data) {
     PROCESS_END();
 }
 
+// 1 if the decrypted payload is exactly the fields the status register (and
+// the extension flags) announce
+static uint8_t triumviRecordFits(uint8_t id, uint8_t* cData, uint8_t pdataLen){
+    uint8_t need = 5;
+    if (id==TRIUMVI_PKT_AGG_IDENTIFIER)
+        return 1;
+    if (cData[4]&BATTERYPACK_STATUSREG)
+        need += 2;
+    if (cData[4]&POWERFACTOR_STATUSREG)
+        need += 6;
+    if (cData[4]&TIMESTAMP_STATUSREG)
+        need += 6;
+    if (cData[4]&COUNTER_STATUSREG)
+        need += 4;
+    // extension fields and flags byte
+    if (id==TRIUMVI_PKT_EXT_IDENTIFIER){
+        need += 1;
+        if (cData[pdataLen-1]&DELTA_EXTFLAG)
+            need += 6;
+        if (cData[pdataLen-1]&ENERGY_EXTFLAG)
+            need += 4;
+    }
+    return (need == pdataLen);
+}
+
 PROCESS_THREAD(decryptProcess, ev, data) {
     PROCESS_BEGIN();
     // AES
@@ -294,18 +419,17 @@ PROCESS_THREAD(decryptProcess, ev, data) {
     aes_load_keys(aes_key, AES_KEY_STORE_SIZE_KEY_SIZE_128, 1, 0);
     
     static uint8_t srcExtAddr[8];
-    static uint8_t packetPayload[128];
-    static uint8_t packetDuplicated[123];
-    static uint8_t* cData = packetDuplicated;
+    static uint8_t* cData;
     static uint8_t* aData = srcExtAddr;
 
-    uint8_t *packet_hdr;
-    uint8_t *packet_ptr;
-    uint16_t packet_length;
+    static rawPacket_t* rawPkt;
+    static uint8_t *packet_ptr;
+    static uint8_t packet_length;
     uint8_t src_addr_len;
 
     uint8_t auth_res;
-    uint8_t myPDATA_LEN;
+    static uint8_t myPDATA_LEN;
+    uint8_t extLen;
 
     uint16_t i, j, k;
     uint8_t tmp;
@@ -313,7 +437,7 @@ PROCESS_THREAD(decryptProcess, ev, data) {
     packet_header_t rx_pkt_header;
 
     while(1){
-        PROCESS_YIELD();
+        PROCESS_WAIT_EVENT_UNTIL(rawRXCnt > 0);
         #ifndef LED_DEBUG
         leds_on(LEDS_RED);
         #else
@@ -321,12 +445,10 @@ PROCESS_THREAD(decryptProcess, ev, data) {
         leds_on(LEDS_GREEN);
         leds_on(LEDS_BLUE);
         #endif
-        // Get data from radio buffer and parse it
-        packet_hdr = packetbuf_hdrptr();                                   
-        packet_ptr = packetbuf_dataptr();                                  
-        packet_length = packetbuf_datalen();                               
-        process_packet_header(&rx_pkt_header, packet_hdr);
-        memcpy(packetPayload, packet_ptr, packet_length);
+        rawPkt = &rawRXPackets[rawFullIDX];
+        packet_ptr = rawPkt->frame + rawPkt->hdrLength;
+        packet_length = rawPkt->length - rawPkt->hdrLength;
+        process_packet_header(&rx_pkt_header, rawPkt->frame);
         src_addr_len = rx_pkt_header.pkt_src_addr_len;
 
         // data format: 
@@ -338,6 +460,10 @@ PROCESS_THREAD(decryptProcess, ev, data) {
         // 4 bytes pf (optional)
         // 4 bytes VRMS (optional)
         // 4 bytes IRMS (optional)
+        // 6 bytes time stamp (optional)
+        // 4 bytes counter (optional)
+        // extension fields and flags byte (extended records only)
+        // aggregated frames: 1 byte ID, 8 bytes source addr, decrypted payload
 
         // RX buffer is not full
         if (triumviRXBufFull==0){
@@ -349,46 +475,89 @@ PROCESS_THREAD(decryptProcess, ev, data) {
                 }
                 triumviRXPackets[triumviAvailIDX].length += src_addr_len;
             }
-            // Decrypt packet
-            if (packet_ptr[0]==TRIUMVI_PKT_IDENTIFIER){
+            // Decrypt packet, the payload length follows from the frame length
+            if (((packet_ptr[0]==TRIUMVI_PKT_IDENTIFIER) && (packet_length >= TRIUMVI_PKT_OVERHEAD+5)) ||
+                ((packet_ptr[0]==TRIUMVI_PKT_EXT_IDENTIFIER) && (packet_length >= TRIUMVI_PKT_OVERHEAD+5+1)) ||
+                ((packet_ptr[0]==TRIUMVI_PKT_AGG_IDENTIFIER) && (packet_length >= TRIUMVI_PKT_OVERHEAD+3) &&
+                 (packet_length-TRIUMVI_PKT_OVERHEAD <= TRIUMVI_PAYLOAD_LEN-9))){
+                myPDATA_LEN = packet_length - TRIUMVI_PKT_OVERHEAD;
                 memcpy(myNonce, srcExtAddr, 8);
-                memcpy(&myNonce[9], &packetPayload[1], 4); // Nonce[8] should be 0
-                for (i=0; i<POSSIBLE_PKT_LEN_COMBINATION; i++){ 
-                    myPDATA_LEN = possible_packet_length[i];
-                    memcpy(packetDuplicated, &packetPayload[5], packet_length-5);
-                    ccm_auth_decrypt_start(LEN_LEN, 0, myNonce, aData, ADATA_LEN, 
-                        cData, (myPDATA_LEN+MIC_LEN), MIC_LEN, NULL);
-                    while (ccm_auth_decrypt_check_status()!=AES_CTRL_INT_STAT_RESULT_AV){}
-                    auth_res = ccm_auth_decrypt_get_result(cData, myPDATA_LEN+MIC_LEN, myMic, MIC_LEN);
-                    if (auth_res==CRYPTO_SUCCESS)
-                        break;
-                }
+                memcpy(&myNonce[9], &packet_ptr[1], 4); // Nonce[8] should be 0
+                // decrypt in place, the frame is a copy
+                cData = &packet_ptr[5];
+                ccm_auth_decrypt_start(LEN_LEN, 0, myNonce, aData, ADATA_LEN, 
+                    cData, (myPDATA_LEN+MIC_LEN), MIC_LEN, &decryptProcess);
+                // crypto interrupt polls this process, radio frames keep
+                // coming into rawRXPackets meanwhile
+                PROCESS_WAIT_EVENT_UNTIL(ccm_auth_decrypt_check_status()==AES_CTRL_INT_STAT_RESULT_AV);
+                auth_res = ccm_auth_decrypt_get_result(cData, myPDATA_LEN+MIC_LEN, myMic, MIC_LEN);
                 // succefully decoded the packet, pack the data into buffer
-                if (auth_res==CRYPTO_SUCCESS){
+                if ((auth_res==CRYPTO_SUCCESS) && triumviRecordFits(packet_ptr[0], cData, myPDATA_LEN)){
                     triumviRXPackets[triumviAvailIDX].payload[0] = packet_ptr[0];
                     tmp = triumviRXPackets[triumviAvailIDX].length;
-                    for (i=0; i<4; i++){
-                        triumviRXPackets[triumviAvailIDX].payload[tmp+i] = cData[i];
-                    }
-                    triumviRXPackets[triumviAvailIDX].payload[tmp+4] = cData[4]; // Status register
-                    j = 5;
-                    k = 5;
-                    if (cData[4]&BATTERYPACK_STATUSREG){
-                        triumviRXPackets[triumviAvailIDX].payload[tmp+j] = cData[k]; // Panel ID
-                        triumviRXPackets[triumviAvailIDX].payload[tmp+j+1] = cData[k+1]; // Circuit ID
-                        triumviRXPackets[triumviAvailIDX].length += 2;
-                        j += 2;
-                        k += 2;
+                    // aggregated readings go to Edison as they are
+                    if (packet_ptr[0]==TRIUMVI_PKT_AGG_IDENTIFIER){
+                        memcpy(&triumviRXPackets[triumviAvailIDX].payload[tmp], cData, myPDATA_LEN);
+                        triumviRXPackets[triumviAvailIDX].length += myPDATA_LEN;
                     }
-                    // PF, VRMS, IRMS
-                    if (cData[4]&POWERFACTOR_STATUSREG){
-                        for (i=0; i<6; i++){
-                            triumviRXPackets[triumviAvailIDX].payload[tmp+j+i] = cData[k+i];
+                    else{
+                        for (i=0; i<4; i++){
+                            triumviRXPackets[triumviAvailIDX].payload[tmp+i] = cData[i];
+                        }
+                        triumviRXPackets[triumviAvailIDX].payload[tmp+4] = cData[4]; // Status register
+                        j = 5;
+                        k = 5;
+                        if (cData[4]&BATTERYPACK_STATUSREG){
+                            triumviRXPackets[triumviAvailIDX].payload[tmp+j] = cData[k]; // Panel ID
+                            triumviRXPackets[triumviAvailIDX].payload[tmp+j+1] = cData[k+1]; // Circuit ID
+                            triumviRXPackets[triumviAvailIDX].length += 2;
+                            j += 2;
+                            k += 2;
+                        }
+                        // PF, VRMS, IRMS
+                        if (cData[4]&POWERFACTOR_STATUSREG){
+                            for (i=0; i<6; i++){
+                                triumviRXPackets[triumviAvailIDX].payload[tmp+j+i] = cData[k+i];
+                            }
+                            triumviRXPackets[triumviAvailIDX].length += 6;
+                            j += 6;
+                            k += 6;
                         }
-                        triumviRXPackets[triumviAvailIDX].length += 6;
+                        // time stamp, 6 bytes
+                        if (cData[4]&TIMESTAMP_STATUSREG){
+                            for (i=0; i<6; i++){
+                                triumviRXPackets[triumviAvailIDX].payload[tmp+j+i] = cData[k+i];
+                            }
+                            triumviRXPackets[triumviAvailIDX].length += 6;
+                            j += 6;
+                            k += 6;
+                        }
+                        // counter, 4 bytes
+                        if (cData[4]&COUNTER_STATUSREG){
+                            for (i=0; i<4; i++){
+                                triumviRXPackets[triumviAvailIDX].payload[tmp+j+i] = cData[k+i];
+                            }
+                            triumviRXPackets[triumviAvailIDX].length += 4;
+                            j += 4;
+                            k += 4;
+                        }
+                        // extension fields are at the end, before the flags
+                        if (packet_ptr[0]==TRIUMVI_PKT_EXT_IDENTIFIER){
+                            extLen = 1;
+                            if (cData[myPDATA_LEN-1]&DELTA_EXTFLAG)
+                                extLen += 6;
+                            if (cData[myPDATA_LEN-1]&ENERGY_EXTFLAG)
+                                extLen += 4;
+                            if (extLen > myPDATA_LEN-j)
+                                extLen = 0;
+                            for (i=0; i<extLen; i++){
+                                triumviRXPackets[triumviAvailIDX].payload[tmp+j+i] = cData[myPDATA_LEN-extLen+i];
+                            }
+                            triumviRXPackets[triumviAvailIDX].length += extLen;
+                        }
+                        // base length
+                        triumviRXPackets[triumviAvailIDX].length += 5;
                     }
-                    // base length
-                    triumviRXPackets[triumviAvailIDX].length += 5;
                     
                     // check if fifo is full
                     if (((triumviAvailIDX == TRIUMVI_PACKET_BUF_LEN-1) && (triumviFullIDX == 0)) || 
@@ -406,15 +575,34 @@ PROCESS_THREAD(decryptProcess, ev, data) {
                 }
             }
         }
+        // done with the frame
+        rawFullIDX = (rawFullIDX == RAW_PACKET_BUF_LEN-1)? 0 : rawFullIDX+1;
+        rawRXCnt -= 1;
         #ifndef LED_DEBUG
         leds_off(LEDS_RED);
         #endif
         process_poll(&mainProcess);
+        // the wait below yields first, polls that came in meanwhile are
+        // merged into one, so poll again for the frames still queued
+        if (rawRXCnt > 0)
+            process_poll(&decryptProcess);
     }
     PROCESS_END();
 }
 
+// called from the radio process while packetbuf holds the frame
 void rf_rx_handler(){
+    uint8_t header_length = packetbuf_hdrlen();
+    uint8_t data_length = packetbuf_datalen();
+    // drop the frame if decryption is too far behind
+    if ((rawRXCnt < RAW_PACKET_BUF_LEN) && (header_length+data_length <= sizeof(rawRXPackets[0].frame))){
+        memcpy(rawRXPackets[rawAvailIDX].frame, packetbuf_hdrptr(), header_length);
+        memcpy(rawRXPackets[rawAvailIDX].frame+header_length, packetbuf_dataptr(), data_length);
+        rawRXPackets[rawAvailIDX].hdrLength = header_length;
+        rawRXPackets[rawAvailIDX].length = header_length+data_length;
+        rawAvailIDX = (rawAvailIDX == RAW_PACKET_BUF_LEN-1)? 0 : rawAvailIDX+1;
+        rawRXCnt += 1;
+    }
     process_poll(&decryptProcess);
 }   
 
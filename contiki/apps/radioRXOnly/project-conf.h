@@ -11,6 +11,13 @@
 #define CC2538_RF_CONF_SNIFFER  1
 #define AES_ENABLE
 
+#define TRIUMVI_PKT_IDENTIFIER 0xa0
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
+
+// COBS framed binary records for rxScript/triumviIngest instead of text
+//#define INGEST_OUTPUT
+
 #ifdef AES_ENABLE
 #define AES_PKT_IDENTIFIER 0xc0
 #define LEN_LEN 2 // LVal
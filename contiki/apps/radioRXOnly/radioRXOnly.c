@@ -16,6 +16,10 @@
 #include "spi-arch.h"
 #include "spi.h"
 #include "dev/ssi.h"
+#ifdef INGEST_OUTPUT
+#include "dbg.h"
+#include "ingestFrame.h"
+#endif
 
 
 #include <stdio.h>
@@ -25,6 +29,11 @@
 #define SPI_CS_GPIO_NUM GPIO_C_NUM
 #define SPI_CS_GPIO_PIN 0
 
+#define BATTERYPACK_STATUSREG  0x0040
+
+// ID, nonce, MIC
+#define TRIUMVI_PKT_OVERHEAD (5+MIC_LEN)
+
 
 PROCESS(radioRXOnlyProcess, "Radio RX Process");
 AUTOSTART_PROCESSES(&radioRXOnlyProcess);
@@ -34,6 +43,55 @@ void rf_rx_handler(){
 	process_poll(&radioRXOnlyProcess);
 }   
 
+#ifdef INGEST_OUTPUT
+// One binary record per packet instead of the text lines, see ingestFrame.h.
+// Triumvi packets are decrypted with the payload length taken from the
+// frame length, anything else goes out as received.
+static void ingestPacket(uint8_t* packet, uint16_t length, int8_t rssi){
+	static uint8_t record[INGEST_MAX_RECORD];
+	static uint8_t frame[INGEST_MAX_FRAME];
+	static uint8_t nonce[13];
+	static uint8_t mic[MIC_LEN];
+	uint8_t* addr = &record[1];
+	uint8_t* cData = &record[INGEST_METER_HEADER_LEN];
+	uint8_t src_addr_len = rx_pkt_header.pkt_src_addr_len;
+	uint16_t recordLen = 0;
+	uint8_t pDataLen;
+	uint8_t i;
+
+	if (length > INGEST_MAX_RECORD-INGEST_HEADER_LEN)
+		return;
+	memset(record, 0, INGEST_HEADER_LEN);
+	for (i=0; (i<src_addr_len) && (i<8); i++)
+		addr[i] = rx_pkt_header.pkt_src_addr[src_addr_len - 1 - i];
+	record[9] = (uint8_t)rssi;
+
+	if (((packet[0]==TRIUMVI_PKT_IDENTIFIER) || (packet[0]==TRIUMVI_PKT_EXT_IDENTIFIER) ||
+		(packet[0]==TRIUMVI_PKT_AGG_IDENTIFIER)) && (length > TRIUMVI_PKT_OVERHEAD)){
+		pDataLen = length - TRIUMVI_PKT_OVERHEAD;
+		memcpy(nonce, addr, 8);
+		nonce[8] = 0;
+		memcpy(&nonce[9], &packet[1], 4);
+		// decrypt in place, right behind the record header
+		memcpy(cData, &packet[5], pDataLen+MIC_LEN);
+		ccm_auth_decrypt_start(LEN_LEN, 0, nonce, addr, ADATA_LEN,
+			cData, (pDataLen+MIC_LEN), MIC_LEN, NULL);
+		while (ccm_auth_decrypt_check_status()!=AES_CTRL_INT_STAT_RESULT_AV){}
+		if (ccm_auth_decrypt_get_result(cData, pDataLen+MIC_LEN, mic, MIC_LEN)==CRYPTO_SUCCESS){
+			record[0] = INGEST_REC_METER;
+			memcpy(&record[INGEST_HEADER_LEN], packet, 5);
+			recordLen = INGEST_METER_HEADER_LEN + pDataLen;
+		}
+	}
+	if (recordLen==0){
+		record[0] = INGEST_REC_RAW;
+		memcpy(&record[INGEST_HEADER_LEN], packet, length);
+		recordLen = INGEST_HEADER_LEN + length;
+	}
+	dbg_send_bytes(frame, ingestFrameEncode(record, recordLen, frame));
+}
+#endif
+
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(radioRXOnlyProcess, ev, data)
 {
@@ -63,6 +121,9 @@ PROCESS_THREAD(radioRXOnlyProcess, ev, data)
 		uint16_t packet_length = packetbuf_datalen();                               
 		process_packet_header(&rx_pkt_header, packet_hdr);
 
+		#ifdef INGEST_OUTPUT
+		ingestPacket(packet_ptr, packet_length, (int8_t)packetbuf_attr(PACKETBUF_ATTR_RSSI));
+		#else
 		memcpy(packetPayload, packet_ptr, packet_length);
 		printf("Received a packet from: ");
 		uint8_t src_addr_len = rx_pkt_header.pkt_src_addr_len;
@@ -149,6 +210,7 @@ PROCESS_THREAD(radioRXOnlyProcess, ev, data)
 			printf("\r\n");
 		}
 		printf("\r\n");
+		#endif
 		leds_off(LEDS_RED);
 	}
 
@@ -14,6 +14,7 @@
 //#ifdef ERASE_FRAM
 //#define RTC_SET
 //#define FRAM_WRITE
+//#define FRAM_OFFLOAD  // send the FRAM log when the gateway asks, needs FRAM_WRITE
 
 //#define DATADUMP
 //#define DATADUMP2
@@ -25,7 +26,7 @@
 #define UART_CONF_ENABLE 1
 #endif
 
-//#define FIFTYHZ
+// 50 Hz grid: make GRID_FREQ=50, sets FIFTYHZ and picks the sine table
 #define POLYFIT
 
 //#define TRANSMIT_WAVEFORM
@@ -39,6 +40,18 @@
 #define TRIUMVI_PKT_WAVE_IDENTIFIER0 0xa1
 #define TRIUMVI_PKT_WAVE_IDENTIFIER1 0x5e
 
+// extended record, the regular record followed by the fields of the options
+// below and a flags byte
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+// only transmit readings out of the deadband of the last one, with the
+// energy in between, see deltaReport.h
+//#define DELTA_REPORT
+// accumulated energy register (mWh) in every record, see energyAcc.h
+//#define ENERGY_REPORT
+// several readings per frame, see aggReport.h, not with DELTA_REPORT
+//#define AGGREGATE_REPORT
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
+
 #define VERSION10
 #define FM25CL64B
 
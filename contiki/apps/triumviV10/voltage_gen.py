@@ -1,27 +1,41 @@
-
 import sys
 from math import sqrt, sin, pi
 
+# Nominal voltage waveform for current-only sensing.
+# The table is indexed in degrees and spans two periods, so
+# stdSineTable[i*DEGREE_PER_SAMPLE + phaseOffset] never has to wrap for
+# phaseOffset < 360 and i < samples per cycle, for any SAMPLES_PER_CYCLE
+# that divides 360. The frequency is recorded so the app can check the table
+# against its build.
+
 def main():
-    if len(sys.argv) != 2:
-        print("Invalid parameter, useage: python voltage_gen.py amplitude\r\n")
-        return
-    fileName = 'sineTable_' + sys.argv[1] + 'v.h'
+    if len(sys.argv) < 2 or len(sys.argv) > 3:
+        print("Invalid parameter, useage: python voltage_gen.py VRMS [frequency]\r\n")
+        return 1
+    vrms = int(sys.argv[1])
+    freq = int(sys.argv[2]) if len(sys.argv) > 2 else 60
+    fileName = 'sineTable_{0}v_{1}hz.h'.format(vrms, freq)
     outFile = open(fileName, 'w')
-    outFile.write('/* table is generated with VRMS: {0} v */\r\n'.format(int(sys.argv[1])))
-    outFile.write('const int stdSineTable[] = {\r\n')
-    amplitude = sqrt(2)*int(sys.argv[1])
-    for i in range(360):
-        outFile.write('{0}'.format(int(round(amplitude*sin(i/180.0*pi)))))
+    outFile.write('/* table is generated with VRMS: {0} v, {1} Hz */\r\n'.format(vrms, freq))
+    outFile.write('/* generated by voltage_gen.py, do not edit */\r\n\r\n')
+    outFile.write('// This table should be generated with the actual phase voltage, not line voltage\r\n')
+    outFile.write('#define VOLTAGE_NOMINAL {0}\r\n'.format(vrms))
+    outFile.write('#define SINE_TABLE_FREQ {0}\r\n'.format(freq))
+    outFile.write('#define SINE_TABLE_LEN 720\r\n\r\n')
+    outFile.write('const int stdSineTable[SINE_TABLE_LEN] = {\r\n')
+    amplitude = sqrt(2)*vrms
+    for i in range(720):
+        outFile.write('{0}'.format(int(round(amplitude*sin((i % 360)/180.0*pi)))))
         newLine = True if i % 12 == 11 else False
-        if i == 359:
+        if i == 719:
             outFile.write('};\r\n')
         else:
             outFile.write(', ')
             if newLine:
                 outFile.write('\r\n')
-    print('Successfully generated {0} v VRMS waveform\r\n'.format(sys.argv[1]))
+    print('Successfully generated {0} v VRMS, {1} Hz waveform\r\n'.format(vrms, freq))
     outFile.close()
+    return 0
 
 if __name__=="__main__":
-    main()
+    sys.exit(main())
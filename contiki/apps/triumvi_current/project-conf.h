@@ -12,6 +12,7 @@
 #define CC2538_RF_CONF_SNIFFER  1
 
 //#define FRAM_WRITE
+//#define FRAM_OFFLOAD  // send the FRAM log when the gateway asks, needs FRAM_WRITE
 
 //#define DATADUMP
 //#define DATADUMP2
@@ -32,6 +33,18 @@
 #define TRIUMVI_PKT_WAVE_IDENTIFIER0 0xa1
 #define TRIUMVI_PKT_WAVE_IDENTIFIER1 0x5e
 
+// extended record, the regular record followed by the fields of the options
+// below and a flags byte
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+// only transmit readings out of the deadband of the last one, with the
+// energy in between, see deltaReport.h
+//#define DELTA_REPORT
+// accumulated energy register (mWh) in every record, see energyAcc.h
+//#define ENERGY_REPORT
+// several readings per frame, see aggReport.h, not with DELTA_REPORT
+//#define AGGREGATE_REPORT
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
+
 #define TRIUMVI_PKT_CALIBRATIONCOEF_IDENTIFIER0 0xa1
 #define TRIUMVI_PKT_CALIBRATIONCOEF_IDENTIFIER1 0x5d
 
@@ -46,7 +59,7 @@
 //#define FM25V02
 
 // Other options
-//#define FIFTYHZ
+// 50 Hz grid: make GRID_FREQ=50, sets FIFTYHZ and picks the sine table
 #define POLYFIT
 #define RTC_ENABLE
 #define COUNTER_ENABLE
@@ -1,32 +0,0 @@
-/* table is generated with VRMS: 120 v */
-const int stdSineTable[] = {
-0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 29, 32, 
-35, 38, 41, 44, 47, 50, 52, 55, 58, 61, 64, 66, 
-69, 72, 74, 77, 80, 82, 85, 87, 90, 92, 95, 97, 
-100, 102, 104, 107, 109, 111, 114, 116, 118, 120, 122, 124, 
-126, 128, 130, 132, 134, 136, 137, 139, 141, 142, 144, 145, 
-147, 148, 150, 151, 153, 154, 155, 156, 157, 158, 159, 160, 
-161, 162, 163, 164, 165, 165, 166, 167, 167, 168, 168, 168, 
-169, 169, 169, 169, 170, 170, 170, 170, 170, 169, 169, 169, 
-169, 168, 168, 168, 167, 167, 166, 165, 165, 164, 163, 162, 
-161, 160, 159, 158, 157, 156, 155, 154, 153, 151, 150, 148, 
-147, 145, 144, 142, 141, 139, 137, 136, 134, 132, 130, 128, 
-126, 124, 122, 120, 118, 116, 114, 111, 109, 107, 104, 102, 
-100, 97, 95, 92, 90, 87, 85, 82, 80, 77, 74, 72, 
-69, 66, 64, 61, 58, 55, 52, 50, 47, 44, 41, 38, 
-35, 32, 29, 27, 24, 21, 18, 15, 12, 9, 6, 3, 
-0, -3, -6, -9, -12, -15, -18, -21, -24, -27, -29, -32, 
--35, -38, -41, -44, -47, -50, -52, -55, -58, -61, -64, -66, 
--69, -72, -74, -77, -80, -82, -85, -87, -90, -92, -95, -97, 
--100, -102, -104, -107, -109, -111, -114, -116, -118, -120, -122, -124, 
--126, -128, -130, -132, -134, -136, -137, -139, -141, -142, -144, -145, 
--147, -148, -150, -151, -153, -154, -155, -156, -157, -158, -159, -160, 
--161, -162, -163, -164, -165, -165, -166, -167, -167, -168, -168, -168, 
--169, -169, -169, -169, -170, -170, -170, -170, -170, -169, -169, -169, 
--169, -168, -168, -168, -167, -167, -166, -165, -165, -164, -163, -162, 
--161, -160, -159, -158, -157, -156, -155, -154, -153, -151, -150, -148, 
--147, -145, -144, -142, -141, -139, -137, -136, -134, -132, -130, -128, 
--126, -124, -122, -120, -118, -116, -114, -111, -109, -107, -104, -102, 
--100, -97, -95, -92, -90, -87, -85, -82, -80, -77, -74, -72, 
--69, -66, -64, -61, -58, -55, -52, -50, -47, -44, -41, -38, 
--35, -32, -29, -27, -24, -21, -18, -15, -12, -9, -6, -3};
@@ -25,6 +25,16 @@
 #include "cc2538-rf.h"
 #include "fm25cl64b.h"
 #include "triumvi.h"
+#include "meterCalc.h"
+#include "meterSampler.h"
+#include "calStore.h"
+#include "framLog.h"
+#include "framOffload.h"
+#include "frontEnd.h"
+#include "energyAcc.h"
+#include "reportSched.h"
+#include "deltaReport.h"
+#include "aggReport.h"
 #include "sx1509b.h"
 #include "simple_network_driver.h"
 #include "dev/rom-util.h"
@@ -36,15 +46,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#ifdef VERSION12
-// Ip = ADC * 3000/2048/R/CT (mA)
-//#define I_TRANSFORM 70 // 209 ohm sensing resistor, with 1:10000 CT
-//#define I_TRANSFORM 732 // 20 ohm sensing resistor, with 1:10000 CT
-#define I_TRANSFORM 439 // 20 ohm sensing resistor, with 1:6000 CT
-#else
-#define I_TRANSFORM 97 // 45.3 ohm sensing resistor
-#endif
-
 #define FIRSTSAMPLE_STATUSREG  0x0100
 #define EXTERNALVOLT_STATUSREG 0x0080
 #define BATTERYPACK_STATUSREG  0x0040
@@ -54,26 +55,14 @@
 #define TIMESTAMP_STATUSREG    0x0002
 #define COUNTER_STATUSREG      0x0001
 
+// extension flags, last byte of an extended record
+#define DELTA_EXTFLAG          0x01
+#define ENERGY_EXTFLAG         0x02
+
 #define FLASH_BASE 0x200000
 #define FLASH_SIZE 0x80000 //rom_util_get_flash_size()
 #define FLASH_ERASE_SIZE 0x800
 
-// Adjusted (DC removal) ADC sample thresholds
-#define UPPERTHRESHOLD0  400 // upper threshold for gain == 17
-#define UPPERTHRESHOLD1  500 // upper threshold for gain == 5, 9
-#define UPPERTHRESHOLD2  500 // upper threshold for gain == 3
-#define LOWERTHRESHOLD0  80 // lower threshold for gain == 1
-#if defined(VERSION10)
-#define LOWERTHRESHOLD1  200 // lower threshold for others
-#elif defined(VERSION11) || defined(VERSION12)
-#define LOWERTHRESHOLD1  150 // lower threshold for others
-#endif
-
-// number of samples per cycle
-#define BUF_SIZE 120        // sample current only, 11-bit resolution, 1 cycles
-#define BUF_SIZE2 228       // sample both current and voltage, 10-bit resolution, 2 cycles
-#define MAX_BUF_SIZE 228    // max(BUF_SIZE, BUF_SIZE2)
-
 // number of calibration cycles
 #define CALIBRATION_CYCLES 512
 #define AMP_CALIBRATION_CYCLE 64
@@ -83,6 +72,14 @@
 // Note: The sensor should be calibrated with 120 V source
 #define VOLTAGE_NOMINAL_SCALING 1
 
+// cycles per reading in external voltage mode, streamed through
+// currentADCVal/voltADCVal one cycle at a time so memory does not grow.
+// 16 matches the old capture (8 buffers of 2 cycles), 32~64 cycles average
+// out noisy loads
+#ifndef EXT_VOLT_CYCLES
+#define EXT_VOLT_CYCLES 16
+#endif
+
 // maximum different current setting per gain
 #define MAX_CURRENT_SETTING_PER_GAIN 16
 
@@ -106,29 +103,26 @@
 // (1<<bitShiftArr[i]) = 1, 4, 16 or 64
 // bitShiftArr[i] must lies in (0, 2, 4, 6)
 
-// INA gain indices
+// INA gain indices, inaGainRecipArr[i] = METER_GAIN_RECIP(inaGainArr[i])
 #if defined(VERSION10)
 #define MAX_INA_GAIN_IDX 3
 const uint8_t inaGainArr[MAX_INA_GAIN_IDX+1] = {1, 5, 9, 17};
+const uint32_t inaGainRecipArr[MAX_INA_GAIN_IDX+1] = {METER_GAIN_RECIP(1), METER_GAIN_RECIP(5), METER_GAIN_RECIP(9), METER_GAIN_RECIP(17)};
 const uint8_t bitShiftArr[MAX_INA_GAIN_IDX+1] = {0, 0, 0, 0};
 const uint8_t exponenttArr[MAX_INA_GAIN_IDX+1] = {0, 0, 0, 0};
 #elif defined(VERSION11)
 #define MAX_INA_GAIN_IDX 4
 const uint8_t inaGainArr[MAX_INA_GAIN_IDX+1] = {1, 3, 5, 9, 17};
+const uint32_t inaGainRecipArr[MAX_INA_GAIN_IDX+1] = {METER_GAIN_RECIP(1), METER_GAIN_RECIP(3), METER_GAIN_RECIP(5), METER_GAIN_RECIP(9), METER_GAIN_RECIP(17)};
 const uint8_t bitShiftArr[MAX_INA_GAIN_IDX+1] = {2, 0, 0, 0, 0};
 const uint8_t exponenttArr[MAX_INA_GAIN_IDX+1] = {1, 0, 0, 0, 0};
 #elif defined(VERSION12)
 #define MAX_INA_GAIN_IDX 4
 const uint8_t inaGainArr[MAX_INA_GAIN_IDX+1] = {1, 3, 5, 9, 17};
+const uint32_t inaGainRecipArr[MAX_INA_GAIN_IDX+1] = {METER_GAIN_RECIP(1), METER_GAIN_RECIP(3), METER_GAIN_RECIP(5), METER_GAIN_RECIP(9), METER_GAIN_RECIP(17)};
 const uint8_t bitShiftArr[MAX_INA_GAIN_IDX+1] = {6, 4, 2, 0, 0};
 const uint8_t exponenttArr[MAX_INA_GAIN_IDX+1] = {3, 2, 1, 0, 0};
 #endif
-#define MIN_INA_GAIN_IDX 0
-
-// voltage isolation filter offset
-#define VOLTAGE_SAMPLE_OFFSET 0
-// voltage scaling constant
-#define VOLTAGE_SCALING 720
 
 // APS3B12 control macro
 #define APS3B12_PACKET_ID 31
@@ -154,8 +148,19 @@ static rv3049_time_t rtcTime;
 // 2 bytes PF, 1 byte inaGain, 2 bytes VRMS, 2 bytes IRMS 
 // [6 bytes time stamp (yy, mm, dd, hh, mm, ss)]
 // [4 bytes counter]
-// 5 + 2 + 7 + 6 + 4 = 24
-#define PACKET_PAYLOAD_SIZE 24
+// [2 bytes suppressed readings, 4 bytes energy (DELTA_REPORT)]
+// [4 bytes accumulated energy (ENERGY_REPORT)]
+// [1 byte extension flags (DELTA_REPORT or ENERGY_REPORT)]
+// 5 + 2 + 7 + 6 + 4 + 6 + 4 + 1 = 35
+#define PACKET_PAYLOAD_SIZE 35
+
+// aggregated frame, see aggregateTransmit
+// 2 + 2 + AGG_REPORT_MAX_LEN + 4 + 1
+#define AGG_PAYLOAD_SIZE (AGG_REPORT_MAX_LEN+9)
+
+#if defined(AGGREGATE_REPORT) && defined(DELTA_REPORT)
+#error "AGGREGATE_REPORT and DELTA_REPORT cannot be used together"
+#endif
 
 #define PACKET_WAVEFORM_OVERHEAD 9
 
@@ -167,13 +172,6 @@ typedef enum {
     MODE_NORMAL
 } triumvi_mode_t;
 
-typedef enum {
-    GAIN_TOO_LOW,
-    GAIN_OK,
-    GAIN_TOO_HIGH,
-    GAIN_ERROR
-} gainSetting_t;
-
 typedef enum {
     #ifdef RTC_ENABLE
     STATE_READ_RTC_TIME,
@@ -210,12 +208,13 @@ typedef enum{
 
 volatile static triumvi_state_t myState;
 const uint32_t flash_addr = FLASH_BASE - 2*FLASH_ERASE_SIZE + FLASH_SIZE;
-volatile uint32_t flash_data;
 
 uint32_t timerVal[2];
 uint16_t currentADCVal[MAX_BUF_SIZE];
 int adjustedCurrSamples[MAX_BUF_SIZE];
 int voltADCVal[BUF_SIZE2]; 
+// external voltage mode sums over EXT_VOLT_CYCLES cycles
+static meterAccum_t extVoltAccum;
 
 volatile uint16_t phaseOffset;
 volatile uint16_t dcOffset;
@@ -227,8 +226,17 @@ static struct etimer calibration_timer;
 static struct rtimer myRTimer;
 volatile uint8_t rTimerExpired;
 volatile uint8_t referenceInt;
-volatile uint8_t backOffTime;
-volatile uint8_t backOffHistory;
+static reportSched_t reportSched;
+static rtimer_clock_t readyWaitStart;
+#ifdef DELTA_REPORT
+static deltaReport_t deltaReport;
+#endif
+#ifdef AGGREGATE_REPORT
+static aggReport_t aggReport;
+#endif
+#if defined(DELTA_REPORT) || defined(AGGREGATE_REPORT)
+static rtimer_clock_t lastReadingTime;
+#endif
 volatile uint8_t inaGainIdx;
 volatile uint8_t allInitsAreReadyInt;
 volatile uint8_t rfReceivedInt;
@@ -244,17 +252,21 @@ volatile int aps3b12_current_value;
 
 /* End of global variables */
 
-#include "sineTable.h"
+// nominal voltage, two periods, see voltage_gen.py
+#include SINE_TABLE_H
+#if SINE_TABLE_FREQ != GRID_FREQ
+#error "sine table does not match the grid frequency"
+#endif
 
 /* function prototypes */
 
-/* functions for calibration process only */
-// return product of voltage and current for a cycle
-int cycleProduct(uint16_t* adcSamples, uint16_t offset, uint16_t currentRef);
-// return the phase has maximum correlation
-uint16_t phaseMatchFilter(uint16_t* adcSamples, uint16_t* currentAVG);
 // gain control, adjust gain if necessary
 gainSetting_t gainCtrl(uint16_t* adcSamples, uint8_t externalVolt);
+uint16_t currentReference(uint16_t* adcSamples, uint16_t length, uint8_t externalVolt);
+gainSetting_t gainStep(gainSetting_t res);
+static uint8_t extVoltFold(uint16_t* currSamples, int* voltSamples, uint16_t length);
+static uint32_t rtimerToMs(rtimer_clock_t t);
+static rtimer_clock_t msToRtimer(uint32_t ms);
 // initialize GPIO, peripherals
 void meterInit();
 // samples ADC, and computes power
@@ -262,15 +274,17 @@ int sampleAndCalculate(uint16_t triumviStatusReg);
 // samples current ADC, 11-bit
 void sampleCurrentWaveform();
 // samples current, voltage ADCs, 10-bit each
-void sampleCurrentVoltageWaveform();
+int sampleCurrentVoltageWaveform();
 // power gate to current sensing, disable AD5274 (POT) or ADG604 (analog switch)
 void disablePOT();
 // encrypt data using AES, and wirelessly transmit packet
 void encryptAndTransmit(triumvi_record_t* thisSample, 
                         uint8_t* myNonce, uint32_t nonceCounter);
+#ifdef AGGREGATE_REPORT
+void aggregateTransmit(triumvi_record_t* thisSample,
+                       uint8_t* myNonce, uint32_t nonceCounter);
+#endif
 
-int currentDataTransform(int currentReading, uint8_t externalVolt);
-int voltDataTransform(int voltReading, uint16_t voltReference);
 #ifdef TRANSMIT_WAVEFORM
 // Send entire waveform
 void waveformTransmit(uint8_t triumviStatusReg);
@@ -282,9 +296,6 @@ void aps3b12_enable(uint8_t en);
 
 #ifdef AMPLITUDE_CALIBRATION_EN
 void aps3b12_read_current();
-// find coefficient for 1st order linear regression
-void linearFit(uint16_t* reading, uint16_t* setting, uint8_t length, 
-                uint32_t* slope_n, uint32_t* slope_d, int* offset);
 #endif
 
 void transmitCalibrationCoef();
@@ -303,9 +314,6 @@ static void rtimerEvent(struct rtimer *t, void *ptr);
 static void referenceIntCallBack(uint8_t port, uint8_t pin);
 static void unitReadyCallBack(uint8_t port, uint8_t pin);
 
-#define CURRENT_FIT_FLASH_ADDR(a) (flash_addr+(a*16)+4)
-#define POWER_FIT_FLASH_ADDR(a) (flash_addr+(a*16)+4+(MAX_INA_GAIN_IDX+1)*16)
-#define DC_OFFSET_FLASH_ADDR(a) (flash_addr+(MAX_INA_GAIN_IDX+1)*2*16+a*4)
 /* End of function prototypes */
 
 /*---------------------------------------------------------------------------*/
@@ -339,18 +347,16 @@ PROCESS_THREAD(startupProcess, ev, data) {
     meterSenseConfig(VOLTAGE, SENSE_DISABLE);
     meterVoltageComparator(SENSE_DISABLE);
 
-    // read internal flash
-    flash_data = REG(flash_addr);
-
-    // non-calibrated device
-    if (flash_data==0xffffffff){
+    // read calibration data from internal flash, once
+    // non-calibrated device, or the stored data is corrupted
+    if (calStoreLoad(flash_addr, MAX_INA_GAIN_IDX)!=CAL_STORE_OK){
         process_start(&framCheckProecss, NULL);
         operation_mode = MODE_PHASE_CALIBRATION;
     }
     // calibrated device, load phase offset and dc offset
     else{
-        phaseOffset = (flash_data & 0xffff);
-        dcOffset = ((flash_data & 0xffff0000)>>16);
+        phaseOffset = calStore.phaseOffset;
+        dcOffset = calStore.dcOffset;
         process_start(&triumviProcess, NULL);
         operation_mode = MODE_NORMAL;
     }
@@ -359,19 +365,11 @@ PROCESS_THREAD(startupProcess, ev, data) {
 
 PROCESS_THREAD(framCheckProecss, ev, data) {
     PROCESS_BEGIN();
-    rom_util_page_erase(flash_addr, FLASH_ERASE_SIZE);
+    calStoreClear();
     etimer_set(&calibration_timer, CLOCK_SECOND>>1);
     #ifndef TEST
     triumviLEDON();
     #endif
-    static uint8_t calDataValid;
-    static linearFitCalData_t linearFitCalibrationData;
-    static phaseOffsetCalData_t phaseData;
-    uint32_t tmp;
-    uint8_t i;
-    uint32_t slope_n, slope_d;
-    int offset;
-    uint32_t dc_offset_data;
     static uint8_t button = 0;
     static uint8_t buttonCnt = 0;
     static uint8_t timerCnt = 0;
@@ -443,48 +441,10 @@ PROCESS_THREAD(framCheckProecss, ev, data) {
                     etimer_set(&calibration_timer, CLOCK_SECOND*0.1);
                 }
             } else {
-                calDataValid = triumviFramCalibrateDataValidRead();
                 // data is valid, copy from FRAM
-                if (calDataValid & 0x01){
-                    // read phase/dc offset calibration data
-                    triumviFramCalibrateDataPhaseRead(&phaseData);
-                    // write phase/dc offset calibration data
-                    tmp = (phaseData.dc_Offset<<16) | phaseData.phase_Offset;
-                    rom_util_program_flash(&tmp, flash_addr, 4);
-                    phaseOffset = phaseData.phase_Offset;
-                    dcOffset = phaseData.dc_Offset;
-                    // write current, power linear fit data
-                    for (i=0; i<MAX_INA_GAIN_IDX+1; i++){
-                        if (calDataValid & (0x01<<(i+1))){
-                            // read current fit data
-                            linearFitCalibrationData.type = CURRENT_FIT_TYPE;
-                            linearFitCalibrationData.gain_idx = i;
-                            triumviFramCalibrateDataFitRead(&linearFitCalibrationData);
-                            slope_n = linearFitCalibrationData.numerator;
-                            slope_d = linearFitCalibrationData.denumerator;
-                            offset = linearFitCalibrationData.offset;
-                            // write current fit data
-                            rom_util_program_flash((uint32_t*)&slope_n, CURRENT_FIT_FLASH_ADDR(i),   4);
-                            rom_util_program_flash((uint32_t*)&slope_d, CURRENT_FIT_FLASH_ADDR(i)+4, 4);
-                            rom_util_program_flash((uint32_t*)&offset,  CURRENT_FIT_FLASH_ADDR(i)+8, 4);
-                            // read power fit data
-                            linearFitCalibrationData.type = POWER_FIT_TYPE;
-                            linearFitCalibrationData.gain_idx = i;
-                            triumviFramCalibrateDataFitRead(&linearFitCalibrationData);
-                            slope_n = linearFitCalibrationData.numerator;
-                            slope_d = linearFitCalibrationData.denumerator;
-                            offset = linearFitCalibrationData.offset;
-                            // write power fit data
-                            rom_util_program_flash((uint32_t*)&slope_n, POWER_FIT_FLASH_ADDR(i),   4);
-                            rom_util_program_flash((uint32_t*)&slope_d, POWER_FIT_FLASH_ADDR(i)+4, 4);
-                            rom_util_program_flash((uint32_t*)&offset,  POWER_FIT_FLASH_ADDR(i)+8, 4);
-                            // write dc offset data
-                            dc_offset_data = triumviFramDCOffsetRead(i);
-                            if (dc_offset_data > 0){
-                                rom_util_program_flash((uint32_t*)&dc_offset_data, DC_OFFSET_FLASH_ADDR(i), 4);
-                            }
-                        }
-                    }
+                if (calStoreRestore()==CAL_STORE_OK){
+                    phaseOffset = calStore.phaseOffset;
+                    dcOffset = calStore.dcOffset;
                     transmitCalibrationCoef();
                     process_start(&triumviProcess, NULL);
                     operation_mode = MODE_NORMAL;
@@ -516,23 +476,14 @@ PROCESS_THREAD(phaseCalibrationProcess, ev, data) {
     static uint16_t phaseOffset_array[CALIBRATION_CYCLES];
     static uint32_t dcOffset_accum = 0;
     static uint32_t variance = 0;
-    uint32_t tmp = 0;
     #endif
-    static uint32_t timerExp, currentTime;
     #ifdef RTC_ENABLE
     static uint8_t rtc_pkt[2] = {TRIUMVI_RTC, TRIUMVI_RTC_REQ};
     rtc_packet_received = 0;
     #endif
     rfReceivedInt = 0;
     aps_trials = 0;
-    static phaseOffsetCalData_t phaseData;
     static uint8_t firstGainError = 0;
-    #ifndef AMPLITUDE_CALIBRATION_EN
-    static uint32_t slope_n, slope_d;
-    static int offset;
-    static linearFitCalData_t calData;
-    static uint32_t dc_offset_data;
-    #endif
 
     triumviLEDON();
     etimer_set(&calibration_timer, CLOCK_SECOND*3);
@@ -547,6 +498,7 @@ PROCESS_THREAD(phaseCalibrationProcess, ev, data) {
     meterSenseConfig(CURRENT, SENSE_ENABLE);
 
     (*fram_erase_all)();
+    framLogInit();
 
     while (1){
         PROCESS_YIELD();
@@ -603,18 +555,11 @@ PROCESS_THREAD(phaseCalibrationProcess, ev, data) {
                     // Enable comparator interrupt
                     ungate_gpt(GPTIMER_1);
                     REG(SYSTICK_STCTRL) &= (~SYSTICK_STCTRL_INTEN);
-                    timerExp = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A) - 320000;
                     GPIO_DETECT_RISING(V_REF_CROSS_INT_GPIO_BASE, 0x1<<V_REF_CROSS_INT_GPIO_PIN);
                     meterVoltageComparator(SENSE_ENABLE);
 
-                    // waiting for comparator interrupt
-                    do {
-                        currentTime = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
-                    }
-                    while ((currentTime > timerExp) && (referenceInt==0));
-
-                    // time out, retry
-                    if (currentTime <= timerExp){
+                    // sleep until the comparator interrupt, time out, retry
+                    if (meterWaitCrossing(&referenceInt)==0){
                         gainSetting = GAIN_TOO_HIGH;
                     }
                     // captured interrupt
@@ -642,7 +587,7 @@ PROCESS_THREAD(phaseCalibrationProcess, ev, data) {
                         }
                         #else
                         // perform phase, dc offset calculation
-                        calculatedPhase = phaseMatchFilter(currentADCVal, &currentRef);
+                        calculatedPhase = meterPhaseEstimate(currentADCVal, stdSineTable, &currentRef);
                         phaseOffset_array[cycleCnt] = calculatedPhase;
                         dcOffset_accum += currentRef;
                         #endif
@@ -695,12 +640,9 @@ PROCESS_THREAD(phaseCalibrationProcess, ev, data) {
                             printf("variance: %lu\r\n", variance);
                             #endif
 
-                            phaseData.dc_Offset = dcOffset;
-                            phaseData.phase_Offset = phaseOffset;
-                            triumviFramCalibrateDataPhaseWrite(&phaseData);
-                            // write to flash
-                            tmp = (dcOffset<<16) | phaseOffset;
-                            rom_util_program_flash(&tmp, flash_addr, 4);
+                            // write to FRAM and flash
+                            calStoreSetPhase(phaseOffset, dcOffset);
+                            calStoreCommit();
 
                             if (batteryPackIsAttached()){
                                 batteryPackVoltageEn(SENSE_ENABLE);
@@ -773,35 +715,12 @@ PROCESS_THREAD(phaseCalibrationProcess, ev, data) {
                     // Write pre-calibrated data into FRAM and Flash
                     for (i=0; i<MAX_INA_GAIN_IDX+1; i++){
                         // use ideal CT model for now
-                        slope_n = 97;
-                        slope_d = 100;
-                        offset = 0;
-                        // current correction
-                        rom_util_program_flash((uint32_t*)&slope_n, CURRENT_FIT_FLASH_ADDR(i), 4);
-                        rom_util_program_flash((uint32_t*)&slope_d, CURRENT_FIT_FLASH_ADDR(i)+4, 4);
-                        rom_util_program_flash((uint32_t*)&offset, CURRENT_FIT_FLASH_ADDR(i)+8, 4);
-                        calData.type = CURRENT_FIT_TYPE;
-                        calData.numerator = slope_n;
-                        calData.denumerator = slope_d;
-                        calData.offset = offset;
-                        calData.gain_idx = i;
-                        triumviFramCalibrateDataFitWrite(&calData);
-
-                        // power correction
-                        rom_util_program_flash((uint32_t*)&slope_n, POWER_FIT_FLASH_ADDR(i),   4);
-                        rom_util_program_flash((uint32_t*)&slope_d, POWER_FIT_FLASH_ADDR(i)+4, 4);
-                        rom_util_program_flash((uint32_t*)&offset,  POWER_FIT_FLASH_ADDR(i)+8, 4);
-                        calData.type = POWER_FIT_TYPE;
-                        calData.numerator = slope_n;
-                        calData.denumerator = slope_d;
-                        calData.offset = offset;
-                        calData.gain_idx = i;
-                        triumviFramCalibrateDataFitWrite(&calData);
+                        calStoreSetFit(CURRENT_FIT_TYPE, i, 97, 100, 0);
+                        calStoreSetFit(POWER_FIT_TYPE, i, 97, 100, 0);
                         // populate dc offset
-                        dc_offset_data = dcOffset;
-                        rom_util_program_flash((uint32_t*)&dc_offset_data, DC_OFFSET_FLASH_ADDR(i), 4);
-                        triumviFramDCOffsetWrite(dcOffset, i);
+                        calStoreSetDCOffset(i, dcOffset);
                     }
+                    calStoreCommit();
                     // End of writing pre-calibrated data
                     GPIO_SET_OUTPUT(GPIO_A_BASE, 0x47);
                     GPIO_CLR_PIN(GPIO_A_BASE, 0x47);
@@ -841,10 +760,7 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
     triumviLEDON();
     etimer_set(&calibration_timer, CLOCK_SECOND*5);
     static triumvi_state_amp_calibration_t amplitude_calibration_state = STATE_AMP_STD_LOAD_SET;
-    static uint32_t timerExp, currentTime;
-    uint16_t i, j;
     int tempPower;
-    int energyCal;
     static uint32_t sum_power;
     static uint32_t sum_currentRMS;
     static uint8_t prevInaGainIdx = MAX_INA_GAIN_IDX+1;
@@ -863,9 +779,7 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
     current_set_cnt = 0;
     amp_cal_completed = 0;
     increase_current = 0;
-    static linearFitCalData_t calData;
     static uint32_t dcOffset_accum = 0;
-    static uint32_t dc_offset_data;
     static uint8_t dc_offset_calibration = 1;
     static uint8_t verify_cnt;
     static uint8_t hold_pin_status;
@@ -971,18 +885,11 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                     // Enable comparator interrupt
                     ungate_gpt(GPTIMER_1);
                     REG(SYSTICK_STCTRL) &= (~SYSTICK_STCTRL_INTEN);
-                    timerExp = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A) - 320000;
                     GPIO_DETECT_RISING(V_REF_CROSS_INT_GPIO_BASE, 0x1<<V_REF_CROSS_INT_GPIO_PIN);
                     meterVoltageComparator(SENSE_ENABLE);
 
-                    // waiting for comparator interrupt
-                    do {
-                        currentTime = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
-                    }
-                    while ((currentTime > timerExp) && (referenceInt==0));
-
-                    // time out, retry
-                    if (currentTime <= timerExp){
+                    // sleep until the comparator interrupt, time out, retry
+                    if (meterWaitCrossing(&referenceInt)==0){
                         gainSetting = GAIN_TOO_HIGH;
                     }
                     // captured interrupt
@@ -996,8 +903,7 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
 
                     if (gainSetting==GAIN_OK){
                         if (dc_offset_calibration==1){
-                            dc_offset_data = REG(DC_OFFSET_FLASH_ADDR(inaGainIdx));
-                            if (dc_offset_data == 0xffffffff){
+                            if (!calStoreHasDCOffset(inaGainIdx)){
                                 amp_cal_cnt += 1;
                                 dcOffset_accum += getAverage(currentADCVal, BUF_SIZE);
                                 if (amp_cal_cnt == DC_OFFSET_CALIBRATION_CYCLE){
@@ -1006,8 +912,8 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                     GPIO_SET_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN);
                                     #endif
                                     dcOffset_accum /= DC_OFFSET_CALIBRATION_CYCLE;
-                                    rom_util_program_flash((uint32_t*)&dcOffset_accum, DC_OFFSET_FLASH_ADDR(inaGainIdx), 4);
-                                    triumviFramDCOffsetWrite(((uint16_t)dcOffset_accum), inaGainIdx);
+                                    calStoreSetDCOffset(inaGainIdx, (uint16_t)dcOffset_accum);
+                                    calStoreCommit();
                                     dcOffset_accum = 0;
                                     amp_cal_cnt = 0;
                                     increase_current = 1;
@@ -1037,21 +943,11 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                             }
                             triumviLEDOFF();
                         } else {
-                            energyCal = 0;
-                            for (i=0; i<BUF_SIZE; i++){
-                                j = ((i*3+phaseOffset) >= 360)? i*3+phaseOffset-360 : i*3+phaseOffset;
-                                adjustedCurrSamples[i] = currentDataTransform(adjustedCurrSamples[i], 0x0);
-                                energyCal += (adjustedCurrSamples[i]*stdSineTable[j]);
-                            }
-                            tempPower = (energyCal/BUF_SIZE); // unit is mW
-                            // Fix phase oppsite down
-                            if (tempPower < 0)
-                                tempPower = -1*tempPower;
-
-                            // need to perform flash check, make sure if it's empty to proceed
-                            flash_data = REG(CURRENT_FIT_FLASH_ADDR(inaGainIdx));
+                            tempPower = meterSinePower(adjustedCurrSamples, stdSineTable, phaseOffset,
+                                    inaGainRecipArr[inaGainIdx], bitShiftArr[inaGainIdx], 1); // unit is mW
 
-                            if (flash_data==0xffffffff){ 
+                            // make sure this gain is not calibrated yet to proceed
+                            if (!calStoreHasFit(inaGainIdx)){
                                 sum_power += (tempPower<<bitShiftArr[inaGainIdx]);
                                 sum_currentRMS += (currentRMS(0)<<bitShiftArr[inaGainIdx]);
                                 amp_cal_cnt += 1;
@@ -1069,7 +965,7 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                         hold_pin_status = GPIO_READ_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN)>>FM25V02_HOLD_N_PIN;
                                         GPIO_SET_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN);
                                         #endif
-                                        linearFit(read_current, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
+                                        meterLinearFit(read_current, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
                                         #ifdef DATADUMP3
                                         printf("B\r\n");
                                         printf("current correction\r\n");
@@ -1078,18 +974,10 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                         printf("Denumerator: %lu\r\n", slope_d);
                                         printf("Offset: %d\r\n", offset);
                                         #endif
-                                        rom_util_program_flash((uint32_t*)&slope_n, CURRENT_FIT_FLASH_ADDR(inaGainIdx),   4);
-                                        rom_util_program_flash((uint32_t*)&slope_d, CURRENT_FIT_FLASH_ADDR(inaGainIdx)+4, 4);
-                                        rom_util_program_flash((uint32_t*)&offset,  CURRENT_FIT_FLASH_ADDR(inaGainIdx)+8, 4);
-                                        calData.type = CURRENT_FIT_TYPE;
-                                        calData.numerator = slope_n;
-                                        calData.denumerator = slope_d;
-                                        calData.offset = offset;
-                                        calData.gain_idx = inaGainIdx;
-                                        triumviFramCalibrateDataFitWrite(&calData);
+                                        calStoreSetFit(CURRENT_FIT_TYPE, inaGainIdx, slope_n, slope_d, offset);
 
                                         // power correction
-                                        linearFit(read_power, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
+                                        meterLinearFit(read_power, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
                                         offset *= VOLTAGE_NOMINAL;
                                         #ifdef DATADUMP3
                                         printf("power correction\r\n");
@@ -1097,15 +985,8 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                         printf("Denumerator: %lu\r\n", slope_d);
                                         printf("Offset: %d\r\n", offset);
                                         #endif
-                                        rom_util_program_flash((uint32_t*)&slope_n, POWER_FIT_FLASH_ADDR(inaGainIdx),   4);
-                                        rom_util_program_flash((uint32_t*)&slope_d, POWER_FIT_FLASH_ADDR(inaGainIdx)+4, 4);
-                                        rom_util_program_flash((uint32_t*)&offset,  POWER_FIT_FLASH_ADDR(inaGainIdx)+8, 4);
-                                        calData.type = POWER_FIT_TYPE;
-                                        calData.numerator = slope_n;
-                                        calData.denumerator = slope_d;
-                                        calData.offset = offset;
-                                        calData.gain_idx = inaGainIdx;
-                                        triumviFramCalibrateDataFitWrite(&calData);
+                                        calStoreSetFit(POWER_FIT_TYPE, inaGainIdx, slope_n, slope_d, offset);
+                                        calStoreCommit();
                                         current_set_cnt = 0;
                                         #if defined(VERSION10) || defined(VERSION11)
                                         if (hold_pin_status>0){
@@ -1125,7 +1006,7 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                         hold_pin_status = GPIO_READ_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN)>>FM25V02_HOLD_N_PIN;
                                         GPIO_SET_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN);
                                         #endif
-                                        linearFit(read_current, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
+                                        meterLinearFit(read_current, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
                                         #ifdef DATADUMP3
                                         printf("A\r\n");
                                         printf("current correction\r\n");
@@ -1134,18 +1015,10 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                         printf("Denumerator: %lu\r\n", slope_d);
                                         printf("Offset: %d\r\n", offset);
                                         #endif
-                                        rom_util_program_flash((uint32_t*)&slope_n, CURRENT_FIT_FLASH_ADDR(prevInaGainIdx),   4);
-                                        rom_util_program_flash((uint32_t*)&slope_d, CURRENT_FIT_FLASH_ADDR(prevInaGainIdx)+4, 4);
-                                        rom_util_program_flash((uint32_t*)&offset,  CURRENT_FIT_FLASH_ADDR(prevInaGainIdx)+8, 4);
-                                        calData.type = CURRENT_FIT_TYPE;
-                                        calData.numerator = slope_n;
-                                        calData.denumerator = slope_d;
-                                        calData.offset = offset;
-                                        calData.gain_idx = prevInaGainIdx;
-                                        triumviFramCalibrateDataFitWrite(&calData);
+                                        calStoreSetFit(CURRENT_FIT_TYPE, prevInaGainIdx, slope_n, slope_d, offset);
 
                                         // power correction
-                                        linearFit(read_power, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
+                                        meterLinearFit(read_power, current_setting, current_set_cnt, &slope_n, &slope_d, &offset);
                                         offset *= VOLTAGE_NOMINAL;
                                         #ifdef DATADUMP3
                                         printf("power correction\r\n");
@@ -1153,15 +1026,8 @@ PROCESS_THREAD(amplitudeCalibrationProcess, ev, data){
                                         printf("Denumerator: %lu\r\n", slope_d);
                                         printf("Offset: %d\r\n", offset);
                                         #endif
-                                        rom_util_program_flash((uint32_t*)&slope_n, POWER_FIT_FLASH_ADDR(prevInaGainIdx),   4);
-                                        rom_util_program_flash((uint32_t*)&slope_d, POWER_FIT_FLASH_ADDR(prevInaGainIdx)+4, 4);
-                                        rom_util_program_flash((uint32_t*)&offset,  POWER_FIT_FLASH_ADDR(prevInaGainIdx)+8, 4);
-                                        calData.type = POWER_FIT_TYPE;
-                                        calData.numerator = slope_n;
-                                        calData.denumerator = slope_d;
-                                        calData.offset = offset;
-                                        calData.gain_idx = prevInaGainIdx;
-                                        triumviFramCalibrateDataFitWrite(&calData);
+                                        calStoreSetFit(POWER_FIT_TYPE, prevInaGainIdx, slope_n, slope_d, offset);
+                                        calStoreCommit();
                                         current_set_cnt = 0;
                                         #if defined(VERSION10) || defined(VERSION11)
                                         if (hold_pin_status>0){
@@ -1264,6 +1130,11 @@ PROCESS_THREAD(rf_received_process, ev, data) {
             data_length = packetbuf_datalen();                               
             data_ptr = packetbuf_dataptr();                                  
 
+            #ifdef FRAM_OFFLOAD
+            if (framOffloadInput(data_ptr, data_length))
+                continue;
+            #endif
+
             #ifdef RTC_ENABLE
             if ((data_ptr[0] == TRIUMVI_RTC) && (data_ptr[1] == TRIUMVI_RTC_SET)&&(data_length==8)){
                 rtcTime.year    = data_ptr[2] + 2000;
@@ -1303,11 +1174,15 @@ PROCESS_THREAD(triumviProcess, ev, data) {
     static uint8_t aesKey[] = AES_KEY;
     static uint8_t myNonce[13] = {0};
     memcpy(myNonce, extAddr, 8);
+    #ifdef FRAM_OFFLOAD
+    framOffloadInit(extAddr);
+    #endif
     static uint32_t nonceCounter = 0;
     aes_load_keys(aesKey, AES_KEY_STORE_SIZE_KEY_SIZE_128, 1, 0);
     uint16_t rand0, rand1;
 
 	static int avgPower;
+    static uint32_t reportInterval = REPORT_SCHED_START_INTERVAL;
     uint8_t rdy;
 
     uint16_t triumviStatusReg;
@@ -1322,8 +1197,7 @@ PROCESS_THREAD(triumviProcess, ev, data) {
 	static uint32_t sampleCount = 0;
     
     static uint32_t timerExp, currentTime;
-    uint32_t numerator, denumerator;
-    int offset;
+    const calFit_t* fit;
 
     rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND, 1, &rtimerEvent, NULL);
 
@@ -1336,7 +1210,6 @@ PROCESS_THREAD(triumviProcess, ev, data) {
     #else
     myState = STATE_INIT;
     #endif
-    uint8_t i;
 
     while(1){
         PROCESS_YIELD();
@@ -1390,10 +1263,13 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                 #endif
                 if (rTimerExpired==1){
                     rTimerExpired = 0;
-                    if (allUnitsReady())
+                    if (allUnitsReady()){
                         rdy = 1;
+                        reportSchedEnergy(&reportSched, 0);
+                    }
                     // not all units are ready, go back to sleep
                     else{
+                        readyWaitStart = RTIMER_NOW();
                         GPIO_DETECT_RISING(TRIUMVI_RDYn_IN_GPIO_BASE, 0x1<<TRIUMVI_RDYn_IN_GPIO_PIN);
                         GPIO_ENABLE_INTERRUPT(TRIUMVI_RDYn_IN_GPIO_BASE, 0x1<<TRIUMVI_RDYn_IN_GPIO_PIN);
                         nvic_interrupt_enable(TRIUMVI_RDYn_IN_INT_NVIC_PORT);
@@ -1402,19 +1278,21 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                 else if (allInitsAreReadyInt==1){
                     allInitsAreReadyInt = 0;
                     rdy = 1;
+                    reportSchedEnergy(&reportSched, rtimerToMs(RTIMER_NOW()-readyWaitStart));
+                }
+                #ifdef FRAM_OFFLOAD
+                // an offload session has the radio, measure once it is done
+                if ((rdy==1) && framOffloadActive()){
+                    rdy = 0;
+                    rtimer_set(&myRTimer, RTIMER_NOW()+FRAM_OFFLOAD_HOLDOFF, 1, &rtimerEvent, NULL);
                 }
+                #endif
                 if (rdy==1){
                     unitClrReady();
                     meterSenseVREn(SENSE_ENABLE);
                     meterSenseConfig(VOLTAGE, SENSE_ENABLE);
-                    rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND*0.4, 1, &rtimerEvent, NULL);
+                    rtimer_set(&myRTimer, RTIMER_NOW()+frontEndSettleStart(FRONTEND_VOLTAGE), 1, &rtimerEvent, NULL);
                     myState = STATE_WAITING_VOLTAGE_STABLE;
-                    // consecutive 4 samples, decreases sampling interval
-                    if (((backOffHistory&0x0f)==0x0f)&&(backOffTime>1)){
-                        backOffTime /= 2;
-                        backOffHistory &= 0x03;
-                    }
-                    backOffHistory = (backOffHistory<<1) | 0x01;
                 }
             break;
 
@@ -1422,8 +1300,12 @@ PROCESS_THREAD(triumviProcess, ev, data) {
             case STATE_WAITING_VOLTAGE_STABLE:
                 if (rTimerExpired==1){
                     rTimerExpired = 0;
+                    if (frontEndSettleCheck(FRONTEND_VOLTAGE, calStoreDCOffset(inaGainIdx))==0){
+                        rtimer_set(&myRTimer, RTIMER_NOW()+FRONTEND_POLL_INTERVAL, 1, &rtimerEvent, NULL);
+                        break;
+                    }
                     meterSenseConfig(CURRENT, SENSE_ENABLE);
-                    rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND*0.3, 1, &rtimerEvent, NULL);
+                    rtimer_set(&myRTimer, RTIMER_NOW()+frontEndSettleStart(FRONTEND_CURRENT), 1, &rtimerEvent, NULL);
                     myState = STATE_WAITING_COMPARATOR_STABLE;
                 }
             break;
@@ -1431,6 +1313,10 @@ PROCESS_THREAD(triumviProcess, ev, data) {
             case STATE_WAITING_COMPARATOR_STABLE:
                 if (rTimerExpired==1){
                     rTimerExpired = 0;
+                    if (frontEndSettleCheck(FRONTEND_CURRENT, calStoreDCOffset(inaGainIdx))==0){
+                        rtimer_set(&myRTimer, RTIMER_NOW()+FRONTEND_POLL_INTERVAL, 1, &rtimerEvent, NULL);
+                        break;
+                    }
                     // Layout of Status Reg:
                     // Bit 9: First sample
                     // Bit 8: External Volt Selected
@@ -1478,18 +1364,11 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                     // Enable comparator interrupt
                     ungate_gpt(GPTIMER_1);
                     REG(SYSTICK_STCTRL) &= (~SYSTICK_STCTRL_INTEN);
-                    timerExp = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A) - 320000;
                     GPIO_DETECT_RISING(V_REF_CROSS_INT_GPIO_BASE, 0x1<<V_REF_CROSS_INT_GPIO_PIN);
                     meterVoltageComparator(SENSE_ENABLE);
 
-                    // waiting for comparator interrupt
-                    do {
-                        currentTime = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
-                    }
-                    while ((currentTime > timerExp) && (referenceInt==0));
-
-                    // time out, retry
-                    if (currentTime <= timerExp){
+                    // sleep until the comparator interrupt, time out, retry
+                    if (meterWaitCrossing(&referenceInt)==0){
                         meterSenseConfig(VOLTAGE, SENSE_DISABLE);
                         disablePOT();
                         REG(SYSTICK_STCTRL) |= SYSTICK_STCTRL_INTEN;
@@ -1507,16 +1386,10 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                         sampleCount++;
                         inaGain = inaGainArr[inaGainIdx];
                         #ifdef POLYFIT
-                        // use the calibration coefficient stored in Flash, if the INA gain index is not calibrated, use the nearby coef
-                        i = inaGainIdx;
-                        do {
-                            numerator   = REG(POWER_FIT_FLASH_ADDR(i));
-                            denumerator = REG(POWER_FIT_FLASH_ADDR(i)+4);
-                            offset      = REG(POWER_FIT_FLASH_ADDR(i)+8);
-                            i += 1;
-                        } while (offset == 0xffffffff);
-                        if ((inaGainIdx < MAX_INA_GAIN_IDX) || (avgPower>240000)){
-                            avgPower = (int)(((int64_t)avgPower)*numerator/denumerator + offset);
+                        // use the calibration coefficient loaded from Flash, if the INA gain index is not calibrated, use the nearby coef
+                        fit = calStoreFit(POWER_FIT_TYPE, inaGainIdx);
+                        if ((fit!=NULL) && ((inaGainIdx < MAX_INA_GAIN_IDX) || (avgPower>240000))){
+                            avgPower = (int)(((int64_t)avgPower)*fit->numerator/fit->denumerator + fit->offset);
                         }
                         #endif
                         #ifdef THREEPHASE_DELTA_CONFIG
@@ -1527,18 +1400,14 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                             avgPower = (int)(((int64_t)avgPower)*10000/17321);
                         }
                         #endif
+                        // schedule on the corrected power
+                        reportInterval = reportSchedNext(&reportSched, avgPower);
                         IRMS = currentRMS(triumviStatusReg);
                         VRMS = voltageRMS(triumviStatusReg);
                         #ifdef POLYFIT
-                        i = inaGainIdx;
-                        do {
-                            numerator   = REG(CURRENT_FIT_FLASH_ADDR(i));
-                            denumerator = REG(CURRENT_FIT_FLASH_ADDR(i)+4);
-                            offset      = REG(CURRENT_FIT_FLASH_ADDR(i)+8);
-                            i += 1;
-                        } while (offset == 0xffffffff);
-                        if ((inaGainIdx < MAX_INA_GAIN_IDX) || (IRMS > 500)){
-                            IRMS = (uint16_t)((((uint64_t)IRMS)*numerator/denumerator) + offset);
+                        fit = calStoreFit(CURRENT_FIT_TYPE, inaGainIdx);
+                        if ((fit!=NULL) && ((inaGainIdx < MAX_INA_GAIN_IDX) || (IRMS > 500))){
+                            IRMS = (uint16_t)((((uint64_t)IRMS)*fit->numerator/fit->denumerator) + fit->offset);
                         }
                         #endif
                         #ifdef THREEPHASE_DELTA_CONFIG
@@ -1589,9 +1458,39 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                         triumvi_record.pf = pf;
                         // Write data into FRAM
                         #ifdef FRAM_WRITE
-                        triumviFramWrite(triumvi_record, rtctime);
+                        triumviFramWrite(&triumvi_record, &rtcTime);
                         #endif
+                        #ifdef ENERGY_REPORT
+                        energyAccUpdate(avgPower);
+                        #endif
+                        #ifdef AGGREGATE_REPORT
+                        aggReportAdd(&aggReport, avgPower, rtimerToMs(RTIMER_NOW()-lastReadingTime));
+                        lastReadingTime = RTIMER_NOW();
+                        if (aggReportDue(&aggReport, reportSchedBatch(&reportSched),
+                                reportInterval, REPORT_SCHED_MAX_STALE)){
+                            aggregateTransmit(&triumvi_record, myNonce, nonceCounter);
+                            aggReportClear(&aggReport);
+                            #ifdef FRAM_OFFLOAD
+                            framOffloadListen();
+                            #endif
+                        }
+                        #elif defined(DELTA_REPORT)
+                        // readings within the deadband are only logged
+                        if (deltaReportUpdate(&deltaReport, avgPower, IRMS, pf,
+                                rtimerToMs(RTIMER_NOW()-lastReadingTime))){
+                            encryptAndTransmit(&triumvi_record, myNonce, nonceCounter);
+                            deltaReportSent(&deltaReport, avgPower, IRMS, pf);
+                            #ifdef FRAM_OFFLOAD
+                            framOffloadListen();
+                            #endif
+                        }
+                        lastReadingTime = RTIMER_NOW();
+                        #else
                         encryptAndTransmit(&triumvi_record, myNonce, nonceCounter);
+                        #ifdef FRAM_OFFLOAD
+                        framOffloadListen();
+                        #endif
+                        #endif
                         #endif
                         // First sample, blinks battery pack blue LED
                         if (batteryPackIsUSBAttached() &&
@@ -1609,6 +1508,7 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                         rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND*0.1, 1, &rtimerEvent, NULL);
                     }
                     else{
+                        reportInterval = reportSchedNext(&reportSched, avgPower);
                         if (triumviStatusReg & BATTERYPACK_STATUSREG){
                             batteryPackVoltageEn(SENSE_DISABLE);
                             i2c_disable(I2C_SDA_GPIO_NUM, I2C_SDA_GPIO_PIN, 
@@ -1618,7 +1518,7 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                         myState = STATE_TRIUMVI_LEDBLINK;
                     }
                     #ifdef CHARGING_ENABLE
-                    if (backOffTime==1){
+                    if (reportSchedSurplus(&reportSched)){
                         batteryChargingEnable(1);
                     }
                     #endif
@@ -1631,7 +1531,7 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                     batteryPackVoltageEn(SENSE_DISABLE);
                     i2c_disable(I2C_SDA_GPIO_NUM, I2C_SDA_GPIO_PIN, 
                                 I2C_SCL_GPIO_NUM, I2C_SCL_GPIO_PIN); 
-                    rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND*backOffTime, 1, &rtimerEvent, NULL);
+                    rtimer_set(&myRTimer, RTIMER_NOW()+msToRtimer(reportInterval), 1, &rtimerEvent, NULL);
                     #ifdef RTC_ENABLE
                     myState = STATE_READ_RTC_TIME;
                     #else
@@ -1647,7 +1547,7 @@ PROCESS_THREAD(triumviProcess, ev, data) {
                     #ifdef DATADUMP2
                     rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND*0.1, 1, &rtimerEvent, NULL);
                     #else
-                    rtimer_set(&myRTimer, RTIMER_NOW()+RTIMER_SECOND*backOffTime, 1, &rtimerEvent, NULL);
+                    rtimer_set(&myRTimer, RTIMER_NOW()+msToRtimer(reportInterval), 1, &rtimerEvent, NULL);
                     #endif
                     #ifdef RTC_ENABLE
                     myState = STATE_READ_RTC_TIME;
@@ -1670,89 +1570,20 @@ static void rtimerEvent(struct rtimer *t, void *ptr){
     process_poll(&triumviProcess);
 }
 
-// return phase offset has max product, only be called in calibration mode
-uint16_t phaseMatchFilter(uint16_t* adcSamples, uint16_t* currentAVG){
-    uint16_t i;
-    int prod[360];
-    int maxVal = 0;
-    uint16_t maxVal_phaseOffset = 0;
-    uint16_t currentRef;
-    currentRef = getAverage(adcSamples, BUF_SIZE);
-    for (i=0; i<360; i++){
-        prod[i] = cycleProduct(adcSamples, i, currentRef);
-        if (prod[i] > maxVal){
-            maxVal = prod[i];
-            maxVal_phaseOffset = i;
-        }
-    }
-    *currentAVG = currentRef;
-    return maxVal_phaseOffset;
+// rtimer ticks <-> ms for the reporting scheduler, split to stay in 32 bits
+static uint32_t rtimerToMs(rtimer_clock_t t){
+    return (t/RTIMER_SECOND)*1000 + ((t%RTIMER_SECOND)*1000)/RTIMER_SECOND;
 }
 
-int cycleProduct(uint16_t* adcSamples, uint16_t offset, uint16_t currentRef){
-    uint16_t i;
-    uint16_t tmp;
-    uint16_t length = BUF_SIZE;
-    int product = 0;
-    for (i=0; i<length; i++){
-        tmp = i*3 + offset;
-        if (tmp>=360)
-            tmp -= 360;
-        product += (adcSamples[i] - currentRef)*stdSineTable[tmp];
-    }
-    return product;
+static rtimer_clock_t msToRtimer(uint32_t ms){
+    return (ms/1000)*RTIMER_SECOND + ((ms%1000)*RTIMER_SECOND)/1000;
 }
 
-// Fine tune to 3.002 degree / sample
-// Ideally, timerVal[1] - timerVal[0] = 266667
+// GPTIMER paced, see dev/triumvi/meterSampler.h
+// Ideally, timerVal[0] - timerVal[1] = 266667
 void sampleCurrentWaveform(){
-	uint16_t sampleCnt = 0;
-	uint16_t temp;
-    #ifdef FIFTYHZ
-    uint8_t i;
-    #endif
     timerVal[0] = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
-	while (sampleCnt < BUF_SIZE){
-        #ifdef FIFTYHZ
-        for (i=0; i<59; i++)
-            asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        #else
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        #endif
-		temp = adc_get(I_ADC_CHANNEL, SOC_ADC_ADCCON_REF_EXT_SINGLE, SOC_ADC_ADCCON_DIV_512);
-		currentADCVal[sampleCnt] = ((temp>>4)>2047)? 0 : (temp>>4);
-		sampleCnt++;
-	}
+    meterSampleCurrent(currentADCVal, BUF_SIZE);
     timerVal[1] = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
 }
 
@@ -1830,29 +1661,28 @@ void meterInit(){
 	gpt_enable_event(GPTIMER_1, GPTIMER_SUBTIMER_A);
 	gate_gpt(GPTIMER_1);
 
+	// timer3, paces the ADC
+	meterSamplerInit();
+
 	rTimerExpired = 0;
 	referenceInt = 0;
     allInitsAreReadyInt = 0;
     inaGainIdx = MAX_INA_GAIN_IDX-1; // G = 9
 
-	backOffTime = 4;
-	backOffHistory = 0;
+	reportSchedInit(&reportSched, REPORT_SCHED_MAX_STALE);
+    #ifdef DELTA_REPORT
+    deltaReportInit(&deltaReport);
+    #endif
+    #ifdef AGGREGATE_REPORT
+    aggReportClear(&aggReport);
+    #endif
 
 }
 
-// this function check if the ADC samples are within a proper range
-gainSetting_t gainCtrl(uint16_t* adcSamples, uint8_t externalVolt){
-    uint16_t i;
-    uint16_t upperThreshold = (inaGainIdx==MAX_INA_GAIN_IDX)? UPPERTHRESHOLD0 : 
-                              (inaGainIdx==1)? UPPERTHRESHOLD2 : UPPERTHRESHOLD1;
-    uint16_t lowerThreshold = (inaGainIdx==MIN_INA_GAIN_IDX)? LOWERTHRESHOLD0 : LOWERTHRESHOLD1; 
-    uint16_t length = BUF_SIZE;
+// DC reference of length current samples
+uint16_t currentReference(uint16_t* adcSamples, uint16_t length, uint8_t externalVolt){
     uint16_t currentRef;
-    int currentCal;
-    int maxVal = 0;
-    gainSetting_t res = GAIN_OK;
-    uint32_t dc_offset_data;
-    uint8_t inaGainIdx_copy;
+    uint16_t dc_offset_data;
     
     // in calibration mode, use ADC sample as reference
     if (operation_mode==MODE_PHASE_CALIBRATION){
@@ -1861,63 +1691,63 @@ gainSetting_t gainCtrl(uint16_t* adcSamples, uint8_t externalVolt){
     }
     // using hardcoded value as reference
     else{
-        inaGainIdx_copy = inaGainIdx;
-        do {
-            dc_offset_data = REG(DC_OFFSET_FLASH_ADDR(inaGainIdx_copy));
-            if (inaGainIdx_copy == MAX_INA_GAIN_IDX){
-                dc_offset_data = dcOffset;
-                break;
-            } else {
-                inaGainIdx_copy += 1;
-            }
-        } while (dc_offset_data == 0xffffffff);
+        dc_offset_data = calStoreDCOffset(inaGainIdx);
         
         if (externalVolt){
             #ifdef AVG_VREF
-            currentRef = getAverage(adcSamples, BUF_SIZE2);
+            currentRef = getAverage(adcSamples, length);
             #else
-            currentRef = ((uint16_t)dc_offset_data)>>1;
+            currentRef = dc_offset_data>>1;
             #endif
-            upperThreshold = (upperThreshold>>1);
-            lowerThreshold = (lowerThreshold>>1);
-            length = BUF_SIZE2;
         }
         else{
             #ifdef AVG_VREF
-            currentRef = getAverage(adcSamples, BUF_SIZE);
+            currentRef = getAverage(adcSamples, length);
             #else
-            currentRef = (uint16_t)dc_offset_data;
+            currentRef = dc_offset_data;
             #endif
         }
     }
+    return currentRef;
+}
 
-    // loop the entire samples, substract offset and update max ADC value
-    for (i=0; i<length; i++){
-        currentCal = adcSamples[i] - currentRef;
-        if ((currentCal>upperThreshold)&&(inaGainIdx>MIN_INA_GAIN_IDX)){
-            res = GAIN_TOO_HIGH;
-            inaGainIdx -= 1;
-            setINAGain(inaGainArr[inaGainIdx]);
-            return res;
-        }
-        if (currentCal > maxVal){
-            maxVal = currentCal;
-        }
-        adjustedCurrSamples[i] = currentCal;
-    }
-    
-    if ((maxVal < lowerThreshold) && (inaGainIdx<MAX_INA_GAIN_IDX)){
-        res = GAIN_TOO_LOW;
+// step the INA gain as requested by a gain check
+gainSetting_t gainStep(gainSetting_t res){
+    if (res==GAIN_TOO_HIGH){
+        inaGainIdx -= 1;
+        setINAGain(inaGainArr[inaGainIdx]);
+    } else if (res==GAIN_TOO_LOW){
         // Mux is off, turn it on
         inaGainIdx += 1;
         setINAGain(inaGainArr[inaGainIdx]);
-    } else if ((operation_mode==MODE_PHASE_CALIBRATION) && (maxVal < lowerThreshold) && (inaGainIdx==MAX_INA_GAIN_IDX)){
-        res = GAIN_ERROR;
+    // signal is too small even with the highest gain, only an error in calibration
+    } else if ((res==GAIN_ERROR) && (operation_mode!=MODE_PHASE_CALIBRATION)){
+        res = GAIN_OK;
     }
 
     return res;
 }
 
+// this function check if the ADC samples are within a proper range
+gainSetting_t gainCtrl(uint16_t* adcSamples, uint8_t externalVolt){
+    uint16_t length = (externalVolt)? BUF_SIZE2 : BUF_SIZE;
+    gainSetting_t res;
+
+    res = meterGainCheck(adcSamples, length, currentReference(adcSamples, length, externalVolt),
+                         inaGainIdx, MAX_INA_GAIN_IDX, externalVolt, adjustedCurrSamples);
+    return gainStep(res);
+}
+
+// fold one cycle of current/voltage pairs into extVoltAccum,
+// end the capture as soon as the gain is too high
+static uint8_t extVoltFold(uint16_t* currSamples, int* voltSamples, uint16_t length){
+    int maxVal;
+    if (extVoltAccum.count == 0)
+        extVoltAccum.currentRef = currentReference(currSamples, length, 0x1);
+    maxVal = meterAccumAdd(&extVoltAccum, currSamples, voltSamples, length);
+    return (meterGainRange(maxVal, inaGainIdx, MAX_INA_GAIN_IDX, 0x1)==GAIN_TOO_HIGH);
+}
+
 void encryptAndTransmit(triumvi_record_t* thisSample, 
                         uint8_t* myNonce, uint32_t nonceCounter){
     // 1 byte Identifier, 
@@ -1936,9 +1766,16 @@ void encryptAndTransmit(triumvi_record_t* thisSample,
 	uint16_t randBackOff;
     #ifdef COUNTER_ENABLE
     uint32_t counter_val;
+    #endif
+    #if defined(DELTA_REPORT) || defined(ENERGY_REPORT)
+    uint8_t extFlags = 0;
     #endif
 
+	#if defined(DELTA_REPORT) || defined(ENERGY_REPORT)
+	packetData[0] = TRIUMVI_PKT_EXT_IDENTIFIER;
+	#else
 	packetData[0] = TRIUMVI_PKT_IDENTIFIER;
+	#endif
 	if (thisSample->triumviStatusReg & BATTERYPACK_STATUSREG){
         readingBuf[myPDATA_LEN] = thisSample->panelID;
         readingBuf[myPDATA_LEN+1] = thisSample->circuitID;
@@ -1981,6 +1818,27 @@ void encryptAndTransmit(triumvi_record_t* thisSample,
         myPDATA_LEN += 4;
         packetLen += 4;
     }
+    #endif
+
+    #ifdef DELTA_REPORT
+    deltaReportTrailer(&deltaReport, &readingBuf[myPDATA_LEN]);
+    myPDATA_LEN += DELTA_REPORT_TRAILER_LEN;
+    packetLen += DELTA_REPORT_TRAILER_LEN;
+    extFlags |= DELTA_EXTFLAG;
+    #endif
+
+    #ifdef ENERGY_REPORT
+    packData(&readingBuf[myPDATA_LEN], energyAccRead(), 4);
+    myPDATA_LEN += 4;
+    packetLen += 4;
+    extFlags |= ENERGY_EXTFLAG;
+    #endif
+
+    // extension fields are found from the end of the payload
+    #if defined(DELTA_REPORT) || defined(ENERGY_REPORT)
+    readingBuf[myPDATA_LEN] = extFlags;
+    myPDATA_LEN += 1;
+    packetLen += 1;
     #endif
 
 	ccm_auth_encrypt_start(LEN_LEN, 0, myNonce, aData, ADATA_LEN,
@@ -2018,6 +1876,65 @@ void encryptAndTransmit(triumvi_record_t* thisSample,
     #endif
 }
 
+#ifdef AGGREGATE_REPORT
+// Readings collected in aggReport in one frame, see aggReport.h
+// 1 byte Identifier, 4 bytes nonce, payload, 4 bytes MIC
+// payload:
+// 1 byte status reg (no time stamp, counter or PF), 1 byte number of readings,
+// [1 bytes panel ID, 1 bytes circuit ID]
+// encoded readings
+// [4 bytes accumulated energy (ENERGY_REPORT)]
+// 1 byte extension flags
+void aggregateTransmit(triumvi_record_t* thisSample,
+                       uint8_t* myNonce, uint32_t nonceCounter){
+	static uint8_t packetData[AGG_PAYLOAD_SIZE+9];
+	static uint8_t readingBuf[AGG_PAYLOAD_SIZE];
+	uint8_t myMic[8] = {0x0};
+	uint8_t myPDATA_LEN = 2;
+	uint8_t extFlags = 0;
+	uint16_t randBackOff;
+
+	packetData[0] = TRIUMVI_PKT_AGG_IDENTIFIER;
+	readingBuf[0] = thisSample->triumviStatusReg &
+        ~(TIMESTAMP_STATUSREG | COUNTER_STATUSREG | POWERFACTOR_STATUSREG);
+	readingBuf[1] = aggReport.count;
+	if (thisSample->triumviStatusReg & BATTERYPACK_STATUSREG){
+        readingBuf[myPDATA_LEN] = thisSample->panelID;
+        readingBuf[myPDATA_LEN+1] = thisSample->circuitID;
+        myPDATA_LEN += 2;
+	}
+    memcpy(&readingBuf[myPDATA_LEN], aggReport.buf, aggReport.len);
+    myPDATA_LEN += aggReport.len;
+
+    #ifdef ENERGY_REPORT
+    packData(&readingBuf[myPDATA_LEN], energyAccRead(), 4);
+    myPDATA_LEN += 4;
+    extFlags |= ENERGY_EXTFLAG;
+    #endif
+    readingBuf[myPDATA_LEN] = extFlags;
+    myPDATA_LEN += 1;
+
+	packData(&packetData[1], nonceCounter, 4);
+	packData(&myNonce[9], nonceCounter, 4);
+	ccm_auth_encrypt_start(LEN_LEN, 0, myNonce, myNonce, ADATA_LEN,
+		readingBuf, myPDATA_LEN, MIC_LEN, NULL);
+	while(ccm_auth_encrypt_check_status()!=AES_CTRL_INT_STAT_RESULT_AV){}
+	ccm_auth_encrypt_get_result(myMic, MIC_LEN);
+	memcpy(&packetData[5], readingBuf, myPDATA_LEN);
+	memcpy(&packetData[5+myPDATA_LEN], myMic, MIC_LEN);
+	packetbuf_copyfrom(packetData, 5+myPDATA_LEN+MIC_LEN);
+
+    // Random delay before transmits a packet
+	randBackOff = random_rand();
+	clock_delay_usec(randBackOff);
+	clock_delay_usec(randBackOff);
+
+    REG(RFCORE_XREG_TXPOWER) = 0xff; // 7dBm
+	cc2538_on_and_transmit();
+	CC2538_RF_CSP_ISRFOFF();
+}
+#endif
+
 #ifdef TRANSMIT_WAVEFORM
 void waveformTransmit(uint8_t triumviStatusReg){
     static uint8_t packetData[PACKET_WAVEFORM_OVERHEAD+((BUF_SIZE*3)>>2)];
@@ -2070,49 +1987,21 @@ void waveformTransmit(uint8_t triumviStatusReg){
 #endif
 
 int sampleAndCalculate(uint16_t triumviStatusReg){
-    int tempPower;
-    int tempPower2 = 0;
-    uint16_t i, j, k;
-    uint8_t numOfCycles = 8;
-    uint8_t numOfBitShift = 3; // log2(numOfCycles)
-    uint16_t voltRef;
-    int energyCal = 0;
+    int stream;
     gainSetting_t gainSetting;
 
     if (triumviStatusReg & EXTERNALVOLT_STATUSREG){
-        for (i=0; i<numOfCycles; i++){
-            sampleCurrentVoltageWaveform();
-            gainSetting = gainCtrl(currentADCVal, 0x1);
-            if (gainSetting == GAIN_OK){
-                voltRef = getAverage32(voltADCVal, BUF_SIZE2);
-                energyCal = 0;
-                for (j=0; j<BUF_SIZE2; j++){
-                    k = ((j + VOLTAGE_SAMPLE_OFFSET)>=BUF_SIZE2)? 
-                        (j+VOLTAGE_SAMPLE_OFFSET-BUF_SIZE2) : 
-                        j+VOLTAGE_SAMPLE_OFFSET;
-                    adjustedCurrSamples[j] = currentDataTransform(adjustedCurrSamples[j], 0x1);
-                    voltADCVal[k] = voltDataTransform(voltADCVal[k], voltRef);
-                    energyCal += (adjustedCurrSamples[j]*voltADCVal[k])/1000;
-                }
-                tempPower = (energyCal/BUF_SIZE2); // unit is mW
-                // Fix phase oppsite down
-                if (tempPower < 0)
-                    tempPower = -1*tempPower;
-                tempPower2 += tempPower;
-            }
-            else{
-                tempPower2 = -1;
-                break;
-            }
-        }
+        meterAccumInit(&extVoltAccum, 0, inaGainRecipArr[inaGainIdx], bitShiftArr[inaGainIdx]);
+        stream = sampleCurrentVoltageWaveform();
+        gainSetting = gainStep(meterGainRange(extVoltAccum.maxCurrent, inaGainIdx, MAX_INA_GAIN_IDX, 0x1));
         REG(SYSTICK_STCTRL) |= SYSTICK_STCTRL_INTEN;
         gate_gpt(GPTIMER_1);
         meterSenseConfig(VOLTAGE, SENSE_DISABLE);
         disablePOT();
-        if (tempPower2 < 0)
+        if ((stream < 0) || (gainSetting != GAIN_OK))
             return -1;
         else
-            return (tempPower2>>numOfBitShift);
+            return meterAccumPower(&extVoltAccum); // unit is mW
     }
     else{
         sampleCurrentWaveform();
@@ -2122,16 +2011,8 @@ int sampleAndCalculate(uint16_t triumviStatusReg){
         REG(SYSTICK_STCTRL) |= SYSTICK_STCTRL_INTEN;
         gate_gpt(GPTIMER_1);
         if (gainSetting==GAIN_OK){
-            for (i=0; i<BUF_SIZE; i++){
-                j = ((i*3+phaseOffset) >= 360)? i*3+phaseOffset-360 : i*3+phaseOffset;
-                adjustedCurrSamples[i] = currentDataTransform(adjustedCurrSamples[i], 0x0);
-                energyCal += (adjustedCurrSamples[i]*stdSineTable[j]);
-            }
-            tempPower = (energyCal*VOLTAGE_NOMINAL_SCALING/BUF_SIZE); // unit is mW
-            // Fix phase oppsite down
-            if (tempPower < 0)
-                tempPower = -1*tempPower;
-            return tempPower;
+            return meterSinePower(adjustedCurrSamples, stdSineTable, phaseOffset, 
+                    inaGainRecipArr[inaGainIdx], bitShiftArr[inaGainIdx], VOLTAGE_NOMINAL_SCALING); // unit is mW
         }
     }
     return -1;
@@ -2146,46 +2027,13 @@ void disablePOT(){
     #endif
 }
 
-int currentDataTransform(int currentReading, uint8_t externalVolt){
-    uint8_t inaGain = inaGainArr[inaGainIdx];
-    uint8_t bitShift = bitShiftArr[inaGainIdx];
-    float tmp = (externalVolt)? currentReading*I_TRANSFORM*2/inaGain : currentReading*I_TRANSFORM/inaGain;
-    return (((int)tmp)>>bitShift);
-}
-
-int voltDataTransform(int voltReading, uint16_t voltReference){
-    return (voltReading - voltReference)*VOLTAGE_SCALING;
-}
-
-
-
-void sampleCurrentVoltageWaveform(){
-	uint16_t sampleCnt = 0;
-	uint16_t temp;
-    #ifdef FIFTYHZ
-    uint8_t i;
-    #endif
+// currentADCVal/voltADCVal hold two cycles, one is folded while the other fills
+int sampleCurrentVoltageWaveform(){
+	int res;
 	timerVal[0] = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
-	while (sampleCnt < BUF_SIZE2){
-        #ifdef FIFTYHZ
-        for (i=0; i<59; i++)
-            asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        #else
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        asm("nop");
-        #endif
-		temp = adc_get(I_ADC_CHANNEL, SOC_ADC_ADCCON_REF_EXT_SINGLE, SOC_ADC_ADCCON_DIV_256);
-		currentADCVal[sampleCnt] = ((temp>>5)>1023)? 0 : (temp>>5);
-		temp = adc_get(EXT_VOLT_IN_ADC_CHANNEL, SOC_ADC_ADCCON_REF_EXT_SINGLE, SOC_ADC_ADCCON_DIV_256);
-		voltADCVal[sampleCnt] = ((temp>>5)>1023)? 0 : (temp>>5);
-		sampleCnt++;
-	}
+	res = meterStreamCurrentVoltage(currentADCVal, voltADCVal, BUF_SIZE2>>1, EXT_VOLT_CYCLES, extVoltFold);
 	timerVal[1] = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A);
+	return res;
 }
 
 
@@ -2213,34 +2061,18 @@ static void referenceIntCallBack(uint8_t port, uint8_t pin){
 }
 
 uint16_t currentRMS(uint16_t triumviStatusReg){
-    uint16_t i;
-    uint32_t result = 0;
-    uint64_t result64 = 0;
-    uint16_t length = (triumviStatusReg & EXTERNALVOLT_STATUSREG)? BUF_SIZE2 : BUF_SIZE;
-
-    for (i=0; i<length; i++){
-        result64 += (adjustedCurrSamples[i]*adjustedCurrSamples[i]);
+    if (triumviStatusReg & EXTERNALVOLT_STATUSREG){
+        return meterAccumCurrentRMS(&extVoltAccum);
     }
-    result = (uint32_t)(result64/length);
-    return mysqrt(result);
+    return meterCurrentRMS(adjustedCurrSamples, BUF_SIZE);
 }
 
 // unit is V
 uint16_t voltageRMS(uint16_t triumviStatusReg){
-    uint16_t i;
-    float tmp;
-    float result = 0;
     if (triumviStatusReg & EXTERNALVOLT_STATUSREG){
-        for (i=0; i<BUF_SIZE2; i++){
-            tmp = voltADCVal[i]/1000;
-            result += tmp*tmp;
-        }
-        result /= BUF_SIZE2;
-        return mysqrt((uint32_t)result);
+        return meterAccumVoltageRMS(&extVoltAccum);
     }
     return VOLTAGE_NOMINAL*VOLTAGE_NOMINAL_SCALING;
-    
-    
 }
 
 void aps3b12_set_current(uint16_t cu){
@@ -2269,65 +2101,39 @@ void aps3b12_read_current(){
     packetbuf_copyfrom(pkt, 4);
     cc2538_on_and_transmit();
 }
-
-void linearFit(uint16_t* reading, uint16_t* setting, uint8_t length, 
-                uint32_t* slope_n, uint32_t* slope_d, int* offset){
-    uint8_t i;
-    int32_t readingAvg = getAverage(reading, length);
-    int32_t settingAvg = getAverage(setting, length);
-    int32_t tmp0 = 0;
-    uint32_t tmp1 = 0;
-    for (i=0; i<length; i++){
-        tmp0 += ((reading[i] - readingAvg)*(setting[i] - settingAvg));
-        tmp1 += ((reading[i] - readingAvg)*(reading[i] - readingAvg));
-    }
-    *slope_n = tmp0;
-    *slope_d = tmp1;
-    *offset = settingAvg - (((uint64_t)readingAvg)*tmp0/tmp1);
-}
 #endif
 
 void transmitCalibrationCoef(){
     static uint8_t packetData[8+26*3];
-    static uint8_t calDataValid;
-    static linearFitCalData_t linearFitCalibrationData;
-    static phaseOffsetCalData_t phaseData;
+    uint8_t calDataValid;
     uint8_t i;
-    uint16_t dc_offset_data;
     uint8_t numCalCoef = 0;
 
-    triumviFramCalibrateDataPhaseRead(&phaseData);
-    calDataValid = triumviFramCalibrateDataValidRead();
+    // same layout as the old FRAM valid byte
+    calDataValid = calStore.valid & 0xff;
 
     packetData[0] = TRIUMVI_PKT_CALIBRATIONCOEF_IDENTIFIER0;
     packetData[1] = TRIUMVI_PKT_CALIBRATIONCOEF_IDENTIFIER1;
-    packetData[2] = (phaseData.phase_Offset & 0xff);
-    packetData[3] = (phaseData.phase_Offset & 0xff00)>>8;
-    packetData[4] = (phaseData.dc_Offset & 0xff);
-    packetData[5] = (phaseData.dc_Offset & 0xff00)>>8;
+    packetData[2] = (calStore.phaseOffset & 0xff);
+    packetData[3] = (calStore.phaseOffset & 0xff00)>>8;
+    packetData[4] = (calStore.dcOffset & 0xff);
+    packetData[5] = (calStore.dcOffset & 0xff00)>>8;
     packetData[6] = calDataValid;
     packetData[7] = calDataValid & 0x01;
     if (calDataValid & 0x01){
         for (i=0; i<MAX_INA_GAIN_IDX+1; i++){
             if (calDataValid & (0x01<<(i+1))){
                 packetData[7] |= (0x01<<(i+1));
-                // read current fit data
-                linearFitCalibrationData.type = CURRENT_FIT_TYPE;
-                linearFitCalibrationData.gain_idx = i;
-                triumviFramCalibrateDataFitRead(&linearFitCalibrationData);
-                packData(&packetData[8+numCalCoef*26], linearFitCalibrationData.numerator, 4);
-                packData(&packetData[8+numCalCoef*26+4], linearFitCalibrationData.denumerator, 4);
-                packData(&packetData[8+numCalCoef*26+8], linearFitCalibrationData.offset, 4);
-                // read power fit data
-                linearFitCalibrationData.type = POWER_FIT_TYPE;
-                linearFitCalibrationData.gain_idx = i;
-                triumviFramCalibrateDataFitRead(&linearFitCalibrationData);
-                packData(&packetData[8+numCalCoef*26+12], linearFitCalibrationData.numerator, 4);
-                packData(&packetData[8+numCalCoef*26+16], linearFitCalibrationData.denumerator, 4);
-                packData(&packetData[8+numCalCoef*26+20], linearFitCalibrationData.offset, 4);
-                // read dc offset data
-                dc_offset_data = triumviFramDCOffsetRead(i);
-                packData(&packetData[8+numCalCoef*26+24], dc_offset_data, 2);
+                // current fit data
+                packData(&packetData[8+numCalCoef*26], calStore.currentFit[i].numerator, 4);
+                packData(&packetData[8+numCalCoef*26+4], calStore.currentFit[i].denumerator, 4);
+                packData(&packetData[8+numCalCoef*26+8], calStore.currentFit[i].offset, 4);
+                // power fit data
+                packData(&packetData[8+numCalCoef*26+12], calStore.powerFit[i].numerator, 4);
+                packData(&packetData[8+numCalCoef*26+16], calStore.powerFit[i].denumerator, 4);
+                packData(&packetData[8+numCalCoef*26+20], calStore.powerFit[i].offset, 4);
+                // dc offset data
+                packData(&packetData[8+numCalCoef*26+24], calStore.gainDCOffset[i], 2);
                 if ((numCalCoef==2) || (i==MAX_INA_GAIN_IDX)){
                     packetbuf_copyfrom(packetData, 8+26*(numCalCoef+1));
                     cc2538_on_and_transmit();
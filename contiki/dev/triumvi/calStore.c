@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "reg.h"
+#include "lib/crc16.h"
+#include "dev/rom-util.h"
+#include "triumvi.h"
+#include "calStore.h"
+
+#define CAL_STORE_FLASH_ERASE_SIZE 0x800
+
+calStore_t calStore;
+
+static uint32_t calFlashAddr;
+static uint8_t calMaxGainIdx;
+
+static uint16_t calStoreCRC(calStore_t* store){
+    return crc16_data((unsigned char*)store, offsetof(calStore_t, crc), 0);
+}
+
+static calStoreStatus_t calStoreCheck(calStore_t* store){
+    if ((store->magic != CAL_STORE_MAGIC) || (store->version != CAL_STORE_VERSION))
+        return CAL_STORE_CORRUPT;
+    if (store->crc != calStoreCRC(store))
+        return CAL_STORE_CORRUPT;
+    return CAL_STORE_OK;
+}
+
+static void calStoreReset(){
+    memset(&calStore, 0, sizeof(calStore_t));
+    calStore.magic = CAL_STORE_MAGIC;
+    calStore.version = CAL_STORE_VERSION;
+}
+
+// old flash layout: phase/dc word, current fits, power fits (16 bytes per
+// gain), dc offsets (4 bytes per gain), 0xffffffff if not written
+static void calStoreLoadLegacyFlash(){
+    uint8_t i;
+    uint32_t addr;
+    uint32_t data = REG(calFlashAddr);
+
+    calStoreReset();
+    calStoreSetPhase(data & 0xffff, (data & 0xffff0000)>>16);
+    for (i=0; (i<=calMaxGainIdx) && (i<CAL_STORE_MAX_GAINS); i++){
+        addr = calFlashAddr+(i*16)+4;
+        if (REG(addr+8) != 0xffffffff)
+            calStoreSetFit(CURRENT_FIT_TYPE, i, REG(addr), REG(addr+4), REG(addr+8));
+        addr += (calMaxGainIdx+1)*16;
+        if (REG(addr+8) != 0xffffffff)
+            calStoreSetFit(POWER_FIT_TYPE, i, REG(addr), REG(addr+4), REG(addr+8));
+        addr = calFlashAddr+(calMaxGainIdx+1)*2*16+i*4;
+        if (REG(addr) != 0xffffffff)
+            calStoreSetDCOffset(i, REG(addr));
+    }
+}
+
+calStoreStatus_t calStoreLoad(uint32_t flashAddr, uint8_t maxGainIdx){
+    calStoreStatus_t res;
+    calFlashAddr = flashAddr;
+    calMaxGainIdx = maxGainIdx;
+
+    if (REG(flashAddr) == 0xffffffff){
+        calStoreReset();
+        return CAL_STORE_EMPTY;
+    }
+    memcpy(&calStore, (void*)flashAddr, sizeof(calStore_t));
+    if (calStore.magic == CAL_STORE_MAGIC){
+        res = calStoreCheck(&calStore);
+        if (res != CAL_STORE_OK)
+            calStoreReset();
+        return res;
+    }
+    // calibrated before the store existed, convert once
+    calStoreLoadLegacyFlash();
+    calStoreCommit();
+    return CAL_STORE_OK;
+}
+
+calStoreStatus_t calStoreRestore(){
+    #ifdef FRAM_ENABLE
+    uint8_t i;
+    uint8_t calDataValid;
+    linearFitCalData_t fitData;
+    phaseOffsetCalData_t phaseData;
+    calStoreStatus_t res;
+
+    triumviFramCalibrateStoreRead((uint8_t*)&calStore, sizeof(calStore_t));
+    if (calStore.magic == CAL_STORE_MAGIC){
+        res = calStoreCheck(&calStore);
+        if (res != CAL_STORE_OK){
+            calStoreReset();
+            return res;
+        }
+        calStoreCommit();
+        return CAL_STORE_OK;
+    }
+
+    // old FRAM layout, the valid byte overlaps the low byte of magic
+    calStoreReset();
+    calDataValid = triumviFramCalibrateDataValidRead();
+    if ((calDataValid & CAL_VALID_PHASE)==0)
+        return CAL_STORE_EMPTY;
+    triumviFramCalibrateDataPhaseRead(&phaseData);
+    calStoreSetPhase(phaseData.phase_Offset, phaseData.dc_Offset);
+    for (i=0; (i<=calMaxGainIdx) && (i<CAL_STORE_MAX_GAINS); i++){
+        if (calDataValid & CAL_VALID_FIT(i)){
+            fitData.type = CURRENT_FIT_TYPE;
+            fitData.gain_idx = i;
+            triumviFramCalibrateDataFitRead(&fitData);
+            calStoreSetFit(CURRENT_FIT_TYPE, i, fitData.numerator, fitData.denumerator, fitData.offset);
+            fitData.type = POWER_FIT_TYPE;
+            triumviFramCalibrateDataFitRead(&fitData);
+            calStoreSetFit(POWER_FIT_TYPE, i, fitData.numerator, fitData.denumerator, fitData.offset);
+            if (triumviFramDCOffsetRead(i) > 0)
+                calStoreSetDCOffset(i, triumviFramDCOffsetRead(i));
+        }
+    }
+    calStoreCommit();
+    return CAL_STORE_OK;
+    #else
+    return CAL_STORE_EMPTY;
+    #endif
+}
+
+void calStoreClear(){
+    calStoreReset();
+    rom_util_page_erase(calFlashAddr, CAL_STORE_FLASH_ERASE_SIZE);
+}
+
+void calStoreCommit(){
+    calStore.magic = CAL_STORE_MAGIC;
+    calStore.version = CAL_STORE_VERSION;
+    calStore.crc = calStoreCRC(&calStore);
+    // FRAM first, it is the copy used to restore the flash page
+    #ifdef FRAM_ENABLE
+    triumviFramCalibrateStoreWrite((uint8_t*)&calStore, sizeof(calStore_t));
+    #endif
+    rom_util_page_erase(calFlashAddr, CAL_STORE_FLASH_ERASE_SIZE);
+    rom_util_program_flash((uint32_t*)&calStore, calFlashAddr, sizeof(calStore_t));
+}
+
+void calStoreSetPhase(uint16_t phaseOffset, uint16_t dcOffset){
+    calStore.phaseOffset = phaseOffset;
+    calStore.dcOffset = dcOffset;
+    calStore.valid |= CAL_VALID_PHASE;
+}
+
+void calStoreSetFit(uint8_t type, uint8_t gainIdx, uint32_t numerator, uint32_t denumerator, int offset){
+    calFit_t* fit;
+    if (gainIdx >= CAL_STORE_MAX_GAINS)
+        return;
+    fit = (type==CURRENT_FIT_TYPE)? &calStore.currentFit[gainIdx] : &calStore.powerFit[gainIdx];
+    fit->numerator = numerator;
+    fit->denumerator = denumerator;
+    fit->offset = offset;
+    calStore.valid |= CAL_VALID_FIT(gainIdx);
+}
+
+void calStoreSetDCOffset(uint8_t gainIdx, uint16_t dcOffset){
+    if (gainIdx >= CAL_STORE_MAX_GAINS)
+        return;
+    calStore.gainDCOffset[gainIdx] = dcOffset;
+    calStore.valid |= CAL_VALID_DC(gainIdx);
+}
+
+uint8_t calStoreHasFit(uint8_t gainIdx){
+    return (calStore.valid & CAL_VALID_FIT(gainIdx))? 1 : 0;
+}
+
+uint8_t calStoreHasDCOffset(uint8_t gainIdx){
+    return (calStore.valid & CAL_VALID_DC(gainIdx))? 1 : 0;
+}
+
+const calFit_t* calStoreFit(uint8_t type, uint8_t gainIdx){
+    for (; (gainIdx<=calMaxGainIdx) && (gainIdx<CAL_STORE_MAX_GAINS); gainIdx++){
+        if (calStore.valid & CAL_VALID_FIT(gainIdx))
+            return (type==CURRENT_FIT_TYPE)? &calStore.currentFit[gainIdx] : &calStore.powerFit[gainIdx];
+    }
+    return NULL;
+}
+
+uint16_t calStoreDCOffset(uint8_t gainIdx){
+    for (; (gainIdx<calMaxGainIdx) && (gainIdx<CAL_STORE_MAX_GAINS); gainIdx++){
+        if (calStore.valid & CAL_VALID_DC(gainIdx))
+            return calStore.gainDCOffset[gainIdx];
+    }
+    return calStore.dcOffset;
+}
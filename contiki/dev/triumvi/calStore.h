@@ -0,0 +1,76 @@
+#ifndef __CALSTORE_H__
+#define __CALSTORE_H__
+
+#include <stdint.h>
+
+// Calibration store.
+// All calibration data lives in one calStore_t that is kept in RAM and
+// written as a whole, with a CRC, to the calibration flash page and to FRAM
+// (FRAM_CALIBRATION_STORE_LOC_ADDR). The flash copy is loaded once at boot,
+// the FRAM copy survives a reflash and is used to restore the flash page.
+// Devices calibrated with the old word by word layout are converted when
+// they are loaded.
+
+#define CAL_STORE_MAGIC 0x5443  // "TC", above any phase offset of the old layout
+#define CAL_STORE_VERSION 1
+#define CAL_STORE_MAX_GAINS 5
+
+// valid bits, the low byte is the same as the old FRAM valid byte
+#define CAL_VALID_PHASE 0x01
+#define CAL_VALID_FIT(idx) (0x02<<(idx))
+#define CAL_VALID_DC(idx) (0x0100<<(idx))
+
+typedef struct {
+    uint32_t numerator;
+    uint32_t denumerator;
+    int offset;
+} calFit_t;
+
+// flash programming is word based, keep the size a multiple of 4
+typedef struct {
+    uint16_t magic;
+    uint16_t version;
+    uint16_t phaseOffset;
+    uint16_t dcOffset;
+    uint32_t valid;
+    calFit_t currentFit[CAL_STORE_MAX_GAINS];
+    calFit_t powerFit[CAL_STORE_MAX_GAINS];
+    uint16_t gainDCOffset[CAL_STORE_MAX_GAINS];
+    uint16_t crc;   // crc16 of everything above
+} calStore_t;
+
+typedef enum {
+    CAL_STORE_EMPTY,
+    CAL_STORE_OK,
+    CAL_STORE_CORRUPT   // wrong version or CRC, treated as not calibrated
+} calStoreStatus_t;
+
+// RAM copy, read only outside of this module
+extern calStore_t calStore;
+
+// Load the flash page at flashAddr into RAM. maxGainIdx is the highest
+// INA gain index of the app, used to read the old layout.
+calStoreStatus_t calStoreLoad(uint32_t flashAddr, uint8_t maxGainIdx);
+// Load the FRAM copy (or the old FRAM layout) and write it to flash
+calStoreStatus_t calStoreRestore();
+// Empty RAM copy and erase the flash page, FRAM is untouched
+void calStoreClear();
+// Write the RAM copy to FRAM, then to flash
+void calStoreCommit();
+
+// setters only change the RAM copy, call calStoreCommit to keep them
+void calStoreSetPhase(uint16_t phaseOffset, uint16_t dcOffset);
+// type is CURRENT_FIT_TYPE or POWER_FIT_TYPE
+void calStoreSetFit(uint8_t type, uint8_t gainIdx, uint32_t numerator, uint32_t denumerator, int offset);
+void calStoreSetDCOffset(uint8_t gainIdx, uint16_t dcOffset);
+
+uint8_t calStoreHasFit(uint8_t gainIdx);
+uint8_t calStoreHasDCOffset(uint8_t gainIdx);
+// Fit of gainIdx, or of the closest higher gain that is calibrated.
+// NULL if no gain from gainIdx up is calibrated.
+const calFit_t* calStoreFit(uint8_t type, uint8_t gainIdx);
+// DC offset of gainIdx, or of the closest higher gain that is calibrated,
+// the phase calibration dc offset is used for the highest gain
+uint16_t calStoreDCOffset(uint8_t gainIdx);
+
+#endif
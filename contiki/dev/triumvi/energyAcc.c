@@ -0,0 +1,130 @@
+#include <stdint.h>
+
+#include "contiki.h"
+#include "sys/rtimer.h"
+#include "triumvi.h"
+#include "energyAcc.h"
+
+#define MJ_PER_MWH 3600
+
+static uint32_t energyMWh;
+static uint16_t energyMJ;           // below 1 mWh
+static uint32_t energyRem;          // mW*ticks below 1 mJ
+static uint32_t energySavedMWh;
+static rtimer_clock_t energySavedTime;
+static uint8_t energySeq;
+static uint8_t energySlot;
+
+static int prevPower;
+static rtimer_clock_t prevTime;
+static uint8_t prevValid = 0;
+static uint8_t energyLoaded = 0;
+
+#ifdef FRAM_ENABLE
+static uint8_t energyChecksum(uint8_t* buf){
+    uint8_t i;
+    uint8_t sum = ENERGY_FRAM_MAGIC;
+    for (i=0; i<ENERGY_FRAM_SLOT_LEN-1; i++)
+        sum ^= buf[i];
+    return sum;
+}
+#endif
+
+// register from FRAM, on first use as the FRAM may not be up at boot
+static void energyLoad(){
+    #ifdef FRAM_ENABLE
+    uint8_t buf[ENERGY_FRAM_SLOTS][ENERGY_FRAM_SLOT_LEN];
+    uint8_t found = 0;
+    uint8_t i;
+    uint8_t hold;
+    #endif
+
+    energyLoaded = 1;
+    energyMWh = 0;
+    energyMJ = 0;
+    energyRem = 0;
+    energySeq = 0;
+    energySlot = 0;
+    prevValid = 0;
+    #ifdef FRAM_ENABLE
+    hold = triumviFramHold();
+    for (i=0; i<ENERGY_FRAM_SLOTS; i++)
+        triumviFramEnergyRead(i, buf[i], ENERGY_FRAM_SLOT_LEN);
+    triumviFramRelease(hold);
+
+    // newest valid slot, sequence numbers wrap
+    for (i=0; i<ENERGY_FRAM_SLOTS; i++){
+        if (buf[i][ENERGY_FRAM_SLOT_LEN-1] != energyChecksum(buf[i]))
+            continue;
+        if (found && ((uint8_t)(buf[i][0] - energySeq) >= 0x80))
+            continue;
+        found = 1;
+        energySeq = buf[i][0];
+        energySlot = i;
+        energyMWh = ((uint32_t)buf[i][4]<<24) | ((uint32_t)buf[i][3]<<16) | (buf[i][2]<<8) | buf[i][1];
+        energyMJ = (buf[i][6]<<8) | buf[i][5];
+        if (energyMJ >= MJ_PER_MWH)
+            energyMJ = 0;
+    }
+    #endif
+    energySavedMWh = energyMWh;
+    energySavedTime = RTIMER_NOW();
+}
+
+static void energyCommit(){
+    #ifdef FRAM_ENABLE
+    uint8_t buf[ENERGY_FRAM_SLOT_LEN];
+    uint8_t hold;
+    energySeq += 1;
+    energySlot = (energySlot+1 == ENERGY_FRAM_SLOTS)? 0 : energySlot+1;
+    buf[0] = energySeq;
+    buf[1] = energyMWh & 0xff;
+    buf[2] = (energyMWh & 0xff00)>>8;
+    buf[3] = (energyMWh & 0xff0000)>>16;
+    buf[4] = (energyMWh & 0xff000000)>>24;
+    buf[5] = energyMJ & 0xff;
+    buf[6] = (energyMJ & 0xff00)>>8;
+    buf[7] = energyChecksum(buf);
+    hold = triumviFramHold();
+    triumviFramEnergyWrite(energySlot, buf, ENERGY_FRAM_SLOT_LEN);
+    triumviFramRelease(hold);
+    #endif
+    energySavedMWh = energyMWh;
+    energySavedTime = RTIMER_NOW();
+}
+
+void energyAccUpdate(int power){
+    rtimer_clock_t now;
+    rtimer_clock_t elapsed;
+    uint64_t energy;
+
+    if (power < 0)
+        return;
+    if (energyLoaded==0)
+        energyLoad();
+    now = RTIMER_NOW();
+    elapsed = now - prevTime;
+    if (prevValid){
+        // trapezoid, mW*ticks, then mJ
+        energy = ((uint64_t)prevPower + power)*elapsed/2 + energyRem;
+        energyRem = (uint32_t)(energy % ((uint32_t)RTIMER_SECOND));
+        energy = energy/RTIMER_SECOND + energyMJ;
+        energyMWh += (uint32_t)(energy/MJ_PER_MWH);
+        energyMJ = (uint16_t)(energy%MJ_PER_MWH);
+    }
+    prevPower = power;
+    prevTime = now;
+    prevValid = 1;
+
+    if (energyMWh == energySavedMWh)
+        return;
+    if ((energyMWh - energySavedMWh >= ENERGY_COMMIT_DELTA) ||
+        ((rtimer_clock_t)(now - energySavedTime) >= ENERGY_COMMIT_INTERVAL))
+        energyCommit();
+}
+
+uint32_t energyAccRead(){
+    if (energyLoaded==0)
+        energyLoad();
+    return energyMWh;
+}
@@ -0,0 +1,35 @@
+#ifndef __ENERGYACC_H__
+#define __ENERGYACC_H__
+
+#include <stdint.h>
+#include "contiki.h"
+#include "sys/rtimer.h"
+
+// Accumulated energy register (ENERGY_REPORT).
+// Every valid reading adds the energy since the previous reading, the mean
+// of both readings times the rtimer time in between. The time before the
+// first reading after a reset is not counted, the meter only loses power
+// when the load (and so the harvested current) is gone.
+// The register is kept in FRAM (FRAM_ENERGY_LOC_ADDR) in two slots that are
+// written in turn with a sequence number and a checksum, a brown out during
+// a write leaves the other slot intact. A slot is only written once the
+// register moved by ENERGY_COMMIT_DELTA or ENERGY_COMMIT_INTERVAL passed,
+// which bounds the energy lost at a reset.
+
+#ifndef ENERGY_COMMIT_DELTA
+#define ENERGY_COMMIT_DELTA 1000                        // mWh
+#endif
+#ifndef ENERGY_COMMIT_INTERVAL
+#define ENERGY_COMMIT_INTERVAL ((rtimer_clock_t)RTIMER_SECOND*60)
+#endif
+
+#define ENERGY_FRAM_SLOTS 2
+#define ENERGY_FRAM_SLOT_LEN 8  // seq, 4 bytes mWh, 2 bytes mJ, checksum
+#define ENERGY_FRAM_MAGIC 0xe5
+
+// Every valid reading (mW), the register is loaded from FRAM on first use
+void energyAccUpdate(int power);
+// Accumulated energy, mWh
+uint32_t energyAccRead();
+
+#endif
@@ -0,0 +1,251 @@
+#include <stdint.h>
+
+#include "contiki.h"
+#include "fm25v02.h"
+#include "triumvi.h"
+#include "framLog.h"
+
+#ifdef FRAM_ENABLE
+
+// Sequence numbers run 1~255, 0 is never used so erased FRAM does not
+// continue a sequence. A slot left over from the previous lap is
+// FRAM_LOG_SLOTS records behind, which must not be a multiple of 255.
+#if (FRAM_LOG_SLOTS % 255) == 0
+#error "FRAM_LOG_SLOTS is a multiple of 255, stale records would look valid"
+#endif
+
+#define SLOT_ADDR(slot) (FRAM_DATA_MIN_LOC_ADDR + (slot)*TRIUMVI_RECORD_SIZE)
+
+// slot indices, not addresses
+static uint16_t logRead;
+static uint16_t logWrite;
+static uint16_t logReadSaved;   // read pointer as committed
+static uint8_t logSeq;      // sequence number of the next record
+static uint16_t logDirty;   // pointer moves since the last commit
+static uint8_t logLoaded = 0;
+
+static inline void logWake(){
+    #ifdef FM25V02
+    fm25v02_dummyWakeup();
+    #endif
+}
+
+static inline void logSleep(){
+    #ifdef FM25V02
+    fm25v02_sleep();
+    #endif
+}
+
+static inline uint16_t logNextSlot(uint16_t slot, uint16_t num){
+    slot += num;
+    return (slot >= FRAM_LOG_SLOTS)? slot-FRAM_LOG_SLOTS : slot;
+}
+
+static inline uint8_t logNextSeq(uint8_t seq){
+    return (seq==255)? 1 : seq+1;
+}
+
+static inline uint16_t logDistance(uint16_t from, uint16_t to){
+    return (to >= from)? to-from : FRAM_LOG_SLOTS-from+to;
+}
+
+static inline uint16_t logUsed(){
+    return logDistance(logRead, logWrite);
+}
+
+// seq, write pointer, read pointer in one write
+// pointers are stored as big endian addresses
+static void logCommit(){
+    uint8_t writeBuf[5];
+    writeBuf[0] = logSeq;
+    writeBuf[1] = (SLOT_ADDR(logWrite) & 0xff00)>>8;
+    writeBuf[2] = SLOT_ADDR(logWrite) & 0xff;
+    writeBuf[3] = (SLOT_ADDR(logRead) & 0xff00)>>8;
+    writeBuf[4] = SLOT_ADDR(logRead) & 0xff;
+    (*fram_write)(FRAM_LOG_SEQ_LOC_ADDR, 5, writeBuf);
+    logReadSaved = logRead;
+    logDirty = 0;
+}
+
+static uint8_t logAddrToSlot(uint16_t addr, uint16_t* slot){
+    if ((addr < FRAM_DATA_MIN_LOC_ADDR) || (addr > FRAM_DATA_MAX_LOC_ADDR))
+        return 0;
+    if ((addr - FRAM_DATA_MIN_LOC_ADDR) % TRIUMVI_RECORD_SIZE)
+        return 0;
+    *slot = (addr - FRAM_DATA_MIN_LOC_ADDR)/TRIUMVI_RECORD_SIZE;
+    return 1;
+}
+
+static void logLoad(){
+    uint8_t readBuf[5];
+    uint8_t seq;
+
+    (*fram_read)(FRAM_LOG_SEQ_LOC_ADDR, 5, readBuf);
+    logLoaded = 1;
+    logDirty = 0;
+    logSeq = readBuf[0];
+    // erased or never initialized
+    if ((logAddrToSlot((readBuf[1]<<8 | readBuf[2]), &logWrite)==0) ||
+        (logAddrToSlot((readBuf[3]<<8 | readBuf[4]), &logRead)==0)){
+        logRead = 0;
+        logWrite = 0;
+        logSeq = 1;
+        logCommit();
+        return;
+    }
+    logReadSaved = logRead;
+    // pointers written before records had a sequence number
+    if (logSeq == 0)
+        logSeq = 1;
+
+    // records written after the last commit
+    while (logNextSlot(logWrite, 1) != logRead){
+        (*fram_read)(SLOT_ADDR(logWrite)+FRAM_LOG_SEQ_BYTE, 1, &seq);
+        if (seq != logSeq)
+            break;
+        logWrite = logNextSlot(logWrite, 1);
+        logSeq = logNextSeq(logSeq);
+        logDirty += 1;
+    }
+}
+
+void framLogInit(){
+    logWake();
+    logLoad();
+    logSleep();
+}
+
+void framLogClear(){
+    logWake();
+    if (!logLoaded)
+        logLoad();
+    logRead = logWrite;
+    logCommit();
+    logSleep();
+}
+
+void framLogCommit(){
+    if ((!logLoaded) || (logDirty==0))
+        return;
+    logWake();
+    logCommit();
+    logSleep();
+}
+
+uint16_t framLogCount(){
+    if (!logLoaded)
+        framLogInit();
+    return logUsed();
+}
+
+uint16_t framLogAppend(uint8_t* records, uint16_t num){
+    uint16_t i;
+    uint16_t chunk;
+    uint16_t written = 0;
+
+    logWake();
+    if (!logLoaded)
+        logLoad();
+    if (num > FRAM_LOG_SLOTS-1-logUsed())
+        num = FRAM_LOG_SLOTS-1-logUsed();
+    // slots released since the last commit are still unread after a
+    // reboot, save the read pointer before reusing them
+    if (num > FRAM_LOG_SLOTS-1-logDistance(logReadSaved, logWrite))
+        logCommit();
+
+    for (i=0; i<num; i++){
+        records[i*TRIUMVI_RECORD_SIZE+FRAM_LOG_SEQ_BYTE] = logSeq;
+        logSeq = logNextSeq(logSeq);
+    }
+    // one burst up to the end of the ring, a second one after wrapping
+    while (written < num){
+        chunk = FRAM_LOG_SLOTS-logWrite;
+        if (chunk > num-written)
+            chunk = num-written;
+        (*fram_write)(SLOT_ADDR(logWrite), chunk*TRIUMVI_RECORD_SIZE,
+                &records[written*TRIUMVI_RECORD_SIZE]);
+        logWrite = logNextSlot(logWrite, chunk);
+        written += chunk;
+    }
+
+    logDirty += num;
+    if (logDirty >= FRAM_LOG_COMMIT_INTERVAL)
+        logCommit();
+    logSleep();
+    return num;
+}
+
+uint16_t framLogPeek(uint8_t* records, uint16_t num){
+    uint16_t chunk;
+    uint16_t slot;
+    uint16_t copied = 0;
+
+    logWake();
+    if (!logLoaded)
+        logLoad();
+    if (num > logUsed())
+        num = logUsed();
+
+    slot = logRead;
+    while (copied < num){
+        chunk = FRAM_LOG_SLOTS-slot;
+        if (chunk > num-copied)
+            chunk = num-copied;
+        (*fram_read)(SLOT_ADDR(slot), chunk*TRIUMVI_RECORD_SIZE,
+                &records[copied*TRIUMVI_RECORD_SIZE]);
+        slot = logNextSlot(slot, chunk);
+        copied += chunk;
+    }
+    logSleep();
+    return num;
+}
+
+void framLogRelease(uint16_t num){
+    if (!logLoaded)
+        framLogInit();
+    if (num > logUsed())
+        num = logUsed();
+    logRead = logNextSlot(logRead, num);
+    logDirty += num;
+    if (logDirty >= FRAM_LOG_COMMIT_INTERVAL)
+        framLogCommit();
+}
+
+void framLogPackRecord(uint8_t* dest, triumvi_record_t* thisSample, rv3049_time_t* rtctime){
+    // triumvi_record_t
+    packData(&dest[0], thisSample->avgPower, 4); // 0~3
+    dest[4] = thisSample->triumviStatusReg;
+    dest[5] = thisSample->panelID;
+    dest[6] = thisSample->circuitID;
+    packData(&dest[7], thisSample->pf, 2);
+    packData(&dest[9], thisSample->VRMS, 2);
+    packData(&dest[11], thisSample->IRMS, 2);
+    dest[FRAM_LOG_SEQ_BYTE] = 0x00; // filled in by framLogAppend
+    // rv3049_time_t
+    dest[14] = (rtctime->year - 2000);
+    dest[15] = rtctime->month;
+    dest[16] = rtctime->days;
+    dest[17] = rtctime->hours;
+    dest[18] = rtctime->minutes;
+    dest[19] = rtctime->seconds;
+}
+
+void framLogUnpackRecord(triumviData_t* record, uint8_t* src){
+    // triumvi_record_t
+    record->sample.avgPower = (src[3]<<24 | src[2]<<16 | src[1]<<8 | src[0]);
+    record->sample.triumviStatusReg = src[4];
+    record->sample.panelID = src[5];
+    record->sample.circuitID = src[6];
+    record->sample.pf = (src[8]<<8 | src[7]);
+    record->sample.VRMS = (src[10]<<8 | src[9]);
+    record->sample.IRMS = (src[12]<<8 | src[11]);
+
+    // time stamp
+    record->year = src[14] + 2000;
+    record->month = src[15];
+    record->days = src[16];
+    record->hours = src[17];
+    record->minutes = src[18];
+    record->seconds = src[19];
+}
+#endif
@@ -0,0 +1,51 @@
+#ifndef __FRAMLOG_H__
+#define __FRAMLOG_H__
+
+#include <stdint.h>
+#include "triumvi.h"
+
+// FRAM record log.
+// Ring of TRIUMVI_RECORD_SIZE records between FRAM_DATA_MIN_LOC_ADDR and
+// FRAM_DATA_MAX_LOC_ADDR. The read/write pointers are kept in RAM and only
+// written back every FRAM_LOG_COMMIT_INTERVAL records (or on framLogCommit),
+// together with the sequence number of the next record, in one transaction.
+// Every record carries its sequence number in byte 13, the first access after
+// boot scans forward from the committed write pointer and picks up records
+// that were written after the last commit.
+// Unread records survive a reboot, records read but not committed may be
+// read again.
+
+#ifndef FRAM_LOG_COMMIT_INTERVAL
+#define FRAM_LOG_COMMIT_INTERVAL 16
+#endif
+
+#define FRAM_LOG_SEQ_BYTE 13
+// number of record slots, one is always kept empty
+#define FRAM_LOG_SLOTS (((FRAM_DATA_MAX_LOC_ADDR-FRAM_DATA_MIN_LOC_ADDR)/TRIUMVI_RECORD_SIZE)+1)
+
+#ifdef FRAM_ENABLE
+// Load pointers from FRAM and recover uncommitted records.
+// Called on first use, call again after the FRAM is erased.
+void framLogInit();
+// Drop all records
+void framLogClear();
+// Write the RAM pointers back to FRAM if they changed
+void framLogCommit();
+// Number of unread records
+uint16_t framLogCount();
+
+// Append num packed records in one burst (two if the ring wraps).
+// Returns the number of records written, less than num if FRAM is full.
+uint16_t framLogAppend(uint8_t* records, uint16_t num);
+// Copy up to num oldest records without removing them, returns the number
+// of records copied
+uint16_t framLogPeek(uint8_t* records, uint16_t num);
+// Remove num oldest records
+void framLogRelease(uint16_t num);
+
+// record <-> TRIUMVI_RECORD_SIZE bytes
+void framLogPackRecord(uint8_t* dest, triumvi_record_t* thisSample, rv3049_time_t* rtctime);
+void framLogUnpackRecord(triumviData_t* record, uint8_t* src);
+#endif
+
+#endif
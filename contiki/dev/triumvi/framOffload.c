@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "sys/etimer.h"
+#include "net/packetbuf.h"
+#include "net/netstack.h"
+#include "cc2538-rf.h"
+#include "dev/crypto.h"
+#include "dev/ccm.h"
+#include "lib/random.h"
+#include "triumvi.h"
+#include "framLog.h"
+#include "framOffload.h"
+
+#ifdef FRAM_ENABLE
+
+typedef enum {
+    OFFLOAD_EVENT_NONE,
+    OFFLOAD_EVENT_REQ,
+    OFFLOAD_EVENT_STATUS
+} offloadEvent_t;
+
+static uint8_t offloadAddr[8];
+static volatile offloadEvent_t offloadEvent;
+static uint8_t offloadActive = 0;
+
+// current batch
+static uint8_t batchRecords[FRAM_OFFLOAD_FRAMES_PER_BATCH*FRAM_OFFLOAD_RECORDS_PER_FRAME*TRIUMVI_RECORD_SIZE];
+static uint16_t batchNumRecords;
+static uint8_t batchNumFrames;
+static uint8_t batchSeq = 0;
+static uint8_t batchMissing;    // bit i: frame i not confirmed
+static uint8_t frameBuf[FRAM_OFFLOAD_FRAME_LEN];
+// meter address, direction byte, nonce counter
+static uint8_t offloadNonce[13];
+// nonce of the last frame sent, a status has to echo it
+static uint8_t lastNonce[4];
+
+PROCESS(framOffloadProcess, "FRAM offload");
+
+static void offloadLoadBatch(){
+    uint8_t hold = triumviFramHold();
+    batchNumRecords = framLogPeek(batchRecords, FRAM_OFFLOAD_FRAMES_PER_BATCH*FRAM_OFFLOAD_RECORDS_PER_FRAME);
+    triumviFramRelease(hold);
+    // an empty batch is one frame without records
+    batchNumFrames = (batchNumRecords==0)? 1 :
+        (batchNumRecords+FRAM_OFFLOAD_RECORDS_PER_FRAME-1)/FRAM_OFFLOAD_RECORDS_PER_FRAME;
+    batchMissing = (uint8_t)((0x01<<batchNumFrames)-1);
+    batchSeq += 1;
+}
+
+static void offloadReleaseBatch(){
+    uint8_t hold = triumviFramHold();
+    framLogRelease(batchNumRecords);
+    framLogCommit();
+    triumviFramRelease(hold);
+}
+
+static uint8_t offloadBuildFrame(uint8_t idx){
+    uint16_t first = idx*FRAM_OFFLOAD_RECORDS_PER_FRAME;
+    uint8_t num = 0;
+    uint8_t pdataLen;
+    uint8_t i;
+
+    if (first < batchNumRecords)
+        num = ((batchNumRecords-first) > FRAM_OFFLOAD_RECORDS_PER_FRAME)?
+            FRAM_OFFLOAD_RECORDS_PER_FRAME : batchNumRecords-first;
+    frameBuf[0] = TRIUMVI_PKT_OFFLOAD_IDENTIFIER0;
+    frameBuf[1] = TRIUMVI_PKT_OFFLOAD_IDENTIFIER1;
+    // new nonce for every frame, resent frames included
+    packData(&frameBuf[2], ((uint32_t)random_rand()<<16) | random_rand(), 4);
+    frameBuf[6] = batchSeq;
+    frameBuf[7] = idx;
+    frameBuf[8] = batchNumFrames;
+    frameBuf[9] = num;
+    // drop the FRAM sequence byte, it only matters to the log
+    for (i=0; i<num; i++){
+        memcpy(&frameBuf[FRAM_OFFLOAD_HEADER_LEN+i*FRAM_OFFLOAD_RECORD_SIZE],
+            &batchRecords[(first+i)*TRIUMVI_RECORD_SIZE], FRAM_LOG_SEQ_BYTE);
+        memcpy(&frameBuf[FRAM_OFFLOAD_HEADER_LEN+i*FRAM_OFFLOAD_RECORD_SIZE+FRAM_LOG_SEQ_BYTE],
+            &batchRecords[(first+i)*TRIUMVI_RECORD_SIZE+FRAM_LOG_SEQ_BYTE+1],
+            TRIUMVI_RECORD_SIZE-FRAM_LOG_SEQ_BYTE-1);
+    }
+    pdataLen = FRAM_OFFLOAD_HEADER_LEN-6+num*FRAM_OFFLOAD_RECORD_SIZE;
+
+    // encrypt in place, MIC after the payload
+    offloadNonce[8] = 0;
+    memcpy(&offloadNonce[9], &frameBuf[2], 4);
+    memcpy(lastNonce, &frameBuf[2], 4);
+    ccm_auth_encrypt_start(LEN_LEN, 0, offloadNonce, offloadNonce, ADATA_LEN,
+        &frameBuf[6], pdataLen, MIC_LEN, NULL);
+    while(ccm_auth_encrypt_check_status()!=AES_CTRL_INT_STAT_RESULT_AV){}
+    ccm_auth_encrypt_get_result(&frameBuf[6+pdataLen], MIC_LEN);
+    return 6+pdataLen+MIC_LEN;
+}
+
+static void offloadSendMissing(){
+    uint8_t i;
+    uint8_t length;
+    for (i=0; i<batchNumFrames; i++){
+        // the last frame asks the gateway for a status
+        if ((batchMissing & (0x01<<i)) || (i==batchNumFrames-1)){
+            length = offloadBuildFrame(i);
+            packetbuf_copyfrom(frameBuf, length);
+            cc2538_on_and_transmit();
+        }
+    }
+}
+
+void framOffloadInit(uint8_t* extAddr){
+    memcpy(offloadAddr, extAddr, 8);
+    memcpy(offloadNonce, extAddr, 8);
+    process_start(&framOffloadProcess, NULL);
+}
+
+void framOffloadListen(){
+    if (offloadActive==0)
+        process_poll(&framOffloadProcess);
+}
+
+uint8_t framOffloadActive(){
+    return offloadActive;
+}
+
+// 1 if the control frame is from a gateway with AES_KEY, decrypts the
+// payload in place
+static uint8_t offloadCtrlAuth(uint8_t* data){
+    uint8_t mic[MIC_LEN];
+    offloadNonce[8] = FRAM_OFFLOAD_NONCE_GATEWAY;
+    memcpy(&offloadNonce[9], &data[10], 4);
+    ccm_auth_decrypt_start(LEN_LEN, 0, offloadNonce, &data[1], 9,
+        &data[14], FRAM_OFFLOAD_CTRL_PDATA_LEN+MIC_LEN, MIC_LEN, NULL);
+    while(ccm_auth_decrypt_check_status()!=AES_CTRL_INT_STAT_RESULT_AV){}
+    return (ccm_auth_decrypt_get_result(&data[14], FRAM_OFFLOAD_CTRL_PDATA_LEN+MIC_LEN,
+        mic, MIC_LEN)==CRYPTO_SUCCESS);
+}
+
+uint8_t framOffloadInput(uint8_t* data, uint8_t length){
+    if ((length < 10) || (data[0]!=TRIUMVI_OFFLOAD) || memcmp(&data[2], offloadAddr, 8))
+        return 0;
+    // frames without a valid MIC are dropped
+    if ((length != FRAM_OFFLOAD_CTRL_LEN) || (offloadCtrlAuth(data)==0))
+        return 1;
+    switch (data[1]){
+        case FRAM_OFFLOAD_CMD_REQ:
+            offloadEvent = OFFLOAD_EVENT_REQ;
+        break;
+        case FRAM_OFFLOAD_CMD_STATUS:
+            if ((offloadActive==0) || (data[14]!=batchSeq) || memcmp(&data[16], lastNonce, 4))
+                return 1;
+            batchMissing &= ~data[15];
+            offloadEvent = OFFLOAD_EVENT_STATUS;
+        break;
+        default:
+            return 1;
+    }
+    process_poll(&framOffloadProcess);
+    return 1;
+}
+
+PROCESS_THREAD(framOffloadProcess, ev, data) {
+    static struct etimer offload_timer;
+    static uint8_t rounds;
+    static uint8_t lastBatch;
+    uint8_t hold;
+    uint16_t logged;
+    PROCESS_BEGIN();
+
+    while (1){
+        PROCESS_WAIT_EVENT_UNTIL(ev==PROCESS_EVENT_POLL);
+        hold = triumviFramHold();
+        logged = framLogCount();
+        triumviFramRelease(hold);
+        if (logged==0)
+            continue;
+
+        // listen for a request
+        offloadEvent = OFFLOAD_EVENT_NONE;
+        NETSTACK_RADIO.on();
+        etimer_set(&offload_timer, FRAM_OFFLOAD_LISTEN);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&offload_timer) || (offloadEvent==OFFLOAD_EVENT_REQ));
+        if (offloadEvent!=OFFLOAD_EVENT_REQ){
+            CC2538_RF_CSP_ISRFOFF();
+            continue;
+        }
+
+        offloadActive = 1;
+        offloadLoadBatch();
+        rounds = 0;
+        while (rounds < FRAM_OFFLOAD_RETRIES){
+            offloadEvent = OFFLOAD_EVENT_NONE;
+            offloadSendMissing();
+            etimer_set(&offload_timer, FRAM_OFFLOAD_STATUS_WAIT);
+            PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&offload_timer) || (offloadEvent==OFFLOAD_EVENT_STATUS));
+            if (offloadEvent!=OFFLOAD_EVENT_STATUS){
+                rounds += 1;
+                continue;
+            }
+            rounds = 0;
+            if (batchMissing)
+                continue;
+            // batch confirmed
+            lastBatch = (batchNumRecords==0);
+            offloadReleaseBatch();
+            if (lastBatch)
+                break;
+            offloadLoadBatch();
+        }
+        CC2538_RF_CSP_ISRFOFF();
+        offloadActive = 0;
+    }
+    PROCESS_END();
+}
+#endif
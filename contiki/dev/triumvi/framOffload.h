@@ -0,0 +1,96 @@
+#ifndef __FRAMOFFLOAD_H__
+#define __FRAMOFFLOAD_H__
+
+#include <stdint.h>
+#include "contiki.h"
+
+// FRAM log offload.
+// The gateway asks a meter to drain its FRAM log (framLog.h) by answering a
+// regular reading with an offload request. The meter then sends the log in
+// batches of up to FRAM_OFFLOAD_FRAMES_PER_BATCH frames, each frame packs
+// FRAM_OFFLOAD_RECORDS_PER_FRAME records. After the last frame of a batch the
+// gateway answers with a bitmap of the frames it has, the meter resends the
+// missing ones (always ending with the last frame) until the batch is
+// complete, then removes the batch from FRAM and moves on. A frame with no
+// records ends the session.
+//
+// All offload frames use AES-CCM with AES_KEY like the readings, the nonce is
+// the meter address, a direction byte (0 meter -> gateway,
+// FRAM_OFFLOAD_NONCE_GATEWAY gateway -> meter) and the 4 byte nonce counter
+// sent in the frame, a new random one for every frame.
+//
+// Offload data frame, meter -> gateway
+// 1 byte ID0, 1 byte ID1, 4 bytes nonce, encrypted:
+// 1 byte batch, 1 byte frame index, 1 byte frames in batch,
+// 1 byte records in frame,
+// records, FRAM_OFFLOAD_RECORD_SIZE bytes each (FRAM record without the
+// sequence byte),
+// 4 bytes MIC, the meter address is the additional data
+//
+// Control frames, gateway -> meter
+// 1 byte TRIUMVI_OFFLOAD, 1 byte command, 8 bytes meter address,
+// 4 bytes nonce, encrypted:
+// 1 byte batch, 1 byte received frame bitmap, 4 bytes nonce of the frame
+// that asked for the status (all 0 in FRAM_OFFLOAD_CMD_REQ),
+// 4 bytes MIC, command and address are the additional data
+// Echoing the nonce keeps an old status from being replayed, the meter only
+// removes a batch from FRAM once the MIC and the echo check out.
+
+#define TRIUMVI_PKT_OFFLOAD_IDENTIFIER0 0xa1
+#define TRIUMVI_PKT_OFFLOAD_IDENTIFIER1 0x5c
+#define TRIUMVI_OFFLOAD 0xad
+#define FRAM_OFFLOAD_CMD_REQ 0x01
+#define FRAM_OFFLOAD_CMD_STATUS 0x02
+#define FRAM_OFFLOAD_NONCE_GATEWAY 0x01
+
+#define FRAM_OFFLOAD_HEADER_LEN 10    // clear and encrypted header
+#define FRAM_OFFLOAD_RECORD_SIZE (TRIUMVI_RECORD_SIZE-1)
+// 10 + 5*19 + 4 = 109 bytes, fits in a frame with a 64-bit source address
+#define FRAM_OFFLOAD_RECORDS_PER_FRAME 5
+#define FRAM_OFFLOAD_FRAME_LEN (FRAM_OFFLOAD_HEADER_LEN+FRAM_OFFLOAD_RECORDS_PER_FRAME*FRAM_OFFLOAD_RECORD_SIZE+MIC_LEN)
+#define FRAM_OFFLOAD_CTRL_PDATA_LEN 6
+#define FRAM_OFFLOAD_CTRL_LEN (14+FRAM_OFFLOAD_CTRL_PDATA_LEN+MIC_LEN)
+// at most 8, the status bitmap is 1 byte
+#ifndef FRAM_OFFLOAD_FRAMES_PER_BATCH
+#define FRAM_OFFLOAD_FRAMES_PER_BATCH 8
+#endif
+
+// radio stays on this long after a reading for an offload request
+#ifndef FRAM_OFFLOAD_LISTEN
+#define FRAM_OFFLOAD_LISTEN (CLOCK_SECOND/64)
+#endif
+// wait for a status after the last frame of a batch
+#ifndef FRAM_OFFLOAD_STATUS_WAIT
+#define FRAM_OFFLOAD_STATUS_WAIT (CLOCK_SECOND/16)
+#endif
+// give up after this many rounds without a status
+#ifndef FRAM_OFFLOAD_RETRIES
+#define FRAM_OFFLOAD_RETRIES 4
+#endif
+// meters hold off the next reading this long while a session runs, the
+// session needs the radio on
+#ifndef FRAM_OFFLOAD_HOLDOFF
+#define FRAM_OFFLOAD_HOLDOFF (RTIMER_SECOND/16)
+#endif
+
+#if FRAM_OFFLOAD_FRAMES_PER_BATCH > 8
+#error "FRAM_OFFLOAD_FRAMES_PER_BATCH is at most 8"
+#endif
+#if defined(FRAM_OFFLOAD) && !defined(FRAM_WRITE)
+#error "FRAM_OFFLOAD needs FRAM_WRITE, there is no log to send otherwise"
+#endif
+
+PROCESS_NAME(framOffloadProcess);
+
+// Start the offload process, extAddr is the 64-bit address of this meter
+void framOffloadInit(uint8_t* extAddr);
+// Call after a reading is transmitted, listens for an offload request if
+// there is anything in the FRAM log
+void framOffloadListen();
+// Pass received frames in, returns 1 if the frame belongs to the offload
+uint8_t framOffloadInput(uint8_t* data, uint8_t length);
+// 1 while a session is running, the meter must not start a reading (or
+// turn the radio off) meanwhile
+uint8_t framOffloadActive();
+
+#endif
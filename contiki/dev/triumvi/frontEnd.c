@@ -0,0 +1,148 @@
+#include <stdint.h>
+
+#include "contiki.h"
+#include "sys/rtimer.h"
+#include "adc.h"
+#include "soc-adc.h"
+#include "triumvi.h"
+#include "frontEnd.h"
+
+static const rtimer_clock_t settleMax[FRONTEND_STAGES] = {
+    FRONTEND_VOLTAGE_MAX_SETTLE, FRONTEND_CURRENT_MAX_SETTLE};
+
+static rtimer_clock_t settleLearned[FRONTEND_STAGES];
+static rtimer_clock_t settleSaved[FRONTEND_STAGES];
+static uint8_t settleLoaded = 0;
+
+// current stage
+static rtimer_clock_t settleStartTime;
+static rtimer_clock_t settleStableTime;
+static uint16_t settlePrevRef;
+static uint8_t settleStableCnt;
+// V_REF level the last settled stage ended at, 0 if none yet
+static uint16_t settleLastRef = 0;
+
+static uint8_t settleChecksum(uint8_t* buf){
+    uint8_t i;
+    uint8_t sum = 0;
+    for (i=0; i<FRONTEND_FRAM_LEN-1; i++)
+        sum ^= buf[i];
+    return sum;
+}
+
+// learned times from FRAM, half of the fixed delays if there are none
+static void settleLoad(){
+    uint8_t i;
+    #ifdef FRAM_ENABLE
+    uint8_t buf[FRONTEND_FRAM_LEN];
+    uint8_t hold = triumviFramHold();
+    triumviFramSettleRead(buf, FRONTEND_FRAM_LEN);
+    triumviFramRelease(hold);
+    #endif
+
+    settleLoaded = 1;
+    for (i=0; i<FRONTEND_STAGES; i++){
+        settleLearned[i] = settleMax[i]>>1;
+        #ifdef FRAM_ENABLE
+        if ((buf[0]==FRONTEND_FRAM_MAGIC) && (buf[FRONTEND_FRAM_LEN-1]==settleChecksum(buf)))
+            settleLearned[i] = (buf[2*i+2]<<8 | buf[2*i+1]);
+        if (settleLearned[i] > settleMax[i])
+            settleLearned[i] = settleMax[i];
+        #endif
+        settleSaved[i] = settleLearned[i];
+    }
+}
+
+static void settleCommit(){
+    #ifdef FRAM_ENABLE
+    uint8_t i;
+    uint8_t buf[FRONTEND_FRAM_LEN];
+    uint8_t hold;
+    buf[0] = FRONTEND_FRAM_MAGIC;
+    for (i=0; i<FRONTEND_STAGES; i++){
+        buf[2*i+1] = settleLearned[i] & 0xff;
+        buf[2*i+2] = (settleLearned[i] & 0xff00)>>8;
+        settleSaved[i] = settleLearned[i];
+    }
+    buf[FRONTEND_FRAM_LEN-1] = settleChecksum(buf);
+    hold = triumviFramHold();
+    triumviFramSettleWrite(buf, FRONTEND_FRAM_LEN);
+    triumviFramRelease(hold);
+    #endif
+}
+
+// moving average, 1/4 weight on the new measurement
+static void settleLearn(uint8_t stage, rtimer_clock_t measured){
+    int32_t diff = (int32_t)measured - (int32_t)settleLearned[stage];
+    settleLearned[stage] += diff/4;
+    diff = (int32_t)settleLearned[stage] - (int32_t)settleSaved[stage];
+    if ((diff >= FRONTEND_COMMIT_DELTA) || (diff <= -FRONTEND_COMMIT_DELTA))
+        settleCommit();
+}
+
+static uint16_t settleReadAdc(uint8_t channel){
+    uint16_t val = adc_get(channel, SOC_ADC_ADCCON_REF_EXT_SINGLE, SOC_ADC_ADCCON_DIV_512);
+    return ((val>>4)>2047)? 0 : (val>>4);
+}
+
+static uint16_t settleDiff(uint16_t a, uint16_t b){
+    return (a > b)? a-b : b-a;
+}
+
+rtimer_clock_t frontEndSettleStart(uint8_t stage){
+    rtimer_clock_t first;
+    if (settleLoaded==0)
+        settleLoad();
+    settleStartTime = RTIMER_NOW();
+    settleStableCnt = 0;
+    // stable readings have to start before the learned time to see it
+    first = settleLearned[stage] - (settleLearned[stage]>>2)
+        - (FRONTEND_STABLE_COUNT-1)*FRONTEND_POLL_INTERVAL;
+    if ((first < FRONTEND_POLL_INTERVAL) || (first > settleLearned[stage]))
+        first = FRONTEND_POLL_INTERVAL;
+    return first;
+}
+
+uint8_t frontEndSettleCheck(uint8_t stage, uint16_t expectedRef){
+    rtimer_clock_t now = RTIMER_NOW();
+    uint16_t ref = settleReadAdc(V_REF_ADC_CHANNEL);
+    uint16_t current;
+    uint8_t inRange;
+
+    if (expectedRef==0)
+        expectedRef = settleLastRef;
+    // V_REF has to be at its final level, only without any known level
+    // a reading close to the previous one is accepted
+    if (expectedRef > 0)
+        inRange = (settleDiff(ref, expectedRef) <= FRONTEND_REF_TOLERANCE);
+    else
+        inRange = (settleStableCnt > 0) && (settleDiff(ref, settlePrevRef) <= FRONTEND_REF_TOLERANCE);
+    // amplifier output is railed until the current path is up
+    if (inRange && (stage==FRONTEND_CURRENT)){
+        current = settleReadAdc(I_ADC_CHANNEL);
+        inRange = (current >= FRONTEND_CURRENT_RAIL) && (current <= 2047-FRONTEND_CURRENT_RAIL);
+    }
+
+    if (inRange){
+        if (settleStableCnt==0)
+            settleStableTime = now;
+        settleStableCnt += 1;
+    } else {
+        // a reading compared to the previous one counts as the first
+        settleStableCnt = (expectedRef > 0)? 0 : 1;
+        settleStableTime = now;
+    }
+    settlePrevRef = ref;
+
+    if (settleStableCnt >= FRONTEND_STABLE_COUNT){
+        settleLastRef = ref;
+        settleLearn(stage, settleStableTime - settleStartTime);
+        return 1;
+    }
+    // give up waiting, same as the fixed delay
+    if ((rtimer_clock_t)(now - settleStartTime) >= settleMax[stage]){
+        settleLearn(stage, settleMax[stage]);
+        return 1;
+    }
+    return 0;
+}
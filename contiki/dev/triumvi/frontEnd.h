@@ -0,0 +1,48 @@
+#ifndef __FRONTEND_H__
+#define __FRONTEND_H__
+
+#include <stdint.h>
+#include "contiki.h"
+#include "sys/rtimer.h"
+
+// Sensing front end power sequencing.
+// Instead of a fixed delay after powering a stage, the reference (V_REF) is
+// sampled every FRONTEND_POLL_INTERVAL and the stage is settled once
+// FRONTEND_STABLE_COUNT readings in a row are within FRONTEND_REF_TOLERANCE
+// of the expected level, or after the old fixed delay at the latest. The
+// expected level is the calibrated DC offset, else the level the last stage
+// settled at; with neither, readings are compared to the previous one. The
+// current stage also needs the current channel off the rails.
+// The time it took is learned per stage (moving average), the first check is
+// scheduled a little before the learned time so the learned value can also
+// go down. Learned times are kept in FRAM (FRAM_SETTLE_LOC_ADDR) and only
+// written back when they moved by FRONTEND_COMMIT_DELTA.
+
+#define FRONTEND_VOLTAGE 0  // LDO, voltage sensing
+#define FRONTEND_CURRENT 1  // current sensing, comparator
+#define FRONTEND_STAGES 2
+
+#ifndef FRONTEND_POLL_INTERVAL
+#define FRONTEND_POLL_INTERVAL (RTIMER_SECOND/128)
+#endif
+#define FRONTEND_STABLE_COUNT 3
+#define FRONTEND_REF_TOLERANCE 16   // 12-bit ADC codes
+#define FRONTEND_CURRENT_RAIL 64    // 12-bit ADC codes
+
+// fixed delays used before, upper bound of each stage
+#define FRONTEND_VOLTAGE_MAX_SETTLE (RTIMER_SECOND*0.4)
+#define FRONTEND_CURRENT_MAX_SETTLE (RTIMER_SECOND*0.3)
+
+#define FRONTEND_COMMIT_DELTA (RTIMER_SECOND/64)
+#define FRONTEND_FRAM_MAGIC 0x53
+#define FRONTEND_FRAM_LEN 6     // magic, 2 bytes per stage, checksum
+
+// Call right after the stage is powered, returns the delay until the first
+// frontEndSettleCheck
+rtimer_clock_t frontEndSettleStart(uint8_t stage);
+// Samples the reference, returns 1 once the stage is settled, otherwise call
+// again after FRONTEND_POLL_INTERVAL. The front end must be powered.
+// expectedRef is the calibrated V_REF level in 12-bit codes, 0 if unknown.
+uint8_t frontEndSettleCheck(uint8_t stage, uint16_t expectedRef);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "contiki.h"
+#include "cpu.h"
+#include "reg.h"
+#include "scb.h"
+#include "nvic.h"
+#include "systick.h"
+#include "dev/sys-ctrl.h"
+#include "dev/gptimer.h"
+#include "dev/udma.h"
+#include "soc-adc.h"
+#include "board.h"
+#include "meterCalc.h"
+#include "meterSampler.h"
+#include "triumvi.h"
+
+// a 12-bit conversion takes (512+16)/4 MHz = 132 us, it has to finish
+// before the next time out
+#if (1000000/(GRID_FREQ*BUF_SIZE)) <= 132
+#error "SAMPLES_PER_CYCLE is too high for 12-bit conversions"
+#endif
+
+// ADCCON3 is written by uDMA, one 32-bit word per time out, the
+// address does not increment on either side
+#define SAMPLER_DMA_FLAG (UDMA_CHCTL_DSTINC_NONE | \
+                        UDMA_CHCTL_DSTSIZE_32 | \
+                        UDMA_CHCTL_SRCINC_NONE | \
+                        UDMA_CHCTL_SRCSIZE_32 | \
+                        UDMA_CHCTL_ARBSIZE_1 | \
+                        UDMA_CHCTL_XFERMODE_BASIC)
+
+// a basic uDMA transfer is at most 1024 items, long captures re-arm the
+// channel every SAMPLER_DMA_REARM samples so it never runs out
+#define SAMPLER_DMA_MAX 1024
+#define SAMPLER_DMA_REARM 256
+
+// extra conversion commands, same as adc_get
+static uint32_t currentCmd;
+static uint32_t voltCmd;
+
+static uint16_t* samplerCurrBuf;
+static int* samplerVoltBuf;
+static uint32_t samplerLength;      // samples in the capture
+static uint16_t samplerBufLength;   // buffer length, 2 halves in streaming mode
+static uint16_t samplerHalfLength;  // 0 if not streaming
+static volatile uint32_t samplerCnt;
+static volatile uint16_t samplerIdx;
+static volatile uint8_t samplerVoltPending;
+static volatile uint8_t samplerHalfReady;   // 1: first half, 2: second half
+static volatile uint8_t samplerOverrun;
+static uint8_t (*samplerFold)(uint16_t*, int*, uint16_t);
+
+void meterSamplerInit(){
+    ungate_gpt(SAMPLER_GPTIMER);
+    gpt_set_mode(SAMPLER_GPTIMER, GPTIMER_SUBTIMER_A, GPTIMER_TAMR_TAMR_PERIODIC);
+    gpt_set_count_dir(SAMPLER_GPTIMER, GPTIMER_SUBTIMER_A, GPTIMER_TnMR_TnCDIR_COUNT_DOWN);
+    // time out requests a DMA transfer, no CPU interrupt
+    REG(SAMPLER_GPTIMER_BASE + GPTIMER_DMAEV) = GPTIMER_DMAEV_TATODMAEN;
+    gate_gpt(SAMPLER_GPTIMER);
+    // keep the timer clocked while the CPU is in WFI, and GPTIMER_1 as
+    // well, meterWaitCrossing times its sleep with it
+    REG(SYS_CTRL_SCGCGPT) |= SYS_CTRL_SCGCGPT_GPT3 | SYS_CTRL_SCGCGPT_GPT1;
+
+    udma_channel_disable(SAMPLER_DMA_CHAN);
+    udma_channel_prio_set_default(SAMPLER_DMA_CHAN);
+    udma_channel_use_primary(SAMPLER_DMA_CHAN);
+    udma_channel_use_single(SAMPLER_DMA_CHAN);
+    udma_channel_mask_clr(SAMPLER_DMA_CHAN);
+    udma_set_channel_dst(SAMPLER_DMA_CHAN, SOC_ADC_ADCCON3);
+    udma_set_channel_assignment(SAMPLER_DMA_CHAN, SAMPLER_DMA_ASSIGNMENT);
+
+    nvic_interrupt_disable(NVIC_INT_ADC);
+}
+
+// Sample 0 is started by the CPU together with the timer, the remaining
+// length-1 conversions are started by the timer through uDMA.
+// Returns -1 if a half buffer was overwritten before it was folded.
+static int samplerRun(uint32_t* cmd, uint32_t period){
+    uint8_t half;
+    uint8_t stop = 0;
+    uint16_t offset;
+
+    samplerCnt = 0;
+    samplerIdx = 0;
+    samplerVoltPending = 0;
+    samplerHalfReady = 0;
+    samplerOverrun = 0;
+
+    udma_set_channel_src(SAMPLER_DMA_CHAN, (uint32_t)cmd);
+    udma_set_channel_control_word(SAMPLER_DMA_CHAN,
+        (SAMPLER_DMA_FLAG | udma_xfer_size((samplerLength-1 < SAMPLER_DMA_MAX)? samplerLength-1 : SAMPLER_DMA_MAX)));
+    udma_channel_enable(SAMPLER_DMA_CHAN);
+
+    ungate_gpt(SAMPLER_GPTIMER);
+    gpt_set_interval_value(SAMPLER_GPTIMER, GPTIMER_SUBTIMER_A, period);
+    REG(SAMPLER_GPTIMER_BASE + GPTIMER_ICR) = GPTIMER_ICR_TATOCINT;
+
+    // read ADCH to clear a stale end of conversion
+    REG(SOC_ADC_ADCH);
+    nvic_interrupt_unpend(NVIC_INT_ADC);
+    nvic_interrupt_enable(NVIC_INT_ADC);
+
+    // light sleep only, the ADC and uDMA need the system clock
+    REG(SCB_SYSCTRL) &= ~SCB_SYSCTRL_SLEEPDEEP;
+
+    INTERRUPTS_DISABLE();
+    REG(SOC_ADC_ADCCON3) = *cmd;
+    gpt_enable_event(SAMPLER_GPTIMER, GPTIMER_SUBTIMER_A);
+    // PRIMASK is set, an interrupt that fires between the check and WFI
+    // is left pending and wakes the core right away
+    while ((samplerCnt < samplerLength) || samplerHalfReady){
+        // fold a completed half while the ISR fills the other one
+        if (samplerHalfReady){
+            half = samplerHalfReady;
+            samplerHalfReady = 0;
+            INTERRUPTS_ENABLE();
+            offset = (half==1)? 0 : samplerHalfLength;
+            if (!stop)
+                stop = (*samplerFold)(&samplerCurrBuf[offset], &samplerVoltBuf[offset], samplerHalfLength);
+            INTERRUPTS_DISABLE();
+            if (stop)
+                samplerLength = samplerCnt;
+            continue;
+        }
+        asm("wfi");
+        INTERRUPTS_ENABLE();
+        INTERRUPTS_DISABLE();
+    }
+    INTERRUPTS_ENABLE();
+
+    REG(SAMPLER_GPTIMER_BASE + GPTIMER_CTL) &= ~GPTIMER_CTL_TAEN;
+    gate_gpt(SAMPLER_GPTIMER);
+    nvic_interrupt_disable(NVIC_INT_ADC);
+    udma_channel_disable(SAMPLER_DMA_CHAN);
+
+    return (samplerOverrun)? -1 : 0;
+}
+
+uint8_t meterWaitCrossing(volatile uint8_t* crossed){
+    uint32_t timerExp = get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A) - METER_CROSS_TIMEOUT;
+
+    REG(SCB_SYSCTRL) &= ~SCB_SYSCTRL_SLEEPDEEP;
+    REG(SYSTICK_STCTRL) |= SYSTICK_STCTRL_INTEN;
+    // same as samplerRun, a crossing between the check and WFI is left
+    // pending and wakes the core right away
+    INTERRUPTS_DISABLE();
+    while ((*crossed==0) && (get_event_time(GPTIMER_1, GPTIMER_SUBTIMER_A) > timerExp)){
+        asm("wfi");
+        INTERRUPTS_ENABLE();
+        INTERRUPTS_DISABLE();
+    }
+    REG(SYSTICK_STCTRL) &= (~SYSTICK_STCTRL_INTEN);
+    INTERRUPTS_ENABLE();
+
+    if (*crossed)
+        return 1;
+    meterVoltageComparator(SENSE_DISABLE);
+    return 0;
+}
+
+void meterSampleCurrent(uint16_t* currentBuf, uint16_t length){
+    currentCmd = SOC_ADC_ADCCON_REF_EXT_SINGLE | SOC_ADC_ADCCON_DIV_512 | I_ADC_CHANNEL;
+    samplerCurrBuf = currentBuf;
+    samplerVoltBuf = NULL;
+    samplerLength = length;
+    samplerBufLength = length;
+    samplerHalfLength = 0;
+    samplerRun(&currentCmd, SAMPLER_PERIOD(length));
+}
+
+void meterSampleCurrentVoltage(uint16_t* currentBuf, int* voltBuf, uint16_t length){
+    currentCmd = SOC_ADC_ADCCON_REF_EXT_SINGLE | SOC_ADC_ADCCON_DIV_256 | I_ADC_CHANNEL;
+    voltCmd = SOC_ADC_ADCCON_REF_EXT_SINGLE | SOC_ADC_ADCCON_DIV_256 | EXT_VOLT_IN_ADC_CHANNEL;
+    samplerCurrBuf = currentBuf;
+    samplerVoltBuf = voltBuf;
+    samplerLength = length;
+    samplerBufLength = length;
+    samplerHalfLength = 0;
+    // buffer holds 2 cycles
+    samplerRun(&currentCmd, SAMPLER_PERIOD(length>>1));
+}
+
+int meterStreamCurrentVoltage(uint16_t* currentBuf, int* voltBuf, uint16_t cycleLength,
+        uint16_t numOfCycles, uint8_t (*fold)(uint16_t*, int*, uint16_t)){
+    currentCmd = SOC_ADC_ADCCON_REF_EXT_SINGLE | SOC_ADC_ADCCON_DIV_256 | I_ADC_CHANNEL;
+    voltCmd = SOC_ADC_ADCCON_REF_EXT_SINGLE | SOC_ADC_ADCCON_DIV_256 | EXT_VOLT_IN_ADC_CHANNEL;
+    samplerCurrBuf = currentBuf;
+    samplerVoltBuf = voltBuf;
+    samplerLength = (uint32_t)cycleLength*numOfCycles;
+    samplerBufLength = cycleLength<<1;
+    samplerHalfLength = cycleLength;
+    samplerFold = fold;
+    return samplerRun(&currentCmd, SAMPLER_PERIOD(cycleLength));
+}
+
+// a half is done, hand it to the thread
+static void samplerHalfDone(){
+    if ((samplerHalfLength==0) || ((samplerIdx % samplerHalfLength)!=0))
+        return;
+    if (samplerHalfReady)
+        samplerOverrun = 1;
+    samplerHalfReady = (samplerIdx==samplerHalfLength)? 1 : 2;
+}
+
+void meter_adc_isr(void){
+    uint16_t temp;
+    // reading ADCH clears the end of conversion flag
+    temp = (REG(SOC_ADC_ADCL) & 0xfc);
+    temp |= (REG(SOC_ADC_ADCH) << 8);
+
+    if (samplerCnt >= samplerLength)
+        return;
+
+    // current only, 12-bit
+    if (samplerVoltBuf == NULL){
+        samplerCurrBuf[samplerIdx] = ((temp>>4)>2047)? 0 : (temp>>4);
+    }
+    // current/voltage pair, 10-bit
+    else if (samplerVoltPending == 0){
+        samplerCurrBuf[samplerIdx] = ((temp>>5)>1023)? 0 : (temp>>5);
+        REG(SOC_ADC_ADCCON3) = voltCmd;
+        samplerVoltPending = 1;
+        // between two time outs the channel is idle, safe to rewrite
+        if (samplerHalfLength && samplerCnt && ((samplerCnt % SAMPLER_DMA_REARM)==0)){
+            udma_set_channel_control_word(SAMPLER_DMA_CHAN,
+                (SAMPLER_DMA_FLAG | udma_xfer_size(SAMPLER_DMA_MAX)));
+        }
+        return;
+    }
+    else{
+        samplerVoltBuf[samplerIdx] = ((temp>>5)>1023)? 0 : (temp>>5);
+        samplerVoltPending = 0;
+    }
+    samplerCnt++;
+    samplerIdx++;
+    samplerHalfDone();
+    if (samplerIdx >= samplerBufLength)
+        samplerIdx = 0;
+}
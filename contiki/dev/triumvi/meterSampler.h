@@ -0,0 +1,67 @@
+#ifndef __METERSAMPLER_H__
+#define __METERSAMPLER_H__
+
+#include <stdint.h>
+
+// Timer paced waveform capture.
+// GPTIMER_3A runs at the sample rate, each time out triggers a uDMA transfer
+// that writes the conversion command into ADCCON3, so the ADC starts at
+// exactly the same place in every period no matter what the CPU is doing.
+// The end of conversion interrupt stores the result and the CPU sleeps in
+// WFI for the rest of the capture.
+
+#ifdef FIFTYHZ
+#define GRID_FREQ 50
+#else
+#define GRID_FREQ 60
+#endif
+
+// GPTIMER clock, 266667 ticks per 60 Hz cycle
+#ifdef SYS_CTRL_SYS_CLOCK
+#define SAMPLER_TIMER_CLOCK SYS_CTRL_SYS_CLOCK
+#else
+#define SAMPLER_TIMER_CLOCK 16000000
+#endif
+
+// timer ticks between samples, rounded to nearest
+#define SAMPLER_PERIOD(samplesPerCycle) \
+    ((SAMPLER_TIMER_CLOCK + (GRID_FREQ*(samplesPerCycle)>>1))/(GRID_FREQ*(samplesPerCycle)))
+
+#define SAMPLER_GPTIMER         GPTIMER_3
+#define SAMPLER_GPTIMER_BASE    GPT_3_BASE
+#define SAMPLER_DMA_CHAN        2
+#define SAMPLER_DMA_ASSIGNMENT  UDMA_CH2_TIMER3A
+
+// configure timer and DMA channel, call once from meterInit
+void meterSamplerInit();
+
+// 12-bit current samples, length samples in one cycle
+void meterSampleCurrent(uint16_t* currentBuf, uint16_t length);
+
+// 10-bit current/voltage pairs, length pairs in two cycles
+// the voltage conversion starts right after the current one finishes
+void meterSampleCurrentVoltage(uint16_t* currentBuf, int* voltBuf, uint16_t length);
+
+// Streams numOfCycles cycles of 10-bit current/voltage pairs through a
+// ping-pong buffer of 2*cycleLength pairs. fold is called with each completed
+// half (one cycle) from thread context while the ISR fills the other half,
+// it returns non zero to end the capture early.
+// Returns -1 if fold did not keep up and a half was overwritten.
+int meterStreamCurrentVoltage(uint16_t* currentBuf, int* voltBuf, uint16_t cycleLength,
+        uint16_t numOfCycles, uint8_t (*fold)(uint16_t*, int*, uint16_t));
+
+// GPTIMER_1 ticks to wait for a zero crossing, 20 ms
+#define METER_CROSS_TIMEOUT 320000
+
+// Sleeps (WFI) until the comparator interrupt sets *crossed, or until
+// METER_CROSS_TIMEOUT ticks of GPTIMER_1 pass. GPTIMER_1 must be running,
+// meterSamplerInit keeps it clocked in sleep mode.
+// SysTick interrupt is on during the wait to wake the core for the time
+// out check and off again on return, as for sampling. The comparator is
+// disabled on a time out. Returns 1 on a crossing.
+uint8_t meterWaitCrossing(volatile uint8_t* crossed);
+
+// ADC end of conversion ISR, in the vector table
+void meter_adc_isr(void);
+
+#endif
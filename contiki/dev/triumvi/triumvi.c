@@ -9,6 +9,7 @@
 #include "rv3049.h"
 #include "sx1509b.h"
 #include "triumvi.h"
+#include "framLog.h"
 #include "ad5274.h"
 #include "ioc.h"
 
@@ -102,125 +103,68 @@ uint16_t triumviFramDCOffsetRead(uint8_t inaGainIdx){
     return (readBuf[1]<<8 | readBuf[0]);
 }
 
-uint16_t getReadWritePtr(uint8_t ptrType){
-    uint8_t readBuf[2];
-    uint16_t destAddr = (ptrType==READ_PTR_TYPE)? FRAM_READ_PTR_LOC_ADDR : FRAM_WRITE_PTR_LOC_ADDR; 
-    (*fram_read)(destAddr, 2, readBuf);
-    uint16_t myPtr = (readBuf[0]<<8 | readBuf[1]);
-    return myPtr;
+void triumviFramCalibrateStoreWrite(uint8_t* data, uint16_t length){
+    (*fram_write)(FRAM_CALIBRATION_STORE_LOC_ADDR, length, data);
 }
 
-void triumviFramPtrClear(){
-    // using Big Endianness
-    uint8_t writeBuf[2];
-    writeBuf[0] = (FRAM_DATA_MIN_LOC_ADDR&0xff00)>>8;
-    writeBuf[1] = FRAM_DATA_MIN_LOC_ADDR&0xff;
-    #ifdef FM25V02
-    fm25v02_dummyWakeup();
-    #endif
-    (*fram_write)(FRAM_WRITE_PTR_LOC_ADDR, 2, writeBuf);
-    (*fram_write)(FRAM_READ_PTR_LOC_ADDR, 2, writeBuf);
-    #ifdef FM25V02
-    fm25v02_sleep();
+void triumviFramCalibrateStoreRead(uint8_t* data, uint16_t length){
+    (*fram_read)(FRAM_CALIBRATION_STORE_LOC_ADDR, length, data);
+}
+
+void triumviFramSettleWrite(uint8_t* data, uint16_t length){
+    (*fram_write)(FRAM_SETTLE_LOC_ADDR, length, data);
+}
+
+void triumviFramSettleRead(uint8_t* data, uint16_t length){
+    (*fram_read)(FRAM_SETTLE_LOC_ADDR, length, data);
+}
+
+void triumviFramEnergyWrite(uint8_t slot, uint8_t* data, uint16_t length){
+    (*fram_write)(FRAM_ENERGY_LOC_ADDR+slot*length, length, data);
+}
+
+void triumviFramEnergyRead(uint8_t slot, uint8_t* data, uint16_t length){
+    (*fram_read)(FRAM_ENERGY_LOC_ADDR+slot*length, length, data);
+}
+
+// FRAM hold pin shares the analog switch on version 10/11, set it for the
+// access and hand back the previous state, the sensing frontend may be in use
+uint8_t triumviFramHold(){
+    #if defined(VERSION10) || defined(VERSION11)
+    uint8_t prev = GPIO_READ_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN);
+    GPIO_SET_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN);
+    return prev;
+    #else
+    return 1;
     #endif
 }
 
-void updatePtr(uint8_t ptrType, uint16_t readWritePtr){
-    if (readWritePtr < FRAM_DATA_MAX_LOC_ADDR){
-        readWritePtr += TRIUMVI_RECORD_SIZE;
-    } else{
-        readWritePtr = FRAM_DATA_MIN_LOC_ADDR;
-    }
+void triumviFramRelease(uint8_t prev){
+    #if defined(VERSION10) || defined(VERSION11)
+    if (prev==0)
+        GPIO_CLR_PIN(GPIO_PORT_TO_BASE(FM25V02_HOLD_N_PORT_NUM), 0x1<<FM25V02_HOLD_N_PIN);
+    #endif
+}
 
-    uint8_t writeBuf[2];
-    writeBuf[0] = (readWritePtr & 0xff00)>>8;
-    writeBuf[1] = readWritePtr & 0xff;
-    uint16_t destAddr = (ptrType==READ_PTR_TYPE)? FRAM_READ_PTR_LOC_ADDR : FRAM_WRITE_PTR_LOC_ADDR; 
-    (*fram_write)(destAddr, 2, writeBuf);
+void triumviFramPtrClear(){
+    framLogClear();
 }
 
 // Write record into FRAM, return -1 if FRAM is full
 // Otherwise, return 0 (success)
 int triumviFramWrite(triumvi_record_t* thisSample, rv3049_time_t* rtctime){
-    // Dummy read, wake up FRAM
-    #ifdef FM25V02
-    fm25v02_dummyWakeup();
-    #endif
-    uint16_t readPtr = getReadWritePtr(READ_PTR_TYPE);
-    uint16_t writePtr = getReadWritePtr(WRITE_PTR_TYPE);
-    static uint8_t writeBuf[TRIUMVI_RECORD_SIZE] = {0xff};
-    if (writePtr < readPtr){
-        // FRAM is full
-        if (readPtr == (writePtr + TRIUMVI_RECORD_SIZE)){
-            return -1;
-        }
-    } else {
-        // FRAM is full
-        if ((readPtr==FRAM_DATA_MIN_LOC_ADDR ) && (writePtr==FRAM_DATA_MAX_LOC_ADDR )){
-            return -1;
-        }
-    }
-    // triumvi_record_t 
-    packData(&writeBuf[0], thisSample->avgPower, 4); // 0~3
-    writeBuf[4] = thisSample->triumviStatusReg;
-    writeBuf[5] = thisSample->panelID;
-    writeBuf[6] = thisSample->circuitID;
-    packData(&writeBuf[7], thisSample->pf, 2); 
-    packData(&writeBuf[9], thisSample->VRMS, 2); 
-    packData(&writeBuf[11], thisSample->IRMS, 2); 
-    writeBuf[13] = 0x00; // reserved byte, 0 for now
-    // rv3049_time_t
-    writeBuf[14] = (rtctime->year - 2000);
-    writeBuf[15] = rtctime->month;
-    writeBuf[16] = rtctime->days;
-    writeBuf[17] = rtctime->hours;
-    writeBuf[18] = rtctime->minutes;
-    writeBuf[19] = rtctime->seconds;
-
-    (*fram_write)(writePtr, TRIUMVI_RECORD_SIZE, writeBuf);
-    updatePtr(WRITE_PTR_TYPE, writePtr);
-
-    #ifndef FM25V02
-    fm25v02_sleep();
-    #endif
-    return 0;
+    static uint8_t writeBuf[TRIUMVI_RECORD_SIZE];
+    framLogPackRecord(writeBuf, thisSample, rtctime);
+    return (framLogAppend(writeBuf, 1)==1)? 0 : -1;
 }
 
+// Read and remove the oldest record, return -1 if FRAM is empty
 int triumviFramRead(triumviData_t* record){
-    // Dummy read, wake up FRAM
-    #ifdef FM25V02
-    fm25v02_dummyWakeup();
-    #endif
-    uint16_t readPtr = getReadWritePtr(READ_PTR_TYPE);
-    uint16_t writePtr = getReadWritePtr(WRITE_PTR_TYPE);
     static uint8_t readBuf[TRIUMVI_RECORD_SIZE];
-    // FRAM is empty
-    if (readPtr==writePtr){
+    if (framLogPeek(readBuf, 1)==0)
         return -1;
-    }
-    (*fram_read)(readPtr, TRIUMVI_RECORD_SIZE, readBuf);
-
-    // triumvi_record_t
-    record->sample.avgPower = (readBuf[3]<<24 | readBuf[2]<<16 | readBuf[1]<<8 | readBuf[0]);
-    record->sample.triumviStatusReg = readBuf[4];
-    record->sample.panelID = readBuf[5];
-    record->sample.circuitID = readBuf[6];
-    record->sample.pf = (readBuf[8]<<8 | readBuf[7]);
-    record->sample.VRMS = (readBuf[10]<<8 | readBuf[9]);
-    record->sample.IRMS = (readBuf[12]<<8 | readBuf[11]);
-
-    // time stamp
-    record->year = readBuf[14] + 2000;
-    record->month = readBuf[15];
-    record->days = readBuf[16];
-    record->hours = readBuf[17];
-    record->minutes = readBuf[18];
-    record->seconds = readBuf[19];
-
-    updatePtr(READ_PTR_TYPE, readPtr);
-    #ifndef FM25CL64B
-    fm25v02_sleep();
-    #endif
+    framLogUnpackRecord(record, readBuf);
+    framLogRelease(1);
     return 0;
 }
 #endif
@@ -752,57 +696,3 @@ void batteryChargingEnable(uint8_t en){
 }
 #endif
 #endif
-
-uint16_t mysqrt(uint32_t n){
-    uint32_t xn = n;
-    uint8_t i;
-    for (i=0; i<20; i++){
-        xn = (xn + n/xn)/2;
-    }
-    return (uint16_t)xn;
-}
-
-// return average value
-uint16_t getAverage(uint16_t* data, uint16_t length){
-    uint16_t i;
-    uint32_t sum = 0;
-    for (i=0; i<length; i++)
-        sum += data[i];
-    return (uint16_t)(sum/length);
-}
-
-// return average value
-uint16_t getAverage32(int* data, uint16_t length){
-    uint16_t i;
-    uint32_t sum = 0;
-    for (i=0; i<length; i++)
-        sum += data[i];
-    return (uint16_t)(sum/length);
-}
-
-// calculate variance of phase offset array 
-uint16_t getVariance(uint16_t* data, uint16_t length){
-    uint16_t i;
-    uint16_t avg = getAverage(data, length);
-    int sqr;
-    uint16_t variance = 0;
-    for (i=0; i<length; i++){
-        sqr = data[i] - avg;
-        variance += (sqr*sqr);
-    }
-    variance /= length;
-    return variance;
-}
-
-// dest[0] = src&0xff
-// dest[1] = (src&0xff00)>>8
-// dest[2] = (src&0xff0000)>>16
-// dest[3] = (src&0xff000000)>>24
-void packData(uint8_t* dest, int src, uint8_t len){
-    uint8_t i;
-    for (i=0; i<len; i++){
-        dest[i] = (src&(0xff<<(i<<3)))>>(i<<3);
-    }
-}
-
-
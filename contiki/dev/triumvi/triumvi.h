@@ -15,13 +15,20 @@ int (*fram_write)(uint16_t, uint16_t, uint8_t*);
 int (*fram_read)(uint16_t, uint16_t, uint8_t*);
 #endif
 void (*fram_erase_all)();
-#define TRIUMVI_RECORD_SIZE 20  // size of each record, 6 bytes time, 13 bytes power, 1 byte reserved
+#define TRIUMVI_RECORD_SIZE 20  // size of each record, 6 bytes time, 13 bytes power, 1 byte sequence number
+#define FRAM_LOG_SEQ_LOC_ADDR 11	// Addr 11, next record sequence number, see framLog.h
 #define FRAM_WRITE_PTR_LOC_ADDR 12	// Addr 12~13
 #define FRAM_READ_PTR_LOC_ADDR 14	// Addr 14~15
 #define FRAM_CALIBRATION_DATA_VALID_LOC_ADDR 16         // 1 byte, 7 bits idx, 1 bits valid
 #define FRAM_CALIBRATION_DATA_PHASE_OFFSET_LOC_ADDR 18  // 4 bytes
 #define FRAM_CALIBRATION_DATA_I_FIT_LOC_ADDR 22         // 4 bytes, 22 + 24*idx
 #define FRAM_CALIBRATION_DATA_P_FIT_LOC_ADDR 34         // 4 bytes, 34 + 24*idx
+// calStore_t image, replaces the layout above (16~159), see calStore.h
+#define FRAM_CALIBRATION_STORE_LOC_ADDR 16
+// learned front end settle times (160~165), see frontEnd.h
+#define FRAM_SETTLE_LOC_ADDR 160
+// accumulated energy, two 8 byte slots (166~181), see energyAcc.h
+#define FRAM_ENERGY_LOC_ADDR 166
 
 #define CURRENT_FIT_TYPE 0x0
 #define POWER_FIT_TYPE 0x1
@@ -29,8 +36,6 @@ void (*fram_erase_all)();
 #define COUNTER_LOC_ADDR 192
 #define DC_OFFSET_LOC_ADDR 196
 #define FRAM_DATA_MIN_LOC_ADDR 212
-#define READ_PTR_TYPE 0x0
-#define WRITE_PTR_TYPE 0x1
 
 #define VOLTAGE 0x0
 #define CURRENT 0x1
@@ -84,6 +89,8 @@ typedef struct {
 int triumviFramWrite(triumvi_record_t* thisSample, rv3049_time_t* rtctime);
 int triumviFramRead(triumviData_t* record);
 void triumviFramPtrClear();
+uint8_t triumviFramHold();
+void triumviFramRelease(uint8_t prev);
 // clear data valid flag
 void triumviFramCalibrateDataValidClear();
 uint8_t triumviFramCalibrateDataValidRead();
@@ -95,6 +102,12 @@ void triumviFramCounterWrite(uint32_t counterVal);
 uint32_t triumviFramCounterRead();
 void triumviFramDCOffsetWrite(uint16_t dc_offset, uint8_t inaGainIdx);
 uint16_t triumviFramDCOffsetRead(uint8_t inaGainIdx);
+void triumviFramCalibrateStoreWrite(uint8_t* data, uint16_t length);
+void triumviFramCalibrateStoreRead(uint8_t* data, uint16_t length);
+void triumviFramSettleWrite(uint8_t* data, uint16_t length);
+void triumviFramSettleRead(uint8_t* data, uint16_t length);
+void triumviFramEnergyWrite(uint8_t slot, uint8_t* data, uint16_t length);
+void triumviFramEnergyRead(uint8_t slot, uint8_t* data, uint16_t length);
 #endif
 
 void triumviLEDinit();
@@ -170,6 +183,7 @@ void batteryChargingEnable(uint8_t en);
 #endif
 #endif
 
+// Helpers below are implemented in dev/triumviLib/meterCalc.c
 uint16_t mysqrt(uint32_t n);
 
 // return variance of phase offsets 
@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include "aggReport.h"
+
+void aggReportClear(aggReport_t* agg){
+    agg->len = 0;
+    agg->count = 0;
+    agg->prevPower = 0;
+    agg->span = 0;
+}
+
+static void aggPack(uint8_t* buf, uint32_t val, uint8_t len){
+    uint8_t i;
+    for (i=0; i<len; i++)
+        buf[i] = (val >> (8*i)) & 0xff;
+}
+
+void aggReportAdd(aggReport_t* agg, int32_t power, uint32_t elapsed){
+    uint32_t ticks;
+    int32_t diff;
+
+    if (agg->len + AGG_REPORT_WORST > AGG_REPORT_MAX_LEN)
+        return;
+    if (agg->count == 0){
+        aggPack(&agg->buf[0], (uint32_t)power, 4);
+        agg->len = 4;
+    }
+    else{
+        ticks = (elapsed + AGG_REPORT_TIME_UNIT/2)/AGG_REPORT_TIME_UNIT;
+        aggPack(&agg->buf[agg->len], (ticks > 0xffff)? 0xffff : ticks, 2);
+        diff = power - agg->prevPower;
+        if ((diff > 0x7fff) || (diff <= AGG_REPORT_ESCAPE)){
+            aggPack(&agg->buf[agg->len+2], (uint16_t)AGG_REPORT_ESCAPE, 2);
+            aggPack(&agg->buf[agg->len+4], (uint32_t)power, 4);
+            agg->len += 8;
+        }
+        else{
+            aggPack(&agg->buf[agg->len+2], (uint16_t)diff, 2);
+            agg->len += 4;
+        }
+        agg->span += elapsed;
+    }
+    agg->prevPower = power;
+    agg->count += 1;
+}
+
+uint8_t aggReportDue(aggReport_t* agg, uint8_t batch, uint32_t next, uint32_t maxStale){
+    if (agg->count == 0)
+        return 0;
+    if ((agg->count >= batch) ||
+        (agg->span + next > maxStale) ||
+        (agg->len + AGG_REPORT_WORST > AGG_REPORT_MAX_LEN))
+        return 1;
+    return 0;
+}
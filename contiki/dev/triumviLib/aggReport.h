@@ -0,0 +1,39 @@
+#ifndef __AGGREPORT_H__
+#define __AGGREPORT_H__
+
+#include <stdint.h>
+
+// Aggregated reporting of the Triumvi apps (AGGREGATE_REPORT).
+// Readings are encoded into a buffer as they are taken and sent together in
+// one frame, the radio turn on, CCM and MAC overhead is paid once per frame.
+// Encoding, in the order the readings were taken:
+// - first reading, 4 bytes power (mW)
+// - every following one, 2 bytes time since the previous reading (100 ms,
+//   saturates at 0xffff), 2 bytes power change (mW, signed); changes that do
+//   not fit are AGG_REPORT_ESCAPE followed by 4 bytes power
+// Little endian. The frame is sent right after the last reading, the
+// gateway takes its arrival time as the time of the last reading.
+// Nothing in here touches a peripheral, times are in ms.
+
+#define AGG_REPORT_MAX_LEN 80       // encoded readings, fits a 127 byte frame
+#define AGG_REPORT_WORST 8          // longest encoding of one reading
+#define AGG_REPORT_ESCAPE ((int16_t)0x8000)
+#define AGG_REPORT_TIME_UNIT 100    // ms
+
+typedef struct {
+    uint8_t buf[AGG_REPORT_MAX_LEN];
+    uint8_t len;
+    uint8_t count;
+    int32_t prevPower;
+    uint32_t span;                  // ms from the first to the last reading
+} aggReport_t;
+
+void aggReportClear(aggReport_t* agg);
+// Encodes a reading, elapsed is the time since the previous one
+void aggReportAdd(aggReport_t* agg, int32_t power, uint32_t elapsed);
+// 1 if the buffer has to be sent now: batch readings are in, the next one
+// (next ms away) would make the first reading older than maxStale, or the
+// buffer has no room for another one
+uint8_t aggReportDue(aggReport_t* agg, uint8_t batch, uint32_t next, uint32_t maxStale);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include "deltaReport.h"
+
+void deltaReportInit(deltaReport_t* delta){
+    delta->power = 0;
+    delta->IRMS = 0;
+    delta->pf = 0;
+    delta->sinceTx = 0;
+    delta->energy = 0;
+    delta->energyRem = 0;
+    delta->suppressed = 0;
+    delta->valid = 0;
+}
+
+static uint8_t deltaOut(int32_t diff, int32_t band){
+    return ((diff > band) || (diff < -band))? 1 : 0;
+}
+
+uint8_t deltaReportUpdate(deltaReport_t* delta, int32_t power, uint16_t IRMS,
+                          uint16_t pf, uint32_t elapsed){
+    uint64_t energy;
+    int32_t band;
+
+    // the first reading has no previous one to integrate from
+    if (delta->valid==0)
+        return 1;
+
+    if (power > 0){
+        energy = (uint64_t)power*elapsed + delta->energyRem;
+        delta->energy += (uint32_t)(energy/1000);
+        delta->energyRem = (uint16_t)(energy%1000);
+    }
+    delta->sinceTx += elapsed;
+
+    band = delta->power >> DELTA_REPORT_POWER_SHIFT;
+    if (band < DELTA_REPORT_POWER_MIN)
+        band = DELTA_REPORT_POWER_MIN;
+    if (deltaOut(power - delta->power, band) ||
+        deltaOut((int32_t)IRMS - delta->IRMS, DELTA_REPORT_IRMS) ||
+        deltaOut((int32_t)pf - delta->pf, DELTA_REPORT_PF) ||
+        (delta->sinceTx >= DELTA_REPORT_KEEPALIVE) ||
+        (delta->suppressed == 0xffff))
+        return 1;
+
+    delta->suppressed += 1;
+    return 0;
+}
+
+void deltaReportTrailer(deltaReport_t* delta, uint8_t* buf){
+    buf[0] = delta->suppressed & 0xff;
+    buf[1] = (delta->suppressed & 0xff00)>>8;
+    buf[2] = delta->energy & 0xff;
+    buf[3] = (delta->energy & 0xff00)>>8;
+    buf[4] = (delta->energy & 0xff0000)>>16;
+    buf[5] = (delta->energy & 0xff000000)>>24;
+}
+
+void deltaReportSent(deltaReport_t* delta, int32_t power, uint16_t IRMS, uint16_t pf){
+    delta->power = power;
+    delta->IRMS = IRMS;
+    delta->pf = pf;
+    delta->sinceTx = 0;
+    delta->energy = 0;
+    delta->suppressed = 0;
+    delta->valid = 1;
+}
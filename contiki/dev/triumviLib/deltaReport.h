@@ -0,0 +1,56 @@
+#ifndef __DELTAREPORT_H__
+#define __DELTAREPORT_H__
+
+#include <stdint.h>
+
+// Change triggered reporting of the Triumvi apps (DELTA_REPORT).
+// A reading is only transmitted if power, IRMS or PF moved out of the
+// deadband around the last transmitted reading, or DELTA_REPORT_KEEPALIVE
+// passed since. The energy of every reading (power times the time since the
+// previous one) is accumulated, each transmitted record carries the number
+// of readings suppressed before it and the energy since the previous
+// transmitted record, so the gateway can rebuild the series in between.
+// Nothing in here touches a peripheral, times are in ms.
+
+#ifndef DELTA_REPORT_KEEPALIVE
+#define DELTA_REPORT_KEEPALIVE 300000   // 5 minutes
+#endif
+// power deadband, larger of 1/2^SHIFT of the last transmitted reading and MIN
+#ifndef DELTA_REPORT_POWER_SHIFT
+#define DELTA_REPORT_POWER_SHIFT 5
+#endif
+#ifndef DELTA_REPORT_POWER_MIN
+#define DELTA_REPORT_POWER_MIN 1000     // mW
+#endif
+#ifndef DELTA_REPORT_IRMS
+#define DELTA_REPORT_IRMS 50            // mA
+#endif
+#ifndef DELTA_REPORT_PF
+#define DELTA_REPORT_PF 20              // 1/1000
+#endif
+
+// trailer of a DELTA_REPORT record: 2 bytes suppressed readings, 4 bytes
+// energy (mJ), little endian
+#define DELTA_REPORT_TRAILER_LEN 6
+
+typedef struct {
+    int32_t power;          // last transmitted reading
+    uint16_t IRMS;
+    uint16_t pf;
+    uint32_t sinceTx;       // ms since the last transmitted reading
+    uint32_t energy;        // mJ since the last transmitted reading
+    uint16_t energyRem;     // mW*ms below 1 mJ
+    uint16_t suppressed;
+    uint8_t valid;
+} deltaReport_t;
+
+void deltaReportInit(deltaReport_t* delta);
+// Every valid reading, elapsed is the time since the previous one.
+// Returns 1 if the reading has to be transmitted, then call deltaReportSent
+// after packing the trailer.
+uint8_t deltaReportUpdate(deltaReport_t* delta, int32_t power, uint16_t IRMS,
+                          uint16_t pf, uint32_t elapsed);
+void deltaReportTrailer(deltaReport_t* delta, uint8_t* buf);
+void deltaReportSent(deltaReport_t* delta, int32_t power, uint16_t IRMS, uint16_t pf);
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include "ingestFrame.h"
+
+uint16_t ingestCrc(const uint8_t* buf, uint16_t len){
+    uint16_t crc = 0xffff;
+    uint16_t i;
+    uint8_t j;
+    for (i=0; i<len; i++){
+        crc ^= (uint16_t)buf[i]<<8;
+        for (j=0; j<8; j++)
+            crc = (crc & 0x8000)? (crc<<1) ^ 0x1021 : (crc<<1);
+    }
+    return crc;
+}
+
+uint16_t ingestFrameEncode(const uint8_t* record, uint16_t len, uint8_t* frame){
+    uint16_t crc = ingestCrc(record, len);
+    uint16_t code = 0;      // position of the current code byte
+    uint16_t out = 1;
+    uint16_t i;
+    uint8_t val;
+
+    for (i=0; i<len+2; i++){
+        if (i < len)
+            val = record[i];
+        else if (i == len)
+            val = crc & 0xff;
+        else
+            val = (crc & 0xff00)>>8;
+
+        if (val == 0){
+            frame[code] = out - code;
+            code = out++;
+        }
+        else{
+            frame[out++] = val;
+            // longest block, 254 bytes without a zero following
+            if (out - code == 0xff){
+                frame[code] = 0xff;
+                code = out++;
+            }
+        }
+    }
+    frame[code] = out - code;
+    frame[out++] = 0;
+    return out;
+}
+
+int ingestFrameDecode(const uint8_t* frame, uint16_t len, uint8_t* record, uint16_t maxLen){
+    uint16_t in = 0;
+    uint16_t out = 0;
+    uint16_t crc;
+    uint8_t code;
+    uint8_t i;
+
+    while (in < len){
+        code = frame[in++];
+        if (code == 0)
+            return INGEST_FRAME_COBS_ERROR;
+        for (i=1; i<code; i++){
+            if ((in >= len) || (frame[in]==0) || (out >= maxLen))
+                return INGEST_FRAME_COBS_ERROR;
+            record[out++] = frame[in++];
+        }
+        // a block shorter than 254 bytes stood for a zero, except the last
+        if ((code < 0xff) && (in < len)){
+            if (out >= maxLen)
+                return INGEST_FRAME_COBS_ERROR;
+            record[out++] = 0;
+        }
+    }
+    if (out < 2)
+        return INGEST_FRAME_COBS_ERROR;
+    out -= 2;
+    crc = ingestCrc(record, out);
+    if ((record[out] != (crc & 0xff)) || (record[out+1] != ((crc & 0xff00)>>8)))
+        return INGEST_FRAME_CRC_ERROR;
+    return out;
+}
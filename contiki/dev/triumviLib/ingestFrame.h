@@ -0,0 +1,46 @@
+#ifndef __INGESTFRAME_H__
+#define __INGESTFRAME_H__
+
+#include <stdint.h>
+
+// Binary output of the receivers, read by the gateway ingest daemon
+// (rxScript/triumviIngest).
+// Every received packet is one record, sent as
+//   COBS(record, CRC) 0x00
+// COBS (consistent overhead byte stuffing) removes the zero bytes from the
+// frame, 0x00 only ends a frame and the host finds the next frame after an
+// error. CRC is CRC-16/CCITT (0x1021, start 0xffff) of the record, little
+// endian.
+// Record:
+//   1 byte record type
+//   8 bytes source address, most significant byte first (as in the nonce)
+//   1 byte RSSI (dBm, signed)
+// INGEST_REC_METER, decrypted meter packet:
+//   1 byte packet identifier
+//   4 bytes nonce counter, as received
+//   decrypted payload, same layout as the meter packed it
+// INGEST_REC_RAW, authentication failed or unknown identifier:
+//   received packet from the identifier on
+// Nothing in here touches a peripheral, the same file is compiled on a PC.
+
+#define INGEST_REC_METER 0x01
+#define INGEST_REC_RAW 0x02
+
+#define INGEST_HEADER_LEN 10
+#define INGEST_METER_HEADER_LEN (INGEST_HEADER_LEN+5)
+#define INGEST_MAX_RECORD (INGEST_HEADER_LEN+127)
+// record, CRC, COBS code bytes and the delimiter
+#define INGEST_MAX_FRAME (INGEST_MAX_RECORD+2+(INGEST_MAX_RECORD+2)/254+1+1)
+
+#define INGEST_FRAME_COBS_ERROR -1
+#define INGEST_FRAME_CRC_ERROR -2
+
+uint16_t ingestCrc(const uint8_t* buf, uint16_t len);
+// Encodes a record of len bytes into frame (INGEST_MAX_FRAME bytes),
+// returns the frame length including the delimiter
+uint16_t ingestFrameEncode(const uint8_t* record, uint16_t len, uint8_t* frame);
+// Decodes a frame without its delimiter into record (maxLen bytes), returns
+// the record length or INGEST_FRAME_*_ERROR
+int ingestFrameDecode(const uint8_t* frame, uint16_t len, uint8_t* record, uint16_t maxLen);
+
+#endif
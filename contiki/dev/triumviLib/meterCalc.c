@@ -0,0 +1,348 @@
+
+#include <stdint.h>
+#include "meterCalc.h"
+
+// thresholds of gainIdx, halved for 10-bit samples in external voltage mode
+static void meterGainThresholds(uint8_t gainIdx, uint8_t maxGainIdx, uint8_t externalVolt,
+        uint16_t* upperThreshold, uint16_t* lowerThreshold){
+    *upperThreshold = (gainIdx==maxGainIdx)? UPPERTHRESHOLD0 :
+                      (gainIdx==1)? UPPERTHRESHOLD2 : UPPERTHRESHOLD1;
+    *lowerThreshold = (gainIdx==MIN_INA_GAIN_IDX)? LOWERTHRESHOLD0 : LOWERTHRESHOLD1;
+    if (externalVolt){
+        *upperThreshold = (*upperThreshold>>1);
+        *lowerThreshold = (*lowerThreshold>>1);
+    }
+}
+
+// this function check if the ADC samples are within a proper range
+gainSetting_t meterGainCheck(uint16_t* adcSamples, uint16_t length, uint16_t currentRef,
+        uint8_t gainIdx, uint8_t maxGainIdx, uint8_t externalVolt, int* adjustedSamples){
+    uint16_t i;
+    uint16_t upperThreshold, lowerThreshold;
+    int currentCal;
+    int maxVal = 0;
+
+    meterGainThresholds(gainIdx, maxGainIdx, externalVolt, &upperThreshold, &lowerThreshold);
+
+    // loop the entire samples, substract offset and update max ADC value
+    for (i=0; i<length; i++){
+        currentCal = adcSamples[i] - currentRef;
+        if ((currentCal>upperThreshold)&&(gainIdx>MIN_INA_GAIN_IDX)){
+            return GAIN_TOO_HIGH;
+        }
+        if (currentCal > maxVal){
+            maxVal = currentCal;
+        }
+        adjustedSamples[i] = currentCal;
+    }
+
+    if (maxVal < lowerThreshold){
+        return (gainIdx<maxGainIdx)? GAIN_TOO_LOW : GAIN_ERROR;
+    }
+    return GAIN_OK;
+}
+
+gainSetting_t meterGainRange(int maxVal, uint8_t gainIdx, uint8_t maxGainIdx, uint8_t externalVolt){
+    uint16_t upperThreshold, lowerThreshold;
+
+    meterGainThresholds(gainIdx, maxGainIdx, externalVolt, &upperThreshold, &lowerThreshold);
+
+    if ((maxVal>upperThreshold)&&(gainIdx>MIN_INA_GAIN_IDX)){
+        return GAIN_TOO_HIGH;
+    }
+    if (maxVal < lowerThreshold){
+        return (gainIdx<maxGainIdx)? GAIN_TOO_LOW : GAIN_ERROR;
+    }
+    return GAIN_OK;
+}
+
+int meterCurrentTransform(int currentReading, uint32_t gainRecip, uint8_t bitShift, uint8_t externalVolt){
+    int tmp = (externalVolt)? currentReading*I_TRANSFORM*2 : currentReading*I_TRANSFORM;
+    // divide by the gain, truncate toward 0 as the integer division did
+    if (tmp < 0)
+        tmp = -(int)(((uint64_t)(uint32_t)(-tmp)*gainRecip)>>METER_RECIP_Q);
+    else
+        tmp = (int)(((uint64_t)(uint32_t)tmp*gainRecip)>>METER_RECIP_Q);
+    return (tmp>>bitShift);
+}
+
+int meterVoltTransform(int voltReading, uint16_t voltReference){
+    return (voltReading - voltReference)*VOLTAGE_SCALING;
+}
+
+int meterSinePower(int* currSamples, const int* sineTable, uint16_t phaseOffset,
+        uint32_t gainRecip, uint8_t bitShift, uint8_t voltScaling){
+    uint16_t i;
+    const int* volt = &sineTable[phaseOffset];
+    int energyCal = 0;
+    int tempPower;
+    for (i=0; i<BUF_SIZE; i++){
+        currSamples[i] = meterCurrentTransform(currSamples[i], gainRecip, bitShift, 0x0);
+        energyCal += (currSamples[i]*volt[i*DEGREE_PER_SAMPLE]);
+    }
+    tempPower = (energyCal*voltScaling/BUF_SIZE); // unit is mW
+    // Fix phase oppsite down
+    if (tempPower < 0)
+        tempPower = -1*tempPower;
+    return tempPower;
+}
+
+int meterExtVoltPower(int* currSamples, int* voltSamples, uint32_t gainRecip, uint8_t bitShift){
+    uint16_t j, k;
+    uint16_t voltRef = getAverage32(voltSamples, BUF_SIZE2);
+    int energyCal = 0;
+    int tempPower;
+    for (j=0; j<BUF_SIZE2; j++){
+        k = ((j + VOLTAGE_SAMPLE_OFFSET)>=BUF_SIZE2)?
+            (j+VOLTAGE_SAMPLE_OFFSET-BUF_SIZE2) :
+            j+VOLTAGE_SAMPLE_OFFSET;
+        currSamples[j] = meterCurrentTransform(currSamples[j], gainRecip, bitShift, 0x1);
+        voltSamples[k] = meterVoltTransform(voltSamples[k], voltRef);
+        energyCal += (currSamples[j]*voltSamples[k])/1000;
+    }
+    tempPower = (energyCal/BUF_SIZE2); // unit is mW
+    // Fix phase oppsite down
+    if (tempPower < 0)
+        tempPower = -1*tempPower;
+    return tempPower;
+}
+
+uint16_t meterCurrentRMS(int* currSamples, uint16_t length){
+    uint16_t i;
+    uint32_t result = 0;
+    uint64_t result64 = 0;
+
+    for (i=0; i<length; i++){
+        result64 += (currSamples[i]*currSamples[i]);
+    }
+    result = (uint32_t)(result64/length);
+    return mysqrt(result);
+}
+
+// unit is V
+uint16_t meterVoltageRMS(int* voltSamples, uint16_t length){
+    uint16_t i;
+    int tmp;
+    uint32_t result = 0;
+    // |tmp| < 1024*VOLTAGE_SCALING/1000, cannot overflow for BUF_SIZE2 samples
+    for (i=0; i<length; i++){
+        tmp = voltSamples[i]/1000;
+        result += tmp*tmp;
+    }
+    return mysqrt(result/length);
+}
+
+void meterAccumInit(meterAccum_t* acc, uint16_t currentRef, uint32_t gainRecip, uint8_t bitShift){
+    acc->currentRef = currentRef;
+    acc->gainRecip = gainRecip;
+    acc->bitShift = bitShift;
+    acc->maxCurrent = 0;
+    acc->count = 0;
+    acc->sumI = 0;
+    acc->sumII = 0;
+    acc->sumV = 0;
+    acc->sumVV = 0;
+    acc->sumIV = 0;
+}
+
+int meterAccumAdd(meterAccum_t* acc, uint16_t* currSamples, int* voltSamples, uint16_t length){
+    uint16_t i;
+    int currentCal;
+    int curr;
+    int volt;
+
+    for (i=0; i<length; i++){
+        currentCal = currSamples[i] - acc->currentRef;
+        if (currentCal > acc->maxCurrent)
+            acc->maxCurrent = currentCal;
+        curr = meterCurrentTransform(currentCal, acc->gainRecip, acc->bitShift, 0x1);
+        volt = voltSamples[i];
+        acc->sumI += curr;
+        acc->sumII += (int64_t)curr*curr;
+        acc->sumV += volt;
+        acc->sumVV += (uint32_t)(volt*volt);
+        acc->sumIV += (int64_t)curr*volt;
+    }
+    acc->count += length;
+    return acc->maxCurrent;
+}
+
+// P = cov(i, v)*VOLTAGE_SCALING/1000, the covariance removes the voltage DC
+// the same way as subtracting the average did in meterExtVoltPower
+int meterAccumPower(meterAccum_t* acc){
+    int64_t n = acc->count;
+    int64_t cov;
+    if (n == 0)
+        return 0;
+    // n*cov
+    cov = (n*acc->sumIV - acc->sumI*(int64_t)acc->sumV)/n;
+    cov = cov*VOLTAGE_SCALING/(1000*n);
+    // Fix phase oppsite down
+    if (cov < 0)
+        cov = -cov;
+    return (int)cov;
+}
+
+uint16_t meterAccumCurrentRMS(meterAccum_t* acc){
+    if (acc->count == 0)
+        return 0;
+    return mysqrt((uint32_t)(acc->sumII/acc->count));
+}
+
+// unit is V
+uint16_t meterAccumVoltageRMS(meterAccum_t* acc){
+    uint64_t n = acc->count;
+    uint64_t var;
+    if (n == 0)
+        return 0;
+    // n*var(v) of the raw readings, scaled to V^2
+    var = (n*acc->sumVV - (uint64_t)acc->sumV*acc->sumV)/n;
+    var = var*VOLTAGE_SCALING*VOLTAGE_SCALING/1000000/n;
+    return mysqrt((uint32_t)var);
+}
+
+int meterCycleProduct(uint16_t* adcSamples, const int* sineTable, uint16_t offset, uint16_t currentRef){
+    uint16_t i;
+    const int* volt = &sineTable[offset];
+    int product = 0;
+    for (i=0; i<BUF_SIZE; i++){
+        product += (adcSamples[i] - currentRef)*volt[i*DEGREE_PER_SAMPLE];
+    }
+    return product;
+}
+
+// return phase offset has max product, only be called in calibration mode
+uint16_t meterPhaseMatch(uint16_t* adcSamples, const int* sineTable, uint16_t* currentAVG){
+    uint16_t i;
+    int prod;
+    int maxVal = 0;
+    uint16_t maxVal_phaseOffset = 0;
+    uint16_t currentRef;
+    currentRef = getAverage(adcSamples, BUF_SIZE);
+    for (i=0; i<360; i++){
+        prod = meterCycleProduct(adcSamples, sineTable, i, currentRef);
+        if (prod > maxVal){
+            maxVal = prod;
+            maxVal_phaseOffset = i;
+        }
+    }
+    *currentAVG = currentRef;
+    return maxVal_phaseOffset;
+}
+
+// meterCycleProduct(offset) = sumSin*cos(offset) + sumCos*sin(offset) times
+// the table amplitude, so one pass over the samples gives the whole curve.
+// The peak of the curve is searched with 2 multiplies per degree. The table
+// rounding moves the peak of the real products by a few degrees, so
+// meterCycleProduct is evaluated around it to get the meterPhaseMatch answer.
+uint16_t meterPhaseEstimate(uint16_t* adcSamples, const int* sineTable, uint16_t* currentAVG){
+    uint16_t i;
+    int x;
+    int sumSin = 0;
+    int sumCos = 0;
+    int64_t curve;
+    int64_t maxCurve = 0;
+    uint16_t coarse = 0;
+    uint16_t offset;
+    int prod;
+    int maxVal = 0;
+    uint16_t maxVal_phaseOffset = 0;
+    uint16_t currentRef;
+    currentRef = getAverage(adcSamples, BUF_SIZE);
+    // the table spans two periods, cos(a) = sineTable[a+90]
+    for (i=0; i<BUF_SIZE; i++){
+        x = adcSamples[i] - currentRef;
+        sumSin += x*sineTable[i*DEGREE_PER_SAMPLE];
+        sumCos += x*sineTable[i*DEGREE_PER_SAMPLE+90];
+    }
+    for (i=0; i<360; i++){
+        curve = (int64_t)sumSin*sineTable[i+90] + (int64_t)sumCos*sineTable[i];
+        if (curve > maxCurve){
+            maxCurve = curve;
+            coarse = i;
+        }
+    }
+    // same tie break as meterPhaseMatch, lowest offset wins
+    for (i=0; i<=2*METER_PHASE_REFINE; i++){
+        offset = (coarse + 360 - METER_PHASE_REFINE + i) % 360;
+        prod = meterCycleProduct(adcSamples, sineTable, offset, currentRef);
+        if ((prod > maxVal) || ((prod == maxVal) && (prod > 0) && (offset < maxVal_phaseOffset))){
+            maxVal = prod;
+            maxVal_phaseOffset = offset;
+        }
+    }
+    *currentAVG = currentRef;
+    return maxVal_phaseOffset;
+}
+
+void meterLinearFit(uint16_t* reading, uint16_t* setting, uint8_t length,
+                uint32_t* slope_n, uint32_t* slope_d, int* offset){
+    uint8_t i;
+    int32_t readingAvg = getAverage(reading, length);
+    int32_t settingAvg = getAverage(setting, length);
+    int32_t tmp0 = 0;
+    uint32_t tmp1 = 0;
+    for (i=0; i<length; i++){
+        tmp0 += ((reading[i] - readingAvg)*(setting[i] - settingAvg));
+        tmp1 += ((reading[i] - readingAvg)*(reading[i] - readingAvg));
+    }
+    *slope_n = tmp0;
+    *slope_d = tmp1;
+    *offset = settingAvg - (((uint64_t)readingAvg)*tmp0/tmp1);
+}
+
+uint16_t mysqrt(uint32_t n){
+    uint32_t xn = n;
+    uint8_t i;
+    // the M3 returns 0 on divide by 0, a PC traps
+    if (n==0)
+        return 0;
+    for (i=0; i<20; i++){
+        xn = (xn + n/xn)/2;
+    }
+    return (uint16_t)xn;
+}
+
+// return average value
+uint16_t getAverage(uint16_t* data, uint16_t length){
+    uint16_t i;
+    uint32_t sum = 0;
+    for (i=0; i<length; i++)
+        sum += data[i];
+    return (uint16_t)(sum/length);
+}
+
+// return average value
+uint16_t getAverage32(int* data, uint16_t length){
+    uint16_t i;
+    uint32_t sum = 0;
+    for (i=0; i<length; i++)
+        sum += data[i];
+    return (uint16_t)(sum/length);
+}
+
+// calculate variance of phase offset array
+uint16_t getVariance(uint16_t* data, uint16_t length){
+    uint16_t i;
+    uint16_t avg = getAverage(data, length);
+    int sqr;
+    uint16_t variance = 0;
+    for (i=0; i<length; i++){
+        sqr = data[i] - avg;
+        variance += (sqr*sqr);
+    }
+    variance /= length;
+    return variance;
+}
+
+// dest[0] = src&0xff
+// dest[1] = (src&0xff00)>>8
+// dest[2] = (src&0xff0000)>>16
+// dest[3] = (src&0xff000000)>>24
+void packData(uint8_t* dest, int src, uint8_t len){
+    uint8_t i;
+    for (i=0; i<len; i++){
+        dest[i] = (src&(0xff<<(i<<3)))>>(i<<3);
+    }
+}
+
@@ -0,0 +1,153 @@
+#ifndef __METERCALC_H__
+#define __METERCALC_H__
+
+#include <stdint.h>
+
+// Metering arithmetic shared by the Triumvi apps.
+// Nothing in here touches a peripheral, the apps sample the ADC, set the INA
+// gain and read the calibration data, then hand the buffers to these functions.
+// The same file is compiled on a PC by tools/meterReplay.
+
+#ifdef VERSION12
+// Ip = ADC * 3000/2048/R/CT (mA)
+//#define I_TRANSFORM 70 // 209 ohm sensing resistor, with 1:10000 CT
+//#define I_TRANSFORM 732 // 20 ohm sensing resistor, with 1:10000 CT
+#define I_TRANSFORM 439 // 20 ohm sensing resistor, with 1:6000 CT
+#else
+#define I_TRANSFORM 97 // 45.3 ohm sensing resistor
+#endif
+
+// Adjusted (DC removal) ADC sample thresholds
+#define UPPERTHRESHOLD0  400 // upper threshold for gain == 17
+#define UPPERTHRESHOLD1  500 // upper threshold for gain == 5, 9
+#define UPPERTHRESHOLD2  500 // upper threshold for gain == 3
+#define LOWERTHRESHOLD0  80 // lower threshold for gain == 1
+#if defined(VERSION11) || defined(VERSION12)
+#define LOWERTHRESHOLD1  150 // lower threshold for others
+#else
+#define LOWERTHRESHOLD1  200 // lower threshold for others
+#endif
+
+// number of samples per cycle, set by the app Makefile with the sine table
+#ifndef SAMPLES_PER_CYCLE
+#define SAMPLES_PER_CYCLE 120
+#endif
+#define BUF_SIZE SAMPLES_PER_CYCLE  // sample current only, 11-bit resolution, 1 cycles
+#define BUF_SIZE2 228       // sample both current and voltage, 10-bit resolution, 2 cycles
+#define MAX_BUF_SIZE ((BUF_SIZE>BUF_SIZE2)? BUF_SIZE : BUF_SIZE2)
+
+// degree per sample in BUF_SIZE mode
+#define DEGREE_PER_SAMPLE (360/BUF_SIZE)
+#if (360 % BUF_SIZE) != 0
+#error "SAMPLES_PER_CYCLE must divide 360"
+#endif
+
+#define MIN_INA_GAIN_IDX 0
+
+// Q26 reciprocal of an INA gain, precomputed next to inaGainArr.
+// (x*METER_GAIN_RECIP(g))>>METER_RECIP_Q == x/g for 0 <= x < 2^21 and g <= 17,
+// the rounding error of the reciprocal is below g, so x*error < 2^26.
+// |ADC reading|*I_TRANSFORM*2 stays below 2^21.
+#define METER_RECIP_Q 26
+#define METER_GAIN_RECIP(g) ((((uint32_t)1<<METER_RECIP_Q)+(g)-1)/(g))
+
+// voltage isolation filter offset
+#define VOLTAGE_SAMPLE_OFFSET 0
+// voltage scaling constant
+#define VOLTAGE_SCALING 720
+
+typedef enum {
+    GAIN_TOO_LOW,
+    GAIN_OK,
+    GAIN_TOO_HIGH,
+    GAIN_ERROR
+} gainSetting_t;
+
+// Remove the DC reference from adcSamples, write the result to adjustedSamples,
+// and check the samples against the thresholds of gainIdx.
+// Returns GAIN_TOO_HIGH / GAIN_TOO_LOW if the caller should step the gain,
+// GAIN_ERROR if the signal is too small even at maxGainIdx, GAIN_OK otherwise.
+// adjustedSamples is only complete if GAIN_OK or GAIN_ERROR is returned.
+gainSetting_t meterGainCheck(uint16_t* adcSamples, uint16_t length, uint16_t currentRef,
+        uint8_t gainIdx, uint8_t maxGainIdx, uint8_t externalVolt, int* adjustedSamples);
+
+// Same thresholds as meterGainCheck, on the largest adjusted sample of a
+// capture that has already been processed.
+gainSetting_t meterGainRange(int maxVal, uint8_t gainIdx, uint8_t maxGainIdx, uint8_t externalVolt);
+
+// adjusted current ADC reading -> mA (>>bitShift), gainRecip = METER_GAIN_RECIP(inaGain)
+int meterCurrentTransform(int currentReading, uint32_t gainRecip, uint8_t bitShift, uint8_t externalVolt);
+// voltage ADC reading -> mV
+int meterVoltTransform(int voltReading, uint16_t voltReference);
+
+// Current only mode, one cycle (BUF_SIZE) against the nominal sine table.
+// sineTable spans two periods (voltage_gen.py), &sineTable[phaseOffset] is
+// the table already rotated by the calibrated phase, so there is no wrap.
+// currSamples are transformed to mA in place. Returns |power| in mW.
+int meterSinePower(int* currSamples, const int* sineTable, uint16_t phaseOffset,
+        uint32_t gainRecip, uint8_t bitShift, uint8_t voltScaling);
+// External voltage mode, BUF_SIZE2 current/voltage pairs.
+// Both buffers are transformed in place. Returns |power| in mW.
+int meterExtVoltPower(int* currSamples, int* voltSamples, uint32_t gainRecip, uint8_t bitShift);
+
+// Running sums for the external voltage mode, so any number of cycles can
+// be folded in one at a time without keeping the samples.
+// Voltage readings are kept raw, the DC is removed when the result is read.
+typedef struct {
+    uint32_t gainRecip;
+    uint8_t bitShift;
+    uint16_t currentRef;
+    int maxCurrent;     // largest adjusted current reading, for meterGainRange
+    uint32_t count;
+    int64_t sumI;       // mA
+    uint64_t sumII;     // mA^2
+    uint32_t sumV;      // raw
+    uint64_t sumVV;     // raw^2
+    int64_t sumIV;      // mA * raw
+} meterAccum_t;
+
+void meterAccumInit(meterAccum_t* acc, uint16_t currentRef, uint32_t gainRecip, uint8_t bitShift);
+// add length 10-bit current/voltage pairs, returns the largest adjusted current
+int meterAccumAdd(meterAccum_t* acc, uint16_t* currSamples, int* voltSamples, uint16_t length);
+// |power| in mW over all samples added
+int meterAccumPower(meterAccum_t* acc);
+// RMS current in mA (>>bitShift)
+uint16_t meterAccumCurrentRMS(meterAccum_t* acc);
+// unit is V
+uint16_t meterAccumVoltageRMS(meterAccum_t* acc);
+
+// RMS of transformed samples
+uint16_t meterCurrentRMS(int* currSamples, uint16_t length);
+// unit is V
+uint16_t meterVoltageRMS(int* voltSamples, uint16_t length);
+
+// return product of voltage and current for a cycle
+int meterCycleProduct(uint16_t* adcSamples, const int* sineTable, uint16_t offset, uint16_t currentRef);
+// return the phase has maximum correlation
+uint16_t meterPhaseMatch(uint16_t* adcSamples, const int* sineTable, uint16_t* currentAVG);
+// meterPhaseMatch from a quadrature correlation and a +-METER_PHASE_REFINE
+// degree search, ~30x less work per cycle. Matches the brute force search on
+// every waveSyn capture (tools/meterReplay).
+#ifndef METER_PHASE_REFINE
+#define METER_PHASE_REFINE 4
+#endif
+uint16_t meterPhaseEstimate(uint16_t* adcSamples, const int* sineTable, uint16_t* currentAVG);
+
+// find coefficient for 1st order linear regression
+void meterLinearFit(uint16_t* reading, uint16_t* setting, uint8_t length,
+                uint32_t* slope_n, uint32_t* slope_d, int* offset);
+
+uint16_t mysqrt(uint32_t n);
+
+// return variance of phase offsets
+uint16_t getVariance(uint16_t* data, uint16_t length);
+
+// return mean(data)
+uint16_t getAverage(uint16_t* data, uint16_t length);
+// return mean(data)
+uint16_t getAverage32(int* data, uint16_t length);
+
+// split a uint32_t into 4 uint8_t
+void packData(uint8_t* dest, int src, uint8_t len);
+
+#endif
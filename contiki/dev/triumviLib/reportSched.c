@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include "reportSched.h"
+
+void reportSchedInit(reportSched_t* sched, uint32_t maxStale){
+    sched->maxStale = (maxStale < REPORT_SCHED_MIN_INTERVAL)? REPORT_SCHED_MIN_INTERVAL : maxStale;
+    sched->interval = REPORT_SCHED_START_INTERVAL;
+    sched->floor = REPORT_SCHED_START_INTERVAL;
+    if (sched->floor > sched->maxStale)
+        sched->floor = sched->maxStale;
+    sched->sleep = sched->floor;
+    sched->lastPower = 0;
+    sched->readyRun = 0;
+    sched->havePower = 0;
+    sched->changed = 0;
+}
+
+void reportSchedEnergy(reportSched_t* sched, uint32_t wait){
+    uint32_t needed;
+    if (wait > 0){
+        // the supercap needed this long to recharge
+        needed = sched->sleep + wait;
+        if (needed > sched->floor)
+            sched->floor = (needed > sched->maxStale)? sched->maxStale : needed;
+        sched->readyRun = 0;
+        return;
+    }
+    sched->readyRun += 1;
+    if (sched->readyRun >= REPORT_SCHED_READY_RUN){
+        sched->readyRun = 0;
+        sched->floor >>= 1;
+        if (sched->floor < REPORT_SCHED_MIN_INTERVAL)
+            sched->floor = REPORT_SCHED_MIN_INTERVAL;
+    }
+}
+
+static uint8_t reportSchedChanged(reportSched_t* sched, int32_t power){
+    int32_t diff = power - sched->lastPower;
+    int32_t band = sched->lastPower >> REPORT_SCHED_DELTA_SHIFT;
+    if (band < REPORT_SCHED_DELTA_MIN)
+        band = REPORT_SCHED_DELTA_MIN;
+    return ((diff > band) || (diff < -band))? 1 : 0;
+}
+
+uint32_t reportSchedNext(reportSched_t* sched, int32_t power){
+    sched->changed = 0;
+    // failed reading, retry as soon as there is energy
+    if (power < 0){
+        sched->interval = sched->floor;
+    }
+    else if ((sched->havePower==0) || reportSchedChanged(sched, power)){
+        sched->interval = REPORT_SCHED_MIN_INTERVAL;
+        sched->lastPower = power;
+        sched->havePower = 1;
+        sched->changed = 1;
+    }
+    // steady load, compare against the reading that started it so slow
+    // drifts still count as a change
+    else{
+        sched->interval <<= 1;
+        if (sched->interval > sched->maxStale)
+            sched->interval = sched->maxStale;
+    }
+    sched->sleep = (sched->interval < sched->floor)? sched->floor : sched->interval;
+    return sched->sleep;
+}
+
+uint8_t reportSchedSurplus(reportSched_t* sched){
+    return (sched->floor <= REPORT_SCHED_MIN_INTERVAL)? 1 : 0;
+}
+
+uint8_t reportSchedBatch(reportSched_t* sched){
+    uint32_t batch = sched->floor/REPORT_SCHED_MIN_INTERVAL;
+    if (sched->changed || (batch < 1))
+        return 1;
+    return (batch > REPORT_SCHED_MAX_BATCH)? REPORT_SCHED_MAX_BATCH : batch;
+}
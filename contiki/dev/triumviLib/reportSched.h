@@ -0,0 +1,64 @@
+#ifndef __REPORTSCHED_H__
+#define __REPORTSCHED_H__
+
+#include <stdint.h>
+
+// Reporting interval of the Triumvi apps.
+// Two limits decide the time until the next wake-up:
+// - energy floor, the shortest interval the harvester keeps up with. Every
+//   wake-up tells how long the unit had to wait for READYn (the supercap
+//   threshold of the power stage), a wait raises the floor to the interval
+//   that would have been long enough, REPORT_SCHED_READY_RUN wake-ups in a
+//   row without waiting halve it again (the old backOffTime rule).
+// - load, a reading that moved more than the deadband from the last change
+//   drops the interval to the energy floor, steady readings double it up to
+//   the max staleness.
+// Times are in ms. Nothing in here touches a peripheral, the same file is
+// compiled on a PC by tools/reportSim.
+
+#ifndef REPORT_SCHED_MIN_INTERVAL
+#define REPORT_SCHED_MIN_INTERVAL 1000      // fastest reporting
+#endif
+#ifndef REPORT_SCHED_MAX_STALE
+#define REPORT_SCHED_MAX_STALE 30000        // longest time without a reading
+#endif
+#define REPORT_SCHED_START_INTERVAL 4000    // after power up
+#define REPORT_SCHED_READY_RUN 4
+#ifndef REPORT_SCHED_MAX_BATCH
+#define REPORT_SCHED_MAX_BATCH 16           // readings per aggregated frame
+#endif
+
+// load change deadband, larger of 1/2^SHIFT of the previous reading and MIN
+#ifndef REPORT_SCHED_DELTA_SHIFT
+#define REPORT_SCHED_DELTA_SHIFT 3
+#endif
+#ifndef REPORT_SCHED_DELTA_MIN
+#define REPORT_SCHED_DELTA_MIN 2000         // mW
+#endif
+
+typedef struct {
+    uint32_t interval;      // interval for the current load
+    uint32_t floor;         // energy limited shortest interval
+    uint32_t sleep;         // last returned interval
+    uint32_t maxStale;
+    int32_t lastPower;      // reading of the last load change, mW
+    uint8_t readyRun;       // wake-ups without waiting for READYn
+    uint8_t havePower;
+    uint8_t changed;        // last reading was a load change
+} reportSched_t;
+
+void reportSchedInit(reportSched_t* sched, uint32_t maxStale);
+// Once per wake-up, wait is the time spent waiting for READYn after the
+// timer expired, 0 if the unit was ready right away
+void reportSchedEnergy(reportSched_t* sched, uint32_t wait);
+// After the reading, power < 0 if it failed. Returns the time until the next
+// wake-up
+uint32_t reportSchedNext(reportSched_t* sched, int32_t power);
+// Readings per frame with AGGREGATE_REPORT. Load changes go out right away,
+// otherwise the more the harvester falls behind the fastest reporting, the
+// more readings share a radio wake-up
+uint8_t reportSchedBatch(reportSched_t* sched);
+// 1 if the harvester keeps up with the fastest reporting
+uint8_t reportSchedSurplus(reportSched_t* sched);
+
+#endif
@@ -95,6 +95,8 @@ void usb_isr(void);
 void gpt_1_a_isr(void);
 void gpt_1_b_isr(void);
 void gpt_2_a_isr(void);
+/* Apps linking meterSampler.c override the weak ADC handler */
+void meter_adc_isr(void) __attribute__ ((weak, alias ("default_handler")));
 
 void crypto_isr(void);
 
@@ -158,7 +160,7 @@ void(*const vectors[])(void) =
   0,                          /* 27 Reserved */
   0,                          /* 28 Reserved */
   0,                          /* 29 Reserved */
-  default_handler,            /* 30 ADC Sequence 0 */
+  meter_adc_isr,              /* 30 ADC Sequence 0 */
   0,                          /* 31 Reserved */
   0,                          /* 32 Reserved */
   0,                          /* 33 Reserved */
@@ -0,0 +1,1087 @@
+/*
+    Simulates a building of Triumvi meters against one gateway bridge
+    (apps/edisonRX), to size TRIUMVI_PACKET_BUF_LEN and the SPI protocol
+    without hundreds of meters on the bench.
+
+    Meters: every meter builds its frames the way encryptAndTransmit and
+    aggregateTransmit do (identifier, nonce counter, status register,
+    optional panel/circuit, PF/VRMS/IRMS, time stamp, counter, extension
+    fields) and encrypts them with AES-CCM, AES_KEY and the extended address
+    nonce. The reporting mode (-m) is the app build:
+      plain  0xa0 every reading (0xa2 with -E)
+      delta  0xa2, DELTA_REPORT and ENERGY_REPORT (dev/triumviLib/deltaReport)
+      agg    0xa3, AGGREGATE_REPORT (dev/triumviLib/aggReport)
+    Readings come every -i ms (+-j percent), or with -i 0 when
+    dev/triumviLib/reportSched lets them, with the harvester model of
+    tools/reportSim (10 uW per W of load, 1000 uJ a wake-up). The loads are
+    log uniform up to -W watts and move to a new level every -c seconds on
+    average.
+
+    Channel: the random back off of the apps (2 x 0..65535 us), 250 kbps,
+    23 bytes of PHY and MAC overhead. Frames that overlap at the gateway are
+    lost unless one is -C dB stronger (capture). On top, every link loses
+    -l percent of the frames in bursts of -B frames on average.
+
+    Bridge: the edisonRX pipeline, a raw frame queue of -R frames in front
+    of the decryption (-D us a frame), the decrypted packet queue of -Q
+    packets (TRIUMVI_PACKET_BUF_LEN, 0 for unbounded to find the depth that
+    would have been needed), and the Edison reading it over SPI at -S Hz,
+    -O us per transaction, -L us after the data ready line goes up. One
+    packet per REQ_DATA/GET_DATA pair, or with -a as many as fit a
+    REQ_BATCH/ACK_BATCH pair.
+
+    Reported: offered load, collisions and losses, drops at both queues,
+    queue depth, SPI use, and the latency from the end of the radio frame
+    to the Edison. -o writes every frame the gateway radio got as decrypted
+    ingest records (dev/triumviLib/ingestFrame.h), the stream radioRXOnly
+    sends with INGEST_OUTPUT, to feed rxScript/triumviIngest under load.
+
+    Usage: fleetSim [-n meters] [-d seconds] [-m plain|delta|agg] [-i ms]
+                    [-j percent] [-W watts] [-c seconds] [-b percent] [-T]
+                    [-K] [-E] [-l percent] [-B frames] [-C dB] [-Q packets]
+                    [-R frames] [-D us] [-S Hz] [-O us] [-L us] [-a]
+                    [-o file] [-s seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "reportSched.h"
+#include "deltaReport.h"
+#include "aggReport.h"
+#include "ingestFrame.h"
+
+// as in the apps, see platform/enharvest/contiki-conf.h and project-conf.h
+#define AES_KEY {0x46, 0xe2, 0xe5, 0x28, 0x9a, 0x65, 0x3c, 0xe9, 0x0, 0x2f, 0xc1, 0x6e, 0x65, 0xee, 0xc, 0x3e}
+#define TRIUMVI_PKT_IDENTIFIER 0xa0
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
+#define LEN_LEN 2
+#define MIC_LEN 4
+#define ADATA_LEN 8
+#define PDATA_LEN 5
+
+#define BATTERYPACK_STATUSREG  0x40
+#define POWERFACTOR_STATUSREG  0x04
+#define TIMESTAMP_STATUSREG    0x02
+#define COUNTER_STATUSREG      0x01
+#define DELTA_EXTFLAG          0x01
+#define ENERGY_EXTFLAG         0x02
+
+#define TRIUMVI_PKT_OVERHEAD (5+MIC_LEN)
+#define TRIUMVI_PAYLOAD_LEN 98      // edisonRX packet buffer entry
+#define SPI_BATCH_MAX_LEN 255
+#define FRAME_MAX 127
+
+#define AIR_OVERHEAD 23             // preamble, SFD, length, MAC header, FCS
+#define AIR_BYTE_US 32              // 250 kbps
+#define LED_TIME 100000             // us, LED blink after a reading
+#define HARVEST 10.0                // uW per W of load
+#define WAKE_COST 1000.0            // uJ
+#define STORE_CAP 10000.0           // uJ
+#define LEAKAGE 20.0                // uW
+#define VRMS_NOMINAL 120
+
+#define UNBOUNDED_QUEUE 65536
+#define LATENCY_BINS 120000         // 1 ms each
+
+enum {MODE_PLAIN, MODE_DELTA, MODE_AGG};
+enum {EV_WAKE, EV_TX_START, EV_TX_END, EV_DECRYPT, EV_SPI_START, EV_SPI_DONE};
+
+typedef struct {
+    uint64_t time;          // us
+    uint32_t seq;           // same time, order of scheduling
+    uint32_t arg;
+    uint8_t type;
+} event_t;
+
+typedef struct {
+    uint8_t data[FRAME_MAX];    // from the identifier on, as packetbuf_copyfrom
+    uint8_t len;
+    uint8_t corrupted;
+    uint32_t meter;
+    uint64_t end;
+    int next;               // free list
+} frame_t;
+
+typedef struct {
+    uint8_t extAddr[8];
+    int8_t rssi;
+    uint8_t battery;
+    uint8_t panel;
+    uint8_t circuit;
+    uint8_t lossBad;        // Gilbert-Elliott state of the link
+    uint16_t pf;            // 1/1000
+    double load;            // W
+    uint64_t nextChange;
+    uint64_t lastReading;
+    uint64_t waitStart;     // timer expired, waiting for READYn
+    uint64_t storeTime;
+    double store;           // uJ
+    double energy;          // mWh
+    uint32_t counter;
+    uint8_t waiting;
+    uint8_t haveReading;
+    reportSched_t sched;
+    deltaReport_t delta;
+    aggReport_t agg;
+} meter_t;
+
+typedef struct {
+    uint8_t len;            // bytes to the Edison, ID, address, payload
+    uint64_t rxTime;
+} queued_t;
+
+typedef struct {
+    uint32_t meters;
+    uint64_t duration;      // us
+    int mode;
+    uint32_t interval;      // ms, 0 for reportSched
+    double jitter;
+    double maxLoad;         // W
+    double changeTime;      // s
+    double battery;         // fraction
+    uint8_t timeStamp;
+    uint8_t counter;
+    uint8_t energy;
+    double loss;            // fraction
+    double burst;           // frames
+    double capture;         // dB
+    uint32_t queueLen;
+    uint32_t rawLen;
+    uint32_t decryptTime;   // us
+    double spiClock;
+    uint32_t spiOverhead;   // us
+    uint32_t readyLatency;  // us
+    uint8_t batch;
+} simConfig_t;
+
+typedef struct {
+    uint64_t readings;
+    uint64_t frames;
+    uint64_t frameBytes;
+    uint64_t airTime;       // us, summed over frames
+    uint64_t collisions;
+    uint64_t losses;
+    uint64_t received;
+    uint64_t rawDrops;
+    uint64_t authFails;
+    uint64_t queueDrops;
+    uint64_t delivered;
+    uint64_t deliveredBytes;
+    uint64_t transactions;
+    uint64_t spiBusy;       // us
+    uint32_t maxDepth;
+    uint64_t* depthTime;    // us at every queue depth
+    uint32_t* latency;      // packets per ms of latency
+    double latencySum;      // us
+    uint64_t latencyMax;
+} simResult_t;
+
+static simConfig_t cfg;
+static simResult_t res;
+static meter_t* meters;
+static uint8_t aesRoundKey[176];
+static FILE* ingestOut;
+
+/* Random numbers, reproducible with -s */
+
+static uint64_t rngState = 1;
+
+static uint32_t rnd32(){
+    // xorshift64*
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (rngState * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static double rndUniform(){
+    return (rnd32() + 0.5)/4294967296.0;
+}
+
+static double rndExp(double mean){
+    return -mean*log(rndUniform());
+}
+
+/* AES-128 and CCM, as the CC2538 engine runs them */
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
+
+static uint8_t xtime(uint8_t x){
+    return (x<<1) ^ ((x & 0x80)? 0x1b : 0);
+}
+
+static void aesExpandKey(const uint8_t* key, uint8_t* rk){
+    uint8_t rcon = 1;
+    uint8_t t[4];
+    int i;
+
+    memcpy(rk, key, 16);
+    for (i=16; i<176; i+=4){
+        memcpy(t, &rk[i-4], 4);
+        if ((i & 15) == 0){
+            uint8_t tmp = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[tmp];
+            rcon = xtime(rcon);
+        }
+        rk[i] = rk[i-16] ^ t[0];
+        rk[i+1] = rk[i-15] ^ t[1];
+        rk[i+2] = rk[i-14] ^ t[2];
+        rk[i+3] = rk[i-13] ^ t[3];
+    }
+}
+
+static void aesEncrypt(const uint8_t* rk, const uint8_t* in, uint8_t* out){
+    uint8_t s[16];
+    uint8_t t[16];
+    uint8_t a, b, c, d, e;
+    int round;
+    int i;
+
+    for (i=0; i<16; i++)
+        s[i] = in[i] ^ rk[i];
+    for (round=1; round<=10; round++){
+        // SubBytes and ShiftRows, state in columns
+        for (i=0; i<16; i++)
+            t[i] = sbox[s[(i + 4*(i & 3)) & 15]];
+        if (round < 10){
+            for (i=0; i<16; i+=4){
+                a = t[i]; b = t[i+1]; c = t[i+2]; d = t[i+3];
+                e = a ^ b ^ c ^ d;
+                t[i] ^= e ^ xtime(a ^ b);
+                t[i+1] ^= e ^ xtime(b ^ c);
+                t[i+2] ^= e ^ xtime(c ^ d);
+                t[i+3] ^= e ^ xtime(d ^ a);
+            }
+        }
+        for (i=0; i<16; i++)
+            s[i] = t[i] ^ rk[round*16 + i];
+    }
+    memcpy(out, s, 16);
+}
+
+// CBC-MAC of the CCM blocks, nonce of 15-LEN_LEN bytes
+static void ccmMac(const uint8_t* nonce, const uint8_t* aData, uint8_t aLen,
+                   const uint8_t* data, uint8_t len, uint8_t micLen, uint8_t* tag){
+    uint8_t block[16];
+    int i, j;
+
+    block[0] = ((aLen? 1 : 0)<<6) | (((micLen-2)>>1)<<3) | (LEN_LEN-1);
+    memcpy(&block[1], nonce, 15-LEN_LEN);
+    block[14] = 0;
+    block[15] = len;
+    aesEncrypt(aesRoundKey, block, tag);
+    if (aLen){
+        // 2 bytes length, ADATA_LEN fits the first block
+        memset(block, 0, 16);
+        block[1] = aLen;
+        memcpy(&block[2], aData, aLen);
+        for (i=0; i<16; i++)
+            tag[i] ^= block[i];
+        aesEncrypt(aesRoundKey, tag, tag);
+    }
+    for (i=0; i<len; i+=16){
+        for (j=0; (j<16) && (i+j<len); j++)
+            tag[j] ^= data[i+j];
+        aesEncrypt(aesRoundKey, tag, tag);
+    }
+}
+
+// counter mode from block idx on, in place
+static void ccmCtr(const uint8_t* nonce, uint8_t* data, uint8_t len, uint8_t idx){
+    uint8_t ctr[16];
+    uint8_t key[16];
+    int i, j;
+
+    ctr[0] = LEN_LEN-1;
+    memcpy(&ctr[1], nonce, 15-LEN_LEN);
+    ctr[14] = 0;
+    for (i=0; i<len; i+=16){
+        ctr[15] = idx++;
+        aesEncrypt(aesRoundKey, ctr, key);
+        for (j=0; (j<16) && (i+j<len); j++)
+            data[i+j] ^= key[j];
+    }
+}
+
+// payload encrypted in place, MIC appended
+static void ccmEncrypt(const uint8_t* nonce, const uint8_t* aData, uint8_t* data,
+                       uint8_t len){
+    uint8_t tag[16];
+    ccmMac(nonce, aData, ADATA_LEN, data, len, MIC_LEN, tag);
+    ccmCtr(nonce, data, len, 1);
+    ccmCtr(nonce, tag, MIC_LEN, 0);
+    memcpy(&data[len], tag, MIC_LEN);
+}
+
+// payload and MIC decrypted in place, 0 if the MIC matches
+static int ccmDecrypt(const uint8_t* nonce, const uint8_t* aData, uint8_t* data,
+                      uint8_t len){
+    uint8_t tag[16];
+    ccmCtr(nonce, data, len, 1);
+    ccmCtr(nonce, &data[len], MIC_LEN, 0);
+    ccmMac(nonce, aData, ADATA_LEN, data, len, MIC_LEN, tag);
+    return memcmp(tag, &data[len], MIC_LEN)? -1 : 0;
+}
+
+/* Events */
+
+static event_t* heap;
+static size_t heapLen;
+static size_t heapCap;
+static uint32_t heapSeq;
+
+static int eventBefore(const event_t* a, const event_t* b){
+    return (a->time < b->time) || ((a->time == b->time) && (a->seq < b->seq));
+}
+
+static void schedule(uint64_t time, uint8_t type, uint32_t arg){
+    size_t i;
+    size_t parent;
+    event_t ev;
+
+    if (heapLen == heapCap){
+        heapCap = heapCap? heapCap*2 : 1024;
+        heap = realloc(heap, heapCap*sizeof(event_t));
+    }
+    ev.time = time;
+    ev.seq = heapSeq++;
+    ev.type = type;
+    ev.arg = arg;
+    for (i=heapLen++; i>0; i=parent){
+        parent = (i-1)/2;
+        if (!eventBefore(&ev, &heap[parent]))
+            break;
+        heap[i] = heap[parent];
+    }
+    heap[i] = ev;
+}
+
+static event_t nextEvent(){
+    event_t top = heap[0];
+    event_t last = heap[--heapLen];
+    size_t i = 0;
+    size_t child;
+
+    while ((child = 2*i+1) < heapLen){
+        if ((child+1 < heapLen) && eventBefore(&heap[child+1], &heap[child]))
+            child++;
+        if (!eventBefore(&heap[child], &last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* Frames */
+
+static frame_t* frames;
+static int framesCap;
+static int frameFree = -1;
+
+static int frameAlloc(){
+    int i;
+    if (frameFree < 0){
+        frames = realloc(frames, (framesCap+256)*sizeof(frame_t));
+        for (i=framesCap; i<framesCap+256; i++)
+            frames[i].next = (i+1 < framesCap+256)? i+1 : -1;
+        frameFree = framesCap;
+        framesCap += 256;
+    }
+    i = frameFree;
+    frameFree = frames[i].next;
+    return i;
+}
+
+static void frameRelease(int i){
+    frames[i].next = frameFree;
+    frameFree = i;
+}
+
+/* Meters */
+
+static void packLE(uint8_t* dest, uint32_t src, uint8_t len){
+    uint8_t i;
+    for (i=0; i<len; i++)
+        dest[i] = (src>>(i<<3)) & 0xff;
+}
+
+static void meterNonce(const meter_t* m, uint32_t nonceCounter, uint8_t* nonce){
+    memcpy(nonce, m->extAddr, 8);
+    nonce[8] = 0;
+    packLE(&nonce[9], nonceCounter, 4);
+}
+
+// readings of one meter, as triumvi_current packs them
+static uint8_t buildRecord(meter_t* m, uint8_t* buf, int32_t power, uint64_t now){
+    uint8_t len = PDATA_LEN;
+    uint8_t extFlags = 0;
+    uint16_t IRMS = power/VRMS_NOMINAL;
+    uint64_t s = now/1000000;
+
+    packLE(buf, power, 4);
+    buf[4] = POWERFACTOR_STATUSREG | (m->battery? BATTERYPACK_STATUSREG : 0) |
+        (cfg.timeStamp? TIMESTAMP_STATUSREG : 0) | (cfg.counter? COUNTER_STATUSREG : 0);
+    if (m->battery){
+        buf[len] = m->panel;
+        buf[len+1] = m->circuit;
+        len += 2;
+    }
+    packLE(&buf[len], m->pf, 2);
+    buf[len+2] = VRMS_NOMINAL & 0xff;
+    buf[len+3] = ((VRMS_NOMINAL>>8)<<6) | 1;
+    packLE(&buf[len+4], IRMS, 2);
+    len += 6;
+    if (cfg.timeStamp){
+        buf[len] = 26;
+        buf[len+1] = 1;
+        buf[len+2] = 1 + s/86400;
+        buf[len+3] = (s/3600)%24;
+        buf[len+4] = (s/60)%60;
+        buf[len+5] = s%60;
+        len += 6;
+    }
+    if (cfg.counter){
+        packLE(&buf[len], m->counter++, 4);
+        len += 4;
+    }
+    if (cfg.mode == MODE_DELTA){
+        deltaReportTrailer(&m->delta, &buf[len]);
+        len += DELTA_REPORT_TRAILER_LEN;
+        extFlags |= DELTA_EXTFLAG;
+    }
+    if (cfg.energy){
+        packLE(&buf[len], (uint32_t)m->energy, 4);
+        len += 4;
+        extFlags |= ENERGY_EXTFLAG;
+    }
+    if ((cfg.mode == MODE_DELTA) || cfg.energy)
+        buf[len++] = extFlags;
+    return len;
+}
+
+static uint8_t buildAggregate(meter_t* m, uint8_t* buf){
+    uint8_t len = 2;
+    buf[0] = m->battery? BATTERYPACK_STATUSREG : 0;
+    buf[1] = m->agg.count;
+    if (m->battery){
+        buf[len] = m->panel;
+        buf[len+1] = m->circuit;
+        len += 2;
+    }
+    memcpy(&buf[len], m->agg.buf, m->agg.len);
+    len += m->agg.len;
+    if (cfg.energy){
+        packLE(&buf[len], (uint32_t)m->energy, 4);
+        len += 4;
+    }
+    buf[len++] = cfg.energy? ENERGY_EXTFLAG : 0;
+    return len;
+}
+
+static void transmit(uint32_t idx, uint8_t id, uint8_t pdataLen, const uint8_t* payload,
+                     uint64_t now){
+    meter_t* m = &meters[idx];
+    uint32_t nonceCounter = rnd32();
+    uint8_t nonce[13];
+    int f = frameAlloc();
+    frame_t* fr = &frames[f];
+
+    fr->data[0] = id;
+    packLE(&fr->data[1], nonceCounter, 4);
+    memcpy(&fr->data[5], payload, pdataLen);
+    meterNonce(m, nonceCounter, nonce);
+    ccmEncrypt(nonce, m->extAddr, &fr->data[5], pdataLen);
+    fr->len = 5 + pdataLen + MIC_LEN;
+    fr->meter = idx;
+    fr->corrupted = 0;
+    res.frames += 1;
+    res.frameBytes += fr->len;
+    // random back off, twice random_rand() us
+    schedule(now + 2*(rnd32() & 0xffff), EV_TX_START, f);
+}
+
+static void meterLoad(meter_t* m, uint64_t now){
+    while (now >= m->nextChange){
+        m->load = 5*exp(rndUniform()*log(cfg.maxLoad/5));
+        m->nextChange += (uint64_t)(rndExp(cfg.changeTime)*1e6) + 1;
+    }
+}
+
+static void meterInit(uint32_t idx){
+    meter_t* m = &meters[idx];
+    memset(m, 0, sizeof(meter_t));
+    // TI OUI, then the meter number
+    m->extAddr[0] = 0x00;
+    m->extAddr[1] = 0x12;
+    m->extAddr[2] = 0x4b;
+    m->extAddr[3] = 0x00;
+    packLE(&m->extAddr[4], idx, 4);
+    m->rssi = -95 + (int8_t)(rnd32()%41);
+    m->battery = rndUniform() < cfg.battery;
+    m->panel = idx/42;
+    m->circuit = idx%42;
+    m->pf = 500 + rnd32()%501;
+    meterLoad(m, 0);
+    reportSchedInit(&m->sched, REPORT_SCHED_MAX_STALE);
+    deltaReportInit(&m->delta);
+    aggReportClear(&m->agg);
+    m->store = STORE_CAP/2;
+}
+
+static void meterWake(uint32_t idx, uint64_t now){
+    meter_t* m = &meters[idx];
+    uint8_t payload[TRIUMVI_PAYLOAD_LEN];
+    uint32_t elapsed;
+    uint32_t next;
+    uint8_t len;
+    double rate;
+    int32_t power;
+
+    meterLoad(m, now);
+    if (!m->waiting){
+        m->waiting = 1;
+        m->waitStart = now;
+    }
+    if (cfg.interval == 0){
+        // harvester, wait for READYn
+        rate = HARVEST*m->load - LEAKAGE;
+        m->store += rate*(now - m->storeTime)/1e6;
+        m->storeTime = now;
+        if (m->store > STORE_CAP)
+            m->store = STORE_CAP;
+        if (m->store < WAKE_COST){
+            if (rate <= 0)
+                schedule(m->nextChange, EV_WAKE, idx);
+            else
+                schedule(now + (uint64_t)((WAKE_COST - m->store)/rate*1e6) + 1, EV_WAKE, idx);
+            return;
+        }
+        m->store -= WAKE_COST;
+        reportSchedEnergy(&m->sched, (now - m->waitStart)/1000);
+    }
+    m->waiting = 0;
+
+    res.readings += 1;
+    power = (int32_t)(m->load*1000*(1 + 0.01*(2*rndUniform() - 1)));
+    elapsed = m->haveReading? (now - m->lastReading)/1000 : 0;
+    if (m->haveReading)
+        m->energy += (double)power*(now - m->lastReading)/3.6e9;
+    m->haveReading = 1;
+    m->lastReading = now;
+
+    if (cfg.interval == 0){
+        next = reportSchedNext(&m->sched, power);
+        next += LED_TIME/1000;
+    }
+    else{
+        next = cfg.interval*(1 + cfg.jitter*(2*rndUniform() - 1));
+    }
+
+    switch (cfg.mode){
+        case MODE_PLAIN:
+            len = buildRecord(m, payload, power, now);
+            transmit(idx, cfg.energy? TRIUMVI_PKT_EXT_IDENTIFIER : TRIUMVI_PKT_IDENTIFIER,
+                     len, payload, now);
+        break;
+
+        case MODE_DELTA:
+            if (deltaReportUpdate(&m->delta, power, power/VRMS_NOMINAL, m->pf, elapsed)){
+                len = buildRecord(m, payload, power, now);
+                transmit(idx, TRIUMVI_PKT_EXT_IDENTIFIER, len, payload, now);
+                deltaReportSent(&m->delta, power, power/VRMS_NOMINAL, m->pf);
+            }
+        break;
+
+        case MODE_AGG:
+            aggReportAdd(&m->agg, power, elapsed);
+            if (aggReportDue(&m->agg, (cfg.interval == 0)? reportSchedBatch(&m->sched) :
+                    REPORT_SCHED_MAX_BATCH,
+                    next, REPORT_SCHED_MAX_STALE)){
+                len = buildAggregate(m, payload);
+                transmit(idx, TRIUMVI_PKT_AGG_IDENTIFIER, len, payload, now);
+                aggReportClear(&m->agg);
+            }
+        break;
+    }
+    schedule(now + (uint64_t)next*1000, EV_WAKE, idx);
+}
+
+/* Channel */
+
+static int* air;            // frames on the air
+static int airLen;
+static int airCap;
+
+static void txStart(int f, uint64_t now){
+    frame_t* fr = &frames[f];
+    double diff;
+    int i;
+
+    fr->end = now + (uint64_t)(AIR_OVERHEAD + fr->len)*AIR_BYTE_US;
+    res.airTime += fr->end - now;
+    for (i=0; i<airLen; i++){
+        diff = meters[fr->meter].rssi - meters[frames[air[i]].meter].rssi;
+        if (diff < cfg.capture)
+            fr->corrupted = 1;
+        if (-diff < cfg.capture)
+            frames[air[i]].corrupted = 1;
+    }
+    if (airLen == airCap){
+        airCap = airCap? airCap*2 : 16;
+        air = realloc(air, airCap*sizeof(int));
+    }
+    air[airLen++] = f;
+    schedule(fr->end, EV_TX_END, f);
+}
+
+// Gilbert-Elliott, mean burst of cfg.burst frames, cfg.loss of all frames
+static int linkLost(meter_t* m){
+    double leave = 1/cfg.burst;
+    double enter = cfg.loss*leave/(1 - cfg.loss);
+    if (cfg.loss <= 0)
+        return 0;
+    if (cfg.burst <= 1)
+        return rndUniform() < cfg.loss;
+    if (m->lossBad)
+        m->lossBad = rndUniform() >= leave;
+    else
+        m->lossBad = rndUniform() < enter;
+    return m->lossBad;
+}
+
+/* Bridge */
+
+static int* rawQueue;       // rawRXPackets
+static uint32_t rawHead;
+static uint32_t rawCnt;
+static queued_t* queue;     // triumviRXPackets
+static uint32_t queueCap;
+static uint32_t queueHead;
+static uint32_t queueCnt;
+static uint64_t queueTime;  // last change of queueCnt
+static uint8_t decrypting;
+static uint8_t spiBusy;     // from data ready until the last transaction
+static uint8_t spiSecond;   // next transaction is GET_DATA/ACK_BATCH
+static uint32_t spiBatch;   // packets in the transfer
+
+static void queueDepth(uint64_t now){
+    res.depthTime[queueCnt] += now - queueTime;
+    queueTime = now;
+}
+
+// as radioRXOnly sends it with INGEST_OUTPUT, decrypted
+static void writeIngest(const frame_t* fr){
+    uint8_t record[INGEST_MAX_RECORD];
+    uint8_t out[INGEST_MAX_FRAME];
+    const meter_t* m = &meters[fr->meter];
+    uint8_t pdataLen = fr->len - TRIUMVI_PKT_OVERHEAD;
+    uint8_t nonce[13];
+    uint32_t nonceCounter = fr->data[1] | (fr->data[2]<<8) | (fr->data[3]<<16) |
+        ((uint32_t)fr->data[4]<<24);
+
+    record[0] = INGEST_REC_METER;
+    memcpy(&record[1], m->extAddr, 8);
+    record[9] = (uint8_t)m->rssi;
+    memcpy(&record[INGEST_HEADER_LEN], fr->data, fr->len);
+    meterNonce(m, nonceCounter, nonce);
+    ccmDecrypt(nonce, m->extAddr, &record[INGEST_METER_HEADER_LEN], pdataLen);
+    fwrite(out, 1, ingestFrameEncode(record, INGEST_METER_HEADER_LEN + pdataLen, out),
+           ingestOut);
+}
+
+static void spiReady(uint64_t now){
+    if ((queueCnt > 0) && !spiBusy){
+        spiBusy = 1;
+        spiSecond = 0;
+        schedule(now + cfg.readyLatency, EV_SPI_START, 0);
+    }
+}
+
+static void decryptStart(uint64_t now){
+    if (decrypting || (rawCnt == 0))
+        return;
+    decrypting = 1;
+    schedule(now + cfg.decryptTime, EV_DECRYPT, rawQueue[rawHead]);
+}
+
+static void txEnd(int f, uint64_t now){
+    frame_t* fr = &frames[f];
+    int i;
+
+    for (i=0; i<airLen; i++){
+        if (air[i] == f){
+            air[i] = air[--airLen];
+            break;
+        }
+    }
+    if (fr->corrupted){
+        res.collisions += 1;
+        frameRelease(f);
+        return;
+    }
+    if (linkLost(&meters[fr->meter])){
+        res.losses += 1;
+        frameRelease(f);
+        return;
+    }
+    res.received += 1;
+    if (ingestOut)
+        writeIngest(fr);
+    // rf_rx_handler
+    if (rawCnt >= cfg.rawLen){
+        res.rawDrops += 1;
+        frameRelease(f);
+        return;
+    }
+    rawQueue[(rawHead + rawCnt) % cfg.rawLen] = f;
+    rawCnt += 1;
+    decryptStart(now);
+}
+
+// payload bytes edisonRX forwards, 0 if it does not
+static uint8_t bridgeLength(const uint8_t* data, uint8_t pdataLen){
+    const uint8_t* c = &data[5];
+    uint8_t len = 1 + 8;
+    uint8_t extLen;
+
+    if (data[0] == TRIUMVI_PKT_AGG_IDENTIFIER)
+        return (pdataLen <= TRIUMVI_PAYLOAD_LEN-9)? len + pdataLen : 0;
+    len += 5;
+    if (c[4] & BATTERYPACK_STATUSREG)
+        len += 2;
+    if (c[4] & POWERFACTOR_STATUSREG)
+        len += 6;
+    if (data[0] == TRIUMVI_PKT_EXT_IDENTIFIER){
+        extLen = 1;
+        if (c[pdataLen-1] & DELTA_EXTFLAG)
+            extLen += 6;
+        if (c[pdataLen-1] & ENERGY_EXTFLAG)
+            extLen += 4;
+        if (extLen <= pdataLen-5)
+            len += extLen;
+    }
+    return len;
+}
+
+static void decryptDone(int f, uint64_t now){
+    frame_t* fr = &frames[f];
+    uint8_t nonce[13];
+    uint8_t pdataLen = fr->len - TRIUMVI_PKT_OVERHEAD;
+    uint8_t len;
+    uint32_t nonceCounter = fr->data[1] | (fr->data[2]<<8) | (fr->data[3]<<16) |
+        ((uint32_t)fr->data[4]<<24);
+
+    decrypting = 0;
+    rawHead = (rawHead + 1) % cfg.rawLen;
+    rawCnt -= 1;
+
+    meterNonce(&meters[fr->meter], nonceCounter, nonce);
+    if (ccmDecrypt(nonce, meters[fr->meter].extAddr, &fr->data[5], pdataLen) ||
+        ((len = bridgeLength(fr->data, pdataLen)) == 0)){
+        res.authFails += 1;
+    }
+    else if (queueCnt >= cfg.queueLen){
+        res.queueDrops += 1;
+    }
+    else{
+        queueDepth(now);
+        queue[(queueHead + queueCnt) % queueCap].len = len;
+        queue[(queueHead + queueCnt) % queueCap].rxTime = fr->end;
+        queueCnt += 1;
+        if (queueCnt > res.maxDepth)
+            res.maxDepth = queueCnt;
+        spiReady(now);
+    }
+    frameRelease(f);
+    decryptStart(now);
+}
+
+// first transaction reads the packets, the second one acknowledges them
+static void spiStart(uint64_t now){
+    uint32_t bytes;
+    uint32_t len = 1;
+    uint32_t idx;
+
+    if (!spiSecond){
+        if (cfg.batch){
+            // spiBatchBuild
+            for (spiBatch=0; spiBatch<queueCnt; spiBatch++){
+                idx = (queueHead + spiBatch) % queueCap;
+                if (len + 1 + queue[idx].len > SPI_BATCH_MAX_LEN)
+                    break;
+                len += 1 + queue[idx].len;
+            }
+        }
+        else{
+            spiBatch = 1;
+            len = queue[queueHead].len;
+        }
+        bytes = 2 + len;        // command, length, data
+    }
+    else{
+        bytes = cfg.batch? 3 : 2;
+    }
+    res.transactions += 1;
+    res.spiBusy += cfg.spiOverhead + (uint64_t)(bytes*8e6/cfg.spiClock);
+    schedule(now + cfg.spiOverhead + (uint64_t)(bytes*8e6/cfg.spiClock), EV_SPI_DONE, 0);
+}
+
+static void spiDone(uint64_t now){
+    uint64_t lat;
+    uint32_t i;
+    queued_t* q;
+
+    if (!spiSecond){
+        spiSecond = 1;
+        spiStart(now);
+        return;
+    }
+    queueDepth(now);
+    for (i=0; i<spiBatch; i++){
+        q = &queue[queueHead];
+        lat = now - q->rxTime;
+        res.delivered += 1;
+        res.deliveredBytes += q->len;
+        res.latencySum += lat;
+        if (lat > res.latencyMax)
+            res.latencyMax = lat;
+        res.latency[(lat/1000 < LATENCY_BINS)? lat/1000 : LATENCY_BINS-1] += 1;
+        queueHead = (queueHead + 1) % queueCap;
+        queueCnt -= 1;
+    }
+    spiBusy = 0;
+    spiReady(now);
+}
+
+/* Report */
+
+static double depthPercentile(double p){
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint32_t i;
+    for (i=0; i<=queueCap; i++)
+        total += res.depthTime[i];
+    for (i=0; i<=queueCap; i++){
+        sum += res.depthTime[i];
+        if (sum >= p*total)
+            return i;
+    }
+    return queueCap;
+}
+
+static double latencyPercentile(double p){
+    uint64_t sum = 0;
+    uint32_t i;
+    for (i=0; i<LATENCY_BINS; i++){
+        sum += res.latency[i];
+        if (sum >= p*res.delivered)
+            return i+1;
+    }
+    return LATENCY_BINS;
+}
+
+static double percent(uint64_t part, uint64_t whole){
+    return whole? 100.0*part/whole : 0;
+}
+
+static void report(){
+    static const char* modes[] = {"plain", "delta", "agg"};
+    double seconds = cfg.duration/1e6;
+    double meanDepth = 0;
+    uint32_t i;
+
+    for (i=0; i<=queueCap; i++)
+        meanDepth += (double)i*res.depthTime[i]/cfg.duration;
+
+    printf("%u meters, %s, %s, %.0f s, queue %s%u, raw queue %u, decrypt %u us, "
+           "SPI %.1f MHz %s\n", cfg.meters, modes[cfg.mode],
+           cfg.interval? "fixed interval" : "reportSched", seconds,
+           (cfg.queueLen == UNBOUNDED_QUEUE)? ">" : "", cfg.queueLen, cfg.rawLen,
+           cfg.decryptTime, cfg.spiClock/1e6, cfg.batch? "batch" : "single");
+    printf("  offered    %8.1f frames/s %9.1f bytes/s, %.2f readings a frame, "
+           "airtime %.1f%%\n", res.frames/seconds, res.frameBytes/seconds,
+           res.frames? (double)res.readings/res.frames : 0.0,
+           100.0*res.airTime/cfg.duration);
+    printf("  radio      %8.1f frames/s received, collisions %.2f%%, link losses %.2f%%\n",
+           res.received/seconds, percent(res.collisions, res.frames),
+           percent(res.losses, res.frames));
+    printf("  bridge     raw queue drops %.2f%%, auth failures %llu, packet queue drops %.2f%%\n",
+           percent(res.rawDrops, res.received), (unsigned long long)res.authFails,
+           percent(res.queueDrops, res.received));
+    printf("  queue      depth mean %.2f p99 %.0f p99.9 %.0f max %u, full %.2f%% of the time\n",
+           meanDepth, depthPercentile(0.99), depthPercentile(0.999), res.maxDepth,
+           100.0*res.depthTime[cfg.queueLen < queueCap? cfg.queueLen : queueCap]/cfg.duration);
+    printf("  spi        %8.1f packets/s %9.1f bytes/s, %.1f transactions/s, busy %.1f%%\n",
+           res.delivered/seconds, res.deliveredBytes/seconds, res.transactions/seconds,
+           100.0*res.spiBusy/cfg.duration);
+    printf("  latency    mean %.1f ms p99 %.0f ms max %.1f ms\n",
+           res.delivered? res.latencySum/res.delivered/1000 : 0.0,
+           latencyPercentile(0.99), res.latencyMax/1000.0);
+    printf("  end to end %.2f%% of the frames sent reached the Edison\n",
+           percent(res.delivered, res.frames));
+}
+
+static void usage(const char* name){
+    fprintf(stderr, "Usage: %s [-n meters] [-d seconds] [-m plain|delta|agg] [-i ms] "
+            "[-j percent]\n       [-W watts] [-c seconds] [-b percent] [-T] [-K] [-E] "
+            "[-l percent] [-B frames]\n       [-C dB] [-Q packets] [-R frames] [-D us] "
+            "[-S Hz] [-O us] [-L us] [-a]\n       [-o file] [-s seed]\n", name);
+}
+
+int main(int argc, char** argv){
+    static const uint8_t aesKey[] = AES_KEY;
+    const char* ingestFile = NULL;
+    uint64_t seed = 1;
+    uint64_t now = 0;
+    event_t ev;
+    uint32_t i;
+    int opt;
+
+    cfg.meters = 100;
+    cfg.duration = 600*1000000ULL;
+    cfg.mode = MODE_PLAIN;
+    cfg.interval = 0;
+    cfg.jitter = 0.1;
+    cfg.maxLoad = 2000;
+    cfg.changeTime = 300;
+    cfg.battery = 0.2;
+    cfg.loss = 0.01;
+    cfg.burst = 1;
+    cfg.capture = 3;
+    cfg.queueLen = 32;
+    cfg.rawLen = 4;
+    cfg.decryptTime = 1000;
+    cfg.spiClock = 4e6;
+    cfg.spiOverhead = 200;
+    cfg.readyLatency = 2000;
+
+    while ((opt = getopt(argc, argv, "n:d:m:i:j:W:c:b:TKEl:B:C:Q:R:D:S:O:L:ao:s:")) != -1){
+        switch (opt){
+            case 'n': cfg.meters = strtoul(optarg, NULL, 0); break;
+            case 'd': cfg.duration = strtoull(optarg, NULL, 0)*1000000; break;
+            case 'm':
+                if (strcmp(optarg, "plain") == 0)
+                    cfg.mode = MODE_PLAIN;
+                else if (strcmp(optarg, "delta") == 0)
+                    cfg.mode = MODE_DELTA;
+                else if (strcmp(optarg, "agg") == 0)
+                    cfg.mode = MODE_AGG;
+                else{
+                    usage(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'i': cfg.interval = strtoul(optarg, NULL, 0); break;
+            case 'j': cfg.jitter = atof(optarg)/100; break;
+            case 'W': cfg.maxLoad = atof(optarg); break;
+            case 'c': cfg.changeTime = atof(optarg); break;
+            case 'b': cfg.battery = atof(optarg)/100; break;
+            case 'T': cfg.timeStamp = 1; break;
+            case 'K': cfg.counter = 1; break;
+            case 'E': cfg.energy = 1; break;
+            case 'l': cfg.loss = atof(optarg)/100; break;
+            case 'B': cfg.burst = atof(optarg); break;
+            case 'C': cfg.capture = atof(optarg); break;
+            case 'Q': cfg.queueLen = strtoul(optarg, NULL, 0); break;
+            case 'R': cfg.rawLen = strtoul(optarg, NULL, 0); break;
+            case 'D': cfg.decryptTime = strtoul(optarg, NULL, 0); break;
+            case 'S': cfg.spiClock = atof(optarg); break;
+            case 'O': cfg.spiOverhead = strtoul(optarg, NULL, 0); break;
+            case 'L': cfg.readyLatency = strtoul(optarg, NULL, 0); break;
+            case 'a': cfg.batch = 1; break;
+            case 'o': ingestFile = optarg; break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if ((cfg.meters == 0) || (cfg.duration == 0) || (cfg.rawLen == 0) ||
+        (cfg.spiClock <= 0) || (cfg.maxLoad <= 5) || (cfg.changeTime <= 0) ||
+        (cfg.loss >= 1) || (cfg.jitter >= 1)){
+        usage(argv[0]);
+        return 1;
+    }
+    // the delta trailer and the energy register go together in the apps
+    if (cfg.mode == MODE_DELTA)
+        cfg.energy = 1;
+    if ((cfg.queueLen == 0) || (cfg.queueLen > UNBOUNDED_QUEUE))
+        cfg.queueLen = UNBOUNDED_QUEUE;
+    if (ingestFile){
+        ingestOut = fopen(ingestFile, "wb");
+        if (ingestOut == NULL){
+            perror(ingestFile);
+            return 1;
+        }
+    }
+
+    rngState = seed? seed : 1;
+    aesExpandKey(aesKey, aesRoundKey);
+    queueCap = cfg.queueLen;
+    queue = malloc(queueCap*sizeof(queued_t));
+    rawQueue = malloc(cfg.rawLen*sizeof(int));
+    res.depthTime = calloc(queueCap+1, sizeof(uint64_t));
+    res.latency = calloc(LATENCY_BINS, sizeof(uint32_t));
+    meters = malloc(cfg.meters*sizeof(meter_t));
+
+    // meters power up spread over the first interval
+    for (i=0; i<cfg.meters; i++){
+        meterInit(i);
+        schedule((uint64_t)(rndUniform()*1000*(cfg.interval? cfg.interval :
+                 REPORT_SCHED_START_INTERVAL)), EV_WAKE, i);
+    }
+
+    while (heapLen > 0){
+        ev = nextEvent();
+        if (ev.time >= cfg.duration)
+            break;
+        now = ev.time;
+        switch (ev.type){
+            case EV_WAKE: meterWake(ev.arg, now); break;
+            case EV_TX_START: txStart(ev.arg, now); break;
+            case EV_TX_END: txEnd(ev.arg, now); break;
+            case EV_DECRYPT: decryptDone(ev.arg, now); break;
+            case EV_SPI_START: spiStart(now); break;
+            case EV_SPI_DONE: spiDone(now); break;
+        }
+    }
+    queueDepth(cfg.duration);
+    report();
+
+    if (ingestOut)
+        fclose(ingestOut);
+    free(meters);
+    free(res.latency);
+    free(res.depthTime);
+    free(rawQueue);
+    free(queue);
+    free(frames);
+    free(air);
+    free(heap);
+    return 0;
+}
@@ -0,0 +1,551 @@
+/*
+    Replays recorded current waveforms through the firmware metering code
+    (dev/triumviLib/meterCalc.c) on a PC, and reports the compute cost per
+    cycle and the error against a floating point reference.
+
+    Supported captures (format is detected from the content):
+    - DATADUMP UART logs of the phase calibration process
+      ("ADC reference:", "INA Gain:", "Current reading:" lines), raw ADC
+    - waveSyn/timeCapture.txt, waveSyn/timeVariant/data*.txt
+      ("Time Stamp: t  Current (mA): i"), re-quantized to ADC codes
+    - Tektronix scope CSV (waveSyn/T0115CH4.CSV), resampled at the firmware
+      sampling rate, volts are converted with -s mA/V
+
+    Every evaluated cycle is also run through the float implementation the
+    firmware used before the fixed point rewrite, the cycles that do not
+    match bit for bit are counted.
+    The phase of every evaluated cycle is found with both meterPhaseMatch
+    (brute force) and meterPhaseEstimate, the spread of each and the cycles
+    where they disagree are reported.
+    -b checks meterCurrentTransform for every ADC code and gain, and
+    meterVoltageRMS on synthesized 0-300 V waveforms, against the float code.
+
+    Usage: meterReplay [-p phase] [-g gainIdx] [-r adcRef] [-s mAPerVolt]
+                       [-n repeat] [-v] [-b] [file ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meterCalc.h"
+#include SINE_TABLE_H
+
+// Mirrors the gain tables in apps/triumvi_current
+#if defined(VERSION10)
+#define MAX_INA_GAIN_IDX 3
+static const uint8_t inaGainArr[MAX_INA_GAIN_IDX+1] = {1, 5, 9, 17};
+static const uint32_t inaGainRecipArr[MAX_INA_GAIN_IDX+1] = {METER_GAIN_RECIP(1), METER_GAIN_RECIP(5), METER_GAIN_RECIP(9), METER_GAIN_RECIP(17)};
+static const uint8_t bitShiftArr[MAX_INA_GAIN_IDX+1] = {0, 0, 0, 0};
+#elif defined(VERSION11)
+#define MAX_INA_GAIN_IDX 4
+static const uint8_t inaGainArr[MAX_INA_GAIN_IDX+1] = {1, 3, 5, 9, 17};
+static const uint32_t inaGainRecipArr[MAX_INA_GAIN_IDX+1] = {METER_GAIN_RECIP(1), METER_GAIN_RECIP(3), METER_GAIN_RECIP(5), METER_GAIN_RECIP(9), METER_GAIN_RECIP(17)};
+static const uint8_t bitShiftArr[MAX_INA_GAIN_IDX+1] = {2, 0, 0, 0, 0};
+#elif defined(VERSION12)
+#define MAX_INA_GAIN_IDX 4
+static const uint8_t inaGainArr[MAX_INA_GAIN_IDX+1] = {1, 3, 5, 9, 17};
+static const uint32_t inaGainRecipArr[MAX_INA_GAIN_IDX+1] = {METER_GAIN_RECIP(1), METER_GAIN_RECIP(3), METER_GAIN_RECIP(5), METER_GAIN_RECIP(9), METER_GAIN_RECIP(17)};
+static const uint8_t bitShiftArr[MAX_INA_GAIN_IDX+1] = {6, 4, 2, 0, 0};
+#endif
+
+// 16 MHz GPTIMER ticks per cycle, as in sampleCurrentWaveform()
+#define CLOCK_FREQ 16e6
+#define TICKS_PER_CYCLE (CLOCK_FREQ/SINE_TABLE_FREQ)
+#define ADC_MAX 2047
+#define MAX_CYCLES 4096
+#define LINE_LEN 256
+
+typedef enum {
+    CAPTURE_DATADUMP,
+    CAPTURE_MA,
+    CAPTURE_SCOPE,
+    CAPTURE_UNKNOWN
+} capture_t;
+
+typedef struct {
+    // one entry per sample, either raw ADC (DATADUMP) or mA
+    double sample[BUF_SIZE];
+    uint16_t adcRef;
+    uint8_t gainIdx;
+    uint8_t isADC;
+} cycle_t;
+
+static cycle_t cycles[MAX_CYCLES];
+
+static int optPhase = -1;
+static int optGainIdx = MAX_INA_GAIN_IDX-1;
+static int optRef = 1024;
+static double optScale = 1000.0;
+static int optRepeat = 1000;
+static int optVerbose = 0;
+static int optBench = 0;
+
+// Float implementation replaced by the Q26 gain reciprocals, kept as the
+// reference for the bit accuracy checks
+static int floatCurrentTransform(int currentReading, uint8_t inaGain, uint8_t bitShift, uint8_t externalVolt){
+    float tmp = (externalVolt)? currentReading*I_TRANSFORM*2/inaGain : currentReading*I_TRANSFORM/inaGain;
+    return (((int)tmp)>>bitShift);
+}
+
+static int floatSinePower(int* currSamples, const int* sineTable, uint16_t phaseOffset,
+        uint8_t inaGain, uint8_t bitShift, uint8_t voltScaling){
+    uint16_t i;
+    int energyCal = 0;
+    int tempPower;
+    for (i=0; i<BUF_SIZE; i++){
+        currSamples[i] = floatCurrentTransform(currSamples[i], inaGain, bitShift, 0x0);
+        energyCal += (currSamples[i]*sineTable[i*DEGREE_PER_SAMPLE+phaseOffset]);
+    }
+    tempPower = (energyCal*voltScaling/BUF_SIZE);
+    if (tempPower < 0)
+        tempPower = -1*tempPower;
+    return tempPower;
+}
+
+static uint16_t floatVoltageRMS(int* voltSamples, uint16_t length){
+    uint16_t i;
+    float tmp;
+    float result = 0;
+    for (i=0; i<length; i++){
+        tmp = voltSamples[i]/1000;
+        result += tmp*tmp;
+    }
+    result /= length;
+    return mysqrt((uint32_t)result);
+}
+
+static capture_t detectCapture(FILE* fp){
+    char line[LINE_LEN];
+    capture_t res = CAPTURE_UNKNOWN;
+    while (fgets(line, LINE_LEN, fp)){
+        if (strstr(line, "Current reading:") || strstr(line, "ADC reference:")){
+            res = CAPTURE_DATADUMP;
+            break;
+        }
+        if (strstr(line, "Current (mA):")){
+            res = CAPTURE_MA;
+            break;
+        }
+        if (strstr(line, "Sample Interval") || strncmp(line, "TIME,", 5)==0){
+            res = CAPTURE_SCOPE;
+            break;
+        }
+    }
+    rewind(fp);
+    return res;
+}
+
+static int gainToIdx(int gain){
+    int i;
+    for (i=0; i<=MAX_INA_GAIN_IDX; i++){
+        if (inaGainArr[i]==gain)
+            return i;
+    }
+    return optGainIdx;
+}
+
+// DATADUMP: header lines followed by BUF_SIZE "Current reading" lines
+static int loadDataDump(FILE* fp){
+    char line[LINE_LEN];
+    int numCycles = 0;
+    int cnt = 0;
+    int ref = optRef;
+    int gainIdx = optGainIdx;
+    unsigned int val;
+    while (fgets(line, LINE_LEN, fp) && numCycles < MAX_CYCLES){
+        if (sscanf(line, "ADC reference: %u", &val)==1){
+            ref = val;
+            cnt = 0;
+        }
+        else if (sscanf(line, "INA Gain: %u", &val)==1){
+            gainIdx = gainToIdx(val);
+        }
+        else if (sscanf(line, "Current reading: %u", &val)==1){
+            cycles[numCycles].sample[cnt++] = val;
+            if (cnt==BUF_SIZE){
+                cycles[numCycles].adcRef = ref;
+                cycles[numCycles].gainIdx = gainIdx;
+                cycles[numCycles].isADC = 1;
+                numCycles++;
+                cnt = 0;
+            }
+        }
+    }
+    return numCycles;
+}
+
+// "Time Stamp: t   Current (mA): i", a new cycle starts when t wraps
+static int loadCurrentCapture(FILE* fp){
+    char line[LINE_LEN];
+    int numCycles = 0;
+    int cnt = 0;
+    long timeStamp, prevTime = -1;
+    int current;
+    char *timeField, *currentField;
+    while (fgets(line, LINE_LEN, fp) && numCycles < MAX_CYCLES){
+        // some captures have a stray byte between the two fields, or start
+        // in the middle of the first line
+        timeField = strstr(line, "Time Stamp:");
+        currentField = strstr(line, "Current (mA):");
+        if (!currentField)
+            continue;
+        current = strtol(currentField+strlen("Current (mA):"), NULL, 10);
+        if (timeField){
+            timeStamp = strtol(timeField+strlen("Time Stamp:"), NULL, 10);
+            if (timeStamp < prevTime)
+                cnt = 0;
+            prevTime = timeStamp;
+        }
+        if (cnt < BUF_SIZE){
+            cycles[numCycles].sample[cnt++] = current;
+            if (cnt==BUF_SIZE){
+                cycles[numCycles].isADC = 0;
+                numCycles++;
+            }
+        }
+    }
+    return numCycles;
+}
+
+// scope CSV, resampled with linear interpolation at the firmware rate
+static int loadScope(FILE* fp){
+    char line[LINE_LEN];
+    double dt = 0;
+    double t, v;
+    double* trace = NULL;
+    size_t len = 0, cap = 0;
+    int numCycles = 0;
+    int i;
+    double samplePeriod = (double)TICKS_PER_CYCLE/BUF_SIZE/CLOCK_FREQ;
+    double cycleLen, pos, frac;
+    size_t idx;
+
+    while (fgets(line, LINE_LEN, fp)){
+        if (sscanf(line, "Sample Interval,%lf", &dt)==1)
+            continue;
+        if (sscanf(line, "%lf,%lf", &t, &v)!=2)
+            continue;
+        if (len==cap){
+            cap = (cap)? cap*2 : 65536;
+            trace = realloc(trace, cap*sizeof(double));
+            if (!trace)
+                return 0;
+        }
+        trace[len++] = v;
+    }
+    if ((dt <= 0) || (len==0)){
+        free(trace);
+        return 0;
+    }
+
+    cycleLen = samplePeriod*BUF_SIZE/dt;
+    while (((numCycles+1)*cycleLen < len-1) && (numCycles < MAX_CYCLES)){
+        for (i=0; i<BUF_SIZE; i++){
+            pos = (numCycles*BUF_SIZE + i)*samplePeriod/dt;
+            idx = (size_t)pos;
+            frac = pos - idx;
+            cycles[numCycles].sample[i] = optScale*(trace[idx]*(1-frac) + trace[idx+1]*frac);
+        }
+        cycles[numCycles].isADC = 0;
+        numCycles++;
+    }
+    free(trace);
+    return numCycles;
+}
+
+// mA -> ADC code with the given gain, what the front-end would have produced
+static void quantize(const cycle_t* c, uint8_t gainIdx, uint16_t* adc, uint16_t* ref){
+    int i;
+    long code;
+    if (c->isADC){
+        for (i=0; i<BUF_SIZE; i++)
+            adc[i] = (uint16_t)c->sample[i];
+        *ref = c->adcRef;
+        return;
+    }
+    for (i=0; i<BUF_SIZE; i++){
+        code = lround(c->sample[i]*inaGainArr[gainIdx]/I_TRANSFORM) + optRef;
+        adc[i] = (code < 0)? 0 : (code > ADC_MAX)? ADC_MAX : code;
+    }
+    *ref = optRef;
+}
+
+static double cycleMilliAmp(const cycle_t* c, int i){
+    if (c->isADC)
+        return (c->sample[i] - c->adcRef)*I_TRANSFORM/inaGainArr[c->gainIdx];
+    return c->sample[i];
+}
+
+static double nowNs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static void replay(const char* fileName){
+    FILE* fp = fopen(fileName, "r");
+    capture_t type;
+    int numCycles = 0;
+    int n, i, k;
+    uint16_t adc[BUF_SIZE];
+    uint16_t ref;
+    uint16_t phase;
+    uint16_t phaseRef;
+    int adjusted[MAX_BUF_SIZE];
+    int work[MAX_BUF_SIZE];
+    uint8_t gainIdx = optGainIdx;
+    gainSetting_t gainSetting = GAIN_OK;
+    int power = 0;
+    uint16_t irms = 0;
+    double refPower, refIrms, deg, mA;
+    double errPower, errIrms;
+    double sumErrPower = 0, maxErrPower = 0;
+    double sumErrIrms = 0, maxErrIrms = 0;
+    double t0, tGain = 0, tPower = 0, tRms = 0;
+    int evaluated = 0, retries = 0, mismatch = 0;
+    int floatPower;
+    uint16_t floatIrms;
+    uint16_t phaseMatch, phaseEst;
+    double tMatch = 0, tEst = 0;
+    double sumMatch = 0, sumSqMatch = 0, sumEst = 0, sumSqEst = 0;
+    int phaseDiff = 0;
+    int phaseRepeat = (optRepeat > 100)? optRepeat/100 : 1;
+
+    if (!fp){
+        perror(fileName);
+        return;
+    }
+    type = detectCapture(fp);
+    switch (type){
+        case CAPTURE_DATADUMP: numCycles = loadDataDump(fp); break;
+        case CAPTURE_MA: numCycles = loadCurrentCapture(fp); break;
+        case CAPTURE_SCOPE: numCycles = loadScope(fp); break;
+        default: break;
+    }
+    fclose(fp);
+    if (numCycles==0){
+        fprintf(stderr, "%s: no complete cycle found\n", fileName);
+        return;
+    }
+
+    // phase calibration on the first cycle, same as phaseCalibrationProcess
+    if (optPhase >= 0){
+        phase = optPhase;
+    } else {
+        quantize(&cycles[0], cycles[0].isADC? cycles[0].gainIdx : gainIdx, adc, &ref);
+        phase = meterPhaseMatch(adc, stdSineTable, &phaseRef);
+    }
+
+    for (n=0; n<numCycles; n++){
+        if (cycles[n].isADC)
+            gainIdx = cycles[n].gainIdx;
+        // gain control, on the device a retry is the next cycle
+        for (k=0; k<=MAX_INA_GAIN_IDX; k++){
+            quantize(&cycles[n], gainIdx, adc, &ref);
+            t0 = nowNs();
+            for (i=0; i<optRepeat; i++)
+                gainSetting = meterGainCheck(adc, BUF_SIZE, ref, gainIdx, MAX_INA_GAIN_IDX, 0x0, adjusted);
+            tGain += (nowNs()-t0)/optRepeat;
+            if (gainSetting==GAIN_TOO_HIGH && !cycles[n].isADC){
+                gainIdx -= 1;
+                retries++;
+            } else if (gainSetting==GAIN_TOO_LOW && !cycles[n].isADC){
+                gainIdx += 1;
+                retries++;
+            } else {
+                break;
+            }
+        }
+        if ((gainSetting==GAIN_TOO_HIGH) || (gainSetting==GAIN_TOO_LOW))
+            continue;
+
+        // samples are transformed in place, restore them for every repetition
+        t0 = nowNs();
+        for (i=0; i<optRepeat; i++){
+            memcpy(work, adjusted, sizeof(int)*BUF_SIZE);
+            power = meterSinePower(work, stdSineTable, phase, inaGainRecipArr[gainIdx], bitShiftArr[gainIdx], 1);
+        }
+        tPower += (nowNs()-t0)/optRepeat;
+        t0 = nowNs();
+        for (i=0; i<optRepeat; i++)
+            irms = meterCurrentRMS(work, BUF_SIZE);
+        tRms += (nowNs()-t0)/optRepeat;
+
+        memcpy(work, adjusted, sizeof(int)*BUF_SIZE);
+        floatPower = floatSinePower(work, stdSineTable, phase, inaGainArr[gainIdx], bitShiftArr[gainIdx], 1);
+        floatIrms = meterCurrentRMS(work, BUF_SIZE);
+        if ((floatPower != power) || (floatIrms != irms))
+            mismatch++;
+
+        // undo the exponent, the gateway does the same
+        power <<= bitShiftArr[gainIdx];
+        irms <<= bitShiftArr[gainIdx];
+
+        // floating point reference from the same samples and phase
+        refPower = 0;
+        refIrms = 0;
+        for (i=0; i<BUF_SIZE; i++){
+            mA = cycleMilliAmp(&cycles[n], i);
+            deg = (i*DEGREE_PER_SAMPLE + phase)*M_PI/180;
+            refPower += mA*VOLTAGE_NOMINAL*sqrt(2)*sin(deg);
+            refIrms += mA*mA;
+        }
+        refPower = fabs(refPower/BUF_SIZE);
+        refIrms = sqrt(refIrms/BUF_SIZE);
+        errPower = (refPower > 0)? fabs(power - refPower)/refPower*100 : 0;
+        errIrms = (refIrms > 0)? fabs(irms - refIrms)/refIrms*100 : 0;
+        sumErrPower += errPower;
+        sumErrIrms += errIrms;
+        if (errPower > maxErrPower)
+            maxErrPower = errPower;
+        if (errIrms > maxErrIrms)
+            maxErrIrms = errIrms;
+        evaluated++;
+
+        // phase calibration cost and spread, on the raw samples
+        t0 = nowNs();
+        for (i=0; i<phaseRepeat; i++)
+            phaseMatch = meterPhaseMatch(adc, stdSineTable, &phaseRef);
+        tMatch += (nowNs()-t0)/phaseRepeat;
+        t0 = nowNs();
+        for (i=0; i<phaseRepeat; i++)
+            phaseEst = meterPhaseEstimate(adc, stdSineTable, &phaseRef);
+        tEst += (nowNs()-t0)/phaseRepeat;
+        if (phaseMatch != phaseEst)
+            phaseDiff++;
+        sumMatch += phaseMatch;
+        sumSqMatch += (double)phaseMatch*phaseMatch;
+        sumEst += phaseEst;
+        sumSqEst += (double)phaseEst*phaseEst;
+
+        if (optVerbose){
+            printf("cycle %d gain %u power %d mW (ref %.0f) irms %u mA (ref %.0f)\n",
+                n, inaGainArr[gainIdx], power, refPower, irms, refIrms);
+        }
+    }
+
+    printf("%s: %d cycles, %d evaluated, %d gain retries, phase offset %u\n",
+        fileName, numCycles, evaluated, retries, phase);
+    if (evaluated==0)
+        return;
+    printf("  time per cycle: gain %.0f ns, power %.0f ns, rms %.0f ns\n",
+        tGain/evaluated, tPower/evaluated, tRms/evaluated);
+    printf("  power error: mean %.3f %%, max %.3f %%\n", sumErrPower/evaluated, maxErrPower);
+    printf("  irms error:  mean %.3f %%, max %.3f %%\n", sumErrIrms/evaluated, maxErrIrms);
+    printf("  float path:  %d of %d cycles differ\n", mismatch, evaluated);
+    printf("  phase match: mean %.2f, std %.2f deg, %.0f ns\n", sumMatch/evaluated,
+        sqrt(fabs(sumSqMatch/evaluated - (sumMatch/evaluated)*(sumMatch/evaluated))), tMatch/evaluated);
+    printf("  phase est:   mean %.2f, std %.2f deg, %.0f ns, %d of %d cycles differ\n", sumEst/evaluated,
+        sqrt(fabs(sumSqEst/evaluated - (sumEst/evaluated)*(sumEst/evaluated))), tEst/evaluated,
+        phaseDiff, evaluated);
+}
+
+// fixed point vs float, exhaustive over the ADC range
+static void benchTransform(){
+    int reading, k, ext, res, ref;
+    int mismatch = 0, total = 0;
+    double t0, tFixed = 0, tFloat = 0;
+    volatile int sink = 0;
+
+    for (k=0; k<=MAX_INA_GAIN_IDX; k++){
+        for (ext=0; ext<2; ext++){
+            for (reading=-2048; reading<2048; reading++){
+                res = meterCurrentTransform(reading, inaGainRecipArr[k], bitShiftArr[k], ext);
+                ref = floatCurrentTransform(reading, inaGainArr[k], bitShiftArr[k], ext);
+                if (res != ref){
+                    if (mismatch < 10)
+                        printf("  gain %u ext %d reading %d: %d != %d\n", inaGainArr[k], ext, reading, res, ref);
+                    mismatch++;
+                }
+                total++;
+            }
+        }
+        t0 = nowNs();
+        for (reading=-2048; reading<2048; reading++)
+            sink += meterCurrentTransform(reading, inaGainRecipArr[k], bitShiftArr[k], 0);
+        tFixed += nowNs()-t0;
+        t0 = nowNs();
+        for (reading=-2048; reading<2048; reading++)
+            sink += floatCurrentTransform(reading, inaGainArr[k], bitShiftArr[k], 0);
+        tFloat += nowNs()-t0;
+    }
+    printf("current transform: %d of %d readings differ, %.2f ns fixed, %.2f ns float\n",
+        mismatch, total, tFixed/(4096*(MAX_INA_GAIN_IDX+1)), tFloat/(4096*(MAX_INA_GAIN_IDX+1)));
+}
+
+// external voltage mode waveforms, 2 cycles of BUF_SIZE2 10-bit samples
+static void benchVoltageRMS(){
+    int volt[BUF_SIZE2];
+    int adc[BUF_SIZE2];
+    int vrms, ph, i, diff, maxDiff = 0;
+    int mismatch = 0, total = 0, lastExact = -1;
+    uint16_t ref, res, refRes;
+    long code;
+    double v;
+
+    for (vrms=0; vrms<=300; vrms++){
+        for (ph=0; ph<360; ph+=15){
+            for (i=0; i<BUF_SIZE2; i++){
+                v = vrms*sqrt(2)*sin((i*720.0/BUF_SIZE2 + ph)*M_PI/180);
+                code = lround(v*1000/VOLTAGE_SCALING) + 512;
+                adc[i] = (code < 0)? 0 : (code > 1023)? 1023 : code;
+            }
+            ref = getAverage32(adc, BUF_SIZE2);
+            for (i=0; i<BUF_SIZE2; i++)
+                volt[i] = meterVoltTransform(adc[i], ref);
+            res = meterVoltageRMS(volt, BUF_SIZE2);
+            refRes = floatVoltageRMS(volt, BUF_SIZE2);
+            if (res != refRes){
+                diff = abs(res - refRes);
+                if (diff > maxDiff)
+                    maxDiff = diff;
+                mismatch++;
+            }
+            else if (mismatch == 0){
+                lastExact = vrms;
+            }
+            total++;
+        }
+    }
+    printf("voltage RMS: %d of %d waveforms differ (max %d V), identical up to %d VRMS\n",
+        mismatch, total, maxDiff, lastExact);
+}
+
+int main(int argc, char** argv){
+    int opt;
+    while ((opt = getopt(argc, argv, "p:g:r:s:n:vb")) != -1){
+        switch (opt){
+            case 'p': optPhase = atoi(optarg) % 360; break;
+            case 'g': optGainIdx = atoi(optarg); break;
+            case 'r': optRef = atoi(optarg); break;
+            case 's': optScale = atof(optarg); break;
+            case 'n': optRepeat = atoi(optarg); break;
+            case 'v': optVerbose = 1; break;
+            case 'b': optBench = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-p phase] [-g gainIdx] [-r adcRef] "
+                    "[-s mAPerVolt] [-n repeat] [-v] [-b] [file ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if ((optGainIdx < MIN_INA_GAIN_IDX) || (optGainIdx > MAX_INA_GAIN_IDX) || (optRepeat < 1)){
+        fprintf(stderr, "invalid option\n");
+        return 1;
+    }
+    if (optBench){
+        benchTransform();
+        benchVoltageRMS();
+    }
+    else if (optind >= argc){
+        fprintf(stderr, "no input file\n");
+        return 1;
+    }
+    for (; optind<argc; optind++)
+        replay(argv[optind]);
+    return 0;
+}
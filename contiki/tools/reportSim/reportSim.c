@@ -0,0 +1,356 @@
+/*
+    Runs the reporting scheduler (dev/triumviLib/reportSched.c) on a PC
+    against a simulated harvester and load traces, next to the fixed
+    backOffTime rule the apps used before, and reports how often each
+    reports, how stale the readings get and how long a load change takes to
+    show up.
+
+    Harvester model: the CT charges the supercap with k uW per W of load
+    (less a constant leakage), READYn is released once the store holds the
+    energy of one wake-up (-e uJ), the store saturates at -c uJ.
+    Every wake-up costs -e uJ, the reading is the trace value with -n percent
+    of uniform noise, the LED blink adds 100 ms before the next sleep.
+
+    Trace files: "seconds milliwatts" per line, '#' starts a comment, a value
+    holds until the next line. Without files, built in traces are used
+    (steady, step, fridge, noisy, light).
+
+    Usage: reportSim [-m maxStaleMs] [-k uWPerW] [-e wakeUJ] [-c capUJ]
+                     [-l leakUW] [-n noisePercent] [-d seconds] [-v]
+                     [file ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reportSched.h"
+
+#define SIM_STEP 10             // ms
+#define SIM_LED_TIME 100        // ms, LED blink after a reading
+#define MAX_TRACE_LEN 4096
+
+typedef struct {
+    uint32_t time;              // ms
+    int32_t power;              // mW
+} tracePoint_t;
+
+typedef struct {
+    const char* name;
+    tracePoint_t points[MAX_TRACE_LEN];
+    int len;
+} trace_t;
+
+typedef struct {
+    double harvest;             // uW per W of load
+    double wakeCost;            // uJ
+    double capacity;            // uJ
+    double leakage;             // uW
+    double noise;               // fraction
+    uint32_t duration;          // ms
+    uint32_t maxStale;          // ms
+    int verbose;
+} simConfig_t;
+
+typedef struct {
+    uint32_t readings;
+    uint32_t waits;
+    uint64_t waitTime;
+    uint32_t maxGap;
+    uint32_t changes;
+    uint32_t missed;            // changes not seen before the trace moved on
+    uint64_t latency;
+    uint32_t maxLatency;
+} simResult_t;
+
+/* Scheduling policies */
+
+typedef struct {
+    const char* name;
+    void (*init)(void* state, uint32_t maxStale);
+    void (*energy)(void* state, uint32_t wait);
+    uint32_t (*next)(void* state, int32_t power);
+} policy_t;
+
+static void schedInit(void* state, uint32_t maxStale){
+    reportSchedInit((reportSched_t*)state, maxStale);
+}
+
+static void schedEnergy(void* state, uint32_t wait){
+    reportSchedEnergy((reportSched_t*)state, wait);
+}
+
+static uint32_t schedNext(void* state, int32_t power){
+    return reportSchedNext((reportSched_t*)state, power);
+}
+
+// backOffTime/backOffHistory as in the apps before the scheduler
+typedef struct {
+    uint32_t backOffTime;
+    uint8_t backOffHistory;
+} backOff_t;
+
+static void backOffInit(void* state, uint32_t maxStale){
+    backOff_t* b = (backOff_t*)state;
+    b->backOffTime = 4000;
+    b->backOffHistory = 0;
+}
+
+static void backOffEnergy(void* state, uint32_t wait){
+    backOff_t* b = (backOff_t*)state;
+    if (((b->backOffHistory&0x0f)==0x0f)&&(b->backOffTime>1000)){
+        b->backOffTime /= 2;
+        b->backOffHistory &= 0x03;
+    }
+    b->backOffHistory = (b->backOffHistory<<1) | 0x01;
+}
+
+static uint32_t backOffNext(void* state, int32_t power){
+    return ((backOff_t*)state)->backOffTime;
+}
+
+static const policy_t policies[] = {
+    {"backoff", backOffInit, backOffEnergy, backOffNext},
+    {"sched", schedInit, schedEnergy, schedNext},
+};
+#define NUM_POLICIES (sizeof(policies)/sizeof(policies[0]))
+
+/* Traces */
+
+static void traceAdd(trace_t* trace, uint32_t seconds, int32_t power){
+    if (trace->len >= MAX_TRACE_LEN)
+        return;
+    trace->points[trace->len].time = seconds*1000;
+    trace->points[trace->len].power = power;
+    trace->len += 1;
+}
+
+static int32_t traceAt(const trace_t* trace, uint32_t time, int* idx){
+    while ((*idx+1 < trace->len) && (trace->points[*idx+1].time <= time))
+        *idx += 1;
+    return trace->points[*idx].power;
+}
+
+static void builtinTraces(trace_t* traces, int* num){
+    int i;
+    trace_t* t;
+
+    t = &traces[(*num)++];
+    t->name = "steady";
+    traceAdd(t, 0, 100000);
+
+    t = &traces[(*num)++];
+    t->name = "step";
+    traceAdd(t, 0, 100000);
+    traceAdd(t, 600, 1000000);
+    traceAdd(t, 1800, 50000);
+    traceAdd(t, 2700, 400000);
+
+    // compressor, 10 minutes on, 20 minutes off, start up spike
+    t = &traces[(*num)++];
+    t->name = "fridge";
+    for (i=0; i<24; i++){
+        traceAdd(t, i*1800, 600000);
+        traceAdd(t, i*1800+5, 150000);
+        traceAdd(t, i*1800+600, 5000);
+    }
+
+    // fluctuating load, a new level every 10 s within +-3 %
+    t = &traces[(*num)++];
+    t->name = "noisy";
+    srand(1);
+    for (i=0; i<1000; i++)
+        traceAdd(t, i*10, 500000 + (rand()%30001) - 15000);
+
+    // light load, the harvester cannot keep up with 1 s reports
+    t = &traces[(*num)++];
+    t->name = "light";
+    traceAdd(t, 0, 20000);
+    traceAdd(t, 1200, 40000);
+    traceAdd(t, 2400, 15000);
+}
+
+static int traceRead(const char* fileName, trace_t* trace){
+    FILE* fp = fopen(fileName, "r");
+    char line[256];
+    double seconds, power;
+    char* p;
+
+    if (fp==NULL){
+        perror(fileName);
+        return -1;
+    }
+    trace->name = fileName;
+    trace->len = 0;
+    while (fgets(line, sizeof(line), fp)){
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+        if (sscanf(line, "%lf %lf", &seconds, &power) == 2)
+            traceAdd(trace, (uint32_t)seconds, (int32_t)power);
+    }
+    fclose(fp);
+    if (trace->len == 0){
+        fprintf(stderr, "%s: no samples\n", fileName);
+        return -1;
+    }
+    return 0;
+}
+
+/* Simulation */
+
+static void simulate(const simConfig_t* cfg, const trace_t* trace,
+                     const policy_t* policy, simResult_t* res){
+    union {
+        reportSched_t sched;
+        backOff_t backOff;
+    } state;
+    double energy = 0;
+    uint32_t time;
+    uint32_t wake = REPORT_SCHED_START_INTERVAL;
+    uint32_t waitStart = 0;
+    uint32_t lastReading = 0;
+    uint32_t changeTime = 0;
+    uint8_t waiting = 0;
+    uint8_t changePending = 0;
+    int32_t load;
+    int32_t prevLoad;
+    int32_t reading;
+    uint32_t wait;
+    uint32_t sleep;
+    int idx = 0;
+
+    memset(res, 0, sizeof(simResult_t));
+    policy->init(&state, cfg->maxStale);
+    prevLoad = trace->points[0].power;
+    srand(2);
+
+    for (time=0; time<cfg->duration; time+=SIM_STEP){
+        load = traceAt(trace, time, &idx);
+        if (load != prevLoad){
+            if (changePending)
+                res->missed += 1;
+            changePending = 1;
+            changeTime = time;
+            res->changes += 1;
+            prevLoad = load;
+        }
+
+        energy += (cfg->harvest*load/1e3 - cfg->leakage)*SIM_STEP/1000;
+        if (energy < 0)
+            energy = 0;
+        if (energy > cfg->capacity)
+            energy = cfg->capacity;
+
+        if ((time >= wake) && (waiting==0)){
+            waiting = 1;
+            waitStart = time;
+        }
+        if ((waiting==0) || (energy < cfg->wakeCost))
+            continue;
+
+        // READYn, take a reading
+        waiting = 0;
+        wait = time - waitStart;
+        energy -= cfg->wakeCost;
+        policy->energy(&state, wait);
+        if (wait > 0){
+            res->waits += 1;
+            res->waitTime += wait;
+        }
+        reading = (int32_t)(load*(1 + cfg->noise*(2.0*rand()/RAND_MAX - 1)));
+        sleep = policy->next(&state, reading);
+        wake = time + SIM_LED_TIME + sleep;
+
+        if (res->readings && (time - lastReading > res->maxGap))
+            res->maxGap = time - lastReading;
+        lastReading = time;
+        res->readings += 1;
+        if (changePending){
+            changePending = 0;
+            res->latency += time - changeTime;
+            if (time - changeTime > res->maxLatency)
+                res->maxLatency = time - changeTime;
+        }
+        if (cfg->verbose)
+            printf("  %9.2f s  %s  load %8.1f W  wait %6u ms  sleep %6u ms\n",
+                   time/1000.0, policy->name, load/1000.0, wait, sleep);
+    }
+}
+
+static void printResult(const simConfig_t* cfg, const policy_t* policy,
+                        const simResult_t* res){
+    uint32_t seen = res->changes - res->missed;
+    printf("  %-8s %6u readings %7.1f /h  max gap %6.1f s  waits %5u (avg %6.1f s)",
+           policy->name, res->readings, res->readings*3600000.0/cfg->duration,
+           res->maxGap/1000.0, res->waits,
+           res->waits? res->waitTime/1000.0/res->waits : 0.0);
+    if (res->changes)
+        printf("  change latency avg %5.1f s max %5.1f s missed %u/%u",
+               seen? res->latency/1000.0/seen : 0.0, res->maxLatency/1000.0,
+               res->missed, res->changes);
+    printf("\n");
+}
+
+static void usage(const char* name){
+    fprintf(stderr, "Usage: %s [-m maxStaleMs] [-k uWPerW] [-e wakeUJ] [-c capUJ] "
+            "[-l leakUW] [-n noisePercent] [-d seconds] [-v] [file ...]\n", name);
+}
+
+int main(int argc, char** argv){
+    static trace_t traces[8];
+    simConfig_t cfg;
+    simResult_t res;
+    int numTraces = 0;
+    int opt;
+    int i;
+    unsigned p;
+
+    cfg.harvest = 10;
+    cfg.wakeCost = 1000;
+    cfg.capacity = 10000;
+    cfg.leakage = 20;
+    cfg.noise = 0.01;
+    cfg.duration = 3600000;
+    cfg.maxStale = REPORT_SCHED_MAX_STALE;
+    cfg.verbose = 0;
+
+    while ((opt = getopt(argc, argv, "m:k:e:c:l:n:d:v")) != -1){
+        switch (opt){
+            case 'm': cfg.maxStale = strtoul(optarg, NULL, 0); break;
+            case 'k': cfg.harvest = atof(optarg); break;
+            case 'e': cfg.wakeCost = atof(optarg); break;
+            case 'c': cfg.capacity = atof(optarg); break;
+            case 'l': cfg.leakage = atof(optarg); break;
+            case 'n': cfg.noise = atof(optarg)/100; break;
+            case 'd': cfg.duration = strtoul(optarg, NULL, 0)*1000; break;
+            case 'v': cfg.verbose = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (cfg.wakeCost > cfg.capacity){
+        fprintf(stderr, "wake-up cost exceeds the capacity\n");
+        return 1;
+    }
+
+    if (optind >= argc){
+        builtinTraces(traces, &numTraces);
+    }
+    for (i=optind; (i<argc) && (numTraces < (int)(sizeof(traces)/sizeof(traces[0]))); i++){
+        if (traceRead(argv[i], &traces[numTraces]) == 0)
+            numTraces += 1;
+    }
+
+    printf("harvest %.1f uW/W, wake-up %.0f uJ, store %.0f uJ, leakage %.0f uW, "
+           "max staleness %u ms, %u s\n", cfg.harvest, cfg.wakeCost, cfg.capacity,
+           cfg.leakage, cfg.maxStale, cfg.duration/1000);
+    for (i=0; i<numTraces; i++){
+        printf("%s\n", traces[i].name);
+        for (p=0; p<NUM_POLICIES; p++){
+            simulate(&cfg, &traces[i], &policies[p], &res);
+            printResult(&cfg, &policies[p], &res);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,375 @@
+/*
+    Power factor / crest factor captures of the meter, data/BKn/Pxxx_BKn.asc.
+    Every line of a capture is "Power: <mW>", the file name holds the
+    ground truth power in W (P178.3_BK0.asc) and the parent directory the
+    load bank setting.
+
+    All captures are memory mapped and parsed by a pool of threads. For
+    every capture: samples, mean, standard deviation, min, max and the error
+    of the mean against the ground truth. For every load bank: the least
+    squares line measured = gain * truth + offset over its captures, with
+    the largest and the RMS error of the captures. The report goes to stdout
+    as JSON, -p also writes <bank>proc.txt for dataPlot.plt.
+
+    Usage: ascStats [-j threads] [-p procDir] [dir | file.asc ...]
+           dir is searched for BKn/Pxxx.asc, default data
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_BANK_NAME 64
+
+typedef struct {
+    char* path;
+    char bank[MAX_BANK_NAME];
+    double nominal;         // W, from the file name
+    uint64_t samples;
+    uint64_t badLines;
+    double mean;            // mW
+    double m2;              // sum of squared deviations, mW^2
+    int64_t min;
+    int64_t max;
+    int error;              // could not be read
+} capture_t;
+
+typedef struct {
+    capture_t* captures;
+    size_t num;
+    size_t next;
+} work_t;
+
+/* Parsing */
+
+static int isBlank(char c){
+    return (c==' ') || (c=='\t') || (c=='\r');
+}
+
+// second whitespace separated token of every line, as an integer
+static void parseCapture(capture_t* cap, const char* p, const char* end){
+    const char* eol;
+    int64_t val;
+    int neg;
+    int digits;
+    double delta;
+
+    for (; p < end; p = eol+1){
+        eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        while ((p < eol) && isBlank(*p))
+            p++;
+        if (p == eol)
+            continue;
+        while ((p < eol) && !isBlank(*p))
+            p++;
+        while ((p < eol) && isBlank(*p))
+            p++;
+        neg = 0;
+        if ((p < eol) && (*p=='-' || *p=='+')){
+            neg = (*p=='-');
+            p++;
+        }
+        val = 0;
+        digits = 0;
+        while ((p < eol) && (*p>='0') && (*p<='9')){
+            val = val*10 + (*p - '0');
+            digits++;
+            p++;
+        }
+        if (digits == 0){
+            cap->badLines += 1;
+            continue;
+        }
+        if (neg)
+            val = -val;
+        // Welford, one pass without losing the variance to cancellation
+        cap->samples += 1;
+        delta = val - cap->mean;
+        cap->mean += delta/cap->samples;
+        cap->m2 += delta*(val - cap->mean);
+        if ((cap->samples == 1) || (val < cap->min))
+            cap->min = val;
+        if ((cap->samples == 1) || (val > cap->max))
+            cap->max = val;
+    }
+}
+
+static void readCapture(capture_t* cap){
+    struct stat st;
+    const char* data;
+    int fd = open(cap->path, O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &st) < 0)){
+        perror(cap->path);
+        cap->error = 1;
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    if (st.st_size > 0){
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED){
+            perror(cap->path);
+            cap->error = 1;
+        }
+        else{
+            madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+            parseCapture(cap, data, data + st.st_size);
+            munmap((void*)data, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+static void* worker(void* arg){
+    work_t* work = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->num)
+        readCapture(&work->captures[i]);
+    return NULL;
+}
+
+/* Captures */
+
+// P<watts>_..., bank from the parent directory
+static int captureName(capture_t* cap, char* path){
+    const char* name = strrchr(path, '/');
+    const char* dir;
+    size_t len;
+    char* end;
+
+    name = name? name+1 : path;
+    cap->path = path;
+    if (name[0] != 'P')
+        return -1;
+    cap->nominal = strtod(name+1, &end);
+    if ((end == name+1) || (cap->nominal <= 0))
+        return -1;
+
+    dir = name - 1;
+    len = 0;
+    while ((dir > path) && (dir[-1] != '/')){
+        dir--;
+        len++;
+    }
+    if (len == 0){
+        // no parent directory, bank after the '_'
+        dir = (*end == '_')? end+1 : "";
+        len = strcspn(dir, ".");
+    }
+    if (len >= MAX_BANK_NAME)
+        len = MAX_BANK_NAME-1;
+    memcpy(cap->bank, dir, len);
+    cap->bank[len] = '\0';
+    return 0;
+}
+
+static int captureCompare(const void* a, const void* b){
+    const capture_t* x = a;
+    const capture_t* y = b;
+    int res = strcmp(x->bank, y->bank);
+    if (res)
+        return res;
+    return (x->nominal > y->nominal) - (x->nominal < y->nominal);
+}
+
+static double captureError(const capture_t* cap){
+    return (cap->mean/1000 - cap->nominal)/cap->nominal*100;
+}
+
+static void jsonString(const char* s){
+    putchar('"');
+    for (; *s; s++){
+        if ((*s == '"') || (*s == '\\'))
+            putchar('\\');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+/* Report */
+
+static int writeProc(const char* dir, const capture_t* caps, size_t num){
+    char path[4096];
+    FILE* fp;
+    size_t i;
+
+    snprintf(path, sizeof(path), "%s/%sproc.txt", dir, caps[0].bank);
+    fp = fopen(path, "w");
+    if (fp == NULL){
+        perror(path);
+        return -1;
+    }
+    fprintf(fp, "#%s\t\tmeasured\r\n", caps[0].bank);
+    for (i=0; i<num; i++)
+        if (caps[i].samples)
+            fprintf(fp, "%.2f\t%.2f\r\n", caps[i].nominal, caps[i].mean/1000);
+    fclose(fp);
+    return 0;
+}
+
+static void reportBank(const capture_t* caps, size_t num, int first){
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    double gain = 0, offset = 0;
+    double err, maxErr = 0, sumErr2 = 0;
+    double den;
+    size_t n = 0;
+    size_t i;
+
+    for (i=0; i<num; i++){
+        if (caps[i].samples == 0)
+            continue;
+        sx += caps[i].nominal;
+        sy += caps[i].mean/1000;
+        sxx += caps[i].nominal*caps[i].nominal;
+        sxy += caps[i].nominal*caps[i].mean/1000;
+        err = captureError(&caps[i]);
+        sumErr2 += err*err;
+        if (fabs(err) > fabs(maxErr))
+            maxErr = err;
+        n++;
+    }
+    den = n*sxx - sx*sx;
+    if ((n >= 2) && (den != 0)){
+        gain = (n*sxy - sx*sy)/den;
+        offset = (sy - gain*sx)/n;
+    }
+    printf("%s    {\"bank\": ", first? "" : ",\n");
+    jsonString(caps[0].bank);
+    printf(", \"captures\": %zu, \"gain\": %.6f, \"offset_w\": %.4f, "
+           "\"max_error_pct\": %.4f, \"rms_error_pct\": %.4f}",
+           n, gain, offset, maxErr, n? sqrt(sumErr2/n) : 0.0);
+}
+
+static void report(const capture_t* caps, size_t num){
+    size_t i;
+    size_t start;
+    double std;
+
+    printf("{\n  \"captures\": [\n");
+    for (i=0; i<num; i++){
+        std = (caps[i].samples > 1)? sqrt(caps[i].m2/(caps[i].samples-1)) : 0;
+        printf("    {\"file\": ");
+        jsonString(caps[i].path);
+        printf(", \"bank\": ");
+        jsonString(caps[i].bank);
+        printf(", \"nominal_w\": %.4f, \"samples\": %llu", caps[i].nominal,
+               (unsigned long long)caps[i].samples);
+        if (caps[i].samples)
+            printf(", \"mean_w\": %.6f, \"std_w\": %.6f, \"variance_w2\": %.6f, "
+                   "\"min_w\": %.3f, \"max_w\": %.3f, \"error_pct\": %.4f",
+                   caps[i].mean/1000, std/1000, std*std/1e6, caps[i].min/1000.0,
+                   caps[i].max/1000.0, captureError(&caps[i]));
+        if (caps[i].badLines)
+            printf(", \"bad_lines\": %llu", (unsigned long long)caps[i].badLines);
+        if (caps[i].error)
+            printf(", \"error\": \"unreadable\"");
+        printf("}%s\n", (i+1 < num)? "," : "");
+    }
+    printf("  ],\n  \"banks\": [\n");
+    for (start=0, i=1; i<=num; i++){
+        if ((i == num) || strcmp(caps[i].bank, caps[start].bank)){
+            reportBank(&caps[start], i-start, start==0);
+            start = i;
+        }
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void usage(const char* name){
+    fprintf(stderr, "Usage: %s [-j threads] [-p procDir] [dir | file.asc ...]\n", name);
+}
+
+int main(int argc, char** argv){
+    static const char* defaultDirs[] = {"data"};
+    const char** dirs = defaultDirs;
+    const char* procDir = NULL;
+    char pattern[4096];
+    glob_t files;
+    capture_t* caps;
+    pthread_t* threads;
+    work_t work;
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int numDirs = 1;
+    int globFlags = 0;
+    size_t num = 0;
+    size_t i;
+    size_t start;
+    int opt;
+    int res = 0;
+
+    while ((opt = getopt(argc, argv, "j:p:")) != -1){
+        switch (opt){
+            case 'j': numThreads = strtol(optarg, NULL, 0); break;
+            case 'p': procDir = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind < argc){
+        dirs = (const char**)&argv[optind];
+        numDirs = argc - optind;
+    }
+    if (numThreads < 1)
+        numThreads = 1;
+
+    memset(&files, 0, sizeof(files));
+    for (i=0; i<(size_t)numDirs; i++){
+        if (strstr(dirs[i], ".asc") == dirs[i] + strlen(dirs[i]) - 4)
+            snprintf(pattern, sizeof(pattern), "%s", dirs[i]);
+        else
+            snprintf(pattern, sizeof(pattern), "%s/BK*/P*.asc", dirs[i]);
+        glob(pattern, globFlags, NULL, &files);
+        globFlags = GLOB_APPEND;
+    }
+    caps = calloc(files.gl_pathc? files.gl_pathc : 1, sizeof(capture_t));
+    for (i=0; i<files.gl_pathc; i++){
+        if (captureName(&caps[num], files.gl_pathv[i]) == 0)
+            num++;
+        else
+            fprintf(stderr, "%s: no power in the file name\n", files.gl_pathv[i]);
+    }
+    if (num == 0){
+        fprintf(stderr, "no captures found\n");
+        return 1;
+    }
+
+    work.captures = caps;
+    work.num = num;
+    work.next = 0;
+    if ((size_t)numThreads > num)
+        numThreads = num;
+    threads = malloc(numThreads*sizeof(pthread_t));
+    for (i=0; i<(size_t)numThreads; i++)
+        pthread_create(&threads[i], NULL, worker, &work);
+    for (i=0; i<(size_t)numThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    qsort(caps, num, sizeof(capture_t), captureCompare);
+    report(caps, num);
+    for (i=0; i<num; i++)
+        res |= caps[i].error;
+    if (procDir){
+        for (start=0, i=1; i<=num; i++){
+            if ((i == num) || strcmp(caps[i].bank, caps[start].bank)){
+                if (writeProc(procDir, &caps[start], i-start) < 0)
+                    res = 1;
+                start = i;
+            }
+        }
+    }
+    free(threads);
+    free(caps);
+    globfree(&files);
+    return res;
+}
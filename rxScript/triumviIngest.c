@@ -0,0 +1,1013 @@
+/*
+    Gateway ingest daemon. Reads the binary frames of the receiver
+    (radioRXOnly built with INGEST_OUTPUT, frame format in
+    contiki/dev/triumviLib/ingestFrame.h) from a serial port, decodes the
+    Triumvi records and appends them to a columnar store.
+
+    Store: one file per column in the output directory, named
+    <column>.<type>, little endian, one value per reading. Rows of all columns
+    line up, a column is 0 where its field was not in the packet, the fields
+    column tells which were. Aggregated frames give one row per reading.
+    Frames that could not be decrypted go to raw.bin as
+    [8 bytes time][1 byte length][record].
+    Rows are written by a second thread every -s ms or -n rows and fsync'ed
+    once per batch. On start the columns are cut back to the shortest one, a
+    batch torn by a crash is dropped as a whole.
+
+    Decoded records:
+    0xa0  power (4), status (1), [panel, circuit (status 0x40)],
+          [PF (2), VRMS (1), VRMS bits 9-8 and INA gain (1), IRMS (2)
+          (status 0x04)], [time stamp (6) (status 0x02)],
+          [counter (4) (status 0x01)]
+    0xa2  same, then [suppressed readings (2), energy mJ (4)] (flag 0x01),
+          [energy register mWh (4)] (flag 0x02), flags (1)
+    0xa3  status (1), count (1), [panel, circuit], readings (aggReport.h),
+          [energy register mWh (4)], flags (1)
+
+    Test mode (-t frames) opens a pseudo terminal, a child process writes
+    frames with known values into it (every 97th one corrupted) and the
+    daemon reads it like a serial port, then checks what it decoded.
+
+    Usage: triumviIngest [-d dir] [-b baud] [-s flushMs] [-n rows] [-x] [-v]
+                         device | -f file | -t frames
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "ingestFrame.h"
+
+#define TRIUMVI_PKT_IDENTIFIER 0xa0
+#define TRIUMVI_PKT_EXT_IDENTIFIER 0xa2
+#define TRIUMVI_PKT_AGG_IDENTIFIER 0xa3
+
+#define BATTERYPACK_STATUSREG  0x40
+#define POWERFACTOR_STATUSREG  0x04
+#define TIMESTAMP_STATUSREG    0x02
+#define COUNTER_STATUSREG      0x01
+
+#define DELTA_EXTFLAG          0x01
+#define ENERGY_EXTFLAG         0x02
+
+#define AGG_REPORT_ESCAPE      0x8000
+#define AGG_REPORT_TIME_UNIT   100      // ms
+
+// fields column
+#define FIELD_PANEL     0x01
+#define FIELD_PF        0x02            // pf, vrms, inaGain, irms
+#define FIELD_RTC       0x04
+#define FIELD_COUNTER   0x08
+#define FIELD_DELTA     0x10            // suppressed, deltaEnergy
+#define FIELD_ENERGY    0x20
+#define FIELD_AGG       0x40            // reading of an aggregated frame
+
+#define READ_BUF_LEN 65536
+#define RAW_BUF_LEN 65536
+#define DEFAULT_BATCH 4096
+#define DEFAULT_FLUSH 1000              // ms
+#define TEST_METERS 64
+#define TEST_CORRUPT 97
+#define TEST_IDLE 2000                  // ms without data ends the test
+
+typedef struct {
+    uint64_t time;          // receive time, us since the epoch
+    uint64_t addr;
+    int32_t power;          // mW
+    uint32_t nonce;
+    uint32_t rtc;           // meter time stamp, s since the epoch
+    uint32_t counter;
+    uint32_t deltaEnergy;   // mJ since the previous transmitted reading
+    uint32_t energy;        // mWh
+    uint16_t fields;
+    uint16_t pf;
+    uint16_t vrms;
+    uint16_t irms;
+    uint16_t suppressed;
+    uint8_t id;
+    uint8_t status;
+    uint8_t panel;
+    uint8_t circuit;
+    uint8_t inaGain;
+    int8_t rssi;
+} reading_t;
+
+typedef struct {
+    const char* name;
+    size_t offset;
+    size_t size;
+} column_t;
+
+#define COLUMN(field, type) \
+    {#field "." type, offsetof(reading_t, field), sizeof(((reading_t*)0)->field)}
+
+static const column_t columns[] = {
+    COLUMN(time, "u64"),
+    COLUMN(addr, "u64"),
+    COLUMN(rssi, "i8"),
+    COLUMN(id, "u8"),
+    COLUMN(nonce, "u32"),
+    COLUMN(status, "u8"),
+    COLUMN(fields, "u16"),
+    COLUMN(power, "i32"),
+    COLUMN(panel, "u8"),
+    COLUMN(circuit, "u8"),
+    COLUMN(pf, "u16"),
+    COLUMN(vrms, "u16"),
+    COLUMN(inaGain, "u8"),
+    COLUMN(irms, "u16"),
+    COLUMN(rtc, "u32"),
+    COLUMN(counter, "u32"),
+    COLUMN(suppressed, "u16"),
+    COLUMN(deltaEnergy, "u32"),
+    COLUMN(energy, "u32"),
+};
+#define NUM_COLUMNS (sizeof(columns)/sizeof(columns[0]))
+
+typedef struct {
+    reading_t* rows;
+    uint32_t len;
+    uint8_t raw[RAW_BUF_LEN];
+    uint32_t rawLen;
+} batch_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t rows;
+    uint64_t raw;
+    uint64_t cobsErrors;
+    uint64_t crcErrors;
+    uint64_t badRecords;    // valid frame, payload does not parse
+    uint64_t overruns;      // longer than INGEST_MAX_FRAME
+    uint64_t flushes;
+    uint64_t testMismatch;
+} stats_t;
+
+typedef struct {
+    const char* dir;
+    uint32_t batchRows;
+    uint32_t flushMs;
+    int exponent;           // power and IRMS carry a gain exponent
+    int verbose;
+    int test;
+} config_t;
+
+static config_t cfg;
+static stats_t stats;
+static volatile sig_atomic_t stopRequest = 0;
+static volatile sig_atomic_t statsRequest = 0;
+
+/* Store */
+
+static int columnFd[NUM_COLUMNS];
+static int rawFd;
+static batch_t batches[2];
+static batch_t* current;
+static batch_t* pending;
+static int writerStop = 0;
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerCond = PTHREAD_COND_INITIALIZER;
+
+static int writeAll(int fd, const void* buf, size_t len){
+    const uint8_t* p = buf;
+    ssize_t res;
+    while (len > 0){
+        res = write(fd, p, len);
+        if (res < 0){
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += res;
+        len -= res;
+    }
+    return 0;
+}
+
+static int storeOpen(const char* dir){
+    char path[4096];
+    struct stat st;
+    uint64_t rows = UINT64_MAX;
+    unsigned c;
+
+    if ((mkdir(dir, 0755) < 0) && (errno != EEXIST)){
+        perror(dir);
+        return -1;
+    }
+    for (c=0; c<NUM_COLUMNS; c++){
+        snprintf(path, sizeof(path), "%s/%s", dir, columns[c].name);
+        columnFd[c] = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if ((columnFd[c] < 0) || (fstat(columnFd[c], &st) < 0)){
+            perror(path);
+            return -1;
+        }
+        if ((uint64_t)st.st_size/columns[c].size < rows)
+            rows = st.st_size/columns[c].size;
+    }
+    // drop a torn batch
+    for (c=0; c<NUM_COLUMNS; c++){
+        if (ftruncate(columnFd[c], rows*columns[c].size) < 0){
+            perror(columns[c].name);
+            return -1;
+        }
+    }
+    snprintf(path, sizeof(path), "%s/raw.bin", dir);
+    rawFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (rawFd < 0){
+        perror(path);
+        return -1;
+    }
+    if (rows)
+        fprintf(stderr, "%s: %llu rows\n", dir, (unsigned long long)rows);
+    return 0;
+}
+
+static void storeWrite(batch_t* batch){
+    static uint8_t colBuf[DEFAULT_BATCH*8];
+    static uint8_t* buf = colBuf;
+    static size_t bufLen = sizeof(colBuf);
+    uint32_t r;
+    unsigned c;
+    const uint8_t* src;
+    uint8_t* dst;
+
+    if (batch->len*8 > bufLen){
+        if (buf != colBuf)
+            free(buf);
+        bufLen = batch->len*8;
+        buf = malloc(bufLen);
+    }
+    // one column at a time, values of a column are contiguous on disk
+    for (c=0; (c<NUM_COLUMNS) && batch->len; c++){
+        dst = buf;
+        for (r=0; r<batch->len; r++){
+            src = (const uint8_t*)&batch->rows[r] + columns[c].offset;
+            memcpy(dst, src, columns[c].size);
+            dst += columns[c].size;
+        }
+        if (writeAll(columnFd[c], buf, dst - buf) < 0)
+            perror(columns[c].name);
+    }
+    if (batch->rawLen && (writeAll(rawFd, batch->raw, batch->rawLen) < 0))
+        perror("raw.bin");
+
+    for (c=0; (c<NUM_COLUMNS) && batch->len; c++)
+        fdatasync(columnFd[c]);
+    if (batch->rawLen)
+        fdatasync(rawFd);
+    batch->len = 0;
+    batch->rawLen = 0;
+}
+
+static void* writerThread(void* arg){
+    batch_t* batch;
+    pthread_mutex_lock(&writerLock);
+    while (1){
+        while ((pending == NULL) && (writerStop == 0))
+            pthread_cond_wait(&writerCond, &writerLock);
+        if (pending == NULL)
+            break;
+        batch = pending;
+        pthread_mutex_unlock(&writerLock);
+        storeWrite(batch);
+        pthread_mutex_lock(&writerLock);
+        pending = NULL;
+        stats.flushes += 1;
+        pthread_cond_broadcast(&writerCond);
+    }
+    pthread_mutex_unlock(&writerLock);
+    return NULL;
+}
+
+// hands the current batch to the writer, waits while the previous one is
+// still being written
+static void storeFlush(){
+    if ((current->len == 0) && (current->rawLen == 0))
+        return;
+    pthread_mutex_lock(&writerLock);
+    while (pending != NULL)
+        pthread_cond_wait(&writerCond, &writerLock);
+    pending = current;
+    current = (current == &batches[0])? &batches[1] : &batches[0];
+    pthread_cond_broadcast(&writerCond);
+    pthread_mutex_unlock(&writerLock);
+}
+
+static reading_t* storeRow(){
+    reading_t* row;
+    if (current->len >= cfg.batchRows)
+        storeFlush();
+    row = &current->rows[current->len++];
+    memset(row, 0, sizeof(reading_t));
+    stats.rows += 1;
+    return row;
+}
+
+static void storeRaw(uint64_t time, const uint8_t* record, uint8_t len){
+    if (current->rawLen + len + 9 > RAW_BUF_LEN)
+        storeFlush();
+    memcpy(&current->raw[current->rawLen], &time, 8);
+    current->raw[current->rawLen+8] = len;
+    memcpy(&current->raw[current->rawLen+9], record, len);
+    current->rawLen += len + 9;
+    stats.raw += 1;
+}
+
+/* Decoding */
+
+static uint32_t unpack(const uint8_t* buf, uint8_t len){
+    uint32_t val = 0;
+    while (len--)
+        val = (val<<8) | buf[len];
+    return val;
+}
+
+// triumvi_current VERSION11/12, 2 bit exponent on top, value << 2*exponent
+static int32_t expandPower(uint32_t val){
+    if (cfg.exponent == 0)
+        return (int32_t)val;
+    return (int32_t)((val & 0x3fffffff) << ((val>>30)*2));
+}
+
+static uint16_t expandIRMS(uint16_t val){
+    if (cfg.exponent == 0)
+        return val;
+    return (val & 0x3fff) << ((val>>14)*2);
+}
+
+static uint32_t rtcToEpoch(const uint8_t* buf){
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    t.tm_year = buf[0] + 100;
+    t.tm_mon = buf[1] - 1;
+    t.tm_mday = buf[2];
+    t.tm_hour = buf[3];
+    t.tm_min = buf[4];
+    t.tm_sec = buf[5];
+    return (uint32_t)timegm(&t);
+}
+
+static void printRow(const reading_t* row){
+    printf("%llu.%06llu %016llx %4d %02x %08x st %02x",
+           (unsigned long long)(row->time/1000000), (unsigned long long)(row->time%1000000),
+           (unsigned long long)row->addr, row->rssi, row->id, row->nonce, row->status);
+    if (row->fields & FIELD_PANEL)
+        printf(" panel %02x circuit %u", row->panel, row->circuit);
+    printf(" %.3f W", row->power/1000.0);
+    if (row->fields & FIELD_PF)
+        printf(" pf %.3f vrms %u gain %u irms %u mA", row->pf/1000.0, row->vrms,
+               row->inaGain, row->irms);
+    if (row->fields & FIELD_RTC)
+        printf(" rtc %u", row->rtc);
+    if (row->fields & FIELD_COUNTER)
+        printf(" counter %u", row->counter);
+    if (row->fields & FIELD_DELTA)
+        printf(" suppressed %u %u mJ", row->suppressed, row->deltaEnergy);
+    if (row->fields & FIELD_ENERGY)
+        printf(" energy %u mWh", row->energy);
+    if (row->fields & FIELD_AGG)
+        printf(" agg");
+    printf("\n");
+}
+
+static int testCheck(const reading_t* row);
+
+// 0xa0 and 0xa2, -1 if the payload is too short for its status register
+static int decodeRegular(reading_t* row, const uint8_t* p, int len){
+    int off = 5;
+    int end = len;
+    uint8_t flags;
+
+    if (row->id == TRIUMVI_PKT_EXT_IDENTIFIER){
+        if (end < 1)
+            return -1;
+        flags = p[--end];
+        if (flags & ENERGY_EXTFLAG){
+            end -= 4;
+            if (end < 5)
+                return -1;
+            row->energy = unpack(&p[end], 4);
+            row->fields |= FIELD_ENERGY;
+        }
+        if (flags & DELTA_EXTFLAG){
+            end -= 6;
+            if (end < 5)
+                return -1;
+            row->suppressed = unpack(&p[end], 2);
+            row->deltaEnergy = unpack(&p[end+2], 4);
+            row->fields |= FIELD_DELTA;
+        }
+    }
+    if (end < 5)
+        return -1;
+    row->power = expandPower(unpack(p, 4));
+    row->status = p[4];
+    if (row->status & BATTERYPACK_STATUSREG){
+        if (off+2 > end)
+            return -1;
+        row->panel = p[off];
+        row->circuit = p[off+1];
+        row->fields |= FIELD_PANEL;
+        off += 2;
+    }
+    if (row->status & POWERFACTOR_STATUSREG){
+        if (off+6 > end)
+            return -1;
+        row->pf = unpack(&p[off], 2);
+        row->vrms = p[off+2] | ((p[off+3] & 0xc0)<<2);
+        row->inaGain = p[off+3] & 0x3f;
+        row->irms = expandIRMS(unpack(&p[off+4], 2));
+        row->fields |= FIELD_PF;
+        off += 6;
+    }
+    if (row->status & TIMESTAMP_STATUSREG){
+        if (off+6 > end)
+            return -1;
+        row->rtc = rtcToEpoch(&p[off]);
+        row->fields |= FIELD_RTC;
+        off += 6;
+    }
+    if (row->status & COUNTER_STATUSREG){
+        if (off+4 > end)
+            return -1;
+        row->counter = unpack(&p[off], 4);
+        row->fields |= FIELD_COUNTER;
+        off += 4;
+    }
+    return (off == end)? 0 : -1;
+}
+
+// 0xa3, one row per reading, the last reading was taken at the arrival
+static int decodeAggregate(const reading_t* head, const uint8_t* p, int len){
+    int32_t power[256];
+    uint32_t dt[256];
+    uint8_t count;
+    uint8_t flags;
+    uint64_t back = 0;
+    int off = 2;
+    int end = len;
+    int i;
+    reading_t* row;
+    reading_t tmpl = *head;
+
+    if (len < 3)
+        return -1;
+    flags = p[--end];
+    tmpl.status = p[0];
+    count = p[1];
+    tmpl.fields |= FIELD_AGG;
+    if (flags & ENERGY_EXTFLAG){
+        end -= 4;
+        if (end < off)
+            return -1;
+        tmpl.energy = unpack(&p[end], 4);
+        tmpl.fields |= FIELD_ENERGY;
+    }
+    if (tmpl.status & BATTERYPACK_STATUSREG){
+        if (off+2 > end)
+            return -1;
+        tmpl.panel = p[off];
+        tmpl.circuit = p[off+1];
+        tmpl.fields |= FIELD_PANEL;
+        off += 2;
+    }
+    if ((count == 0) || (off+4 > end))
+        return -1;
+    power[0] = (int32_t)unpack(&p[off], 4);
+    dt[0] = 0;
+    off += 4;
+    for (i=1; i<count; i++){
+        if (off+4 > end)
+            return -1;
+        dt[i] = unpack(&p[off], 2)*AGG_REPORT_TIME_UNIT;
+        if (unpack(&p[off+2], 2) == AGG_REPORT_ESCAPE){
+            if (off+8 > end)
+                return -1;
+            power[i] = (int32_t)unpack(&p[off+4], 4);
+            off += 8;
+        }
+        else{
+            power[i] = power[i-1] + (int16_t)unpack(&p[off+2], 2);
+            off += 4;
+        }
+    }
+    if (off != end)
+        return -1;
+
+    for (i=count-1; i>=0; i--){
+        row = storeRow();
+        *row = tmpl;
+        row->power = expandPower((uint32_t)power[i]);
+        row->time = head->time - back*1000;
+        back += dt[i];
+        if (cfg.verbose)
+            printRow(row);
+        if (cfg.test)
+            testCheck(row);
+    }
+    return 0;
+}
+
+static void decodeRecord(const uint8_t* record, int len, uint64_t time){
+    reading_t head;
+    reading_t* row;
+    const uint8_t* payload;
+    int payloadLen;
+    int i;
+
+    stats.frames += 1;
+    if (len < INGEST_HEADER_LEN){
+        stats.badRecords += 1;
+        return;
+    }
+    if (record[0] == INGEST_REC_RAW){
+        storeRaw(time, record, len);
+        return;
+    }
+    if ((record[0] != INGEST_REC_METER) || (len < INGEST_METER_HEADER_LEN)){
+        stats.badRecords += 1;
+        return;
+    }
+
+    memset(&head, 0, sizeof(head));
+    head.time = time;
+    for (i=0; i<8; i++)
+        head.addr = (head.addr<<8) | record[1+i];
+    head.rssi = (int8_t)record[9];
+    head.id = record[10];
+    head.nonce = unpack(&record[11], 4);
+    payload = &record[INGEST_METER_HEADER_LEN];
+    payloadLen = len - INGEST_METER_HEADER_LEN;
+
+    switch (head.id){
+        case TRIUMVI_PKT_IDENTIFIER:
+        case TRIUMVI_PKT_EXT_IDENTIFIER:
+            if (decodeRegular(&head, payload, payloadLen) < 0)
+                break;
+            row = storeRow();
+            *row = head;
+            if (cfg.verbose)
+                printRow(row);
+            if (cfg.test)
+                testCheck(row);
+            return;
+        case TRIUMVI_PKT_AGG_IDENTIFIER:
+            if (decodeAggregate(&head, payload, payloadLen) < 0)
+                break;
+            return;
+        default:
+            // decrypted, but nothing this daemon knows
+            storeRaw(time, record, len);
+            return;
+    }
+    stats.badRecords += 1;
+}
+
+/* Framing */
+
+static uint8_t frameBuf[INGEST_MAX_FRAME];
+static uint16_t frameLen = 0;
+static uint8_t frameOverrun = 0;
+
+static void deframe(const uint8_t* buf, ssize_t len, uint64_t time){
+    static uint8_t record[INGEST_MAX_RECORD+2];
+    ssize_t i;
+    int res;
+
+    for (i=0; i<len; i++){
+        if (buf[i] != 0){
+            if (frameLen < sizeof(frameBuf))
+                frameBuf[frameLen++] = buf[i];
+            else
+                frameOverrun = 1;
+            continue;
+        }
+        if (frameOverrun){
+            stats.overruns += 1;
+        }
+        else if (frameLen > 0){
+            res = ingestFrameDecode(frameBuf, frameLen, record, sizeof(record));
+            if (res == INGEST_FRAME_COBS_ERROR)
+                stats.cobsErrors += 1;
+            else if (res == INGEST_FRAME_CRC_ERROR)
+                stats.crcErrors += 1;
+            else
+                decodeRecord(record, res, time);
+        }
+        frameLen = 0;
+        frameOverrun = 0;
+    }
+}
+
+/* Input */
+
+static uint64_t nowUs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static uint64_t monotonicMs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static speed_t baudRate(long baud){
+    switch (baud){
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        default: return 0;
+    }
+}
+
+static int serialSetup(int fd, speed_t speed){
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0)
+        return -1;
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (speed){
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    return tcsetattr(fd, TCSANOW, &tio);
+}
+
+static void printStats(double seconds){
+    fprintf(stderr, "%llu bytes, %llu frames (%.0f/s), %llu rows, %llu raw, "
+            "%llu flushes, errors: cobs %llu crc %llu record %llu overrun %llu",
+            (unsigned long long)stats.bytes, (unsigned long long)stats.frames,
+            seconds > 0? stats.frames/seconds : 0.0,
+            (unsigned long long)stats.rows, (unsigned long long)stats.raw,
+            (unsigned long long)stats.flushes, (unsigned long long)stats.cobsErrors,
+            (unsigned long long)stats.crcErrors, (unsigned long long)stats.badRecords,
+            (unsigned long long)stats.overruns);
+    if (cfg.test)
+        fprintf(stderr, ", mismatches %llu", (unsigned long long)stats.testMismatch);
+    fprintf(stderr, "\n");
+}
+
+// until EOF, an error or a signal; stopFrames > 0 ends after that many frames
+static void ingest(int fd, uint64_t stopFrames){
+    static uint8_t buf[READ_BUF_LEN];
+    struct pollfd pfd;
+    uint64_t start = monotonicMs();
+    uint64_t lastFlush = start;
+    uint64_t lastData = start;
+    uint64_t now;
+    ssize_t len;
+    int timeout;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (stopRequest == 0){
+        if (statsRequest){
+            statsRequest = 0;
+            printStats((monotonicMs() - start)/1000.0);
+        }
+        now = monotonicMs();
+        timeout = (now - lastFlush >= cfg.flushMs)? 0 : cfg.flushMs - (now - lastFlush);
+        if (poll(&pfd, 1, timeout) > 0){
+            len = read(fd, buf, sizeof(buf));
+            if (len < 0){
+                if ((errno == EINTR) || (errno == EAGAIN))
+                    continue;
+                // EIO, the other side of a pty went away
+                if (errno != EIO)
+                    perror("read");
+                break;
+            }
+            if (len == 0)
+                break;
+            stats.bytes += len;
+            lastData = monotonicMs();
+            deframe(buf, len, nowUs());
+            if (stopFrames && (stats.frames + stats.cobsErrors + stats.crcErrors >= stopFrames))
+                break;
+        }
+        now = monotonicMs();
+        if (stopFrames && (now - lastData > TEST_IDLE))
+            break;
+        if (now - lastFlush >= cfg.flushMs){
+            storeFlush();
+            lastFlush = now;
+        }
+    }
+    storeFlush();
+    if (cfg.verbose || cfg.test)
+        printStats((monotonicMs() - start)/1000.0);
+}
+
+/* Test mode */
+
+static int32_t testPower(uint32_t nonce){
+    return (int32_t)((nonce*7919u) % 2000000u) - 500;
+}
+
+static uint16_t testRecord(uint32_t seq, uint8_t* record){
+    uint8_t meter = seq % TEST_METERS;
+    uint32_t nonce = seq / TEST_METERS;
+    uint8_t* p = &record[INGEST_METER_HEADER_LEN];
+    uint8_t status;
+    uint16_t len = 0;
+    uint8_t count;
+    uint8_t i;
+    int32_t power;
+    int32_t prev;
+
+    record[0] = INGEST_REC_METER;
+    memcpy(&record[1], "\x00\x12\x4b\x00\x0a\x0b\x0c", 7);
+    record[8] = meter;
+    record[9] = (uint8_t)(-40 - meter);
+    record[11] = nonce & 0xff;
+    record[12] = (nonce>>8) & 0xff;
+    record[13] = (nonce>>16) & 0xff;
+    record[14] = (nonce>>24) & 0xff;
+
+    status = POWERFACTOR_STATUSREG | ((meter & 0x1)? BATTERYPACK_STATUSREG : 0) |
+        ((meter & 0x2)? TIMESTAMP_STATUSREG : 0) | ((meter & 0x4)? COUNTER_STATUSREG : 0);
+    if (meter % 8 == 7){
+        // aggregated frame, one escaped reading
+        record[10] = TRIUMVI_PKT_AGG_IDENTIFIER;
+        count = 1 + nonce % 12;
+        p[0] = status & ~(POWERFACTOR_STATUSREG | TIMESTAMP_STATUSREG | COUNTER_STATUSREG);
+        p[1] = count;
+        len = 2;
+        if (p[0] & BATTERYPACK_STATUSREG){
+            p[len++] = meter;
+            p[len++] = meter + 1;
+        }
+        prev = testPower(nonce);
+        memcpy(&p[len], &prev, 4);
+        len += 4;
+        for (i=1; i<count; i++){
+            power = (i == 5)? prev + 100000 : prev + 37;
+            p[len] = 10*i;
+            p[len+1] = 0;
+            if (i == 5){
+                p[len+2] = 0x00;
+                p[len+3] = 0x80;
+                memcpy(&p[len+4], &power, 4);
+                len += 8;
+            }
+            else{
+                p[len+2] = (power - prev) & 0xff;
+                p[len+3] = ((power - prev)>>8) & 0xff;
+                len += 4;
+            }
+            prev = power;
+        }
+        memcpy(&p[len], &nonce, 4);
+        len += 4;
+        p[len++] = ENERGY_EXTFLAG;
+        return INGEST_METER_HEADER_LEN + len;
+    }
+
+    record[10] = (meter % 8 == 3)? TRIUMVI_PKT_EXT_IDENTIFIER : TRIUMVI_PKT_IDENTIFIER;
+    power = testPower(nonce);
+    memcpy(p, &power, 4);
+    p[4] = status;
+    len = 5;
+    if (status & BATTERYPACK_STATUSREG){
+        p[len++] = meter;
+        p[len++] = meter + 1;
+    }
+    p[len] = 0x84;      // pf 900
+    p[len+1] = 0x03;
+    p[len+2] = 0x78;    // 120 V
+    p[len+3] = 0x05;
+    p[len+4] = meter;
+    p[len+5] = 0;
+    len += 6;
+    if (status & TIMESTAMP_STATUSREG){
+        memcpy(&p[len], "\x10\x06\x0f\x0c\x1e\x00", 6);     // 2016-06-15 12:30:00
+        len += 6;
+    }
+    if (status & COUNTER_STATUSREG){
+        memcpy(&p[len], &nonce, 4);
+        len += 4;
+    }
+    if (record[10] == TRIUMVI_PKT_EXT_IDENTIFIER){
+        memcpy(&p[len], "\x03\x00", 2);
+        memcpy(&p[len+2], &nonce, 4);
+        memcpy(&p[len+6], &nonce, 4);
+        p[len+10] = DELTA_EXTFLAG | ENERGY_EXTFLAG;
+        len += 11;
+    }
+    return INGEST_METER_HEADER_LEN + len;
+}
+
+static int testCheck(const reading_t* row){
+    uint8_t meter = row->addr & 0xff;
+    int32_t expected = testPower(row->nonce);
+    int ok = (row->rssi == (int8_t)(-40 - meter));
+
+    if ((meter & 0x1) && ((row->panel != meter) || (row->circuit != meter+1)))
+        ok = 0;
+    if (row->id == TRIUMVI_PKT_AGG_IDENTIFIER){
+        ok &= (row->energy == row->nonce);
+        ok &= (row->power >= expected) && (row->power < expected + 12*37 + 100000);
+    }
+    else{
+        ok &= (row->power == expected) && (row->pf == 900) && (row->vrms == 120) &&
+            (row->inaGain == 5) && (row->irms == meter);
+        if (meter & 0x2)
+            ok &= (row->rtc == 1465993800);
+        if (meter & 0x4)
+            ok &= (row->counter == row->nonce);
+        if (row->id == TRIUMVI_PKT_EXT_IDENTIFIER)
+            ok &= (row->suppressed == 3) && (row->deltaEnergy == row->nonce) &&
+                (row->energy == row->nonce);
+    }
+    if (!ok)
+        stats.testMismatch += 1;
+    return ok;
+}
+
+static void testWriter(int fd, uint32_t frames){
+    static uint8_t out[READ_BUF_LEN];
+    uint8_t record[INGEST_MAX_RECORD];
+    uint32_t outLen = 0;
+    uint32_t seq;
+    uint16_t len;
+
+    for (seq=0; seq<frames; seq++){
+        len = ingestFrameEncode(record, testRecord(seq, record), &out[outLen]);
+        // one byte changed, never to the delimiter
+        if (seq % TEST_CORRUPT == TEST_CORRUPT-1)
+            out[outLen+len/2] = (out[outLen+len/2]==0xff)? 0xfe : out[outLen+len/2]+1;
+        outLen += len;
+        if (outLen + INGEST_MAX_FRAME > sizeof(out)){
+            writeAll(fd, out, outLen);
+            outLen = 0;
+        }
+    }
+    writeAll(fd, out, outLen);
+}
+
+static int testRun(uint32_t frames){
+    int master;
+    int slave;
+    pid_t child;
+    int status;
+    uint64_t bad = frames/TEST_CORRUPT;
+    uint64_t frameErrors;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) < 0) || (unlockpt(master) < 0)){
+        perror("pty");
+        return 1;
+    }
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if ((slave < 0) || (serialSetup(slave, 0) < 0)){
+        perror(ptsname(master));
+        return 1;
+    }
+    child = fork();
+    if (child == 0){
+        close(slave);
+        testWriter(master, frames);
+        // keep the pty open until the reader is done
+        pause();
+        _exit(0);
+    }
+    close(master);
+    ingest(slave, frames);
+    kill(child, SIGTERM);
+    waitpid(child, &status, 0);
+    close(slave);
+
+    // a corrupted byte can also break the COBS code or split a frame
+    frameErrors = stats.crcErrors + stats.cobsErrors;
+    if ((stats.frames + frameErrors != frames) || (frameErrors != bad) ||
+        stats.badRecords || stats.testMismatch){
+        fprintf(stderr, "test failed, %llu frame errors expected\n", (unsigned long long)bad);
+        return 1;
+    }
+    fprintf(stderr, "test passed\n");
+    return 0;
+}
+
+/* Main */
+
+static void onSignal(int sig){
+    if (sig == SIGUSR1)
+        statsRequest = 1;
+    else
+        stopRequest = 1;
+}
+
+static void usage(const char* name){
+    fprintf(stderr, "Usage: %s [-d dir] [-b baud] [-s flushMs] [-n rows] [-x] [-v] "
+            "device | -f file | -t frames\n", name);
+}
+
+int main(int argc, char** argv){
+    struct sigaction sa;
+    pthread_t writer;
+    const char* file = NULL;
+    long baud = 115200;
+    uint32_t testFrames = 0;
+    speed_t speed;
+    int fd = -1;
+    int opt;
+    int res = 0;
+
+    cfg.dir = "triumviData";
+    cfg.batchRows = DEFAULT_BATCH;
+    cfg.flushMs = DEFAULT_FLUSH;
+    cfg.exponent = 0;
+    cfg.verbose = 0;
+    cfg.test = 0;
+
+    while ((opt = getopt(argc, argv, "d:b:s:n:f:t:xv")) != -1){
+        switch (opt){
+            case 'd': cfg.dir = optarg; break;
+            case 'b': baud = strtol(optarg, NULL, 0); break;
+            case 's': cfg.flushMs = strtoul(optarg, NULL, 0); break;
+            case 'n': cfg.batchRows = strtoul(optarg, NULL, 0); break;
+            case 'f': file = optarg; break;
+            case 't': testFrames = strtoul(optarg, NULL, 0); cfg.test = 1; break;
+            case 'x': cfg.exponent = 1; break;
+            case 'v': cfg.verbose = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if ((cfg.batchRows == 0) || (cfg.flushMs == 0) ||
+        ((file == NULL) && (cfg.test == 0) && (optind >= argc))){
+        usage(argv[0]);
+        return 1;
+    }
+    if (storeOpen(cfg.dir) < 0)
+        return 1;
+
+    batches[0].rows = malloc(cfg.batchRows*sizeof(reading_t));
+    batches[1].rows = malloc(cfg.batchRows*sizeof(reading_t));
+    if ((batches[0].rows == NULL) || (batches[1].rows == NULL)){
+        perror("malloc");
+        return 1;
+    }
+    current = &batches[0];
+    pthread_create(&writer, NULL, writerThread, NULL);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    if (cfg.test){
+        res = testRun(testFrames);
+    }
+    else{
+        if (file != NULL){
+            fd = strcmp(file, "-")? open(file, O_RDONLY) : STDIN_FILENO;
+            if (fd < 0)
+                perror(file);
+        }
+        else{
+            speed = baudRate(baud);
+            if (speed == 0)
+                fprintf(stderr, "unsupported baud rate %ld\n", baud);
+            else if (((fd = open(argv[optind], O_RDWR | O_NOCTTY)) < 0) ||
+                     (serialSetup(fd, speed) < 0))
+                perror(argv[optind]);
+        }
+        if (fd >= 0)
+            ingest(fd, 0);
+        else
+            res = 1;
+    }
+
+    pthread_mutex_lock(&writerLock);
+    writerStop = 1;
+    pthread_cond_broadcast(&writerCond);
+    pthread_mutex_unlock(&writerLock);
+    pthread_join(writer, NULL);
+    return res;
+}
@@ -0,0 +1,525 @@
+/*
+    Phase calibration from recorded current waveforms, replaces phaseCalc.py
+    and calibrate/phaseCalUART.py.
+
+    The phase of every cycle has a closed form: with the sample phases t_i
+    and the samples x_i (cycle mean removed),
+        sum x_i*sin(p + t_i) = S*cos(p) + C*sin(p),
+        S = sum x_i*sin(t_i), C = sum x_i*cos(t_i)
+    is largest at p = atan2(C, S), the offset the firmware phase search
+    (meterPhaseMatch) looks for, without trying every degree.
+    Cycles are combined with a circular mean, cycles more than -k standard
+    deviations from it or with less than 1/4 of the median amplitude are
+    outliers and left out of the result.
+
+    Captures (format is detected from the content):
+    - DATADUMP UART logs of the phase calibration process, "reading:" lines
+      between "reference:" / "difference:" / "gain:" headers, one cycle per
+      block. Sample i is at i*360/N degrees as in the firmware table,
+      "Time difference" is only reported.
+    - "Time Stamp: t  Current (mA): i" captures (timeCapture.txt), t in
+      16 MHz ticks, a new cycle where t wraps
+    - Tektronix scope CSV (T0115CH4.CSV), phase from the trigger, cut into
+      cycles of the grid period
+
+    Outputs:
+    -o header, CAL_PHASE_OFFSET (degrees into stdSineTable), CAL_DC_OFFSET
+       (DATADUMP only) and the voltage table rotated by the phase, one cycle
+       of -n samples
+    -t table, "seconds value" lines of the rotated voltage at the sampling
+       of the first cycle, offset to positive, for iplot1.plt
+
+    Usage: phaseCal [-f gridHz] [-V vrms] [-n samples] [-k sigma] [-d ticks]
+                    [-r] [-v] [-o header.h] [-t table.txt] file ...
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define CLOCK_FREQ 16e6
+#define LINE_LEN 256
+#define DEG (M_PI/180)
+
+typedef enum {
+    CAPTURE_DATADUMP,
+    CAPTURE_MA,
+    CAPTURE_SCOPE,
+    CAPTURE_UNKNOWN
+} capture_t;
+
+typedef struct {
+    double phase;           // degrees, [0, 360)
+    double amplitude;       // same unit as the samples
+    double dc;
+    uint32_t samples;
+    uint32_t line;          // first line of the cycle
+    uint8_t outlier;
+} cycle_t;
+
+typedef struct {
+    cycle_t* cycles;
+    size_t num;
+    size_t cap;
+    double timeDiff;        // DATADUMP "Time difference" sum
+    uint32_t timeDiffCnt;
+    uint32_t incomplete;    // cycles of another length
+} result_t;
+
+// samples of the cycle being read
+typedef struct {
+    double* x;
+    double* t;              // degrees
+    size_t len;
+    size_t cap;
+    uint32_t line;
+} buffer_t;
+
+static double optFreq = 60;
+static double optVrms = 120;
+static double optSigma = 3;
+static double optTickOffset = 0;
+static int optReverse = 0;
+static int optVerbose = 0;
+static int optSamples = 120;
+
+// sampling of the first cycle, for the -t table
+static size_t firstLen = 0;
+static double firstStep = 0;    // seconds per sample
+
+static void bufferAdd(buffer_t* b, double x, double t){
+    if (b->len == b->cap){
+        b->cap = b->cap? b->cap*2 : 1024;
+        b->x = realloc(b->x, b->cap*sizeof(double));
+        b->t = realloc(b->t, b->cap*sizeof(double));
+        if ((b->x == NULL) || (b->t == NULL)){
+            perror("realloc");
+            exit(1);
+        }
+    }
+    b->x[b->len] = optReverse? -x : x;
+    b->t[b->len] = t;
+    b->len += 1;
+}
+
+static double wrap360(double deg){
+    deg = fmod(deg, 360);
+    return (deg < 0)? deg + 360 : deg;
+}
+
+// difference in (-180, 180]
+static double wrap180(double deg){
+    deg = wrap360(deg);
+    return (deg > 180)? deg - 360 : deg;
+}
+
+static void cycleEnd(result_t* res, buffer_t* b, double step){
+    cycle_t* c;
+    double mean = 0;
+    double s = 0, co = 0;
+    size_t i;
+
+    if (b->len < 8){
+        b->len = 0;
+        return;
+    }
+    for (i=0; i<b->len; i++)
+        mean += b->x[i];
+    mean /= b->len;
+    for (i=0; i<b->len; i++){
+        s += (b->x[i] - mean)*sin(b->t[i]*DEG);
+        co += (b->x[i] - mean)*cos(b->t[i]*DEG);
+    }
+
+    if (res->num == res->cap){
+        res->cap = res->cap? res->cap*2 : 256;
+        res->cycles = realloc(res->cycles, res->cap*sizeof(cycle_t));
+        if (res->cycles == NULL){
+            perror("realloc");
+            exit(1);
+        }
+    }
+    c = &res->cycles[res->num++];
+    c->phase = wrap360(atan2(co, s)/DEG);
+    c->amplitude = 2*sqrt(s*s + co*co)/b->len;
+    c->dc = mean;
+    c->samples = b->len;
+    c->line = b->line;
+    c->outlier = 0;
+
+    if (firstLen == 0){
+        firstLen = b->len;
+        firstStep = step;
+    }
+    b->len = 0;
+}
+
+/* Captures */
+
+static capture_t detectCapture(FILE* fp){
+    char line[LINE_LEN];
+    capture_t res = CAPTURE_UNKNOWN;
+    while (fgets(line, LINE_LEN, fp)){
+        if (strstr(line, "reading:") || strstr(line, "reference:")){
+            res = CAPTURE_DATADUMP;
+            break;
+        }
+        if (strstr(line, "Current (mA):")){
+            res = CAPTURE_MA;
+            break;
+        }
+        if (strstr(line, "Sample Interval") || strncmp(line, "TIME,", 5)==0){
+            res = CAPTURE_SCOPE;
+            break;
+        }
+    }
+    rewind(fp);
+    return res;
+}
+
+// the sample phase depends on the cycle length, known at the end of it
+static void dataDumpEnd(result_t* res, buffer_t* b){
+    size_t i;
+    for (i=0; i<b->len; i++)
+        b->t[i] = i*360.0/b->len;
+    cycleEnd(res, b, 1/(optFreq*b->len));
+}
+
+// "ADC reference: r", "Time difference: d", "INA Gain: g" and
+// "Current reading: x" lines, older logs put the headers after the readings
+static void loadDataDump(FILE* fp, result_t* res){
+    char line[LINE_LEN];
+    buffer_t b;
+    uint32_t lineNum = 0;
+    char* p;
+
+    memset(&b, 0, sizeof(b));
+    while (fgets(line, LINE_LEN, fp)){
+        lineNum++;
+        if ((p = strstr(line, "reading:")) != NULL){
+            if (b.len == 0)
+                b.line = lineNum;
+            bufferAdd(&b, strtod(p+8, NULL), 0);
+            continue;
+        }
+        if ((p = strstr(line, "difference:")) != NULL){
+            res->timeDiff += strtod(p+11, NULL);
+            res->timeDiffCnt += 1;
+        }
+        else if (!strstr(line, "reference:") && !strstr(line, "Gain:")){
+            continue;
+        }
+        if (b.len)
+            dataDumpEnd(res, &b);
+    }
+    dataDumpEnd(res, &b);
+    free(b.x);
+    free(b.t);
+}
+
+static void loadCurrentCapture(FILE* fp, result_t* res){
+    char line[LINE_LEN];
+    buffer_t b;
+    uint32_t lineNum = 0;
+    double timeStamp, prevTime = -1;
+    double step = 0;
+    char *timeField, *currentField;
+
+    memset(&b, 0, sizeof(b));
+    while (fgets(line, LINE_LEN, fp)){
+        lineNum++;
+        timeField = strstr(line, "Time Stamp:");
+        currentField = strstr(line, "Current (mA):");
+        if (!timeField || !currentField)
+            continue;
+        timeStamp = strtod(timeField+strlen("Time Stamp:"), NULL) + optTickOffset;
+        if (timeStamp < prevTime)
+            cycleEnd(res, &b, step);
+        if ((b.len == 1) && (step == 0))
+            step = (timeStamp - prevTime)/CLOCK_FREQ;
+        if (b.len == 0)
+            b.line = lineNum;
+        prevTime = timeStamp;
+        bufferAdd(&b, strtod(currentField+strlen("Current (mA):"), NULL),
+                  timeStamp/CLOCK_FREQ*optFreq*360);
+    }
+    cycleEnd(res, &b, step);
+    free(b.x);
+    free(b.t);
+}
+
+static void loadScope(FILE* fp, result_t* res){
+    char line[LINE_LEN];
+    buffer_t b;
+    uint32_t lineNum = 0;
+    double dt = 0;
+    double t, v;
+    double start = 0;
+    long period = -1;
+    long k;
+
+    memset(&b, 0, sizeof(b));
+    while (fgets(line, LINE_LEN, fp)){
+        lineNum++;
+        if (sscanf(line, "Sample Interval,%lf", &dt)==1)
+            continue;
+        if (sscanf(line, "%lf,%lf", &t, &v)!=2)
+            continue;
+        if (period < 0)
+            start = t;
+        // whole grid periods from the first sample
+        k = (long)floor((t - start)*optFreq);
+        if (k != period){
+            if (period >= 0)
+                cycleEnd(res, &b, dt);
+            period = k;
+            b.line = lineNum;
+        }
+        bufferAdd(&b, v, t*optFreq*360);
+    }
+    // the rest of the trace is less than a period
+    if (b.len)
+        res->incomplete += 1;
+    free(b.x);
+    free(b.t);
+}
+
+/* Statistics */
+
+static int compareDouble(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// circular mean of the cycles not marked, returns the number used
+static size_t circularMean(const result_t* res, double* mean, double* std){
+    double s = 0, c = 0, d, sum2 = 0;
+    size_t n = 0;
+    size_t i;
+
+    for (i=0; i<res->num; i++){
+        if (res->cycles[i].outlier)
+            continue;
+        s += sin(res->cycles[i].phase*DEG);
+        c += cos(res->cycles[i].phase*DEG);
+        n++;
+    }
+    if (n == 0)
+        return 0;
+    *mean = wrap360(atan2(s, c)/DEG);
+    for (i=0; i<res->num; i++){
+        if (res->cycles[i].outlier)
+            continue;
+        d = wrap180(res->cycles[i].phase - *mean);
+        sum2 += d*d;
+    }
+    *std = (n > 1)? sqrt(sum2/(n-1)) : 0;
+    return n;
+}
+
+// cycles of another length than most, weak cycles, then -k sigma, twice
+static size_t markOutliers(result_t* res, double* mean, double* std){
+    double* amp = malloc(res->num*sizeof(double));
+    uint32_t* lens = malloc(res->num*sizeof(uint32_t));
+    double median;
+    uint32_t modeLen = 0;
+    size_t modeCnt = 0, cnt;
+    size_t n = 0;
+    size_t i, j;
+    int pass;
+
+    for (i=0; i<res->num; i++){
+        amp[i] = res->cycles[i].amplitude;
+        lens[i] = res->cycles[i].samples;
+    }
+    qsort(amp, res->num, sizeof(double), compareDouble);
+    median = amp[res->num/2];
+    for (i=0; i<res->num; i++){
+        for (cnt=0, j=0; j<res->num; j++)
+            cnt += (lens[j] == lens[i]);
+        if (cnt > modeCnt){
+            modeCnt = cnt;
+            modeLen = lens[i];
+        }
+        if (modeCnt > res->num/2)
+            break;
+    }
+    for (i=0; i<res->num; i++){
+        // scope cycles differ by a sample or so, DATADUMP blocks must match
+        if (abs((int)res->cycles[i].samples - (int)modeLen) > (int)modeLen/100){
+            res->cycles[i].outlier = 1;
+            res->incomplete += 1;
+        }
+        if (res->cycles[i].amplitude < median/4)
+            res->cycles[i].outlier = 1;
+    }
+    for (pass=0; pass<2; pass++){
+        n = circularMean(res, mean, std);
+        if (n < 3)
+            break;
+        for (i=0; i<res->num; i++){
+            if (fabs(wrap180(res->cycles[i].phase - *mean)) > optSigma*(*std) + 1e-9)
+                res->cycles[i].outlier = 1;
+        }
+    }
+    n = circularMean(res, mean, std);
+    free(amp);
+    free(lens);
+    return n;
+}
+
+/* Outputs */
+
+static int writeHeader(const char* fileName, const result_t* res, size_t used,
+                       double phase, double std, int haveDC, double dc, int argc, char** argv){
+    FILE* fp = fopen(fileName, "w");
+    double amplitude = sqrt(2)*optVrms;
+    int i;
+    int a;
+
+    if (fp == NULL){
+        perror(fileName);
+        return -1;
+    }
+    fprintf(fp, "/* phase calibration, generated by phaseCal, do not edit */\r\n");
+    fprintf(fp, "/*");
+    for (a=0; a<argc; a++)
+        fprintf(fp, " %s", argv[a]);
+    fprintf(fp, " */\r\n");
+    fprintf(fp, "/* %zu of %zu cycles, std %.3f degrees */\r\n\r\n", used, res->num, std);
+    fprintf(fp, "#define CAL_PHASE_OFFSET %d // degrees into stdSineTable\r\n",
+            (int)lround(phase) % 360);
+    if (haveDC)
+        fprintf(fp, "#define CAL_DC_OFFSET %ld // ADC code\r\n", lround(dc));
+    fprintf(fp, "#define CAL_VOLTAGE_NOMINAL %g\r\n", optVrms);
+    fprintf(fp, "#define CAL_SINE_TABLE_LEN %d\r\n\r\n", optSamples);
+    fprintf(fp, "const int calSineTable[CAL_SINE_TABLE_LEN] = {\r\n");
+    for (i=0; i<optSamples; i++){
+        fprintf(fp, "%ld", lround(amplitude*sin((phase + i*360.0/optSamples)*DEG)));
+        if (i == optSamples-1)
+            fprintf(fp, "};\r\n");
+        else
+            fprintf(fp, (i % 12 == 11)? ",\r\n" : ", ");
+    }
+    fclose(fp);
+    return 0;
+}
+
+// phaseCalc.py sineTable.txt, offset to all positive
+static int writeTable(const char* fileName, double phase){
+    FILE* fp = fopen(fileName, "w");
+    double amplitude = sqrt(2)*optVrms;
+    size_t i;
+
+    if (fp == NULL){
+        perror(fileName);
+        return -1;
+    }
+    for (i=0; i<firstLen; i++)
+        fprintf(fp, "%.10g\t%ld\r\n", firstStep*i,
+                lround(amplitude*sin((phase + 360*optFreq*firstStep*i)*DEG) + amplitude));
+    fclose(fp);
+    return 0;
+}
+
+static void usage(const char* name){
+    fprintf(stderr, "Usage: %s [-f gridHz] [-V vrms] [-n samples] [-k sigma] [-d ticks] "
+            "[-r] [-v] [-o header.h] [-t table.txt] file ...\n", name);
+}
+
+int main(int argc, char** argv){
+    static const char* captureNames[] = {"DATADUMP", "mA capture", "scope"};
+    const char* headerFile = NULL;
+    const char* tableFile = NULL;
+    result_t res;
+    capture_t type;
+    FILE* fp;
+    size_t start, used;
+    size_t i;
+    double mean = 0, std = 0;
+    double dc = 0;
+    int haveDC = 0;
+    int opt;
+    int f;
+
+    while ((opt = getopt(argc, argv, "f:V:n:k:d:rvo:t:")) != -1){
+        switch (opt){
+            case 'f': optFreq = atof(optarg); break;
+            case 'V': optVrms = atof(optarg); break;
+            case 'n': optSamples = atoi(optarg); break;
+            case 'k': optSigma = atof(optarg); break;
+            case 'd': optTickOffset = atof(optarg); break;
+            case 'r': optReverse = 1; break;
+            case 'v': optVerbose = 1; break;
+            case 'o': headerFile = optarg; break;
+            case 't': tableFile = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if ((optind >= argc) || (optFreq <= 0) || (optSamples <= 0)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&res, 0, sizeof(res));
+    for (f=optind; f<argc; f++){
+        fp = fopen(argv[f], "r");
+        if (fp == NULL){
+            perror(argv[f]);
+            return 1;
+        }
+        start = res.num;
+        type = detectCapture(fp);
+        switch (type){
+            case CAPTURE_DATADUMP: loadDataDump(fp, &res); haveDC = 1; break;
+            case CAPTURE_MA: loadCurrentCapture(fp, &res); break;
+            case CAPTURE_SCOPE: loadScope(fp, &res); break;
+            default: fprintf(stderr, "%s: unknown format\n", argv[f]); break;
+        }
+        fclose(fp);
+        if (type != CAPTURE_UNKNOWN)
+            printf("%s: %s, %zu cycles\n", argv[f], captureNames[type], res.num - start);
+    }
+    if (res.num == 0){
+        fprintf(stderr, "no cycles found\n");
+        return 1;
+    }
+
+    used = markOutliers(&res, &mean, &std);
+    if (used == 0){
+        fprintf(stderr, "no usable cycles\n");
+        return 1;
+    }
+    for (i=0; i<res.num; i++){
+        if (!res.cycles[i].outlier)
+            dc += res.cycles[i].dc;
+        if (optVerbose || res.cycles[i].outlier)
+            printf("  line %6u  %5u samples  phase %7.2f  (%+7.2f)  amplitude %9.2f%s\n",
+                   res.cycles[i].line, res.cycles[i].samples, res.cycles[i].phase,
+                   wrap180(res.cycles[i].phase - mean), res.cycles[i].amplitude,
+                   res.cycles[i].outlier? "  outlier" : "");
+    }
+    dc /= used;
+
+    printf("cycles %zu, used %zu, outliers %zu (%u of another length)\n",
+           res.num, used, res.num - used, res.incomplete);
+    printf("phase offset %.3f degrees, std %.3f, variance %.3f\n", mean, std, std*std);
+    if (haveDC)
+        printf("dc offset %.1f\n", dc);
+    if (res.timeDiffCnt)
+        printf("time difference %.1f ticks, nominal %.1f (%+.3f degrees per cycle)\n",
+               res.timeDiff/res.timeDiffCnt, CLOCK_FREQ/optFreq,
+               (res.timeDiff/res.timeDiffCnt*optFreq/CLOCK_FREQ - 1)*360);
+
+    if (headerFile && (writeHeader(headerFile, &res, used, mean, std,
+                                   haveDC, dc, argc, argv) < 0))
+        return 1;
+    if (tableFile && (writeTable(tableFile, mean) < 0))
+        return 1;
+    free(res.cycles);
+    return 0;
+}
@@ -0,0 +1,449 @@
+/*
+    Sample timing of the current waveform capture (sampleCurrentWaveform).
+    Reads two kinds of timing records from captures and DATADUMP logs:
+
+      Time Stamp: <ticks>  Current (mA): <mA>
+          GPTIMER_1 time of every sample, one line per sample. A stamp
+          smaller than the one before starts a new cycle.
+      Time difference: <ticks>
+          timerVal[0] - timerVal[1], the length of the whole capture.
+          Ideally 266667 ticks, one 60 Hz cycle of the 16 MHz timer.
+
+    For the sample stamps: interval statistics and a histogram of the
+    intervals around the nominal period (cycle/samples), and the skew of
+    every sample, t(i) - t(0) - i*period. The skew is how far the sample sits
+    from the voltage table entry it gets multiplied with. For the capture
+    lengths: the drift from the nominal cycle.
+
+    The largest skew and drift are turned into a phase error and the worst
+    real power error that phase error causes at power factor -p.
+
+    All files are memory mapped and parsed by a pool of threads.
+
+    Usage: sampleTiming [-f grid Hz] [-c timer clock] [-n samples per cycle]
+                        [-p power factor] [-w bin ticks] [-H histogram file]
+                        [-j threads] [file ...]
+           default files data*.txt
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HIST_BINS 201       // odd, the middle bin is the nominal period
+
+typedef struct {
+    uint64_t n;
+    double mean;
+    double m2;              // sum of squared deviations
+    int64_t min;
+    int64_t max;
+} stats_t;
+
+typedef struct {
+    char* path;
+    stats_t interval;       // ticks between consecutive samples
+    stats_t window;         // Time difference lines, ticks
+    uint64_t cycles;        // cycles with sample stamps
+    uint64_t skewN;
+    double skewSq;          // sum of squared skews, ticks^2
+    double skewMax;         // largest |skew|, ticks
+    uint64_t hist[HIST_BINS];
+    uint64_t badLines;
+    int error;              // could not be read
+} capture_t;
+
+typedef struct {
+    capture_t* captures;
+    size_t num;
+    size_t next;
+} work_t;
+
+// set once in main before the threads start
+static double cycleTicks;   // timer ticks per grid cycle
+static double period;       // nominal ticks between samples
+static long histCenter;     // interval in the middle bin
+static long binWidth = 1;
+
+/* Statistics */
+
+static void statsAdd(stats_t* s, int64_t val){
+    // Welford, one pass without losing the variance to cancellation
+    double delta;
+    s->n += 1;
+    delta = val - s->mean;
+    s->mean += delta/s->n;
+    s->m2 += delta*(val - s->mean);
+    if ((s->n == 1) || (val < s->min))
+        s->min = val;
+    if ((s->n == 1) || (val > s->max))
+        s->max = val;
+}
+
+static void statsMerge(stats_t* dst, const stats_t* src){
+    double delta;
+    uint64_t n;
+    if (src->n == 0)
+        return;
+    if (dst->n == 0){
+        *dst = *src;
+        return;
+    }
+    n = dst->n + src->n;
+    delta = src->mean - dst->mean;
+    dst->m2 += src->m2 + delta*delta*dst->n*src->n/n;
+    dst->mean += delta*src->n/n;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->n = n;
+}
+
+static double statsStd(const stats_t* s){
+    return (s->n > 1)? sqrt(s->m2/(s->n-1)) : 0;
+}
+
+static int histBin(int64_t interval){
+    int64_t d = interval - histCenter;
+    // floor division, so negative offsets land in the bin below
+    long bin = (d >= 0)? d/binWidth : -((-d + binWidth - 1)/binWidth);
+    bin += HIST_BINS/2;
+    if (bin < 0)
+        return 0;
+    if (bin >= HIST_BINS)
+        return HIST_BINS-1;
+    return bin;
+}
+
+/* Parsing */
+
+// first number after the field, 0 if there is none
+static int fieldValue(const char* p, const char* eol, const char* field, int64_t* val){
+    size_t len = strlen(field);
+    const char* q;
+    int digits = 0;
+    int neg = 0;
+
+    q = memmem(p, eol - p, field, len);
+    if (q == NULL)
+        return 0;
+    q += len;
+    while ((q < eol) && ((*q==' ') || (*q=='\t')))
+        q++;
+    if ((q < eol) && (*q=='-')){
+        neg = 1;
+        q++;
+    }
+    *val = 0;
+    while ((q < eol) && (*q>='0') && (*q<='9')){
+        *val = *val*10 + (*q - '0');
+        digits++;
+        q++;
+    }
+    if (digits == 0)
+        return -1;
+    if (neg)
+        *val = -*val;
+    return 1;
+}
+
+static void parseCapture(capture_t* cap, const char* p, const char* end){
+    const char* eol;
+    int64_t val;
+    int64_t first = 0;      // stamp of the first sample in the cycle
+    int64_t prev = 0;
+    uint64_t idx = 0;       // samples so far in the cycle
+    double skew;
+    int res;
+
+    for (; p < end; p = eol+1){
+        eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+
+        if ((res = fieldValue(p, eol, "Time Stamp:", &val)) != 0){
+            if (res < 0){
+                cap->badLines += 1;
+                continue;
+            }
+            if ((idx == 0) || (val < prev)){
+                cap->cycles += 1;
+                first = val;
+                idx = 0;
+            }
+            else{
+                statsAdd(&cap->interval, val - prev);
+                cap->hist[histBin(val - prev)] += 1;
+            }
+            skew = (val - first) - idx*period;
+            cap->skewN += 1;
+            cap->skewSq += skew*skew;
+            if (fabs(skew) > cap->skewMax)
+                cap->skewMax = fabs(skew);
+            prev = val;
+            idx++;
+        }
+        else if ((res = fieldValue(p, eol, "Time difference:", &val)) != 0){
+            if (res < 0){
+                cap->badLines += 1;
+                continue;
+            }
+            statsAdd(&cap->window, val);
+            // the stamps that follow belong to the next capture
+            idx = 0;
+        }
+    }
+}
+
+static void readCapture(capture_t* cap){
+    struct stat st;
+    const char* data;
+    int fd = open(cap->path, O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &st) < 0)){
+        perror(cap->path);
+        cap->error = 1;
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    if (st.st_size > 0){
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED){
+            perror(cap->path);
+            cap->error = 1;
+        }
+        else{
+            madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+            parseCapture(cap, data, data + st.st_size);
+            munmap((void*)data, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+static void* worker(void* arg){
+    work_t* work = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->num)
+        readCapture(&work->captures[i]);
+    return NULL;
+}
+
+/* Report */
+
+static double toDegree(double ticks){
+    return ticks*360/cycleTicks;
+}
+
+static double toPpm(double ticks, double nominal){
+    return (ticks - nominal)/nominal*1e6;
+}
+
+// worst relative error of P = V*I*cos(phi) with phi off by +-err degrees
+static double powerError(double pf, double err){
+    double phi = acos(pf);
+    double e1 = cos(phi + err*M_PI/180)/pf - 1;
+    double e2 = cos(phi - err*M_PI/180)/pf - 1;
+    return ((fabs(e1) > fabs(e2))? fabs(e1) : fabs(e2))*100;
+}
+
+static void reportCapture(const capture_t* cap){
+    printf("%s:", cap->path);
+    if (cap->error){
+        printf(" unreadable\n");
+        return;
+    }
+    if (cap->interval.n)
+        printf(" %llu cycles, interval %.2f std %.2f [%lld, %lld] ticks (%+.0f ppm), "
+               "skew max %.1f rms %.1f ticks",
+               (unsigned long long)cap->cycles, cap->interval.mean, statsStd(&cap->interval),
+               (long long)cap->interval.min, (long long)cap->interval.max,
+               toPpm(cap->interval.mean, period), cap->skewMax,
+               cap->skewN? sqrt(cap->skewSq/cap->skewN) : 0.0);
+    if (cap->window.n)
+        printf("%s %llu captures, length %.1f std %.1f [%lld, %lld] ticks (%+.0f ppm)",
+               cap->interval.n? "," : "", (unsigned long long)cap->window.n,
+               cap->window.mean, statsStd(&cap->window), (long long)cap->window.min,
+               (long long)cap->window.max, toPpm(cap->window.mean, cycleTicks));
+    if ((cap->interval.n == 0) && (cap->window.n == 0))
+        printf(" no timing records");
+    if (cap->badLines)
+        printf(", %llu bad lines", (unsigned long long)cap->badLines);
+    printf("\n");
+}
+
+// marks the first and last bin, they also hold everything outside
+static void reportHist(FILE* fp, const uint64_t* hist, uint64_t total, int marks, const char* eol){
+    int i;
+    for (i=0; i<HIST_BINS; i++){
+        if (hist[i] == 0)
+            continue;
+        fprintf(fp, "%s%ld\t%llu\t%.3f%s",
+                !marks? "" : (i==0)? "<=" : (i==HIST_BINS-1)? ">=" : "",
+                histCenter + (long)(i - HIST_BINS/2)*binWidth,
+                (unsigned long long)hist[i], 100.0*hist[i]/total, eol);
+    }
+}
+
+static void usage(const char* name){
+    fprintf(stderr, "Usage: %s [-f grid Hz] [-c timer clock] [-n samples per cycle]\n"
+            "       [-p power factor] [-w bin ticks] [-H histogram file] [-j threads] [file ...]\n",
+            name);
+}
+
+int main(int argc, char** argv){
+    static char* defaultFiles[] = {"data*.txt"};
+    char** patterns = defaultFiles;
+    const char* histFile = NULL;
+    double gridFreq = 60;
+    double timerClock = 16000000;
+    double pf = 0.5;
+    long samples = 120;
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int numPatterns = 1;
+    int globFlags = 0;
+    glob_t files;
+    capture_t* caps;
+    capture_t total;
+    pthread_t* threads;
+    work_t work;
+    double skewMax;
+    double drift;
+    FILE* fp;
+    size_t i;
+    int j;
+    int opt;
+    int res = 0;
+
+    while ((opt = getopt(argc, argv, "f:c:n:p:w:H:j:")) != -1){
+        switch (opt){
+            case 'f': gridFreq = strtod(optarg, NULL); break;
+            case 'c': timerClock = strtod(optarg, NULL); break;
+            case 'n': samples = strtol(optarg, NULL, 0); break;
+            case 'p': pf = strtod(optarg, NULL); break;
+            case 'w': binWidth = strtol(optarg, NULL, 0); break;
+            case 'H': histFile = optarg; break;
+            case 'j': numThreads = strtol(optarg, NULL, 0); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if ((gridFreq <= 0) || (timerClock <= 0) || (samples < 1) || (binWidth < 1) ||
+        (pf <= 0) || (pf > 1)){
+        usage(argv[0]);
+        return 1;
+    }
+    if (optind < argc){
+        patterns = &argv[optind];
+        numPatterns = argc - optind;
+    }
+    if (numThreads < 1)
+        numThreads = 1;
+    cycleTicks = timerClock/gridFreq;
+    period = cycleTicks/samples;
+    histCenter = lround(period);
+
+    // file names without wildcards are kept even if they do not exist
+    memset(&files, 0, sizeof(files));
+    for (j=0; j<numPatterns; j++){
+        glob(patterns[j], globFlags | GLOB_NOCHECK, NULL, &files);
+        globFlags = GLOB_APPEND;
+    }
+    caps = calloc(files.gl_pathc? files.gl_pathc : 1, sizeof(capture_t));
+    for (i=0; i<files.gl_pathc; i++)
+        caps[i].path = files.gl_pathv[i];
+
+    work.captures = caps;
+    work.num = files.gl_pathc;
+    work.next = 0;
+    if ((size_t)numThreads > work.num)
+        numThreads = work.num;
+    threads = malloc((numThreads? numThreads : 1)*sizeof(pthread_t));
+    for (j=0; j<numThreads; j++)
+        pthread_create(&threads[j], NULL, worker, &work);
+    for (j=0; j<numThreads; j++)
+        pthread_join(threads[j], NULL);
+
+    memset(&total, 0, sizeof(total));
+    for (i=0; i<work.num; i++){
+        reportCapture(&caps[i]);
+        res |= caps[i].error;
+        statsMerge(&total.interval, &caps[i].interval);
+        statsMerge(&total.window, &caps[i].window);
+        total.cycles += caps[i].cycles;
+        total.skewN += caps[i].skewN;
+        total.skewSq += caps[i].skewSq;
+        if (caps[i].skewMax > total.skewMax)
+            total.skewMax = caps[i].skewMax;
+        for (j=0; j<HIST_BINS; j++)
+            total.hist[j] += caps[i].hist[j];
+    }
+
+    printf("\nnominal: %.0f ticks per cycle, %ld samples, period %.2f ticks, "
+           "%.4f degree per tick\n", cycleTicks, samples, period, toDegree(1));
+    if (total.interval.n){
+        printf("intervals: %llu in %llu cycles, mean %.3f std %.3f [%lld, %lld] ticks, "
+               "%+.0f ppm\n", (unsigned long long)total.interval.n,
+               (unsigned long long)total.cycles, total.interval.mean,
+               statsStd(&total.interval), (long long)total.interval.min,
+               (long long)total.interval.max, toPpm(total.interval.mean, period));
+        printf("skew: max %.1f rms %.1f ticks\n", total.skewMax,
+               sqrt(total.skewSq/total.skewN));
+    }
+    if (total.window.n){
+        printf("capture length: %llu, mean %.1f std %.1f [%lld, %lld] ticks, %+.0f ppm\n",
+               (unsigned long long)total.window.n, total.window.mean,
+               statsStd(&total.window), (long long)total.window.min,
+               (long long)total.window.max, toPpm(total.window.mean, cycleTicks));
+    }
+    if ((total.interval.n == 0) && (total.window.n == 0)){
+        fprintf(stderr, "no timing records found\n");
+        res = 1;
+    }
+    else{
+        // the last sample is off by the whole drift of the capture
+        skewMax = total.skewMax;
+        if (total.window.n){
+            drift = fabs(total.window.max - cycleTicks);
+            if (fabs(total.window.min - cycleTicks) > drift)
+                drift = fabs(total.window.min - cycleTicks);
+            if (drift > skewMax)
+                skewMax = drift;
+        }
+        printf("error bound: phase %.3f degree, real power %.3f%% at pf %.2f, "
+               "%.4f%% at pf 1\n", toDegree(skewMax), powerError(pf, toDegree(skewMax)),
+               pf, powerError(1, toDegree(skewMax)));
+    }
+
+    if (total.interval.n){
+        printf("\ninterval histogram, ticks\tcount\t%%\n");
+        reportHist(stdout, total.hist, total.interval.n, 1, "\n");
+        if (histFile){
+            fp = fopen(histFile, "w");
+            if (fp == NULL){
+                perror(histFile);
+                res = 1;
+            }
+            else{
+                fprintf(fp, "#ticks\tcount\tpercent\r\n");
+                reportHist(fp, total.hist, total.interval.n, 0, "\r\n");
+                fclose(fp);
+            }
+        }
+    }
+
+    free(threads);
+    free(caps);
+    globfree(&files);
+    return res;
+}